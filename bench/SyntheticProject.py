@@ -0,0 +1,225 @@
+# benchmark -- automated system for testing distcc correctness
+# and performance on various source trees.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+__doc__ = """Generate a synthetic C or C++ project to benchmark distcc with.
+
+Unlike the projects in ProjectDefs.py, nothing needs to be downloaded or
+configured, and the shape of the project can be chosen to stress the part of
+distcc under study: many small translation units, deep or wide include
+graphs for pump mode, or templates that make the compiler itself the
+bottleneck.
+"""
+
+import os
+import random
+
+# Include graph shapes.  Each header is numbered, and only includes headers
+# with higher numbers, so that the graph never has cycles.
+#   flat:  headers include nothing; each translation unit includes
+#          'fanout' of them.
+#   chain: each header includes the next one, so that including one header
+#          pulls in all those after it.
+#   tree:  header i includes headers fanout*i+1 to fanout*i+fanout; each
+#          translation unit includes the root.
+#   dag:   each header includes 'fanout' headers chosen at random from those
+#          after it, so that there's a lot of sharing.
+SHAPES = ('flat', 'chain', 'tree', 'dag')
+
+
+class SyntheticProject:
+    """Describes a generated project, and writes it to disk."""
+
+    def __init__(self, n_tus=64, n_headers=200, fanout=8, shape='tree',
+                 template_depth=0, lang='c', functions=20, seed=1):
+        """Constructor:
+
+        Args:
+          n_tus: the number of translation units, each of which is built
+                 into an object file.
+          n_headers: the number of headers in the include graph.
+          fanout: the number of headers each header or translation unit
+                  includes, according to the shape.
+          shape: one of SHAPES.
+          template_depth: if nonzero, every header defines a template that
+                  recurses this deep, and every translation unit
+                  instantiates those it can see.  Needs lang 'c++'.
+          lang: 'c' or 'c++'.
+          functions: the number of functions in each file.
+          seed: for the random choices, so that a project can be recreated.
+        """
+        if shape not in SHAPES:
+            raise ValueError("unknown include graph shape %r" % shape)
+        if lang not in ('c', 'c++'):
+            raise ValueError("unknown language %r" % lang)
+        if template_depth and lang != 'c++':
+            raise ValueError("templates need lang 'c++'")
+        self.n_tus = n_tus
+        self.n_headers = n_headers
+        self.fanout = max(fanout, 1)
+        self.shape = shape
+        self.template_depth = template_depth
+        self.lang = lang
+        self.functions = functions
+        self.seed = seed
+        if lang == 'c':
+            self.source_ext, self.header_ext = '.c', '.h'
+        else:
+            self.source_ext, self.header_ext = '.cc', '.hh'
+
+    def __repr__(self):
+        return ("SyntheticProject(tus=%d, headers=%d, fanout=%d, shape=%s, "
+                "template_depth=%d, lang=%s)"
+                % (self.n_tus, self.n_headers, self.fanout, self.shape,
+                   self.template_depth, self.lang))
+
+    def _header_includes(self, rand):
+        """Return, for each header, the list of headers it includes."""
+        n = self.n_headers
+        if self.shape == 'flat':
+            return [[] for i in range(n)]
+        elif self.shape == 'chain':
+            return [[i + 1] if i + 1 < n else [] for i in range(n)]
+        elif self.shape == 'tree':
+            return [[j for j in range(self.fanout * i + 1,
+                                      self.fanout * i + self.fanout + 1)
+                     if j < n]
+                    for i in range(n)]
+        else:
+            return [sorted(rand.sample(range(i + 1, n),
+                                       min(self.fanout, n - i - 1)))
+                    for i in range(n)]
+
+    def _tu_includes(self, rand):
+        """Return, for each translation unit, the headers it includes."""
+        if self.n_headers == 0:
+            return [[] for i in range(self.n_tus)]
+        if self.shape == 'tree':
+            return [[0] for i in range(self.n_tus)]
+        count = min(self.fanout, self.n_headers)
+        return [sorted(rand.sample(range(self.n_headers), count))
+                for i in range(self.n_tus)]
+
+    def _header_name(self, i):
+        return 'h%d%s' % (i, self.header_ext)
+
+    def _write(self, path, text):
+        f = open(path, 'w')
+        try:
+            f.write(text)
+        finally:
+            f.close()
+
+    def _header_text(self, i, includes):
+        guard = 'SYNTHETIC_H%d' % i
+        lines = ['#ifndef %s' % guard, '#define %s' % guard, '']
+        lines += ['#include "%s"' % self._header_name(j) for j in includes]
+        lines.append('')
+        for f in range(self.functions):
+            lines.append('static inline int h%d_f%d(int x) '
+                         '{ return x * %d + %d; }' % (i, f, f + 1, i))
+        if self.template_depth:
+            lines += ['',
+                      'template <int N> struct H%dDepth {' % i,
+                      '  static int value(int x) '
+                      '{ return H%dDepth<N - 1>::value(x) * 3 + N; }' % i,
+                      '};',
+                      'template <> struct H%dDepth<0> {' % i,
+                      '  static int value(int x) { return x + %d; }' % i,
+                      '};']
+        lines += ['', '#endif /* %s */' % guard, '']
+        return '\n'.join(lines)
+
+    def _source_text(self, t, includes, visible):
+        lines = ['#include "%s"' % self._header_name(j) for j in includes]
+        lines.append('')
+        for f in range(self.functions):
+            lines.append('int tu%d_f%d(int x)' % (t, f))
+            lines.append('{')
+            lines.append('  int y = x;')
+            for j in visible[:8]:
+                lines.append('  y += h%d_f%d(y);' % (j, f % self.functions))
+            if self.template_depth:
+                for j in visible[:4]:
+                    lines.append('  y += H%dDepth<%d>::value(y);'
+                                 % (j, self.template_depth))
+            lines.append('  return y;')
+            lines.append('}')
+            lines.append('')
+        return '\n'.join(lines)
+
+    def _makefile_text(self):
+        objs = ' '.join('obj/tu%d.o' % t for t in range(self.n_tus))
+        if self.lang == 'c':
+            compile_cmd = '$(CC) $(CFLAGS) -c $< -o $@'
+        else:
+            compile_cmd = '$(CXX) $(CXXFLAGS) -c $< -o $@'
+        return ("# Generated by bench/SyntheticProject.py: %r\n"
+                "CC = cc\n"
+                "CXX = c++\n"
+                "CFLAGS = -O2 -Iinclude\n"
+                "CXXFLAGS = -O2 -Iinclude\n"
+                "\n"
+                "all: %s\n"
+                "\n"
+                "obj/%%.o: src/%%%s\n"
+                "\t%s\n"
+                "\n"
+                "clean:\n"
+                "\trm -f obj/*.o\n"
+                % (self, objs, self.source_ext, compile_cmd))
+
+    def generate(self, project_dir):
+        """Write the project into project_dir, which may not exist yet.
+
+        Returns the number of headers that each translation unit sees,
+        on average, to help make sense of the results.
+        """
+        rand = random.Random(self.seed)
+        header_includes = self._header_includes(rand)
+        tu_includes = self._tu_includes(rand)
+
+        for d in ('include', 'src', 'obj'):
+            path = os.path.join(project_dir, d)
+            if not os.path.isdir(path):
+                os.makedirs(path)
+
+        for i in range(self.n_headers):
+            self._write(os.path.join(project_dir, 'include',
+                                     self._header_name(i)),
+                        self._header_text(i, header_includes[i]))
+
+        total_visible = 0
+        for t in range(self.n_tus):
+            # Work out all the headers this translation unit sees.
+            visible = []
+            seen = set()
+            pending = list(tu_includes[t])
+            while pending:
+                j = pending.pop(0)
+                if j not in seen:
+                    seen.add(j)
+                    visible.append(j)
+                    pending.extend(header_includes[j])
+            total_visible += len(visible)
+            self._write(os.path.join(project_dir, 'src',
+                                     'tu%d%s' % (t, self.source_ext)),
+                        self._source_text(t, tu_includes[t], visible))
+
+        self._write(os.path.join(project_dir, 'Makefile'),
+                    self._makefile_text())
+        return float(total_visible) / max(self.n_tus, 1)
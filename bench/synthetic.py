@@ -0,0 +1,405 @@
+#! /usr/bin/env python3
+
+# benchmark -- automated system for testing distcc correctness
+# and performance on various source trees.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+
+# Unlike benchmark.py, this needs neither the network nor any servers set
+# up beforehand.  It generates a project with SyntheticProject.py, starts
+# some distccd instances on this machine, builds the project against them
+# in plain and pump modes, and reports how long each build took, together
+# with the time spent in each phase of the compiles, from the client's log,
+# and on each job, from the daemons' job summaries.
+#
+# The daemons all run on one machine, so this measures distcc's overheads
+# rather than how it scales.  Use benchmark.py with real servers for that.
+
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+from getopt import getopt
+
+import statistics
+from SyntheticProject import SyntheticProject, SHAPES
+
+# Logged by the client for each remote compile, see remote.c.
+RE_PHASES = re.compile(r"phases of \S+ on \S+: connect (\d+)ms, cpp (\d+)ms, "
+                       r"send (\d+)ms, compile (\d+)ms, receive (\d+)ms")
+PHASE_NAMES = ('connect', 'cpp', 'send', 'compile', 'receive')
+
+# Logged by the client for each compile, wherever it ran.
+RE_ELAPSED = re.compile(r"elapsed compilation time (\d+\.\d+)s")
+
+# The daemon's job summary, see serve.c.
+RE_JOB = re.compile(r"client: \S+ (\w+) exit:\d+ sig:\d+ core:\d+ ret:\d+ "
+                    r"time:(\d+)ms")
+
+
+def show_help():
+    print("""Usage: synthetic.py [OPTION]...
+Build a generated project against distccd instances on this machine.
+
+Project options:
+  --tus=N                    translation units [64]
+  --headers=N                headers [200]
+  --fanout=N                 headers included by each file [8]
+  --shape=SHAPE              include graph: %s [tree]
+  --template-depth=N         recursion depth of templates, for C++ [0]
+  --lang=LANG                c or c++ [c]
+  --functions=N              functions in each file [20]
+
+Build options:
+  --servers=N                distccd instances to start [3]
+  --base-port=PORT           port of the first one [4700]
+  --server-jobs=N            jobs each distccd accepts [2]
+  -j N, --jobs=N             jobs for make [servers * server-jobs]
+  --modes=MODES              comma-separated: plain, lzo, pump [plain,pump]
+  -n N                       build each mode N times [1]
+  --cc=PATH                  C compiler [cc]
+  --cxx=PATH                 C++ compiler [c++]
+  --bindir=DIR               where to find distcc, distccd and pump
+                             [the build directory, if built, else $PATH]
+  --work-dir=DIR             where to generate and build [synthetic]
+  --output=FILE              print the report to FILE as well as stdout
+  --help                     show this message
+""" % ', '.join(SHAPES))
+
+
+def find_program(bindir, name):
+    if bindir:
+        return os.path.join(bindir, name)
+    path = shutil.which(name)
+    if not path:
+        sys.exit("Could not find %s; use --bindir" % name)
+    return path
+
+
+def default_bindir():
+    """The directory this script was built in, if distcc was built there."""
+    top = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    if os.access(os.path.join(top, 'distccd'), os.X_OK):
+        return top
+    return None
+
+
+class Daemons:
+    """A set of distccd instances listening on consecutive local ports."""
+
+    def __init__(self, distccd, n, base_port, jobs, work_dir):
+        self.ports = list(range(base_port, base_port + n))
+        self.jobs = jobs
+        self.logs = [os.path.join(work_dir, 'distccd-%d.log' % p)
+                     for p in self.ports]
+        self.procs = []
+        for port, log in zip(self.ports, self.logs):
+            if os.path.exists(log):
+                os.unlink(log)
+            # The compiler is named by the client, so the daemons must
+            # accept it without a masquerade directory.
+            self.procs.append(subprocess.Popen(
+                [distccd, '--daemon', '--no-detach',
+                 '--listen', '127.0.0.1', '--port', str(port),
+                 '--allow', '127.0.0.1', '--enable-tcp-insecure',
+                 '--jobs', str(jobs), '--log-file', log]))
+        for port in self.ports:
+            self._wait_for(port)
+
+    def _wait_for(self, port):
+        for i in range(100):
+            sock = socket.socket()
+            try:
+                if sock.connect_ex(('127.0.0.1', port)) == 0:
+                    return
+            finally:
+                sock.close()
+            time.sleep(0.1)
+        self.stop()
+        sys.exit("distccd did not start listening on port %d" % port)
+
+    def hosts(self, opts):
+        return ' '.join('127.0.0.1:%d/%d%s' % (port, self.jobs, opts)
+                        for port in self.ports)
+
+    def log_sizes(self):
+        return [os.path.getsize(log) if os.path.exists(log) else 0
+                for log in self.logs]
+
+    def jobs_since(self, sizes):
+        """Return a list of (port, result, ms) for jobs logged since the
+        logs had the given sizes."""
+        jobs = []
+        for port, log, size in zip(self.ports, self.logs, sizes):
+            f = open(log, 'r')
+            try:
+                f.seek(size)
+                text = f.read()
+            finally:
+                f.close()
+            jobs += [(port, m.group(1), int(m.group(2)))
+                     for m in RE_JOB.finditer(text)]
+        return jobs
+
+    def stop(self):
+        for proc in self.procs:
+            if proc.poll() is None:
+                proc.send_signal(signal.SIGTERM)
+        for proc in self.procs:
+            proc.wait()
+
+
+class BuildResult:
+    """Timings from one build of the project."""
+
+    def __init__(self, mode, wall, status, phases, elapsed, jobs):
+        self.mode = mode
+        self.wall = wall
+        self.status = status
+        self.phases = phases       # a list of tuples, one per remote compile
+        self.elapsed = elapsed     # seconds taken by each distcc invocation
+        self.jobs = jobs           # (port, result, ms) from the daemons
+
+
+def build_once(mode, run, project_dir, work_dir, daemons, distcc, pump,
+               cc, cxx, make_jobs):
+    subprocess.call(['make', '-s', 'clean'], cwd=project_dir)
+    client_log = os.path.join(work_dir, 'client-%s-%d.log' % (mode, run))
+    if os.path.exists(client_log):
+        os.unlink(client_log)
+
+    env = dict(os.environ)
+    env['DISTCC_HOSTS'] = daemons.hosts({'plain': '', 'lzo': ',lzo',
+                                         'pump': ',cpp,lzo'}[mode])
+    env['DISTCC_LOG'] = client_log
+    env['DISTCC_VERBOSE'] = '1'
+    cmd = ['make', '-s', '-j%d' % make_jobs,
+           'CC=%s %s' % (distcc, cc), 'CXX=%s %s' % (distcc, cxx)]
+    if mode == 'pump':
+        cmd = [pump] + cmd
+
+    print("** Building %s, run %d" % (mode, run + 1))
+    sizes = daemons.log_sizes()
+    before = time.time()
+    status = subprocess.call(cmd, cwd=project_dir, env=env)
+    wall = time.time() - before
+
+    text = ''
+    if os.path.exists(client_log):
+        f = open(client_log, 'r')
+        try:
+            text = f.read()
+        finally:
+            f.close()
+    phases = [tuple(int(g) for g in m.groups())
+              for m in RE_PHASES.finditer(text)]
+    elapsed = [float(m.group(1)) for m in RE_ELAPSED.finditer(text)]
+    return BuildResult(mode, wall, status, phases, elapsed,
+                       daemons.jobs_since(sizes))
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of values, or None if there are none."""
+    if not values:
+        return None
+    values = sorted(values)
+    rank = (len(values) * pct + 99) // 100
+    return values[max(rank, 1) - 1]
+
+
+def format_ms(value):
+    if value is None:
+        return '%9s' % 'n/a'
+    return '%9.1f' % value
+
+
+def report(out, project, avg_visible, daemons, results, modes, cc, cxx):
+    out.write("""
+                   ==================================
+                   distcc synthetic benchmark results
+                   ==================================
+
+""")
+    out.write("Date: %s\n" % time.ctime())
+    out.write("Project: %r\n" % project)
+    out.write("Headers seen by each translation unit: %.1f\n" % avg_visible)
+    out.write("Compilers: %s, %s\n" % (cc, cxx))
+    out.write("Servers: %s\n" % daemons.hosts(''))
+    out.write("Local number of CPUs: %s\n\n"
+              % os.sysconf('SC_NPROCESSORS_ONLN'))
+
+    out.write("%-8s %5s %9s %9s %9s %9s %7s\n"
+              % ('mode', 'runs', 'time', 's.d.', 'remote', 'failed',
+                 'status'))
+    for mode in modes:
+        runs = [r for r in results if r.mode == mode]
+        walls = [r.wall for r in runs]
+        sd = statistics.std(walls)
+        ok_jobs = sum(len([j for j in r.jobs if j[1] == 'COMPILE_OK'])
+                      for r in runs)
+        bad_jobs = sum(len([j for j in r.jobs if j[1] != 'COMPILE_OK'])
+                       for r in runs)
+        status = max([r.status for r in runs] or [0])
+        out.write("%-8s %5d %8.2fs %9s %9d %9d %7d\n"
+                  % (mode, len(runs), statistics.mean(walls) or 0,
+                     sd is None and 'n/a' or '%8.2fs' % sd,
+                     ok_jobs, bad_jobs, status))
+
+    out.write("\nTime per compile, in milliseconds:\n")
+    out.write("%-8s %-14s %7s %9s %9s %9s %9s\n"
+              % ('mode', 'phase', 'count', 'mean', 'p50', 'p95', 'max'))
+    for mode in modes:
+        runs = [r for r in results if r.mode == mode]
+        rows = []
+        for i, name in enumerate(PHASE_NAMES):
+            rows.append(('client ' + name,
+                         [p[i] for r in runs for p in r.phases]))
+        rows.append(('client total',
+                     [e * 1000 for r in runs for e in r.elapsed]))
+        rows.append(('daemon job',
+                     [j[2] for r in runs for j in r.jobs
+                      if j[1] == 'COMPILE_OK']))
+        for name, values in rows:
+            out.write("%-8s %-14s %7d %s %s %s %s\n"
+                      % (mode, name, len(values),
+                         format_ms(statistics.mean(values)),
+                         format_ms(percentile(values, 50)),
+                         format_ms(percentile(values, 95)),
+                         format_ms(max(values) if values else None)))
+
+    out.write("\nJobs per server:\n")
+    for mode in modes:
+        counts = [len([j for r in results if r.mode == mode
+                       for j in r.jobs if j[0] == port])
+                  for port in daemons.ports]
+        out.write("%-8s %s\n" % (mode, ' '.join('%d:%d' % pc for pc in
+                                                zip(daemons.ports, counts))))
+
+
+def main():
+    """Run the benchmark per arguments"""
+    options, args = getopt(sys.argv[1:], 'j:n:',
+                           ['help', 'tus=', 'headers=', 'fanout=', 'shape=',
+                            'template-depth=', 'lang=', 'functions=',
+                            'servers=', 'base-port=', 'server-jobs=', 'jobs=',
+                            'modes=', 'cc=', 'cxx=', 'bindir=', 'work-dir=',
+                            'output='])
+    project_args = {}
+    opt_servers = 3
+    opt_base_port = 4700
+    opt_server_jobs = 2
+    opt_jobs = None
+    opt_modes = ['plain', 'pump']
+    opt_repeats = 1
+    opt_cc = 'cc'
+    opt_cxx = 'c++'
+    opt_bindir = default_bindir()
+    opt_work_dir = 'synthetic'
+    opt_output = None
+
+    for opt, optarg in options:
+        if opt == '--help':
+            show_help()
+            return
+        elif opt == '--tus':
+            project_args['n_tus'] = int(optarg)
+        elif opt == '--headers':
+            project_args['n_headers'] = int(optarg)
+        elif opt == '--fanout':
+            project_args['fanout'] = int(optarg)
+        elif opt == '--shape':
+            project_args['shape'] = optarg
+        elif opt == '--template-depth':
+            project_args['template_depth'] = int(optarg)
+        elif opt == '--lang':
+            project_args['lang'] = optarg
+        elif opt == '--functions':
+            project_args['functions'] = int(optarg)
+        elif opt == '--servers':
+            opt_servers = int(optarg)
+        elif opt == '--base-port':
+            opt_base_port = int(optarg)
+        elif opt == '--server-jobs':
+            opt_server_jobs = int(optarg)
+        elif opt in ('-j', '--jobs'):
+            opt_jobs = int(optarg)
+        elif opt == '--modes':
+            opt_modes = optarg.split(',')
+        elif opt == '-n':
+            opt_repeats = int(optarg)
+        elif opt == '--cc':
+            opt_cc = optarg
+        elif opt == '--cxx':
+            opt_cxx = optarg
+        elif opt == '--bindir':
+            opt_bindir = optarg
+        elif opt == '--work-dir':
+            opt_work_dir = optarg
+        elif opt == '--output':
+            opt_output = optarg
+    if args:
+        sys.exit("unexpected argument %r; try --help" % args[0])
+    if opt_bindir:
+        opt_bindir = os.path.abspath(opt_bindir)
+    for mode in opt_modes:
+        if mode not in ('plain', 'lzo', 'pump'):
+            sys.exit("unknown mode %r; try --help" % mode)
+
+    project = SyntheticProject(**project_args)
+    work_dir = os.path.abspath(opt_work_dir)
+    project_dir = os.path.join(work_dir, 'project')
+    if os.path.isdir(project_dir):
+        shutil.rmtree(project_dir)
+    print("** Generating %r in %s" % (project, project_dir))
+    avg_visible = project.generate(project_dir)
+
+    # The daemons are told the compiler by name, so use the full path.
+    cc = shutil.which(opt_cc) or opt_cc
+    cxx = shutil.which(opt_cxx) or opt_cxx
+    distcc = find_program(opt_bindir, 'distcc')
+    pump = find_program(opt_bindir, 'pump')
+    daemons = Daemons(find_program(opt_bindir, 'distccd'), opt_servers,
+                      opt_base_port, opt_server_jobs, work_dir)
+    results = []
+    try:
+        for mode in opt_modes:
+            for run in range(opt_repeats):
+                results.append(build_once(
+                    mode, run, project_dir, work_dir, daemons, distcc, pump,
+                    cc, cxx, opt_jobs or opt_servers * opt_server_jobs))
+    finally:
+        daemons.stop()
+
+    report(sys.stdout, project, avg_visible, daemons, results, opt_modes,
+           cc, cxx)
+    if opt_output:
+        f = open(opt_output, 'w')
+        try:
+            report(f, project, avg_visible, daemons, results, opt_modes,
+                   cc, cxx)
+        finally:
+            f.close()
+    if [r for r in results if r.status]:
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
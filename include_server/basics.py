@@ -78,6 +78,7 @@ class ClientRootKeeper(object):
       sys.exit('DISTCC_CLIENT_TMP must have at most two directory levels.')
     self.number_missing_levels = 3 - len(self.client_tmp.split('/'))
     self.client_root = None
+    self.image_store = None
 
   def Glob(self, pid_expr):
     """Glob unpadded client roots whose pid is matched by pid expression."""
@@ -108,6 +109,23 @@ class ClientRootKeeper(object):
       sys.exit('Could not create client root directory %s: %s' %
                (self.client_root, why))
 
+  def ImageStoreMakedir(self):
+    """Return the directory of compressed images shared by all generations.
+
+    The directory is a sibling of the client roots, so that images can be
+    hard-linked into them, and it is named as generation 0 of this process, so
+    that it is cleaned out along with them. Superseded images are removed from
+    it; see CompressFiles.Forget and CompressFiles.PruneImageStore.
+    """
+    if not self.image_store:
+      try:
+        self.image_store = tempfile.mkdtemp(
+            '.%s-%s-0' % (self.INCLUDE_SERVER_NAME, os.getpid()),
+            dir=self.client_tmp)
+      except (IOError, OSError) as why:
+        sys.exit('Could not create image store directory: %s' % why)
+    return self.image_store
+
   def CleanOutClientRoots(self, pid=None):
     """Delete client root directories pertaining to this process.
     Args:
@@ -212,18 +230,25 @@ GC_THRESHOLD = 10000
 opt_algorithm = MEMOIZING  # currently, only choice
 opt_debug_pattern = 1  # see DEBUG below
 opt_email_bound = MAX_EMAILS_TO_SEND
+opt_compression_threads = 4        # threads compressing closure files
 opt_exact_analysis = False         # use CPP instead of include analyzer
+opt_inotify = False    # invalidate caches selectively as directories change
+opt_prefetch = None    # compilation database to analyze ahead of requests
 opt_print_times = False
+opt_query_stats = False  # ask a running include server for its telemetry
 opt_path_observation_re = None
 opt_send_email = False
+opt_send_prefetch = None  # database for a running include server to prefetch
 opt_simple_algorithm = False
 opt_stat_reset_triggers = {}
 opt_statistics = False
+opt_stats_json = None  # file to write telemetry to as JSON at shutdown
 opt_unsafe_absolute_includes = False
 opt_consider_unexpanded_macro_fns = True # inverse of CLI to avoid double negative
 opt_no_force_dirs = False
 opt_verify = False     # whether to compare calculated include closure to that
                        # produced by compiler
+opt_workers = 1        # number of processes serving requests
 opt_write_include_closure = False  # write include closures to file
 
 # HELPER FUNCTION FOR STAT_RESET_TRIGGERS
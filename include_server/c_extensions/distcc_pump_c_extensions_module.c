@@ -51,7 +51,10 @@ static char CompressLzo1xAlloc_doc__[] =
 "   Raises:\n"
 "     distcc_pump_c_extensions.Error\n"
 "   Returns:\n"
-    " a string, compressed according to distcc protocol\n.";
+    " a string, compressed according to distcc protocol\n"
+"\n"
+"   The interpreter lock is released while compressing, so several threads\n"
+"   may compress at once.\n";
 
 static PyObject *
 CompressLzo1xAlloc(PyObject *dummy, PyObject *args) {
@@ -60,12 +63,17 @@ CompressLzo1xAlloc(PyObject *dummy, PyObject *args) {
   Py_ssize_t in_len;
   char *out_buf;
   size_t out_len;
+  int ret;
   UNUSED(dummy);
   if (!PyArg_ParseTuple(args, "s#", &in_buf, &in_len))
     return NULL;
   if (in_len < 0)
     return NULL;
-  if (dcc_compress_lzo1x_alloc(in_buf, in_len, &out_buf, &out_len)) {
+  /* in_buf stays valid: args holds a reference to the object. */
+  Py_BEGIN_ALLOW_THREADS
+  ret = dcc_compress_lzo1x_alloc_r(in_buf, in_len, &out_buf, &out_len);
+  Py_END_ALLOW_THREADS
+  if (ret) {
     PyErr_SetString(distcc_pump_c_extensionsError,
                     "Couldn't compress that.");
     return NULL;
@@ -360,6 +368,227 @@ Realpath(PyObject *dummy, PyObject *args) {
 
 
 
+/***********************************************************************
+ScanDirectives
+***********************************************************************/
+
+static /* const */ char ScanDirectives_doc__[] =
+"ScanDirectives(file_contents):\n"
+"  Find the #include, #include_next, #import and #define directives.\n"
+"\n"
+"  This is a native version of parse_file.ScanDirectives, which remains\n"
+"  the reference implementation and is used in differential tests.\n"
+"  A directive is recognized at the start of a line, possibly preceded by\n"
+"  white space, a '*/' and /* ... */ comments. Backslash-newline\n"
+"  continuations are joined and paired /* ... */ comments are removed\n"
+"  from the directive text. '\\r\\n' and '\\r' are treated as line ends,\n"
+"  as they are by Python's universal newlines mode.\n"
+"\n"
+"  Arguments:\n"
+"    file_contents: a bytes object, the raw (latin-1) file contents\n"
+"  Returns:\n"
+"    a list of pairs (directive, text), where directive is one of\n"
+"    'define', 'include', 'include_next' or 'import', and text is the\n"
+"    cleaned-up directive, starting with '#'\n"
+;
+
+/* The directive keywords in the order tried by parse_file.POUND_SIGN_RE:
+   "include_next" must be tried before "include". */
+static const char *const scan_directive_keywords[] = {
+  "define", "include_next", "include", "import", NULL
+};
+
+static int
+scan_is_eol(char c) {
+  return c == '\n' || c == '\r';
+}
+
+static int
+scan_is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+/* Is this (latin-1) character matched by \w in a Python str regexp? */
+static int
+scan_is_word_char(unsigned char c) {
+  if (c < 0x80)
+    return isalnum(c) || c == '_';
+  return c == 0xaa || c == 0xb2 || c == 0xb3 || c == 0xb5 || c == 0xb9
+      || c == 0xba || (c >= 0xbc && c <= 0xbe)
+      || (c >= 0xc0 && c != 0xd7 && c != 0xf7);
+}
+
+/* Length of the line ending at P, or 0 if P is not at a line ending. */
+static size_t
+scan_eol_len(const char *p, const char *end) {
+  if (p >= end)
+    return 0;
+  if (*p == '\n')
+    return 1;
+  if (*p == '\r')
+    return (p + 1 < end && p[1] == '\n') ? 2 : 1;
+  return 0;
+}
+
+/* If P points to '#', optional blanks and a directive keyword followed by a
+   word boundary, then return the keyword; otherwise return NULL. */
+static const char *
+scan_directive_keyword(const char *p, const char *end) {
+  const char *const *kw;
+
+  if (p >= end || *p != '#')
+    return NULL;
+  for (p++; p < end && scan_is_blank(*p); p++)
+    ;
+  for (kw = scan_directive_keywords; *kw; kw++) {
+    size_t len = strlen(*kw);
+    if ((size_t) (end - p) >= len && memcmp(p, *kw, len) == 0
+        && (p + len == end || !scan_is_word_char((unsigned char) p[len])))
+      return *kw;
+  }
+  return NULL;
+}
+
+/* Find where the directive on the physical line [LINE, LINE_END) begins.
+
+   This follows POUND_SIGN_RE: the '#' may be preceded by blanks, the end
+   of a comment begun on an earlier line, and a run of comments, which the
+   regexp matches greedily, so the last comment end on the line is tried
+   first. */
+static const char *
+scan_directive_start(const char *line, const char *line_end,
+                     const char **keyword) {
+  const char *p = line;
+  const char *e;
+
+  while (p < line_end && scan_is_blank(*p))
+    p++;
+  if (line_end - p >= 2 && p[0] == '*' && p[1] == '/') {
+    p += 2;
+    while (p < line_end && scan_is_blank(*p))
+      p++;
+  }
+  if ((*keyword = scan_directive_keyword(p, line_end)))
+    return p;
+  if (line_end - p < 4 || p[0] != '/' || p[1] != '*')
+    return NULL;
+  for (e = line_end - 2; e >= p + 2; e--) {
+    const char *q;
+    if (e[0] != '*' || e[1] != '/')
+      continue;
+    for (q = e + 2; q < line_end && scan_is_blank(*q); q++)
+      ;
+    if ((*keyword = scan_directive_keyword(q, line_end)))
+      return q;
+  }
+  return NULL;
+}
+
+/* Copy the logical line starting at START into a fresh Python string, with
+   backslash-newlines and paired comments removed. */
+static PyObject *
+scan_directive_text(const char *start, const char *end) {
+  const char *p = start, *line_end;
+  char *text, *out;
+  size_t len, i, j;
+  PyObject *result;
+
+  /* A line ending that is preceded by a backslash continues the line. */
+  for (;;) {
+    while (p < end && !scan_is_eol(*p))
+      p++;
+    if (p == end || p[-1] != '\\')
+      break;
+    p += scan_eol_len(p, end);
+  }
+  line_end = p;
+
+  if ((text = malloc(p - start)) == NULL)
+    return PyErr_NoMemory();
+  for (out = text, p = start; p < line_end; ) {
+    size_t eol;
+    if (*p == '\\' && (eol = scan_eol_len(p + 1, line_end))) {
+      p += 1 + eol;
+      continue;
+    }
+    *out++ = *p++;
+  }
+  len = out - text;
+
+  /* Remove paired comments, left to right and non-greedily, like
+     PAIRED_COMMENT_RE. */
+  for (i = j = 0; i < len; ) {
+    if (i + 1 < len && text[i] == '/' && text[i + 1] == '*') {
+      size_t k;
+      for (k = i + 2; k + 1 < len; k++)
+        if (text[k] == '*' && text[k + 1] == '/')
+          break;
+      if (k + 1 < len) {
+        i = k + 2;
+        continue;
+      }
+      /* Unpaired: no later comment can be paired either. */
+      memmove(text + j, text + i, len - i);
+      j += len - i;
+      break;
+    }
+    text[j++] = text[i++];
+  }
+
+  result = PyUnicode_DecodeLatin1(text, j, NULL);
+  free(text);
+  return result;
+}
+
+static PyObject *
+ScanDirectives(PyObject *dummy, PyObject *args) {
+  const char *buf, *end, *p, *hash;
+  Py_ssize_t len;
+  PyObject *list_object;
+  UNUSED(dummy);
+
+  if (!PyArg_ParseTuple(args, "y#", &buf, &len))
+    return NULL;
+  if ((list_object = PyList_New(0)) == NULL)
+    return NULL;
+  end = buf + len;
+
+  /* Every directive has a '#' on its first line, so let memchr (which is
+     vectorized in any decent libc) skip the uninteresting parts, and only
+     look at the lines that contain a '#'. */
+  for (p = buf; p < end && (hash = memchr(p, '#', end - p)); ) {
+    const char *line = hash, *line_end = hash, *start, *keyword;
+
+    while (line > buf && !scan_is_eol(line[-1]))
+      line--;
+    while (line_end < end && !scan_is_eol(*line_end))
+      line_end++;
+    p = line_end;
+
+    if ((start = scan_directive_start(line, line_end, &keyword))) {
+      PyObject *tuple;
+      PyObject *text = scan_directive_text(start, end);
+      if (text == NULL)
+        goto error;
+      tuple = Py_BuildValue("(sN)", keyword, text);
+      if (tuple == NULL)
+        goto error;
+      if (PyList_Append(list_object, tuple) < 0) {
+        Py_DECREF(tuple);
+        goto error;
+      }
+      Py_DECREF(tuple);
+    }
+  }
+  return list_object;
+
+ error:
+  Py_DECREF(list_object);
+  return NULL;
+}
+
+
+
 /***********************************************************************
 Bindings;
 ************************************************************************/
@@ -397,6 +626,8 @@ static PyMethodDef module_methods[] = {
   {"XArgv",       (PyCFunction)XArgv,   METH_VARARGS, XArgv_doc__},
   {"CompressLzo1xAlloc", (PyCFunction)CompressLzo1xAlloc, METH_VARARGS,
    CompressLzo1xAlloc_doc__},
+  {"ScanDirectives", (PyCFunction)ScanDirectives, METH_VARARGS,
+   ScanDirectives_doc__},
   {NULL, NULL, 0, NULL}
 };
 
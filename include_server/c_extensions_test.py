@@ -50,6 +50,7 @@ def RunTest(random_filename):
   assert distcc_pump_c_extensions.OsPathExists.__doc__
   assert distcc_pump_c_extensions.OsPathIsFile.__doc__
   assert distcc_pump_c_extensions.Realpath.__doc__
+  assert distcc_pump_c_extensions.ScanDirectives.__doc__
 
   # RTokenString and RArgv
 
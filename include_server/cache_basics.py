@@ -197,6 +197,12 @@ import compiler_defaults
 
 DIR_ARRAY_SIZE = 500
 
+# The states of a stat recorded by BuildStatCache.  They are kept in byte
+# arrays, one byte per search directory, to keep the cache small.
+STAT_UNKNOWN = 0
+STAT_ABSENT = 1
+STAT_PRESENT = 2
+
 # We currently use the stat and realpath of GNU libc stat and
 # realpath. They are about an order of magnitude faster than their
 # Python counterparts, even when called through the Python/C
@@ -335,8 +341,11 @@ class DirnameCache(object):
     currdir.
     """
     try:
-      return self.cache[(currdir_idx, searchdir_idx, includepath_idx)]
+      result = self.cache[(currdir_idx, searchdir_idx, includepath_idx)]
+      statistics.dirname_hit_counter += 1
+      return result
     except KeyError:
+      statistics.dirname_miss_counter += 1
       directory = os.path.dirname(os.path.join(
          self.directory_map.string[searchdir_idx],
          self.includepath_map.string[includepath_idx]))
@@ -617,20 +626,31 @@ class BuildStatCache(object):
 
   The hash table is three-level structure:
    - build_stat[currdir_idx] contains an array for each includepath_idx
-   - build_stat[currdir_idx][includepath_idx] is this array, and
+   - build_stat[currdir_idx][includepath_idx] is this array, a bytearray, and
    - build_stat[currdir_idx][includepath_idx][searchdir_idx] is either
-      * False if os.path.join(currdir, searchdir, includepath) does not exist
-      * True if it does
-      * None when it is not known whether it exists or not
+      * STAT_ABSENT if os.path.join(currdir, searchdir, includepath) does not
+        exist
+      * STAT_PRESENT if it does
+      * STAT_UNKNOWN when it is not known whether it exists or not
   In addition, we keep a parallel structure for the realpath, that lets us
   quickly map from a filepath to os.path.realpath(filepath).
-   - real_stat[currdir_idx] contains an array for each fp
-   - real_stat[currdir_idx][includepath_idx] is this array, and
-   - real_stat[currdir_idx][includepath_idx][searchdir_idx] is either
-      * realpath_idx, such that realpath_map.string[realpath_idx] =
-           os.path.realpath(os.path.join(currdir, searchdir, includepath))
-        when build_stat[currdir_idx][includepath_idx][searchdir_idx] = True
-      * None, otherwise
+   - real_stat[currdir_idx] contains a dictionary for each fp
+   - real_stat[currdir_idx][includepath_idx] is this dictionary, and
+   - real_stat[currdir_idx][includepath_idx][searchdir_idx] is
+      ((searchdir_idx, includepath_idx), realpath_idx), the value returned by
+      Resolve, such that realpath_map.string[realpath_idx] =
+        os.path.realpath(os.path.join(currdir, searchdir, includepath))
+      when build_stat[currdir_idx][includepath_idx][searchdir_idx] is
+      STAT_PRESENT.  Since an includepath exists in few of the search
+      directories, these dictionaries are much smaller than the arrays.  The
+      values are shared by all nodes of the include analysis that refer to
+      them.
+
+  If directory_watcher is set to a DirectoryWatcher, then every stat is
+  preceded by a watch on the directory it examines, and
+   - dependents[wd][name] is the list of triples
+     (currdir_idx, includepath_idx, searchdir_idx) whose entries become
+     unknown again when entry name of the directory watched by wd changes.
   """
 
   def __init__(self, includepath_map, directory_map, realpath_map):
@@ -640,6 +660,8 @@ class BuildStatCache(object):
     self.directory_map = directory_map
     self.realpath_map = realpath_map
     self.path_observations = []
+    self.directory_watcher = None
+    self.dependents = {}
 
   def _Verify(self, currdir_idx, searchdir_idx, includepath_idx):
     """Verify that the cached result is the same as obtained by stat call.
@@ -657,8 +679,9 @@ class BuildStatCache(object):
     really_exists = _OsPathIsFile(
       self.directory_map.string[searchdir_idx]
       + self.includepath_map.string[includepath_idx])
-    cache_exists = self.build_stat[currdir_idx][includepath_idx][searchdir_idx]
-    assert isinstance(cache_exists, bool)
+    cache_stat = self.build_stat[currdir_idx][includepath_idx][searchdir_idx]
+    assert cache_stat in (STAT_ABSENT, STAT_PRESENT)
+    cache_exists = cache_stat == STAT_PRESENT
     if cache_exists != really_exists:
       filepath = os.path.join(self.directory_map.string[currdir_idx],
                               self.directory_map.string[searchdir_idx],
@@ -682,6 +705,38 @@ class BuildStatCache(object):
              translation_unit, includepath, relpath, realpath)
     self.path_observations = []
 
+  def _Watch(self, currdir_idx, includepath_idx, searchdir_idx, relpath):
+    """Watch the directory that a stat of relpath examines."""
+    watched = self.directory_watcher.Watch(
+      os.path.join(self.directory_map.string[currdir_idx], relpath))
+    if watched:
+      (wd, name) = watched
+      self.dependents.setdefault(wd, {}).setdefault(name, []).append(
+        (currdir_idx, includepath_idx, searchdir_idx))
+
+  def Invalidate(self, wd, name):
+    """Forget the stats that depend on an entry of a watched directory.
+
+    Arguments:
+      wd: a watch descriptor of the directory_watcher
+      name: an entry of the watched directory, or None for all of them
+    Returns:
+      the set of includepath indices whose resolution may have changed
+    """
+    if name is None:
+      triples = [ triple
+                  for triples_for_name in self.dependents.pop(wd, {}).values()
+                  for triple in triples_for_name ]
+    else:
+      triples = self.dependents.get(wd, {}).pop(name, [])
+    includepath_idxs = set()
+    for (currdir_idx, includepath_idx, searchdir_idx) in triples:
+      self.build_stat[currdir_idx][includepath_idx][searchdir_idx] = (
+        STAT_UNKNOWN)
+      self.real_stat[currdir_idx][includepath_idx].pop(searchdir_idx, None)
+      includepath_idxs.add(includepath_idx)
+    return includepath_idxs
+
   def Resolve(self, includepath_idx, currdir_idx, searchdir_idx,
               searchlist_idxs):
     """Says whether (currdir_idx, searchdir_idx, includepath_idx) exists,
@@ -715,9 +770,13 @@ class BuildStatCache(object):
       # the sl_idx to return for example? And what about the use of '+'
       # (as an optimization) below instead of os.path.join.
       return (None, None)
+    statistics.build_stat_lookup_counter += 1
+    missed = False  # whether we have had to stat in this call
     dir_map_string = self.directory_map.string   # memoize the fn pointer
     build_stat = self.build_stat
     real_stat = self.real_stat
+    absent = STAT_ABSENT                         # local lookups are faster
+    present = STAT_PRESENT
     if __debug__:
       dir_map = self.directory_map
       assert 0 < includepath_idx < self.includepath_map.Length()
@@ -741,9 +800,8 @@ class BuildStatCache(object):
       currdir_stats = build_stat.setdefault(currdir_idx, {})
       currdir_realpaths = real_stat.setdefault(currdir_idx, {})
       searchdir_stats = currdir_stats[includepath_idx] = \
-                        [None] * DIR_ARRAY_SIZE
-      searchdir_realpaths = currdir_realpaths[includepath_idx] = \
-                        [None] * DIR_ARRAY_SIZE
+                        bytearray(DIR_ARRAY_SIZE)
+      searchdir_realpaths = currdir_realpaths[includepath_idx] = {}
 
     # Try searchdir_idx if not None, then try every index in searchlist_idxs.
     # This inner loop may be executed tens of millions of times.
@@ -755,41 +813,48 @@ class BuildStatCache(object):
           statistics.search_counter += 1
           statistics.build_stat_counter += 1
         try:
-          # We expect that searchdir_stats[sl_idx] == False, because
+          # We expect that searchdir_stats[sl_idx] == absent, because
           # we've usually seen sl_idx before for our includepath and
           # our currdir --- and includepath does not usually exist
           # relative to the sp directory.  We're optimizing for this
           # case of course. That should give us a rate of a couple of
           # million iterations per second (for this case).
-          if searchdir_stats[sl_idx] == False:
+          stat = searchdir_stats[sl_idx]
+          if stat == absent:
             if __debug__: self._Verify(currdir_idx, sl_idx, includepath_idx)
             continue
-          if searchdir_stats[sl_idx]:
+          if stat == present:
             if __debug__: self._Verify(currdir_idx, sl_idx, includepath_idx)
-            return ((sl_idx, includepath_idx), searchdir_realpaths[sl_idx])
+            return searchdir_realpaths[sl_idx]
         except IndexError:   # DIR_ARRAY_SIZE wasn't big enough; let's double
-          searchdir_stats.extend([None] * max(sl_idx, len(searchdir_stats)))
-          searchdir_realpaths.extend([None] * max(sl_idx, len(searchdir_stats)))
+          searchdir_stats.extend(bytes(max(sl_idx, len(searchdir_stats))))
 
         # If we get here, result is not cached yet.
         if __debug__: statistics.sys_stat_counter += 1
+        if not missed:
+          missed = True
+          statistics.build_stat_miss_counter += 1
         # We do not explicitly take into account currdir_idx, because
         # of the check above that os.getcwd is set to current_dir.
         relpath = dir_map_string[sl_idx] + includepath
+        if self.directory_watcher:
+          # Watch before the stat, lest a change in between goes unnoticed.
+          self._Watch(currdir_idx, includepath_idx, sl_idx, relpath)
         if _OsPathIsFile(relpath):
-          searchdir_stats[sl_idx] = True
+          searchdir_stats[sl_idx] = present
           rpath = os.path.join(dir_map_string[currdir_idx], relpath)
-          realpath_idx = searchdir_realpaths[sl_idx] = (
-            self.realpath_map.Index(rpath))
+          realpath_idx = self.realpath_map.Index(rpath)
+          result = searchdir_realpaths[sl_idx] = (
+            (sl_idx, includepath_idx), realpath_idx)
           # This is the place to catch errant files according to user defined
           # regular expression path_observation_re.
           if basics.opt_path_observation_re:
             realpath = self.realpath_map.string[realpath_idx]
             if basics.opt_path_observation_re.search(realpath):
               self.path_observations.append((includepath, relpath, realpath))
-          return ((sl_idx, includepath_idx), realpath_idx)
+          return result
         else:
-          searchdir_stats[sl_idx] = False
+          searchdir_stats[sl_idx] = absent
 
     if __debug__: Debug(DEBUG_TRACE2, "Resolve: failed")
     return (None, None)
@@ -19,12 +19,78 @@
 
 """Compress files in an include closure."""
 
+import concurrent.futures
+import hashlib
 import os
+import shutil
 import sys
+import threading
 import os.path
 
+import basics
 import distcc_pump_c_extensions
 
+# The threads doing the compression; shared by all generations of caches.
+_executor = None
+
+
+def _Executor():
+  global _executor
+  if not _executor:
+    _executor = concurrent.futures.ThreadPoolExecutor(
+        max_workers=basics.opt_compression_threads)
+  return _executor
+
+
+def _CompressFile(realpath, new_filepath, prefix, image_store,
+                  md5_filepath=None):
+  """Make new_filepath a compressed image of realpath prefixed by prefix.
+
+  Images are kept in image_store under the digest of what they compress, so
+  that a file compressed once, in this or an earlier generation, is only
+  linked into place. If md5_filepath is given, the MD5 digest of what is
+  compressed is also written there, in hex. Runs in a compression thread: on
+  failure, exit with a message, which Wait reraises in the request handler.
+  Returns the path of the image.
+  """
+  try:
+    real_file_fd = open(realpath, "rb")
+  except (IOError, OSError) as why:
+    sys.exit("Could not open '%s' for reading: %s" % (realpath, why))
+  try:
+    contents = prefix.encode() + real_file_fd.read()
+  except (IOError, OSError) as why:
+    sys.exit("Could not read '%s': %s" % (realpath, why))
+  finally:
+    real_file_fd.close()
+  image = os.path.join(image_store,
+                       hashlib.sha1(contents).hexdigest() + ".lzo")
+  # Write under temporary names and rename, so that nobody ever sees a partial
+  # image; in particular not a distcc client still reading an earlier image of
+  # a since modified file.
+  tmp_suffix = ".tmp%d" % threading.get_ident()
+  try:
+    if not os.path.exists(image):
+      image_fd = open(image + tmp_suffix, "wb")
+      image_fd.write(distcc_pump_c_extensions.CompressLzo1xAlloc(contents))
+      image_fd.close()
+      os.rename(image + tmp_suffix, image)
+    tmp_filepath = new_filepath + tmp_suffix
+    try:
+      os.link(image, tmp_filepath)
+    except OSError:
+      shutil.copyfile(image, tmp_filepath)
+    os.rename(tmp_filepath, new_filepath)
+    if md5_filepath:
+      md5_fd = open(md5_filepath + tmp_suffix, "w")
+      md5_fd.write(hashlib.md5(contents).hexdigest())
+      md5_fd.close()
+      os.rename(md5_filepath + tmp_suffix, md5_filepath)
+  except (IOError, OSError) as why:
+    sys.exit("Could not write to '%s': %s" % (new_filepath, why))
+  return image
+
+
 class CompressFiles(object):
 
   def __init__(self, includepath_map, directory_map, realpath_map, mirror_path):
@@ -39,26 +105,70 @@ class CompressFiles(object):
     self.directory_map = directory_map
     self.realpath_map = realpath_map
     self.mirror_path = mirror_path
-    # The realpath_map indices of files that have been compressed already.
-    self.files_compressed = set([])
+    # The filepaths under client_root of the files that have been compressed
+    # already, each mapped to itself.  The lists that Start returns share
+    # these strings, which matters when many of them are kept; see
+    # IncludeAnalyzer.DoCompilationCommand.
+    self.files_compressed = {}
+    # The compressions in flight, as pairs of a filepath and a future.
+    self.pending = []
+    # The image of each filepath in files_compressed whose compression is
+    # done, and for each such image, how many of these filepaths use it.
+    self.images = {}
+    self.image_users = {}
 
-  def Compress(self, include_closure, client_root_keeper, currdir_idx):
-    """Copy files in include_closure to the client_root directory, compressing
-    them as we go, and also inserting #line directives.
+  def _MakeDirectory(self, realpath, new_filepath, client_root_keeper,
+                     currdir_idx):
+    """Make sure the directory of new_filepath, the image of realpath, exists.
+    """
+    dirname = os.path.dirname(new_filepath)
+    try:
+      if not os.path.isdir(dirname):
+        my_root = client_root_keeper.client_root
+        self.mirror_path.DoPath(realpath, currdir_idx, my_root)
+    except (IOError, OSError) as why:
+      # Kill include server
+      sys.exit("Could not make directory '%s': %s" % (dirname, why))
+
+  def Start(self, include_closure, client_root_keeper, currdir_idx,
+            precompiled_headers=()):
+    """Start copying files in include_closure to the client_root directory,
+    compressing them as we go, and also inserting #line directives.
 
     Arguments:
       include_closure: a dictionary, see IncludeAnalyzer.RunAlgorithm
       client_root_keeper: an object as defined in basics.py
+      precompiled_headers: realpath indices of precompiled headers to copy
+        as well; each image gets a sidecar file, with the suffix .md5, holding
+        the MD5 digest of the precompiled header, by which distcc clients and
+        servers know it
     Returns: a list of filepaths under client_root
 
     Walk through the files in the include closure. Make sure their compressed
-    images (with either .lzo or lzo.abs extension) exist under client_root as
-    handled by client_root_keeper. Also collect all the .lzo or .lzo.abs
-    filepaths in a list, which is the return value.
+    images (with either .lzo or lzo.abs extension) will exist under
+    client_root as handled by client_root_keeper, once Wait returns. Also
+    collect all the .lzo or .lzo.abs filepaths in a list, which is the return
+    value.
     """
     realpath_string = self.realpath_map.string
+    image_store = client_root_keeper.ImageStoreMakedir()
     files = [] # where we accumulate files
 
+    for realpath_idx in precompiled_headers:
+      realpath = realpath_string[realpath_idx]
+      new_filepath = "%s%s.lzo" % (client_root_keeper.client_root, realpath)
+      known_filepath = self.files_compressed.get(new_filepath)
+      if known_filepath:
+        files.append(known_filepath)
+      else:
+        files.append(new_filepath)
+        self.files_compressed[new_filepath] = new_filepath
+        self._MakeDirectory(realpath, new_filepath, client_root_keeper,
+                            currdir_idx)
+        self.pending.append((new_filepath,
+          _Executor().submit(_CompressFile, realpath, new_filepath, "",
+                             image_store, new_filepath + ".md5")))
+
     for realpath_idx in include_closure:
       # Thanks to symbolic links, many absolute filepaths may designate
       # the very same canonical path (as calculated by realpath). The
@@ -72,17 +182,14 @@ class CompressFiles(object):
       else:
         new_filepath = "%s%s.lzo" % (client_root_keeper.client_root,
                                      realpath)
-      files.append(new_filepath)
-      if not new_filepath in self.files_compressed:
-        self.files_compressed.add(new_filepath)
-        dirname = os.path.dirname(new_filepath)
-        try:
-          if not os.path.isdir(dirname):
-            my_root = client_root_keeper.client_root
-            self.mirror_path.DoPath(realpath, currdir_idx, my_root)
-        except (IOError, OSError) as why:
-          # Kill include server
-          sys.exit("Could not make directory '%s': %s" % (dirname, why))
+      known_filepath = self.files_compressed.get(new_filepath)
+      if known_filepath:
+        files.append(known_filepath)
+      else:
+        files.append(new_filepath)
+        self.files_compressed[new_filepath] = new_filepath
+        self._MakeDirectory(realpath, new_filepath, client_root_keeper,
+                            currdir_idx)
         if new_filepath.endswith('.abs'):
           (searchdir_idx, includepath_idx) = include_closure[realpath_idx][0]
           # TODO(csilvers): can't we use + here instead of os.path.join?
@@ -97,20 +204,68 @@ class CompressFiles(object):
           # This file will be relatively resolved on the served. No need to
           # change its name.
           prefix = ""
-        try:
-          real_file_fd = open(realpath, "rb")
-        except (IOError, OSError) as why:
-          sys.exit("Could not open '%s' for reading: %s" % (realpath, why))
-        try:
-          new_filepath_fd = open(new_filepath, "wb")
-        except (IOError, OSError) as why:
-          sys.exit("Could not open '%s' for writing: %s" % (new_filepath, why))
-        try:
-          new_filepath_fd.write(
-            distcc_pump_c_extensions.CompressLzo1xAlloc(
-              prefix.encode() + real_file_fd.read()))
-        except (IOError, OSError) as why:
-          sys.exit("Could not write to '%s': %s" % (new_filepath, why))
-        new_filepath_fd.close()
-        real_file_fd.close()
+        self.pending.append((new_filepath,
+          _Executor().submit(_CompressFile, realpath, new_filepath, prefix,
+                             image_store)))
+    return files
+
+  def Wait(self):
+    """Wait until the files of previous calls to Start are all in place.
+
+    Raises:
+      SystemExit if a file could not be compressed
+    """
+    pending = self.pending
+    self.pending = []
+    for (new_filepath, future) in pending:
+      image = future.result()
+      self.images[new_filepath] = image
+      self.image_users[image] = self.image_users.get(image, 0) + 1
+
+  def Compress(self, include_closure, client_root_keeper, currdir_idx):
+    """Start, then Wait. Returns the list of filepaths that Start returns."""
+    files = self.Start(include_closure, client_root_keeper, currdir_idx)
+    self.Wait()
     return files
+
+  def Forget(self, realpath, client_root):
+    """Make the next Compress of realpath read the file again.
+
+    Arguments:
+      realpath: the realpath of a file that has changed
+      client_root: the client root directory of the current generation
+    """
+    self.Wait()
+    for new_filepath in ["%s%s.lzo" % (client_root, realpath),
+                         "%s%s.lzo.abs" % (client_root, realpath)]:
+      self.files_compressed.pop(new_filepath, None)
+      image = self.images.pop(new_filepath, None)
+      if image:
+        self.image_users[image] -= 1
+        if not self.image_users[image]:
+          # The image is superseded. Client roots that have it keep their own
+          # links to it.
+          del self.image_users[image]
+          try:
+            os.unlink(image)
+          except OSError:
+            pass
+
+  def PruneImageStore(self, image_store):
+    """Remove the images in image_store that this object does not use.
+
+    Called when the caches are cleared, so that the next generation keeps what
+    this one used, while what was superseded earlier goes.
+    """
+    self.Wait()
+    try:
+      names = os.listdir(image_store)
+    except OSError:
+      return
+    for name in names:
+      image = os.path.join(image_store, name)
+      if image not in self.image_users:
+        try:
+          os.unlink(image)
+        except OSError:
+          pass
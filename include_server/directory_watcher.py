@@ -0,0 +1,278 @@
+#! /usr/bin/env python3
+
+# Copyright 2007 Google Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Report changes to the directories examined by the include server.
+
+The include server assumes that source files do not change during a build.
+Builds that generate headers break that assumption. A DirectoryWatcher lets
+the include analyzer find out, through Linux's inotify interface, which
+directory entries changed since the previous request, so that only the cache
+entries depending on them need to be recomputed.
+"""
+
+import ctypes
+import ctypes.util
+import errno
+import os
+import os.path
+import struct
+
+import basics
+
+Debug = basics.Debug
+DEBUG_WARNING = basics.DEBUG_WARNING
+
+# From <sys/inotify.h>.
+IN_MODIFY      = 0x00000002
+IN_CLOSE_WRITE = 0x00000008
+IN_MOVED_FROM  = 0x00000040
+IN_MOVED_TO    = 0x00000080
+IN_CREATE      = 0x00000100
+IN_DELETE      = 0x00000200
+IN_DELETE_SELF = 0x00000400
+IN_MOVE_SELF   = 0x00000800
+IN_Q_OVERFLOW  = 0x00004000
+IN_IGNORED     = 0x00008000
+IN_ONLYDIR     = 0x01000000
+IN_ISDIR       = 0x40000000
+IN_NONBLOCK    = os.O_NONBLOCK
+IN_CLOEXEC     = getattr(os, 'O_CLOEXEC', 0o2000000)
+
+# The events that may change the outcome of a stat or the contents of a file.
+WATCH_MASK = (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO
+              | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF
+              | IN_ONLYDIR)
+
+# struct inotify_event { int wd; uint32_t mask, cookie, len; char name[]; }
+_EVENT_HEADER = struct.Struct('iIII')
+
+_libc = None
+
+
+def _Libc():
+  """Return the C library, or None if it does not offer inotify."""
+  global _libc
+  if _libc is None:
+    try:
+      libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+      libc.inotify_init1, libc.inotify_add_watch, libc.inotify_rm_watch
+      _libc = libc
+    except (OSError, AttributeError):
+      _libc = False
+  return _libc or None
+
+
+def _RaiseErrno(filename=None):
+  err = ctypes.get_errno()
+  raise OSError(err, os.strerror(err), filename)
+
+
+class DirectoryWatcher(object):
+  """Watch directories and report which of their entries changed.
+
+  Instance variables:
+    fd: the inotify file descriptor
+    wds: wds[dirpath] is the watch descriptor of directory dirpath; several
+         paths may denote the same directory and hence share a descriptor
+    dirpaths: dirpaths[wd] is the set of directory paths watched through wd
+    symlinks: symlinks[wd] is the set of entries of the directory that were
+              symbolic links when the watch was installed
+    failed: True once a watch could not be installed; from then on, changes
+            may go unreported
+  """
+
+  def __init__(self):
+    """Constructor.
+
+    Raises:
+      OSError if inotify is not available
+    """
+    libc = _Libc()
+    if not libc:
+      raise OSError(errno.ENOSYS, "inotify is not available")
+    self.libc = libc
+    self.fd = libc.inotify_init1(IN_NONBLOCK | IN_CLOEXEC)
+    if self.fd < 0:
+      _RaiseErrno()
+    self.wds = {}
+    self.dirpaths = {}
+    self.symlinks = {}
+    self.failed = False
+
+  def Close(self):
+    """Release the inotify descriptor, and with it all watches."""
+    if self.fd >= 0:
+      os.close(self.fd)
+      self.fd = -1
+
+  def WatchDirectory(self, dirpath):
+    """Watch an existing directory.
+
+    Arguments:
+      dirpath: an absolute directory path
+    Returns:
+      the watch descriptor, or None if dirpath is not a directory
+    Raises:
+      OSError if the watch cannot be installed for other reasons
+    """
+    try:
+      return self.wds[dirpath]
+    except KeyError:
+      pass
+    wd = self.libc.inotify_add_watch(self.fd, os.fsencode(dirpath),
+                                     WATCH_MASK)
+    if wd < 0:
+      if ctypes.get_errno() in (errno.ENOENT, errno.ENOTDIR):
+        return None
+      _RaiseErrno(dirpath)
+    if wd not in self.dirpaths:
+      self.dirpaths[wd] = set()
+      # Replacing or removing a symbolic link may change the realpath of
+      # everything below it; remember which entries are links.
+      try:
+        self.symlinks[wd] = set([entry.name for entry in os.scandir(dirpath)
+                                 if entry.is_symlink()])
+      except OSError:
+        self.symlinks[wd] = set()
+    self.dirpaths[wd].add(dirpath)
+    self.wds[dirpath] = wd
+    return wd
+
+  def Watch(self, filepath):
+    """Watch for changes that may affect whether filepath exists.
+
+    Arguments:
+      filepath: an absolute filepath
+    Returns:
+      a pair (wd, name), where wd watches the nearest existing directory
+      above filepath and name is the entry of that directory that leads to
+      filepath; or None if watching failed.
+
+    If the directory of filepath does not exist, then the nearest existing
+    ancestor is watched instead: filepath can come into existence only after
+    an entry has been created there.
+    """
+    if self.failed:
+      return None
+    dirpath, name = os.path.split(filepath)
+    try:
+      while True:
+        wd = self.WatchDirectory(dirpath)
+        if wd is not None:
+          return (wd, name)
+        if dirpath == '/':
+          return None
+        dirpath, name = os.path.split(dirpath)
+    except OSError as why:
+      # Typically, fs.inotify.max_user_watches is exhausted.
+      Debug(DEBUG_WARNING,
+            "Could not watch '%s': %s. Falling back on stat reset triggers.",
+            dirpath, why)
+      self.failed = True
+      return None
+
+  def _Forget(self, wd):
+    """Drop the bookkeeping for wd; return the directory paths it watched."""
+    dirpaths = self.dirpaths.pop(wd, set())
+    self.symlinks.pop(wd, None)
+    for dirpath in dirpaths:
+      if self.wds.get(dirpath) == wd:
+        del self.wds[dirpath]
+    return dirpaths
+
+  def _Subdirectories(self, dirpath):
+    """The watch descriptors of the watched directories below dirpath.
+
+    Paths with '..' components may well lead out of dirpath; skip them."""
+    prefix = dirpath + '/'
+    return set([ wd for (path, wd) in self.wds.items()
+                 if path.startswith(prefix) and '/..' not in path ])
+
+  def _ReadEvents(self):
+    """Read all pending events as a list of (wd, mask, name) triples."""
+    events = []
+    while True:
+      try:
+        buf = os.read(self.fd, 65536)
+      except BlockingIOError:
+        return events
+      if not buf:
+        return events
+      offset = 0
+      while offset < len(buf):
+        (wd, mask, unused_cookie, length) = (
+          _EVENT_HEADER.unpack_from(buf, offset))
+        offset += _EVENT_HEADER.size
+        name = buf[offset:offset + length].split(b'\0', 1)[0]
+        offset += length
+        events.append((wd, mask, name and os.fsdecode(name) or None))
+
+  def Changes(self):
+    """Collect the changes reported since the previous call.
+
+    Returns:
+      (changes, flush), where changes is a set of pairs (wd, name) meaning
+      that entry name of the directory watched by wd was created, removed,
+      renamed or written to, or -- if name is None -- that the directory
+      itself went away; and flush is True if the changes cannot be attributed
+      to directory entries: because the event queue overflowed or because a
+      symbolic link changed, which may change realpaths.
+    """
+    changes = set()
+    flush = False
+    for (wd, mask, name) in self._ReadEvents():
+      if mask & IN_Q_OVERFLOW:
+        flush = True
+        continue
+      if mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF):
+        changes.add((wd, None))
+        dirpaths = self._Forget(wd)
+        if mask & IN_MOVE_SELF:
+          self.libc.inotify_rm_watch(self.fd, wd)
+        # The directories below were moved, or removed, along with it.
+        for dirpath in dirpaths:
+          for sub_wd in self._Subdirectories(dirpath):
+            changes.add((sub_wd, None))
+            self._Forget(sub_wd)
+            self.libc.inotify_rm_watch(self.fd, sub_wd)
+        continue
+      if wd not in self.dirpaths or not name:
+        continue
+      changes.add((wd, name))
+      if mask & (IN_DELETE | IN_MOVED_FROM):
+        if name in self.symlinks[wd]:
+          flush = True
+        elif mask & IN_ISDIR:
+          for dirpath in list(self.dirpaths[wd]):
+            for sub_wd in self._Subdirectories(os.path.join(dirpath, name)):
+              changes.add((sub_wd, None))
+              self._Forget(sub_wd)
+              self.libc.inotify_rm_watch(self.fd, sub_wd)
+      elif mask & (IN_CREATE | IN_MOVED_TO):
+        for dirpath in self.dirpaths[wd]:
+          if os.path.islink(os.path.join(dirpath, name)):
+            flush = True
+          break
+    return (changes, flush)
+
+  def Directory(self, wd):
+    """A directory path watched through wd, or None."""
+    for dirpath in self.dirpaths.get(wd, ()):
+      return dirpath
+    return None
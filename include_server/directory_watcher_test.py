@@ -0,0 +1,80 @@
+#! /usr/bin/env python3
+
+# Copyright 2007 Google Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Tests for directory_watcher."""
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import directory_watcher
+
+
+class DirectoryWatcherTest(unittest.TestCase):
+
+  def setUp(self):
+    self.tmp = os.path.realpath(tempfile.mkdtemp())
+    try:
+      self.watcher = directory_watcher.DirectoryWatcher()
+    except OSError:
+      self.watcher = None  # no inotify here
+
+  def tearDown(self):
+    if self.watcher:
+      self.watcher.Close()
+    shutil.rmtree(self.tmp)
+
+  def test_Watch(self):
+    if not self.watcher: return
+    watcher = self.watcher
+    tmp = self.tmp
+    os.mkdir(tmp + '/a')
+    (wd_a, name) = watcher.Watch(tmp + '/a/x.h')
+    self.assertEqual(name, 'x.h')
+    # A missing directory is watched through its nearest existing ancestor.
+    (wd_tmp, name) = watcher.Watch(tmp + '/b/c/y.h')
+    self.assertEqual(name, 'b')
+    self.assertEqual(watcher.Directory(wd_tmp), tmp)
+    self.assertEqual(watcher.Watch(tmp + '/a/../z.h'), (wd_tmp, 'z.h'))
+    self.assertEqual(watcher.Changes(), (set(), False))
+
+    open(tmp + '/a/x.h', 'w').close()
+    os.mkdir(tmp + '/b')
+    self.assertEqual(watcher.Changes(),
+                     (set([(wd_a, 'x.h'), (wd_tmp, 'b')]), False))
+
+    # Removing a directory also reports the directory itself.
+    os.remove(tmp + '/a/x.h')
+    os.rmdir(tmp + '/a')
+    (changes, flush) = watcher.Changes()
+    self.assertFalse(flush)
+    self.assertTrue((wd_a, None) in changes)
+    self.assertTrue((wd_tmp, 'a') in changes)
+    self.assertEqual(watcher.Directory(wd_a), None)
+
+  def test_Symlinks(self):
+    if not self.watcher: return
+    watcher = self.watcher
+    tmp = self.tmp
+    watcher.Watch(tmp + '/x.h')
+    os.symlink(tmp, tmp + '/link')
+    self.assertEqual(watcher.Changes()[1], True)
+
+unittest.main()
@@ -25,8 +25,11 @@ include analyzer.
 
 __author__ = "Nils Klarlund"
 
+import collections
+import gc
 import os
 import glob
+import time
 
 import basics
 import macro_eval
@@ -36,12 +39,18 @@ import statistics
 import cache_basics
 import mirror_path
 import compress_files
+import directory_watcher
 import include_server
 
 Debug = basics.Debug
 DEBUG_TRACE = basics.DEBUG_TRACE
 NotCoveredError = basics.NotCoveredError
 
+# GCC uses foo.h.gch, when valid, in place of foo.h; its files begin with
+# the magic string.
+GCC_PCH_SUFFIX = ".gch"
+GCC_PCH_MAGIC = b"gpch"
+
 class IncludeAnalyzer(object):
   """The skeleton, including caches, of an include analyzer."""
 
@@ -88,6 +97,21 @@ class IncludeAnalyzer(object):
                                                        self.mirror_path)
     # A fast cache for avoiding calls into the mirror_path object.
     self.mirrored = set([])
+    # With --inotify, watch the directories that are examined, so that changes
+    # to them invalidate only the cache entries that depend on them.
+    self.directory_watcher = None
+    if self.use_directory_watcher:
+      try:
+        self.directory_watcher = directory_watcher.DirectoryWatcher()
+      except OSError as why:
+        Debug(basics.DEBUG_WARNING,
+              "Could not use inotify: %s. Falling back on stat reset triggers.",
+              why)
+        self.use_directory_watcher = False
+    self.build_stat_cache.directory_watcher = self.directory_watcher
+    # The watch descriptors of the directories of stat reset trigger globs;
+    # the globs are evaluated again only when one of these changes.
+    self.trigger_wds = None
 
     # For statistics only. We measure the different search lists
     # (search paths) by accumulating them all in sets.
@@ -95,6 +119,13 @@ class IncludeAnalyzer(object):
     self.angle_dirs_set = set([]) # angle searchlists
     self.include_dir_pairs = set([]) # the pairs (quote search list,
                                      # angle search lists)
+    # Answers to commands analyzed ahead of their requests; see
+    # DoCompilationCommand.
+    self.prefetched = {}
+    # The precompiled headers examined, by absolute path, each mapped to a
+    # pair (stamp, realpath_idx), where realpath_idx is None if the file is
+    # not a GCC precompiled header.
+    self.precompiled_header_cache = {}
 
   def __init__(self, client_root_keeper, stat_reset_triggers={}):
     self.generation = 1
@@ -104,6 +135,11 @@ class IncludeAnalyzer(object):
     self.translation_unit = "unknown translation unit"
     self.timer = None
     self.include_server_cwd = os.getcwd()
+    self.use_directory_watcher = basics.opt_inotify
+    # The number of calls of InvalidateFiles that forgot something.
+    self.invalidation_counter = 0
+    # The (cmd, currdir) pairs still to be analyzed ahead of their requests.
+    self.prefetch_queue = collections.deque()
     self._InitializeAllCaches()
 
   def _ProcessFileFromCommandLine(self, fpath, currdir, kind, search_list):
@@ -142,8 +178,57 @@ class IncludeAnalyzer(object):
         self.client_root_keeper.client_root)
 
     closure = self.RunAlgorithm(fpath_resolved_pair, fpath_real)
+    if kind == "include file":
+      self._FindPrecompiledHeader(fpath_resolved_pair, currdir)
     return closure
 
+  def _FindPrecompiledHeader(self, fpath_resolved_pair, currdir):
+    """Note the GCC precompiled header of a "-include" file, if it has one.
+
+    GCC looks for foo.h.gch next to a forced include foo.h, and uses it if it
+    was made by the same compiler with compatible options. The compilation
+    server can do the same if the precompiled header is sent along; if not,
+    or if it is of no use there, the server falls back on foo.h, which is in
+    the include closure anyway. So the precompiled header is not part of the
+    closure, but is appended to self.precompiled_headers as a triple (path,
+    stamp, realpath_idx). It is stat'ed on every request, since a build
+    typically makes it anew.
+
+    Clang precompiled headers are not considered: they record the paths of
+    the headers they were made from, which differ on the server.
+    """
+    (searchdir_idx, includepath_idx) = fpath_resolved_pair
+    pch_path = os.path.join(currdir,
+                            self.directory_map.string[searchdir_idx]
+                            + self.includepath_map.string[includepath_idx]
+                            + GCC_PCH_SUFFIX)
+    stamp = basics.Stamp(pch_path)
+    if not stamp:
+      return
+    known = self.precompiled_header_cache.get(pch_path)
+    if known and known[0] == stamp:
+      realpath_idx = known[1]
+    else:
+      realpath_idx = None
+      try:
+        pch_file = open(pch_path, "rb")
+        try:
+          is_gcc_pch = pch_file.read(len(GCC_PCH_MAGIC)) == GCC_PCH_MAGIC
+        finally:
+          pch_file.close()
+      except (IOError, OSError):  # a directory of precompiled headers, say
+        is_gcc_pch = False
+      if is_gcc_pch:
+        realpath_idx = self.realpath_map.Index(
+            self.canonical_path.Canonicalize(pch_path))
+        # The precompiled header was made anew: compress it again.
+        self.compress_files.Forget(self.realpath_map.string[realpath_idx],
+                                   self.client_root_keeper.client_root)
+      self.precompiled_header_cache[pch_path] = (stamp, realpath_idx)
+    if realpath_idx:
+      Debug(DEBUG_TRACE, "Using precompiled header '%s'.", pch_path)
+      self.precompiled_headers.append((pch_path, stamp, realpath_idx))
+
   def ProcessCompilationCommand(self, currdir, parsed_command):
     """Do the include analysis for parsed_command.
 
@@ -179,6 +264,7 @@ class IncludeAnalyzer(object):
     statistics.quote_path_total += len(self.quote_dirs)
     statistics.angle_path_total += len(self.angle_dirs)
 
+    self.precompiled_headers = []
     total_closure = {}
     for include_file in self.include_files:
       total_closure.update(
@@ -232,8 +318,107 @@ class IncludeAnalyzer(object):
             path)
       self.ClearStatCaches()
 
-  def DoCompilationCommand(self, cmd, currdir, client_root_keeper):
-    """Parse and and process the command; then gather files and links."""
+  def _WatchStatResetTriggers(self):
+    """Watch the directories in which the trigger globs may match.
+
+    Returns:
+      the set of watch descriptors, or None if watching failed
+    """
+    watcher = self.directory_watcher
+    trigger_wds = set()
+    for glob_expr in self.stat_reset_triggers:
+      dirpath = os.path.dirname(os.path.abspath(glob_expr))
+      # A matching directory may still be created somewhere below the
+      # nearest existing ancestor of the glob's directory part.
+      for path in glob.glob(dirpath) + [dirpath]:
+        watched = watcher.Watch(path + '/')
+        if not watched:
+          return None
+        trigger_wds.add(watched[0])
+    return trigger_wds
+
+  def DoDirectoryWatcherEvents(self):
+    """Invalidate the cache entries that depend on changed directory entries.
+
+    Stat results are forgotten, and so are the parses and compressed images of
+    files that were written to; see InvalidateFiles for the rest.  If changes
+    cannot be attributed, or watching failed, then fall back on clearing all
+    stat caches.
+    """
+    watcher = self.directory_watcher
+    (changes, flush) = watcher.Changes()
+    if self.stat_reset_triggers and not flush:
+      if (self.trigger_wds is None
+          or [ wd for (wd, unused_name) in changes if wd in self.trigger_wds ]):
+        # Rewatch first: the matches of the globs may have moved.
+        self.trigger_wds = self._WatchStatResetTriggers()
+        generation = self.generation
+        self.DoStatResetTriggers()
+        if self.generation != generation:
+          return
+    if watcher.failed:
+      self.use_directory_watcher = False
+      # Prefetching is safe only while changes are tracked.
+      self.prefetch_queue.clear()
+      self.prefetched = {}
+      flush = True
+    if flush:
+      Debug(basics.DEBUG_WARNING,
+            "Directory changes could not be tracked. Clearing caches.")
+      self.ClearStatCaches()
+      return
+    includepath_idxs = set()
+    realpath_idxs = set()
+    realpath_index = self.realpath_map.index
+    for (wd, name) in changes:
+      includepath_idxs |= self.build_stat_cache.Invalidate(wd, name)
+      dirpath = watcher.Directory(wd)
+      if name and dirpath:
+        realpath_idx = realpath_index.get(
+          os.path.join(self.canonical_path.Canonicalize(dirpath), name))
+        if realpath_idx:
+          realpath_idxs.add(realpath_idx)
+    if includepath_idxs or realpath_idxs:
+      Debug(basics.DEBUG_TRACE,
+            "Directory changes: invalidating %d includepaths, %d files.",
+            len(includepath_idxs), len(realpath_idxs))
+      self.InvalidateFiles(includepath_idxs, realpath_idxs)
+
+  def WatchFile(self, realpath_idx):
+    """Watch the directory of a file whose contents are cached."""
+    self.directory_watcher.Watch(self.realpath_map.string[realpath_idx])
+
+  def InvalidateFiles(self, includepath_idxs, realpath_idxs):
+    """Forget what was derived from changed files.
+
+    Arguments:
+      includepath_idxs: includepath indices whose resolution may have changed
+      realpath_idxs: realpath indices of files that were written, created, or
+        removed
+
+    To be extended by derived classes that cache results depending on these.
+    """
+    # What is dropped from the caches may be frozen; see FreezeCaches.
+    if hasattr(gc, 'unfreeze'):
+      gc.unfreeze()
+    if includepath_idxs or realpath_idxs:
+      self.invalidation_counter += 1
+    client_root = self.client_root_keeper.client_root
+    for realpath_idx in realpath_idxs:
+      self.file_cache.pop(realpath_idx, None)
+      self.compress_files.Forget(self.realpath_map.string[realpath_idx],
+                                 client_root)
+
+  def DoCompilationCommand(self, cmd, currdir, client_root_keeper,
+                           prefetch=False):
+    """Parse and and process the command; then gather files and links.
+
+    If prefetch is true, the command has not been requested yet, but is
+    expected to be. The files and links are then also kept, so that the
+    request can be answered without analysis, provided that no cache has been
+    cleared or invalidated since and that the translation unit has the same
+    stamp. Returns None if the command was prefetched or requested already.
+    """
 
     self.translation_unit = "unknown translation unit"  # don't know yet
 
@@ -241,12 +426,16 @@ class IncludeAnalyzer(object):
     # must be evaluated relative to the include server's original working
     # directory.
     os.chdir(self.include_server_cwd)
-    self.DoStatResetTriggers()
+    if self.directory_watcher:
+      self.DoDirectoryWatcherEvents()
+    else:
+      self.DoStatResetTriggers()
 
     # Now change to the distcc client's working directory.
     # That'll let us use os.path.join etc without including currdir explicitly.
     os.chdir(currdir)
 
+    start_time = time.perf_counter()
     parsed_command = (
         parse_command.ParseCommandArgs(cmd,
                                        currdir,
@@ -254,8 +443,42 @@ class IncludeAnalyzer(object):
                                        self.directory_map,
                                        self.compiler_defaults,
                                        self.timer))
-    (unused_quote_dirs, unused_angle_dirs, unused_include_files, source_file,
-     result_file_prefix, unused_Dopts) = parsed_command
+    statistics.AddPhaseTime('command', time.perf_counter() - start_time)
+    (quote_dirs, angle_dirs, include_files, source_file,
+     result_file_prefix, Dopts) = parsed_command
+
+    # Prefetched answers are found by the parsed command, so that it does not
+    # matter how the distcc client rewrote the argv or where the output goes.
+    prefetch_key = (currdir, quote_dirs, angle_dirs, include_files,
+                    source_file, tuple([ tuple(d_opt) for d_opt in Dopts ]))
+    source_stamp = basics.Stamp(source_file)
+    if prefetch:
+      if (prefetch_key in self.prefetched
+          or basics.opt_verify or basics.opt_write_include_closure):
+        return None
+    elif prefetch_key in self.prefetched:
+      prefetched = self.prefetched.pop(prefetch_key)
+      if prefetched:
+        (stamp, precompiled_headers, files_and_links) = prefetched
+        if (stamp == (self.generation, self.invalidation_counter,
+                      source_stamp)
+            and all([ basics.Stamp(pch_path) == pch_stamp
+                      for (pch_path, pch_stamp, _) in precompiled_headers ])):
+          statistics.prefetch_hit_counter += 1
+          statistics.translation_unit = source_file
+          self.translation_unit = source_file
+          return files_and_links
+        statistics.prefetch_stale_counter += 1
+        Debug(DEBUG_TRACE, "Prefetched answer for '%s' is out of date.",
+              source_file)
+        if stamp[2] != source_stamp and not self.directory_watcher:
+          # The translation unit changed after it was analyzed, and what was
+          # derived from it cannot be told apart.
+          Debug(basics.DEBUG_WARNING,
+                "Path '%s' changed. Clearing caches.", source_file)
+          self.ClearStatCaches()
+          return self.DoCompilationCommand(cmd, currdir, client_root_keeper)
+    stamp = (self.generation, self.invalidation_counter, source_stamp)
 
     # Do the real work.
     include_closure = (
@@ -271,8 +494,14 @@ class IncludeAnalyzer(object):
     # handful. We add put the system links first, because there should be very
     # few of them.
     links = self.compiler_defaults.system_links + self.mirror_path.Links()
-    files = self.compress_files.Compress(include_closure, client_root_keeper,
-                                         self.currdir_idx)
+    # Compression threads do the I/O while the rest of the reply is put
+    # together; see the Wait below.
+    start_time = time.perf_counter()
+    precompiled_headers = self.precompiled_headers
+    files = self.compress_files.Start(
+        include_closure, client_root_keeper, self.currdir_idx,
+        [ realpath_idx for (_, _, realpath_idx) in precompiled_headers ])
+    statistics.AddPhaseTime('compress', time.perf_counter() - start_time)
 
     files_and_links = files + links
 
@@ -302,6 +531,15 @@ class IncludeAnalyzer(object):
       include_server.WriteDependencies(include_closure,
                         self.result_file_prefix + '.d_approx',
                         realpath_map)
+    start_time = time.perf_counter()
+    self.compress_files.Wait()
+    statistics.AddPhaseTime('compress', time.perf_counter() - start_time)
+    if prefetch:
+      self.prefetched[prefetch_key] = (stamp, precompiled_headers,
+                                       files_and_links)
+    elif self.prefetch_queue:
+      # Do not prefetch what was requested already.
+      self.prefetched[prefetch_key] = None
     return files_and_links
 
   def _ForceDirectoriesToExist(self):
@@ -398,8 +636,23 @@ class IncludeAnalyzer(object):
 
     raise Exception("RunAlgorithm not implemented.")
 
+  def FreezeCaches(self):
+    """Exempt the objects now in the caches from garbage collection.
+
+    The caches mostly grow from one request to the next; without this, the
+    garbage collector would traverse all of them again and again.  Cyclic
+    garbage left by the last request is collected first, so that only live
+    objects are frozen.  ClearStatCaches and InvalidateFiles make the frozen
+    objects collectable again.
+    """
+    if hasattr(gc, 'freeze'):  # Python 3.7 or later
+      gc.collect()
+      gc.freeze()
+
   def ClearStatCaches(self):
     """Clear caches used for, or dependent on, stats."""
+    if hasattr(gc, 'unfreeze'):
+      gc.unfreeze()
     self.generation += 1
     # Tabula rasa: for this analysis, we must forget everything recorded in the
     # client_root directory about source files, directories, and symbolic links.
@@ -407,4 +660,11 @@ class IncludeAnalyzer(object):
     # clients that have received earlier include manifests perhaps only now get
     # around to reading a previous generation client root directory.
     self.client_root_keeper.ClientRootMakedir(self.generation)
+    # Compressed images that the last generation did not use are not likely
+    # to be used again.
+    if self.client_root_keeper.image_store:
+      self.compress_files.PruneImageStore(
+          self.client_root_keeper.image_store)
+    if self.directory_watcher:
+      self.directory_watcher.Close()
     self._InitializeAllCaches()
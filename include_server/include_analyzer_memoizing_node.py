@@ -25,6 +25,7 @@ __author__ = "Nils Klarlund"
 # introduced to verify soundness of node reutilization in FindNode.
 
 import os
+import time
 
 import basics
 import macro_eval
@@ -56,18 +57,27 @@ class UnionCache(object):
 
   Frozensets are Python's immutable and hashable sets. We hash them into set
   ids, which are integers. That allows us to cache union operations efficiently.
+
+  There is a union operation for almost every edge of every summary graph, and
+  nearly all of them involve the empty set or two equal sets. Those are
+  answered without consulting, or growing, the cache.
   """
 
+  # The set id of the empty set, which is made first.
+  EMPTY_ID = 1
+
   def __init__(self):
     """Constructor:
     Instance variables:
       members: members[set_id] = frozenset([s1,..., sn]), the members of the set
-      cache: cache[(set1_id, set2_id)] = the id of the union of set1 and set2
+      cache: cache[(set1_id, set2_id)] = the id of the union of set1 and set2,
+        where set1_id < set2_id
       id_map: the set of frozen sets we have seen mapped to {1, 2, ..}
     """
-    self.members = {}
+    self.members = [None]
     self.cache = {}
     self.id_map = {}
+    self.SetId(())
 
   def SetId(self, members):
     """Memoize the frozenset of members and return set id."""
@@ -75,9 +85,9 @@ class UnionCache(object):
     try:
       return self.id_map[frozen]
     except KeyError:
-      self.id_map[frozen] = len(self.id_map) + 1
-    self.members[len(self.id_map)] = frozen
-    return len(self.id_map)
+      set_id = self.id_map[frozen] = len(self.members)
+      self.members.append(frozen)
+      return set_id
 
   def Elements(self, set_id):
     """The frozenset corresponding to a set id."""
@@ -85,6 +95,13 @@ class UnionCache(object):
 
   def Union(self, set1_id, set2_id):
     """Return the set id of the union of sets represented by set ids."""
+    if set1_id == set2_id or set2_id == self.EMPTY_ID:
+      return set1_id
+    if set1_id == self.EMPTY_ID:
+      return set2_id
+    # Union is commutative, so only one order needs to be remembered.
+    if set1_id > set2_id:
+      set1_id, set2_id = set2_id, set1_id
     try:
       return self.cache[(set1_id, set2_id)]
     except KeyError:
@@ -103,8 +120,13 @@ class SupportRecord(object):
   initially deemed valid. If a symbol is redefined, then it becomes invalid.
   For efficiency, the valid field is sometimes explicitly handled by a user of
   this object.
+
+  There is a support record for every node of every summary graph, so it has
+  no instance dictionary.
   """
 
+  __slots__ = ('support_master', 'valid', 'union_cache', 'support_id')
+
   def __init__(self, support_master):
     """Constructor.
     Argument:
@@ -121,7 +143,7 @@ class SupportRecord(object):
     self.support_master = support_master
     self.valid = True
     self.union_cache = support_master.union_cache
-    self.support_id = self.union_cache.SetId([])
+    self.support_id = UnionCache.EMPTY_ID
 
   def Update(self, set_id):
     """Augment the support record with the set represented by set_id.
@@ -276,6 +298,11 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
     # Enable the mechanism that invalidates all support records that contain a
     # symbol that is being defined or redefined.
     self.parse_file.SetDefineCallback(self.support_master.InvalidateRecords)
+    # With a directory watcher, remember which include configurations have
+    # summary graphs depending on the resolution of an includepath index, or
+    # on the contents of a realpath index.
+    self.includepath_configs = {}
+    self.realpath_configs = {}
 
   def __init__(self, client_root_keeper, stat_reset_triggers={}):
     """Constructor."""
@@ -291,6 +318,24 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
     # Then, clear own caches.
     self._InitializeAllCachesMemoizing()
 
+  def InvalidateFiles(self, includepath_idxs, realpath_idxs):
+    """Drop the summary graphs that depend on changed files.
+
+    A node is shared by all nodes that include it, so a changed node cannot be
+    replaced on its own. Instead, the summary graph of every include
+    configuration that resolved one of includepath_idxs or read one of
+    realpath_idxs is built anew; the others stay.
+    """
+    include_analyzer.IncludeAnalyzer.InvalidateFiles(self, includepath_idxs,
+                                                     realpath_idxs)
+    incl_configs = set()
+    for includepath_idx in includepath_idxs:
+      incl_configs |= self.includepath_configs.pop(includepath_idx, set())
+    for realpath_idx in realpath_idxs:
+      incl_configs |= self.realpath_configs.pop(realpath_idx, set())
+    for incl_config in incl_configs:
+      self.master_cache.pop(incl_config, None)
+
   def _PrintableFilePath(self, fp):
     return (isinstance(fp, int) and self.includepath_map.String(fp)
             or isinstance(fp, tuple) and
@@ -300,7 +345,8 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
 
   def RunAlgorithm(self, filepath_resolved_pair, filepath_real_idx):
     """See RunAlgorithm of class IncludeAnalyzer in include_analyzer."""
-    incl_config = (self.currdir_idx, self.quote_dirs, self.angle_dirs)
+    incl_config = self.incl_config = (
+      self.currdir_idx, self.quote_dirs, self.angle_dirs)
     try:
       nodes_for_incl_config = self.master_cache[incl_config]
     except KeyError:
@@ -318,15 +364,24 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
         # Assume this is a syntax error of some sort.
         pass
 
-    # Construct or find the node for filepath_resolved.
+    # Construct or find the node for filepath_resolved.  The time spent parsing
+    # files along the way is accounted separately.
+    start_time = time.perf_counter()
+    parse_time = statistics.request_phase_time['parse']
     node = self.FindNode(nodes_for_incl_config,
                          filepath_resolved_pair,
                          RESOLVED,
                          None,
                          filepath_real_idx)
+    closure_time = time.perf_counter()
+    statistics.AddPhaseTime('resolve',
+                            closure_time - start_time
+                            - (statistics.request_phase_time['parse']
+                               - parse_time))
     # Find the nodes reachable from node and represent as an include closure.
     include_closure = {}
     self._CalculateIncludeClosureExceptSystem(node, include_closure)
+    statistics.AddPhaseTime('closure', time.perf_counter() - closure_time)
     return include_closure
 
   def FindNode(self,
@@ -434,6 +489,10 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
         assert fp_real_idx  # this is the realpath corresponding to fp
         assert self.IsFilepathPair(fp)
         fp_resolved_pair = fp  # we are given the resolvant
+      if self.directory_watcher:
+        self.includepath_configs.setdefault(
+          resolution_mode == RESOLVED and fp[1] or fp,
+          set()).add(self.incl_config)
 
     if fp_resolved_pair:
        # The resolution succeeded. Before recursing, make sure to
@@ -498,6 +557,7 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
           self.dirname_cache.cache[(currdir_idx,
                                     searchdir_idx,
                                     includepath_idx)])
+      statistics.dirname_hit_counter += 1
     except KeyError:
       (fp_dirname_idx, fp_dirname_real_idx) = (
           self.dirname_cache.Lookup(currdir_idx,
@@ -524,11 +584,18 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
     # time to set it.
     support_record.valid = True
 
+    if self.directory_watcher:
+      self.realpath_configs.setdefault(fp_real_idx,
+                                       set()).add(self.incl_config)
     # Try to get the cached result of parsing file.
     try:
       (quote_includes, angle_includes, expr_includes, next_includes) = (
         self.file_cache[fp_real_idx])
+      statistics.parse_cache_hit_counter += 1
     except KeyError:
+      statistics.parse_cache_miss_counter += 1
+      if self.directory_watcher:
+        self.WatchFile(fp_real_idx)
       # Parse the file.
       self.file_cache[fp_real_idx] = self.parse_file.Parse(
          self.realpath_map.string[fp_real_idx],
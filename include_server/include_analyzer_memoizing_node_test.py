@@ -229,6 +229,25 @@ class IncludeAnalyzerMemoizingNodeUnitTest(unittest.TestCase):
     # provoke pairs (directory_idx, includepath_idx) to exist in
     # include_closure[rp_idx].
 
+  def test_UnionCache(self):
+    union_cache = include_analyzer_memoizing_node.UnionCache()
+    empty_id = include_analyzer_memoizing_node.UnionCache.EMPTY_ID
+    self.assertEqual(union_cache.SetId([]), empty_id)
+    self.assertEqual(union_cache.Elements(empty_id), frozenset())
+    a_id = union_cache.SetId(["a"])
+    b_id = union_cache.SetId(["b", "b"])
+    self.assertEqual(union_cache.SetId(("a",)), a_id)
+    # Unions with the empty set, or of a set with itself, are not cached.
+    self.assertEqual(union_cache.Union(a_id, empty_id), a_id)
+    self.assertEqual(union_cache.Union(empty_id, b_id), b_id)
+    self.assertEqual(union_cache.Union(a_id, a_id), a_id)
+    self.assertEqual(union_cache.cache, {})
+    ab_id = union_cache.Union(b_id, a_id)
+    self.assertEqual(union_cache.Elements(ab_id), frozenset(["a", "b"]))
+    self.assertEqual(union_cache.Union(a_id, b_id), ab_id)
+    self.assertEqual(len(union_cache.cache), 1)
+    self.assertEqual(union_cache.SetId(["b", "a"]), ab_id)
+
   def tearDown(self):
     pass
 
@@ -25,6 +25,7 @@ __author__ = "Nils Klarlund"
 import os
 import re
 import glob
+import hashlib
 import shutil
 import tempfile
 import unittest
@@ -361,6 +362,230 @@ class IncludeAnalyzerTest(unittest.TestCase):
       cache_basics._OsPathIsFile = real_cache_basic_OsPathIsFile
 
 
+  def test_DirectoryWatcher(self):
+    """Check that with --inotify, headers that come into existence, are
+    rewritten, or go away are picked up without clearing all caches, and
+    without discarding the summary graphs of unaffected include
+    configurations."""
+
+    opt_inotify = basics.opt_inotify
+    cwd = os.getcwd()
+    tmp_dir = os.path.realpath(tempfile.mkdtemp())
+    try:
+      basics.opt_inotify = True
+      include_analyzer = (
+        include_analyzer_memoizing_node.IncludeAnalyzerMemoizingNode(
+          basics.ClientRootKeeper()))
+      if not include_analyzer.directory_watcher:
+        return  # no inotify here
+      src_dir = tmp_dir + '/src'
+      gen_dir = tmp_dir + '/gen'  # does not exist yet
+      os.mkdir(src_dir)
+      def Write(path, contents):
+        f = open(path, 'w')
+        f.write(contents)
+        f.close()
+      Write(src_dir + '/foo.c', '#include "gen.h"\n')
+      Write(src_dir + '/bar.c', '#include <stdio.h>\n')
+
+      def Closure(filename, searchdir):
+        files_and_links = include_analyzer.DoCompilationCommand(
+          ["gcc", "-I" + searchdir, "-c", filename],
+          src_dir,
+          include_analyzer.client_root_keeper)
+        return sorted([ os.path.basename(f).split('.lzo')[0]
+                        for f in files_and_links if '.lzo' in f ])
+
+      self.assertEqual(Closure('bar.c', tmp_dir), ['bar.c'])
+      bar_configs = set(include_analyzer.master_cache)
+      self.assertEqual(Closure('foo.c', gen_dir), ['foo.c'])
+
+      os.mkdir(gen_dir)
+      Write(gen_dir + '/gen.h', '#include "more.h"\n')
+      self.assertEqual(Closure('foo.c', gen_dir), ['foo.c', 'gen.h'])
+      Write(gen_dir + '/more.h', '\n')
+      self.assertEqual(Closure('foo.c', gen_dir),
+                       ['foo.c', 'gen.h', 'more.h'])
+      Write(gen_dir + '/gen.h', '\n')
+      self.assertEqual(Closure('foo.c', gen_dir), ['foo.c', 'gen.h'])
+      os.remove(gen_dir + '/gen.h')
+      self.assertEqual(Closure('foo.c', gen_dir), ['foo.c'])
+
+      self.assertTrue(bar_configs <= set(include_analyzer.master_cache))
+      self.assertEqual(include_analyzer.generation, 1)
+
+      # A symbolic link may change realpaths: start over.
+      os.symlink(gen_dir, src_dir + '/link')
+      self.assertEqual(Closure('foo.c', gen_dir), ['foo.c'])
+      self.assertEqual(include_analyzer.generation, 2)
+      include_analyzer.directory_watcher.Close()
+    finally:
+      basics.opt_inotify = opt_inotify
+      os.chdir(cwd)
+      shutil.rmtree(tmp_dir)
+
+  def test_CompressedImagesAreShared(self):
+    """Check that the files of a closure are in place when the reply is
+    returned, that clearing caches does not cause files to be compressed
+    anew, and that superseded images are pruned."""
+
+    cwd = os.getcwd()
+    tmp_dir = os.path.realpath(tempfile.mkdtemp())
+    try:
+      for name in ['foo.c', 'foo.h', 'bar.h']:
+        f = open(os.path.join(tmp_dir, name), 'w')
+        f.write('#include "%s"\n' % {'foo.c': 'foo.h', 'foo.h': 'bar.h',
+                                       'bar.h': 'foo.h'}[name])
+        f.close()
+
+      def Files():
+        files_and_links = self.include_analyzer.DoCompilationCommand(
+          ["gcc", "-c", "foo.c"], tmp_dir,
+          self.include_analyzer.client_root_keeper)
+        return dict([ (os.path.basename(f), os.stat(f))
+                      for f in files_and_links if f.endswith('.lzo') ])
+
+      files_1 = Files()
+      self.assertEqual(sorted(files_1), ['bar.h.lzo', 'foo.c.lzo', 'foo.h.lzo'])
+      for name in files_1:
+        self.assertTrue(files_1[name].st_size > 0)
+      self.include_analyzer.ClearStatCaches()
+      files_2 = Files()
+      for name in files_1:
+        self.assertEqual(files_1[name].st_ino, files_2[name].st_ino)
+
+      # The image of a header that changed is removed from the store once a
+      # generation has passed without it.
+      image_store = self.include_analyzer.client_root_keeper.image_store
+      self.assertEqual(len(os.listdir(image_store)), 2)  # foo.c is as bar.h
+      f = open(os.path.join(tmp_dir, 'foo.h'), 'w')
+      f.write('#include "bar.h"\n/* changed */\n')
+      f.close()
+      self.include_analyzer.ClearStatCaches()
+      files_3 = Files()
+      self.assertNotEqual(files_2['foo.h.lzo'].st_ino,
+                          files_3['foo.h.lzo'].st_ino)
+      self.assertEqual(len(os.listdir(image_store)), 3)
+      self.include_analyzer.ClearStatCaches()
+      Files()
+      self.assertEqual(len(os.listdir(image_store)), 2)
+    finally:
+      os.chdir(cwd)
+      shutil.rmtree(tmp_dir)
+
+  def test_Prefetch(self):
+    """Check that a prefetched answer is used for the same compilation, and
+    that it is not used after the translation unit or the caches changed."""
+
+    cwd = os.getcwd()
+    tmp_dir = os.path.realpath(tempfile.mkdtemp())
+    include_analyzer = self.include_analyzer
+    try:
+      def Write(name, contents):
+        f = open(os.path.join(tmp_dir, name), 'w')
+        f.write(contents)
+        f.close()
+      Write('foo.c', '#include "foo.h"\n')
+      Write('foo.h', '\n')
+      Write('bar.h', '\n')
+
+      def Files(output, prefetch=False):
+        return include_analyzer.DoCompilationCommand(
+          ["gcc", "-DX=1", "-c", "foo.c", "-o", output], tmp_dir,
+          include_analyzer.client_root_keeper, prefetch)
+
+      def Names(files_and_links):
+        return sorted([ os.path.basename(f) for f in files_and_links
+                        if f.endswith('.lzo') ])
+
+      hits = statistics.prefetch_hit_counter
+      stale = statistics.prefetch_stale_counter
+      prefetched = Files('a.o', prefetch=True)
+      self.assertEqual(Names(prefetched), ['foo.c.lzo', 'foo.h.lzo'])
+      # Prefetching the same compilation again does nothing.
+      self.assertEqual(Files('a.o', prefetch=True), None)
+      # The output file does not matter.
+      self.assertTrue(Files('b.o') is prefetched)
+      self.assertEqual(statistics.prefetch_hit_counter, hits + 1)
+      # The answer is used once only.
+      self.assertEqual(Names(Files('b.o')), ['foo.c.lzo', 'foo.h.lzo'])
+      self.assertEqual(statistics.prefetch_hit_counter, hits + 1)
+
+      # The translation unit changes after it was prefetched.
+      Files('a.o', prefetch=True)
+      Write('foo.c', '#include "bar.h"\n')
+      os.utime(os.path.join(tmp_dir, 'foo.c'), (1, 1))
+      self.assertEqual(Names(Files('a.o')), ['bar.h.lzo', 'foo.c.lzo'])
+      self.assertEqual(statistics.prefetch_stale_counter, stale + 1)
+
+      # The caches are cleared after it was prefetched.
+      Files('a.o', prefetch=True)
+      include_analyzer.ClearStatCaches()
+      self.assertEqual(Names(Files('a.o')), ['bar.h.lzo', 'foo.c.lzo'])
+      self.assertEqual(statistics.prefetch_hit_counter, hits + 1)
+
+      # What was requested already is not prefetched while prefetching.
+      include_analyzer.prefetch_queue.append((["gcc", "-c", "foo.c"], tmp_dir))
+      Files('a.o')
+      self.assertEqual(Files('a.o', prefetch=True), None)
+    finally:
+      os.chdir(cwd)
+      shutil.rmtree(tmp_dir)
+
+  def test_PrecompiledHeader(self):
+    """Check that the GCC precompiled header of a -include file is sent along,
+    with the MD5 digest of its contents, and that other files are not."""
+
+    cwd = os.getcwd()
+    tmp_dir = os.path.realpath(tempfile.mkdtemp())
+    include_analyzer = self.include_analyzer
+    try:
+      def Write(name, contents):
+        f = open(os.path.join(tmp_dir, name), 'wb')
+        f.write(contents)
+        f.close()
+      Write('foo.c', b'int x;\n')
+      Write('pch.h', b'\n')
+      Write('other.h', b'\n')
+      Write('pch.h.gch', b'gpchC014 and so on')
+      Write('other.h.gch', b'CPCH from clang')
+
+      def Files(*include_files):
+        cmd = ["gcc", "-c", "foo.c"]
+        for include_file in include_files:
+          cmd += ["-include", include_file]
+        return include_analyzer.DoCompilationCommand(
+          cmd, tmp_dir, include_analyzer.client_root_keeper)
+
+      def PchImages(files_and_links):
+        return [ f for f in files_and_links if f.endswith('.gch.lzo') ]
+
+      self.assertEqual(PchImages(Files()), [])
+      self.assertEqual(PchImages(Files('other.h')), [])
+      images = PchImages(Files('pch.h', 'other.h'))
+      self.assertEqual([ os.path.basename(f) for f in images ],
+                       ['pch.h.gch.lzo'])
+      md5_file = open(images[0] + '.md5')
+      self.assertEqual(md5_file.read(),
+                       hashlib.md5(b'gpchC014 and so on').hexdigest())
+      md5_file.close()
+
+      # The precompiled header is made anew.
+      Write('pch.h.gch', b'gpchC014 and so forth')
+      os.utime(os.path.join(tmp_dir, 'pch.h.gch'), (1, 1))
+      images = PchImages(Files('pch.h'))
+      md5_file = open(images[0] + '.md5')
+      self.assertEqual(md5_file.read(),
+                       hashlib.md5(b'gpchC014 and so forth').hexdigest())
+      md5_file.close()
+
+      # And removed.
+      os.unlink(os.path.join(tmp_dir, 'pch.h.gch'))
+      self.assertEqual(PchImages(Files('pch.h')), [])
+    finally:
+      os.chdir(cwd)
+      shutil.rmtree(tmp_dir)
+
   def test_DotdotInInclude(self):
     """Set up tricky situation involving an "#include "../foo" occurring in a
     file accessed through a symbolic link.  This include is to be resolved
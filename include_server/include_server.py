@@ -28,13 +28,18 @@ __author__ = "Nils Klarlund"
 import gc
 import getopt
 import glob
+import json
 import os
 import re
+import select
+import shlex
 import shutil
 import signal
+import socket
 import socketserver
 import sys
 import tempfile
+import time
 import traceback
 
 # Include server imports
@@ -49,6 +54,12 @@ import statistics
 # buffered better before connections begin being refused. See also listen(2).
 REQUEST_QUEUE_SIZE = 4096
 
+# A request whose argv starts with CONTROL_COMMAND is not a compilation but a
+# question to the include server itself. The only question so far is
+# [CONTROL_COMMAND, "stats"], which is answered by an argv holding a single
+# string: the telemetry of statistics.Telemetry as JSON.
+CONTROL_COMMAND = "__distcc_include_server_control__"
+
 Debug = basics.Debug
 DEBUG_TRACE = basics.DEBUG_TRACE
 DEBUG_WARNING = basics.DEBUG_WARNING
@@ -73,6 +84,9 @@ server has been spawned.
 
 OPTIONS:
 
+ --compression_threads=N     Compress the files of include closures in N
+                             threads. Default: 4.
+
  -dPAT, --debug_pattern=PAT  Bit vector for turning on warnings and debugging
                                1 = warnings
                                2 = trace some functions
@@ -84,6 +98,14 @@ OPTIONS:
  --email_bound NUMBER        Maximal number of emails to send (in addition to
                              a final email). Default: 3.
 
+ --inotify                   Watch the directories examined during include
+                             analysis with inotify. When entries in them are
+                             created, removed, or written to, forget only the
+                             cached results that depend on these entries.
+                             Globs of --stat_reset_triggers are then evaluated
+                             only when their directories change. Without
+                             inotify, this option has no effect.
+
  --no-email                  Do not send email.
 
  --path_observation_re=RE    Issue warning message whenever a filename is
@@ -96,6 +118,25 @@ OPTIONS:
  --pid_file FILEPATH         The pid of the include server is written to file
                              FILEPATH.
 
+ --prefetch=FILE             Analyze the compilation commands of FILE, a
+                             compilation database such as compile_commands.json,
+                             whenever no request is waiting, and keep the
+                             answers for when they are requested. Needs
+                             --inotify, so that headers generated later are
+                             noticed. With --workers, every worker does so.
+
+ --query_stats               Do not start an include server. Instead, ask the
+                             include server at INCLUDE_SERVER_PORT for its
+                             request latencies, cache hit rates, and closure
+                             sizes, and print them to stdout as JSON. With
+                             --workers, the answer comes from one worker only.
+
+ --send_prefetch=FILE        Do not start an include server. Instead, ask the
+                             include server at INCLUDE_SERVER_PORT to prefetch
+                             the compilation commands of FILE, as for
+                             --prefetch; it must run with --inotify. With
+                             --workers, only one worker does so.
+
  -s, --statistics            Print information to stdout about include analysis.
 
  --stat_reset_triggers=LIST  Flush stat caches when the timestamp of any
@@ -108,6 +149,11 @@ OPTIONS:
                              exceptions to distcc_pump's normal assumption that
                              source files are not modified during the build.
 
+ --stats_json=FILE           When the include server terminates, write its
+                             request latencies, cache hit rates, and closure
+                             sizes to FILE as JSON. With --workers, each worker
+                             writes to FILE.PID, where PID is its process id.
+
  -t, --time                  Print elapsed, user, and system time to stderr.
 
  --unsafe_absolute_includes  Do preprocessing on the compilation server even if
@@ -138,6 +184,12 @@ OPTIONS:
                              with -x, additionally write the included files
                              as calculated by CPP to a .d_exact file.
 
+ --workers=N                 Serve requests concurrently from N processes. Each
+                             of them keeps a full set of caches of its own, so
+                             memory use grows with N. --query_stats and
+                             --send_prefetch reach only one of them.
+                             Default: 1.
+
  -x, --exact_analysis        Use CPP instead, do not omit system headers files.
 """)
 
@@ -329,12 +381,123 @@ def VerifyExactDependencies(include_closure,
 class Queuingsocketserver(socketserver.UnixStreamServer):
   """A socket server whose request queue have size REQUEST_QUEUE_SIZE."""
   request_queue_size = REQUEST_QUEUE_SIZE
+  # The include analyzer of this process; see _SetUpAnalyzer.
+  include_analyzer = None
 
   def handle_error(self, _, client_address):
     """Re-raise current exception; overrides socketserver.handle_error.
     """
     raise
 
+  def service_actions(self):
+    """Prefetch queued compilation commands until a request comes in.
+
+    Called by serve_forever after each request, and whenever it has waited
+    for one in vain; overrides socketserver.BaseServer.service_actions.
+    """
+    include_analyzer = self.include_analyzer
+    while (include_analyzer and include_analyzer.prefetch_queue
+           and not select.select([self], [], [], 0)[0]):
+      (cmd, currdir) = include_analyzer.prefetch_queue.popleft()
+      _Prefetch(include_analyzer, cmd, currdir)
+
+
+# PREFETCHING
+
+# Compiler wrappers that may precede the compiler in a compilation database.
+COMPILER_WRAPPERS = ("distcc", "ccache", "pump")
+
+
+def ReadCompilationDatabase(filepath):
+  """Read the compilation commands of a compilation database.
+
+  The database is a JSON list of entries with a "directory", and either the
+  "arguments" of the command or its "command" line, as written by CMake with
+  CMAKE_EXPORT_COMPILE_COMMANDS, or by 'ninja -t compdb'.  Compiler wrappers
+  such as distcc are removed from the commands.
+
+  Returns:
+    a list of (cmd, currdir) pairs, where cmd is an argv list and currdir an
+    absolute filepath
+  Raises:
+    IOError, OSError: the file could not be read
+    ValueError: the file is not a compilation database
+  """
+  fd = open(filepath)
+  try:
+    entries = json.load(fd)
+  finally:
+    fd.close()
+  if not isinstance(entries, list):
+    raise ValueError("expected a list of compilation commands")
+  database_dir = os.path.dirname(os.path.abspath(filepath))
+  commands = []
+  for entry in entries:
+    try:
+      if "arguments" in entry:
+        cmd = list(entry["arguments"])
+      else:
+        cmd = shlex.split(entry["command"])
+      currdir = os.path.join(database_dir, entry["directory"])
+    except (KeyError, TypeError) as why:
+      raise ValueError("malformed compilation command: %s" % why)
+    while cmd and os.path.basename(cmd[0]) in COMPILER_WRAPPERS:
+      cmd = cmd[1:]
+    if cmd:
+      commands.append((cmd, os.path.normpath(currdir)))
+  return commands
+
+
+def QueuePrefetch(include_analyzer, filepath):
+  """Queue the commands of compilation database filepath for prefetching.
+
+  Prefetching needs --inotify. Without it, nothing would tell the answers
+  kept, or the stat cache entries of headers found missing, out of date
+  once the build generates headers, which it may well do after the
+  commands were analyzed.
+
+  Returns:
+    the number of commands queued, or None if filepath could not be read or
+    there is no directory watcher
+  """
+  if not include_analyzer.directory_watcher:
+    Debug(DEBUG_WARNING, "Not prefetching from '%s': needs --inotify.",
+          filepath)
+    return None
+  try:
+    commands = ReadCompilationDatabase(filepath)
+  except (IOError, OSError, ValueError) as why:
+    Debug(DEBUG_WARNING, "Not prefetching from '%s': %s", filepath, why)
+    return None
+  include_analyzer.prefetch_queue.extend(commands)
+  Debug(DEBUG_TRACE, "Queued %d commands of '%s' for prefetching.",
+        len(commands), filepath)
+  return len(commands)
+
+
+def _Prefetch(include_analyzer, cmd, currdir):
+  """Analyze a compilation command ahead of its request.
+
+  The answer is kept by include_analyzer; see DoCompilationCommand.  Commands
+  that are not covered are skipped: their requests will fail the same way.
+  """
+  start_time = time.perf_counter()
+  try:
+    include_analyzer.timer = basics.IncludeAnalyzerTimer()
+    try:
+      if include_analyzer.DoCompilationCommand(
+          cmd, currdir, include_analyzer.client_root_keeper, prefetch=True):
+        statistics.prefetch_counter += 1
+    finally:
+      include_analyzer.timer.Cancel()
+  except (NotCoveredError, OSError) as inst:
+    statistics.prefetch_failed_counter += 1
+    Debug(DEBUG_TRACE, "Not prefetching '%s': %s", " ".join(cmd),
+          inst.args and inst.args[-1] or "unknown reason")
+    if isinstance(inst, NotCoveredTimeOutError):
+      include_analyzer.ClearStatCaches()
+  statistics.prefetch_total_time += time.perf_counter() - start_time
+
 
 # HANDLER FOR SOCKETSERVER
 
@@ -360,10 +523,14 @@ def DistccIncludeHandlerGenerator(include_analyzer):
          which duplicates the part of the file system that CPP will need.
        - Transmit the file and link names on the socket using the RPC protocol.
       """
-      statistics.StartTiming()
       currdir = distcc_pump_c_extensions.RCwd(self.rfile.fileno())
       cmd = distcc_pump_c_extensions.RArgv(self.rfile.fileno())
+      if cmd and cmd[0] == CONTROL_COMMAND:
+        self.HandleControlCommand(cmd[1:])
+        return
 
+      statistics.StartTiming()
+      failed = False
       try:
         try:
           # We do timeout the include_analyzer using the crude mechanism of
@@ -397,6 +564,7 @@ def DistccIncludeHandlerGenerator(include_analyzer):
           include_analyzer.timer.Cancel()
 
       except NotCoveredError as inst:
+        failed = True
         # Warn user. The 'Preprocessing locally' message is meant to
         # assure the user that the build process is otherwise intact.
         fd = tempfile.TemporaryFile(mode='w+')
@@ -460,13 +628,95 @@ def DistccIncludeHandlerGenerator(include_analyzer):
          include_analyzer.build_stat_cache.WarnAboutPathObservations(
              include_analyzer.translation_unit)
       # Finally, stop the clock and report statistics if needed.
-      statistics.EndTiming()
+      statistics.EndTiming(include_analyzer.translation_unit, failed)
       if basics.opt_statistics:
         statistics.PrintStatistics(include_analyzer)
+      # The client has its answer already; tidy up for the next request.
+      include_analyzer.FreezeCaches()
+
+    def HandleControlCommand(self, args):
+      """Answer a request whose argv is CONTROL_COMMAND followed by args."""
+      if args == ["stats"]:
+        reply = [json.dumps(statistics.Telemetry(include_analyzer),
+                            sort_keys=True)]
+      elif len(args) == 2 and args[0] == "prefetch":
+        queued = QueuePrefetch(include_analyzer, args[1])
+        reply = queued is not None and [str(queued)] or []
+      else:
+        Debug(DEBUG_WARNING, "Unknown include server control command: %s",
+              args)
+        reply = []
+      distcc_pump_c_extensions.XArgv(self.wfile.fileno(), reply)
 
   return IncludeHandler
 
 
+def _SendControlCommand(include_server_port, args):
+  """Send CONTROL_COMMAND with args to the include server; return its answer.
+
+  Raises:
+    IOError, OSError: the include server could not be reached
+    ValueError: the include server gave no intelligible answer
+  """
+  sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+  try:
+    sock.connect(include_server_port)
+    # The current directory, as sent by dcc_x_cwd, is not used for control
+    # commands, but the include server expects it first.
+    currdir = os.getcwd().encode()
+    sock.sendall(b"CDIR%08x" % len(currdir) + currdir)
+    distcc_pump_c_extensions.XArgv(sock.fileno(), [CONTROL_COMMAND] + args)
+    reply = distcc_pump_c_extensions.RArgv(sock.fileno())
+  finally:
+    sock.close()
+  if len(reply) != 1:
+    raise ValueError("Include server did not answer %s." % args[0])
+  return reply[0]
+
+
+def QueryTelemetry(include_server_port):
+  """Ask the include server at include_server_port for its telemetry.
+
+  Returns:
+    the dictionary of statistics.Telemetry of the serving process
+  Raises:
+    as for _SendControlCommand
+  """
+  return json.loads(_SendControlCommand(include_server_port, ["stats"]))
+
+
+def SendPrefetch(include_server_port, filepath):
+  """Ask the include server to prefetch compilation database filepath.
+
+  Returns:
+    the number of compilation commands queued
+  Raises:
+    as for _SendControlCommand
+  """
+  return int(_SendControlCommand(include_server_port,
+                                 ["prefetch", os.path.abspath(filepath)]))
+
+
+def _WriteTelemetry(include_analyzer):
+  """Write the telemetry to the file of --stats_json, if given."""
+  if not basics.opt_stats_json:
+    return
+  filepath = basics.opt_stats_json
+  if basics.opt_workers > 1:
+    filepath = "%s.%d" % (filepath, os.getpid())
+  try:
+    fd = open(filepath, "w")
+    try:
+      json.dump(statistics.Telemetry(include_analyzer), fd, indent=1,
+                sort_keys=True)
+      fd.write("\n")
+    finally:
+      fd.close()
+  except (IOError, OSError) as why:
+    Debug(DEBUG_WARNING, "Could not write telemetry to '%s': %s",
+          filepath, why)
+
+
 def _ParseCommandLineOptions():
   """Parse arguments and options for the include server command.
 
@@ -481,13 +731,19 @@ def _ParseCommandLineOptions():
 			       "d:estvwx",
 			       ["port=",
                                 "pid_file=",
+                                "prefetch=",
+                                "query_stats",
+                                "send_prefetch=",
                                 "debug_pattern=",
                                 "email",
                                 "no-email",
                                 "email_bound=",
+                                "compression_threads=",
                                 "exact_analysis",
+                                "inotify",
                                 "path_observation_re=",
                                 "stat_reset_triggers=",
+                                "stats_json=",
                                 "simple_algorithm",
                                 "statistics",
                                 "time",
@@ -495,6 +751,7 @@ def _ParseCommandLineOptions():
                                 "unsafe_no_unexpanded_functions",
                                 "no_force_dirs",
                                 "verify",
+                                "workers=",
                                 "write_include_closure"])
   except getopt.GetoptError:
     # Print help information and exit.
@@ -510,12 +767,24 @@ def _ParseCommandLineOptions():
         include_server_port = arg
       if opt in ("--pid_file",):
         pid_file = arg
+      if opt in ("--prefetch",):
+        basics.opt_prefetch = os.path.abspath(arg)
+      if opt in ("--query_stats",):
+        basics.opt_query_stats = True
+      if opt in ("--send_prefetch",):
+        basics.opt_send_prefetch = arg
       if opt in ("-e", "--email"):
         basics.opt_send_email = True
       if opt in ("--no-email",):
         basics.opt_send_email = False
       if opt in ("--email_bound",):
         basics.opt_email_bound = int(arg)
+      if opt in ("--compression_threads",):
+        basics.opt_compression_threads = int(arg)
+        if basics.opt_compression_threads < 1:
+          raise ValueError
+      if opt in ("--inotify",):
+        basics.opt_inotify = True
       if opt in ("--path_observation_re",):
         basics.opt_path_observation_re = re.compile(arg)
       if opt in ("--stat_reset_triggers",):
@@ -524,6 +793,8 @@ def _ParseCommandLineOptions():
                   dict ([ (path, basics.Stamp(path))
                           for path in glob.glob(glob_expr) ]))
                  for glob_expr in arg.split(':') ]))
+      if opt in ("--stats_json",):
+        basics.opt_stats_json = os.path.abspath(arg)
       if opt in ("--simple_algorithm",):
         basics.opt_simple_algorithm = True
         sys.exit("Not implemented")
@@ -539,6 +810,10 @@ def _ParseCommandLineOptions():
         basics.opt_verify = True
       if opt in ("-w", "--write_include_closure"):
         basics.opt_write_include_closure = True
+      if opt in ("--workers",):
+        basics.opt_workers = int(arg)
+        if basics.opt_workers < 1:
+          raise ValueError
       if opt in ("-x", "--exact_analysis"):
         basics.opt_exact_include_analysis = True
       if opt in ("--unsafe_no_unexpanded_functions"):
@@ -595,10 +870,10 @@ class _IncludeServerPortReady(object):
       sys.exit("Include server: _IncludeServerPortReady.Release failed.")
 
 
-def _SetUp(include_server_port):
-  """Setup include_analyzer and socket server.
+def _SetUpServer(include_server_port):
+  """Clean out left-overs of earlier include servers and bind the socket.
 
-  Returns: (include_analyzer, server)"""
+  Returns: server, a socket server still without a request handler"""
 
   try:
     os.unlink(include_server_port)
@@ -608,44 +883,182 @@ def _SetUp(include_server_port):
   if os.sep != '/':
     sys.exit("Expected '/' as separator in filepaths.")
 
-  client_root_keeper = basics.ClientRootKeeper()
   # Clean out any junk left over from prior runs.
-  client_root_keeper.CleanOutOthers()
+  basics.ClientRootKeeper().CleanOutOthers()
 
   Debug(DEBUG_TRACE, "Starting socketserver %s" % include_server_port)
 
+  return Queuingsocketserver(include_server_port, None)
+
+
+def _SetUpAnalyzer(server):
+  """Create an include analyzer and let server's requests be handled by it.
+
+  This must be called in the process that is going to serve the requests,
+  because the process id is used in naming the client root. See
+  _CleanOutOthers for the importance of the process id.
+
+  Returns: include_analyzer"""
+
+  client_root_keeper = basics.ClientRootKeeper()
+
   # Create the analyser.
   include_analyzer = (
       include_analyzer_memoizing_node.IncludeAnalyzerMemoizingNode(
            client_root_keeper,
            basics.opt_stat_reset_triggers))
   include_analyzer.email_sender = _EmailSender()
+  if basics.opt_prefetch:
+    QueuePrefetch(include_analyzer, basics.opt_prefetch)
+  server.include_analyzer = include_analyzer
 
-  # Wrap it inside a handler that is a part of a UnixStreamServer.
-  server = Queuingsocketserver(
-    include_server_port,
-    # Now, produce a StreamRequestHandler subclass whose new objects has
-    # a handler which calls the include_analyzer just made.
-    DistccIncludeHandlerGenerator(include_analyzer))
+  # Now, produce a StreamRequestHandler subclass whose new objects has
+  # a handler which calls the include_analyzer just made.
+  server.RequestHandlerClass = DistccIncludeHandlerGenerator(include_analyzer)
 
-  return (include_analyzer, server)
+  return include_analyzer
+
+
+def _SetUp(include_server_port):
+  """Setup include_analyzer and socket server.
+
+  Returns: (include_analyzer, server)"""
+
+  server = _SetUpServer(include_server_port)
+  return (_SetUpAnalyzer(server), server)
 
 
 def _CleanOut(include_analyzer, include_server_port):
-  """Prepare shutdown by cleaning out files and unlinking port."""
+  """Prepare shutdown by writing telemetry, cleaning out files, and unlinking
+  port.
+
+  Arguments:
+    include_analyzer: an include analyzer or None
+    include_server_port: the socket to unlink, or None if other processes may
+      still be serving it
+  """
+  if include_analyzer:
+    _WriteTelemetry(include_analyzer)
   if include_analyzer and include_analyzer.client_root_keeper:
     include_analyzer.client_root_keeper.CleanOutClientRoots()
+  if not include_server_port:
+    return
   try:
     os.unlink(include_server_port)
   except OSError:
     pass
 
 
+def _Serve(include_analyzer, server, include_server_port):
+  """Handle requests until SIGTERM or a fatal error, then clean out.
+
+  Arguments:
+    include_analyzer, include_server_port: as for _CleanOut
+    server: a socket server whose requests are handled by include_analyzer
+  """
+  try:
+    gc.set_threshold(basics.GC_THRESHOLD)
+    # Use commented-out line below to have a message printed for each
+    # collection.
+    # gc.set_debug(gc.DEBUG_STATS + gc.DEBUG_COLLECTABLE)
+    server.serve_forever()
+  except KeyboardInterrupt:
+    print("Include server: keyboard interrupt, quitting after cleaning up.",
+        file=sys.stderr)
+    _CleanOut(include_analyzer, include_server_port)
+  except SignalSIGTERM:
+    Debug(DEBUG_TRACE, "Include server shutting down.")
+    _CleanOut(include_analyzer, include_server_port)
+  except:
+    print("Include server: exception occurred, quitting after cleaning up.",
+            file=sys.stderr)
+    _PrintStackTrace(sys.stderr)
+    _CleanOut(include_analyzer, include_server_port)
+    raise # reraise exception
+
+
+def _ServeWithWorkers(server, include_server_port):
+  """Fork basics.opt_workers processes that serve requests concurrently.
+
+  The workers all accept connections on the socket of server, which they
+  inherit from this process, so that the kernel hands each request to a worker
+  that is idle.  When all workers are busy, requests wait in the socket's
+  request queue, whose size is REQUEST_QUEUE_SIZE; beyond that, clients are
+  refused and preprocess locally.
+
+  Each worker has an include analyzer of its own.  The caches and memoized
+  results are therefore never shared and remain valid exactly as they would in
+  a single include server, at the cost of each worker filling them
+  separately.
+
+  This process only supervises the workers.  If one of them terminates, for
+  example after an internal error, all are terminated, just as a single
+  include server would terminate.
+  """
+  worker_pids = set()
+  try:
+    try:
+      for unused_i in range(basics.opt_workers):
+        pid = os.fork()
+        if pid == 0:
+          # In worker.
+          status = 1
+          try:
+            _Serve(_SetUpAnalyzer(server), server, None)
+            status = 0
+          finally:
+            # Never return into the code of the supervising process.
+            sys.stdout.flush()
+            sys.stderr.flush()
+            os._exit(status)
+        worker_pids.add(pid)
+      pid, unused_status = os.wait()
+      worker_pids.discard(pid)
+      Debug(DEBUG_WARNING, "Include server worker %d terminated; shutting down.",
+            pid)
+    except SignalSIGTERM:
+      Debug(DEBUG_TRACE, "Include server shutting down.")
+    except KeyboardInterrupt:
+      print("Include server: keyboard interrupt, quitting after cleaning up.",
+            file=sys.stderr)
+  finally:
+    signal.signal(signal.SIGTERM, signal.SIG_IGN)
+    for pid in worker_pids:
+      try:
+        os.kill(pid, signal.SIGTERM)
+      except OSError:
+        pass
+    for pid in worker_pids:
+      try:
+        os.waitpid(pid, 0)
+      except OSError:
+        pass
+    server.server_close()
+    _CleanOut(None, include_server_port)
+
+
 def Main():
   """Parse command line, fork, and start stream request handler."""
   # Remember the time spent in the parent.
   times_at_start = os.times()
   include_server_port, pid_file = _ParseCommandLineOptions()
+  if basics.opt_query_stats:
+    try:
+      telemetry = QueryTelemetry(include_server_port)
+    except (IOError, OSError, ValueError) as why:
+      sys.exit("Could not query include server at '%s': %s"
+               % (include_server_port, why))
+    print(json.dumps(telemetry, indent=1, sort_keys=True))
+    return
+  if basics.opt_send_prefetch:
+    try:
+      queued = SendPrefetch(include_server_port, basics.opt_send_prefetch)
+    except (IOError, OSError, ValueError) as why:
+      sys.exit("Could not send '%s' to include server at '%s': %s"
+               % (basics.opt_send_prefetch, include_server_port, why))
+    print("Include server queued %d compilation commands for prefetching."
+          % queued)
+    return
   # Get locking mechanism.
   include_server_port_ready = _IncludeServerPortReady()
   # Now spawn child so that parent can exit immediately after writing
@@ -668,28 +1081,16 @@ def Main():
     # We call _Setup only now, because the process id, used in naming the client
     # root, must be that of this process, not that of the parent process. See
     # _CleanOutOthers for the importance of the process id.
-    (include_analyzer, server) = _SetUp(include_server_port)
-    include_server_port_ready.Release()
+    if basics.opt_workers > 1:
+      server = _SetUpServer(include_server_port)
+      include_server_port_ready.Release()
+      serve = lambda: _ServeWithWorkers(server, include_server_port)
+    else:
+      (include_analyzer, server) = _SetUp(include_server_port)
+      include_server_port_ready.Release()
+      serve = lambda: _Serve(include_analyzer, server, include_server_port)
     try:
-      try:
-        gc.set_threshold(basics.GC_THRESHOLD)
-        # Use commented-out line below to have a message printed for each
-        # collection.
-        # gc.set_debug(gc.DEBUG_STATS + gc.DEBUG_COLLECTABLE)
-        server.serve_forever()
-      except KeyboardInterrupt:
-        print("Include server: keyboard interrupt, quitting after cleaning up.",
-            file=sys.stderr)
-        _CleanOut(include_analyzer, include_server_port)
-      except SignalSIGTERM:
-        Debug(DEBUG_TRACE, "Include server shutting down.")
-        _CleanOut(include_analyzer, include_server_port)
-      except:
-        print("Include server: exception occurred, quitting after cleaning up.",
-                file=sys.stderr)
-        _PrintStackTrace(sys.stderr)
-        _CleanOut(include_analyzer, include_server_port)
-        raise # reraise exception
+      serve()
     finally:
       if basics.opt_print_times:
         _PrintTimes(times_at_start, times_at_fork, os.times())
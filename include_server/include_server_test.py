@@ -25,8 +25,13 @@ ultimately the notion of an AssertionError.
 
 __author__ = "Nils Klarlund"
 
+import json
 import os
+import shutil
+import signal
+import socket
 import sys
+import tempfile
 import traceback
 import unittest
 
@@ -178,10 +183,157 @@ class IncludeServerTest(unittest.TestCase):
     except NotCoveredError:
       pass
 
-    distcc_pump_c_extensions.RWcd = old_RWcd
+    distcc_pump_c_extensions.RCwd = old_RWcd
     distcc_pump_c_extensions.RArgv = old_RArgv
     distcc_pump_c_extensions.XArgv = old_XArgv
     include_server.socketserver.StreamRequestHandler = (
       old_StreamRequestHandler)
 
+  def test_QueryTelemetry(self):
+    include_analyzer = (
+        include_analyzer_memoizing_node.
+            IncludeAnalyzerMemoizingNode(basics.ClientRootKeeper()))
+    socket_dir = tempfile.mkdtemp()
+    include_server_port = os.path.join(socket_dir, "socket")
+    server = include_server.Queuingsocketserver(
+      include_server_port,
+      include_server.DistccIncludeHandlerGenerator(include_analyzer))
+    try:
+      # Serve one request, the control command, in another process: the C
+      # extensions block without releasing the interpreter lock.
+      pid = os.fork()
+      if pid == 0:
+        try:
+          server.handle_request()
+        finally:
+          os._exit(0)
+      telemetry = include_server.QueryTelemetry(include_server_port)
+      os.waitpid(pid, 0)
+    finally:
+      server.server_close()
+      shutil.rmtree(socket_dir)
+      include_analyzer.client_root_keeper.CleanOutClientRoots()
+    self.assertEqual(telemetry['pid'], pid)
+    self.assertEqual(sorted(telemetry['caches']),
+                     ['build_stat', 'dirname', 'node', 'parse'])
+    self.assertEqual(sorted(telemetry['phases_ms']),
+                     sorted(statistics.PHASES))
+    # The control command is not counted as a request.
+    self.assertEqual(telemetry['requests'],
+                     statistics.translation_unit_counter)
+
+  def test_Prefetch(self):
+    # Without inotify, nothing is prefetched.
+    include_analyzer = (
+        include_analyzer_memoizing_node.
+            IncludeAnalyzerMemoizingNode(basics.ClientRootKeeper()))
+    self.assertEqual(
+      include_server.QueuePrefetch(include_analyzer, "/dev/null"), None)
+    opt_inotify = basics.opt_inotify
+    try:
+      basics.opt_inotify = True
+      include_analyzer = (
+          include_analyzer_memoizing_node.
+              IncludeAnalyzerMemoizingNode(basics.ClientRootKeeper()))
+    finally:
+      basics.opt_inotify = opt_inotify
+    if not include_analyzer.directory_watcher:
+      return  # no inotify here
+    cwd = os.getcwd()
+    tmp_dir = os.path.realpath(tempfile.mkdtemp())
+    include_server_port = os.path.join(tmp_dir, "socket")
+    server = include_server.Queuingsocketserver(
+      include_server_port,
+      include_server.DistccIncludeHandlerGenerator(include_analyzer))
+    try:
+      os.mkdir(os.path.join(tmp_dir, "src"))
+      for name in ["src/foo.c", "src/bar.c"]:
+        f = open(os.path.join(tmp_dir, name), "w")
+        f.write("int x;\n")
+        f.close()
+      database = os.path.join(tmp_dir, "compile_commands.json")
+      f = open(database, "w")
+      json.dump([{"directory": "src",
+                  "arguments": ["distcc", "gcc", "-c", "foo.c"],
+                  "file": "foo.c"},
+                 {"directory": os.path.join(tmp_dir, "src"),
+                  "command": "ccache gcc -c 'bar.c' -o bar.o",
+                  "file": "bar.c"}], f)
+      f.close()
+      src_dir = os.path.join(tmp_dir, "src")
+      self.assertEqual(include_server.ReadCompilationDatabase(database),
+                       [(["gcc", "-c", "foo.c"], src_dir),
+                        (["gcc", "-c", "bar.c", "-o", "bar.o"], src_dir)])
+
+      # Queue the commands, and let the server prefetch them while idle.
+      prefetched = statistics.prefetch_counter
+      hits = statistics.prefetch_hit_counter
+      server.include_analyzer = include_analyzer
+      self.assertEqual(
+        include_server.QueuePrefetch(include_analyzer, database), 2)
+      self.assertEqual(
+        include_server.QueuePrefetch(include_analyzer, tmp_dir), None)
+      server.service_actions()
+      self.assertEqual(len(include_analyzer.prefetch_queue), 0)
+      self.assertEqual(statistics.prefetch_counter, prefetched + 2)
+      include_analyzer.DoCompilationCommand(
+        ["gcc", "-c", "bar.c", "-o", "bar.o"], src_dir,
+        include_analyzer.client_root_keeper)
+      self.assertEqual(statistics.prefetch_hit_counter, hits + 1)
+
+      # The same through a control command, served in another process as
+      # in test_QueryTelemetry.
+      pid = os.fork()
+      if pid == 0:
+        try:
+          server.handle_request()
+        finally:
+          os._exit(0)
+      queued = include_server.SendPrefetch(include_server_port, database)
+      os.waitpid(pid, 0)
+      self.assertEqual(queued, 2)
+    finally:
+      os.chdir(cwd)
+      server.server_close()
+      shutil.rmtree(tmp_dir)
+      include_analyzer.client_root_keeper.CleanOutClientRoots()
+
+  def test_ServeWithWorkers(self):
+    socket_dir = tempfile.mkdtemp()
+    include_server_port = os.path.join(socket_dir, "socket")
+    server = include_server.Queuingsocketserver(include_server_port, None)
+    opt_workers = basics.opt_workers
+    basics.opt_workers = 2
+    supervisor = os.fork()
+    if supervisor == 0:
+      status = 1
+      try:
+        signal.signal(signal.SIGTERM, basics.RaiseSignalSIGTERM)
+        include_server._ServeWithWorkers(server, include_server_port)
+        status = 0
+      finally:
+        os._exit(status)
+    basics.opt_workers = opt_workers
+    server.server_close()
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+      # Keep one worker busy with a request that is not sent yet, so that the
+      # query must be answered by the other worker.
+      sock.connect(include_server_port)
+      first = include_server.QueryTelemetry(include_server_port)
+      currdir = os.getcwd().encode()
+      sock.sendall(b"CDIR%08x" % len(currdir) + currdir)
+      distcc_pump_c_extensions.XArgv(sock.fileno(),
+                                     [include_server.CONTROL_COMMAND, "stats"])
+      second = json.loads(distcc_pump_c_extensions.RArgv(sock.fileno())[0])
+    finally:
+      sock.close()
+      os.kill(supervisor, signal.SIGTERM)
+      unused_pid, status = os.waitpid(supervisor, 0)
+      shutil.rmtree(socket_dir)
+    self.assertEqual(status, 0)
+    self.assertNotEqual(first['pid'], second['pid'])
+    self.assertNotEqual(first['pid'], supervisor)
+    self.assertNotEqual(second['pid'], supervisor)
+
 unittest.main()
@@ -141,6 +141,9 @@ for key in CPP_OPTIONS_REGULAR_EXPRESSIONS.keys():
 # separate word in argv.
 CPP_OPTIONS_ALWAYS_TWO_WORDS = {
   '-Xpreprocessor': lambda ps, arg: _RaiseNotImplemented('-Xpreprocessor'),
+  # Clang precompiled headers record the paths of the headers they were made
+  # from, which differ on the compilation server.
+  '-include-pch':   lambda ps, arg: _RaiseNotImplemented('-include-pch'),
 
   # In order to parse correctly, this data structure needs to include
   # *all* two-word arguments that gcc accepts (we don't want to see
@@ -165,6 +165,16 @@ class ParseCommandUnitTest(unittest.TestCase):
                       self.includepath_map,
                       self.directory_map,
                       self.compiler_defaults)
+    self.assertRaises(NotCoveredError,
+                      parse_command.ParseCommandArgs,
+                      parse_command.ParseCommandLine(
+                        self.mock_compiler
+                        + " --sysroot=" + self.mock_sysroot
+                        + " -include-pch a.h.pch a.c"),
+                      os.getcwd(),
+                      self.includepath_map,
+                      self.directory_map,
+                      self.compiler_defaults)
 
     quote_dirs, angle_dirs, include_files, filepath, _incl_cls_file, _d_opts = (
       parse_command.ParseCommandArgs(parse_command.ParseCommandLine(
@@ -35,6 +35,14 @@ import basics
 import cache_basics
 import statistics
 
+# The native directive scanner is much faster than the regular expression
+# based ScanDirectives below, which is kept as the reference implementation.
+try:
+  import distcc_pump_c_extensions
+  _NativeScanDirectives = distcc_pump_c_extensions.ScanDirectives
+except (ImportError, AttributeError):
+  _NativeScanDirectives = None
+
 Debug = basics.Debug
 DEBUG_TRACE = basics.DEBUG_TRACE
 DEBUG_TRACE2 = basics.DEBUG_TRACE2
@@ -54,7 +62,8 @@ POUND_SIGN_RE = re.compile(r"""
   (?P<directive>               # group('directive') -- what we're after
    [#]                         # the pound sign
    [ \t]*                      # space(s)
-   (define|include_next|include|import)\b # the directive
+   (?P<keyword>                # group('keyword')
+    define|include_next|include|import)\b # the directive
    ((?!\\\n).)*                 # the rest on this line: zero or more
                                 # characters, each not a backslash that
                                 # is followed by \n
@@ -163,6 +172,73 @@ def InsertMacroDefInTable(lhs, rhs, symbol_table, callback_function):
   callback_function(lhs)
 
 
+def ScanDirectives(file_contents):
+  """Find the lines of file_contents that contain directives of interest.
+
+  This is the reference implementation of the native
+  distcc_pump_c_extensions.ScanDirectives, which is used when available.
+
+  Arguments:
+    file_contents: a string, read with universal newlines
+  Returns:
+    a list of pairs (keyword, directive), where keyword is one of 'define',
+    'include', 'include_next', or 'import' and directive is the directive line
+    (starting with '#') with line continuations and paired comments removed.
+  """
+  directives = []
+
+  i = 0
+  line_start_last = None
+
+  while True:
+
+    # Scan coarsely to find something of interest
+    mfast = RE_INCLUDE_DEFINE.search(file_contents, i + 1)
+    if not mfast: break
+    i = mfast.end()
+    # Identify the line of interest by scanning backwards to \n
+    line_start = file_contents.rfind("\n", 0, i) + 1 # to beginning of line
+    # Now, line_start is -1 if \n was not found.
+
+    ### TODO(klarlund) continue going back if line continuation preceeding
+
+    # Is this really a new line?
+    if line_start == line_start_last: continue
+    line_start_last = line_start
+
+    # Here we should really skip back over lines to see whether a totally
+    # pathological situation involving '\'-terminated lines like:
+    #
+    # #include <stdio.h>
+    # # Start of pathological situation involving line continuations:
+    # # \
+    #    \
+    #     \
+    #      \
+    #       include     "nidgaard.h"
+    #
+    # occurs, where the first # on each line is just Python syntax and should
+    # not be considered as part of the C/C++ example. This code defines a
+    # valid directive to include "nidgaard.h". We will not handle such
+    # situations correctly -- the include will be missed.
+
+    # Parse the line of interest according to fine-grained parser
+    poundsign_match = POUND_SIGN_RE.match(file_contents, line_start)
+
+    if not poundsign_match:
+      continue
+
+    directives.append(
+      (poundsign_match.group('keyword'),
+       PAIRED_COMMENT_RE.sub( # remove possible paired comments
+         "",
+         BACKSLASH_RE.sub(   # get rid of lines ending in backslash
+           "",
+           poundsign_match.group('directive')))))
+
+  return directives
+
+
 class ParseFile(object):
   """Parser class for syntax understood by CPP, the C and C++
   preprocessor. An instance of this class defines the Parse method."""
@@ -197,20 +273,12 @@ class ParseFile(object):
 
     self.define_callback = callback_function
 
-  def _ParseFine(self, poundsign_match, includepath_map_index, file_contents,
+  def _ParseFine(self, directive, includepath_map_index,
                  symbol_table, quote_includes, angle_includes, expr_includes,
                  next_includes):
     """Helper function for ParseFile."""
-    Debug(DEBUG_TRACE2, "_ParseFine %s",
-      file_contents[poundsign_match.start('directive'):
-                    poundsign_match.end('directive')])
-    m = DIRECTIVE_RE.match(  # parse the directive
-          PAIRED_COMMENT_RE.sub( # remove possible paired comments
-            "",
-            BACKSLASH_RE.sub(   # get rid of lines ending in backslash
-              "",
-              file_contents[poundsign_match.start('directive'):
-                            poundsign_match.end('directive')])))
+    Debug(DEBUG_TRACE2, "_ParseFine %s", directive)
+    m = DIRECTIVE_RE.match(directive)  # parse the directive
     if m:
       try:
         groupdict = m.groupdict()
@@ -278,7 +346,7 @@ class ParseFile(object):
     includepath_map_index = self.includepath_map.Index
 
     try:
-      fd = open(filepath, "r", encoding='latin-1')
+      fd = open(filepath, "rb")
     except IOError as msg:
       # This normally does not happen because the file should be known to
       # exists. Still there might be, say, a permissions issue that prevents it
@@ -289,55 +357,23 @@ class ParseFile(object):
     file_contents = fd.read()
     fd.close()
 
+    if _NativeScanDirectives:
+      directives = _NativeScanDirectives(file_contents)
+    else:
+      directives = ScanDirectives(
+        file_contents.decode('latin-1').replace('\r\n', '\n')
+                                       .replace('\r', '\n'))
+
     quote_includes, angle_includes, expr_includes, next_includes = (
       [], [], [], [])
 
-    i = 0
-    line_start_last = None
-
-    while True:
-
-      # Scan coarsely to find something of interest
-      mfast = RE_INCLUDE_DEFINE.search(file_contents, i + 1)
-      if not mfast: break
-      i = mfast.end()
-      # Identify the line of interest by scanning backwards to \n
-      line_start = file_contents.rfind("\n", 0, i) + 1 # to beginning of line
-      # Now, line_start is -1 if \n was not found.
-
-      ### TODO(klarlund) continue going back if line continuation preceeding
-
-      # Is this really a new line?
-      if line_start == line_start_last: continue
-      line_start_last = line_start
-
-      # Here we should really skip back over lines to see whether a totally
-      # pathological situation involving '\'-terminated lines like:
-      #
-      # #include <stdio.h>
-      # # Start of pathological situation involving line continuations:
-      # # \
-      #    \
-      #     \
-      #      \
-      #       include     "nidgaard.h"
-      #
-      # occurs, where the first # on each line is just Python syntax and should
-      # not be considered as part of the C/C++ example. This code defines a
-      # valid directive to include "nidgaard.h". We will not handle such
-      # situations correctly -- the include will be missed.
-
-      # Parse the line of interest according to fine-grained parser
-      poundsign_match = POUND_SIGN_RE.match(file_contents, line_start)
-
-      if not poundsign_match:
-        continue
-
-      self._ParseFine(poundsign_match, includepath_map_index, file_contents,
-                      symbol_table, quote_includes, angle_includes,
-                      expr_includes, next_includes)
-
-
-    statistics.parse_file_total_time += time.perf_counter() - parse_file_start_time
+    for unused_keyword, directive in directives:
+      self._ParseFine(directive, includepath_map_index, symbol_table,
+                      quote_includes, angle_includes, expr_includes,
+                      next_includes)
+
+    parse_file_time = time.perf_counter() - parse_file_start_time
+    statistics.parse_file_total_time += parse_file_time
+    statistics.AddPhaseTime('parse', parse_file_time)
 
     return (quote_includes, angle_includes, expr_includes, next_includes)
@@ -22,6 +22,7 @@
 
 __author__ = "opensource@google.com"
 
+import os
 import unittest
 
 import basics
@@ -156,4 +157,51 @@ b
                 + "AS_STRING(maps/_filename_.tpl.varnames.h, "
                 + "NOTHANDLED(_filename_))")
 
+  def test_ScanDirectives(self):
+    # The native scanner must agree with the reference implementation.
+    import distcc_pump_c_extensions
+
+    def _Check(contents):
+      self.assertEqual(
+        distcc_pump_c_extensions.ScanDirectives(contents),
+        parse_file.ScanDirectives(
+          contents.decode('latin-1').replace('\r\n', '\n')
+                                    .replace('\r', '\n')))
+
+    for contents in [
+        b"",
+        b"#include <a.h>",
+        b"#include <a.h>\n#include \"b.h\"\n",
+        b"  #\tinclude_next <c.h>\n# import <d.h>\n",
+        b"#includefoo\n#define_x\n#inc\n#  defines\n",
+        b"#define A \\\n  B \\\n  C\nint x;\n",
+        b"#define A \\\r\n B\r\n#include <crlf.h>\r\n",
+        b"#include <cr.h>\r#define CR\r",
+        b"#define A \\\\\n#include <after_double_backslash.h>\n",
+        b"  */  /**/ /*  a */ #  \tinclude blah. blah.\n",
+        b"/* a */ #define X /* c */ #include <greedy.h>\n",
+        b"/* #include <in_comment.h> */\n",
+        b"/* x */ #define Y /* unpaired\n",
+        b"#define Z /* p */ 1 /* q */ 2 /* r\n",
+        b"x # include <not_at_line_start.h>\n",
+        b"#define A \\\n#include <continued.h>\n",
+        b"#\\\ninclude <missed.h>\n",
+        b"#include <a.h>\\",
+        b"#define \xe9t\xe9 1\n#include\xe9\n#include\xd7 x\n",
+        b"# # # include <x.h>\n####\n#define\0A\n",
+        ]:
+      _Check(contents)
+
+    for dirpath, unused_dirnames, filenames in os.walk("test_data"):
+      for filename in filenames:
+        filepath = os.path.join(dirpath, filename)
+        if os.path.isfile(filepath):
+          with open(filepath, "rb") as f:
+            _Check(f.read())
+
+    self.assertEqual(
+      distcc_pump_c_extensions.ScanDirectives(
+        b"#define X /* 1 */ \\\n  2\n  # include <a.h> // b\n"),
+      [('define', '#define X    2'), ('include', '# include <a.h> // b')])
+
 unittest.main()
@@ -150,6 +150,9 @@ ext = setuptools.Extension(
               'src/emaillog.c',
               'src/timeval.c',
               'src/netutil.c',
+              'src/pch.c',
+              'src/lock.c',
+              'src/md5.c',
               'lzo/minilzo.c',
               'include_server/c_extensions/distcc_pump_c_extensions_module.c',
              ]],
@@ -21,6 +21,8 @@
 
 __author__ = "Nils Klarlund"
 
+import collections
+import os
 import time
 
 resolve_expr_counter = 0 # number of computed includes
@@ -57,21 +59,180 @@ len_surplus_nonsys = 0  # the difference between
 
 find_node_counter = 0 # number of times FindNode is called
 
+# The counters below are kept even when the include server runs optimized, so
+# that the telemetry of a production include server is meaningful; the
+# counters above that are guarded by __debug__ are not.
+
+dirname_hit_counter = 0 # lookups answered by DirnameCache
+dirname_miss_counter = 0 # lookups that DirnameCache had to compute
+build_stat_lookup_counter = 0 # calls of BuildStatCache.Resolve
+build_stat_miss_counter = 0 # such calls that needed at least one OS stat
+parse_cache_hit_counter = 0 # parsed files found in the file cache
+parse_cache_miss_counter = 0 # files that had to be parsed
+failed_request_counter = 0 # requests answered by preprocessing locally
+prefetch_counter = 0 # commands analyzed ahead of their requests
+prefetch_failed_counter = 0 # such commands that were not covered
+prefetch_hit_counter = 0 # requests answered with a prefetched answer
+prefetch_stale_counter = 0 # prefetched answers discarded as out of date
+prefetch_total_time = 0.0 # seconds spent analyzing commands ahead of time
+
+# The phases of a request, in the order in which they happen:
+#   command:  parsing the compilation command
+#   parse:    parsing source files for directives (interleaved with resolve)
+#   resolve:  finding and memoizing the nodes of the include graph, except for
+#             the parsing
+#   closure:  gathering the include closure from the graph
+#   compress: compressing the files of the closure into the client root
+PHASES = ('command', 'parse', 'resolve', 'closure', 'compress')
+
+request_phase_time = dict.fromkeys(PHASES, 0.0) # phase -> seconds spent in
+                                               # the current request
+phase_total_time = dict.fromkeys(PHASES, 0.0)
+phase_max_time = dict.fromkeys(PHASES, 0.0)
+max_calculated_closure = 0 # the largest len_calculated_closure seen
+total_calculated_closure = 0 # the sum of len_calculated_closure
+
+# The last few requests, most recent last, for telemetry.
+RECENT_REQUESTS = 32
+recent_requests = collections.deque(maxlen=RECENT_REQUESTS)
+
 
 def StartTiming():
-  global start_time, translation_unit_counter
+  global start_time, translation_unit_counter, request_phase_time
+  global len_calculated_closure, len_calculated_closure_nonsys
   """Mark the start of a request to find an include closure."""
   translation_unit_counter += 1
+  request_phase_time = dict.fromkeys(PHASES, 0.0)
+  len_calculated_closure = len_calculated_closure_nonsys = 0
   start_time = time.perf_counter()
 
 
-def EndTiming():
-  """Mark the end of an include closure calculation."""
+def AddPhaseTime(phase, seconds):
+  """Account seconds spent in phase, one of PHASES, to the current request."""
+  request_phase_time[phase] += seconds
+
+
+def EndTiming(translation_unit=None, failed=False):
+  """Mark the end of an include closure calculation.
+
+  Arguments:
+    translation_unit: the translation unit of the request, if known
+    failed: whether the client has been told to preprocess locally
+  """
   global translation_unit_time, min_time, max_time, total_time
+  global failed_request_counter, max_calculated_closure
+  global total_calculated_closure
   translation_unit_time = time.perf_counter() - start_time
   min_time = min(translation_unit_time, min_time)
   max_time = max(translation_unit_time, max_time)
   total_time += translation_unit_time
+  for phase in PHASES:
+    phase_total_time[phase] += request_phase_time[phase]
+    phase_max_time[phase] = max(phase_max_time[phase],
+                                request_phase_time[phase])
+  if failed:
+    failed_request_counter += 1
+  max_calculated_closure = max(max_calculated_closure, len_calculated_closure)
+  total_calculated_closure += len_calculated_closure
+  recent_requests.append({
+    'translation_unit': translation_unit,
+    'failed': failed,
+    'time_ms': _Ms(translation_unit_time),
+    'phases_ms': dict([ (phase, _Ms(request_phase_time[phase]))
+                        for phase in PHASES ]),
+    'closure': len_calculated_closure,
+    'closure_nonsys': len_calculated_closure_nonsys,
+  })
+
+
+def _Ms(seconds):
+  return round(seconds * 1000.0, 3)
+
+
+def _HitRate(hits, misses):
+  """Return hits / (hits + misses), or None if there were no lookups."""
+  if hits + misses == 0:
+    return None
+  return round(float(hits) / (hits + misses), 4)
+
+
+def Telemetry(include_analyzer=None):
+  """Return the request latencies and cache efficiency seen so far.
+
+  The result is a dictionary made of strings, numbers, lists, and None, so
+  that it can be written as JSON.  With several workers, it describes only
+  the worker whose process id is 'pid'.
+
+  Arguments:
+    include_analyzer: the include analyzer serving the requests, whose cache
+      sizes are then included; or None
+  """
+  n = translation_unit_counter
+  telemetry = {
+    'pid': os.getpid(),
+    'requests': n,
+    'failed_requests': failed_request_counter,
+    'time_ms': {
+      'total': _Ms(total_time),
+      'mean': n and _Ms(total_time / n) or 0.0,
+      'min': n and _Ms(min_time) or 0.0,
+      'max': _Ms(max_time),
+    },
+    'phases_ms': dict([ (phase, {
+                          'total': _Ms(phase_total_time[phase]),
+                          'mean': n and _Ms(phase_total_time[phase] / n)
+                                    or 0.0,
+                          'max': _Ms(phase_max_time[phase]) })
+                        for phase in PHASES ]),
+    'caches': {
+      'dirname': {
+        'hits': dirname_hit_counter,
+        'misses': dirname_miss_counter,
+        'hit_rate': _HitRate(dirname_hit_counter, dirname_miss_counter),
+      },
+      'build_stat': {
+        'hits': build_stat_lookup_counter - build_stat_miss_counter,
+        'misses': build_stat_miss_counter,
+        'hit_rate': _HitRate(build_stat_lookup_counter
+                             - build_stat_miss_counter,
+                             build_stat_miss_counter),
+      },
+      'parse': {
+        'hits': parse_cache_hit_counter,
+        'misses': parse_cache_miss_counter,
+        'hit_rate': _HitRate(parse_cache_hit_counter,
+                             parse_cache_miss_counter),
+      },
+      'node': {
+        'hits': master_hit_counter,
+        'misses': master_miss_counter,
+        'hit_rate': _HitRate(master_hit_counter, master_miss_counter),
+      },
+    },
+    'closure': {
+      'last': len_calculated_closure,
+      'last_nonsys': len_calculated_closure_nonsys,
+      'mean': n and round(float(total_calculated_closure) / n, 1) or 0.0,
+      'max': max_calculated_closure,
+    },
+    'prefetch': {
+      'done': prefetch_counter,
+      'failed': prefetch_failed_counter,
+      'hits': prefetch_hit_counter,
+      'stale': prefetch_stale_counter,
+      'time_ms': _Ms(prefetch_total_time),
+    },
+    'recent_requests': list(recent_requests),
+  }
+  if include_analyzer:
+    telemetry['prefetch']['queued'] = len(include_analyzer.prefetch_queue)
+    caches = telemetry['caches']
+    caches['dirname']['size'] = len(include_analyzer.dirname_cache.cache)
+    caches['parse']['size'] = len(include_analyzer.file_cache)
+    if 'master_cache' in include_analyzer.__dict__:
+      caches['node']['size'] = sum([ len(nodes) for nodes in
+                                     include_analyzer.master_cache.values() ])
+  return telemetry
 
 
 def PrintStatistics(include_analyzer):
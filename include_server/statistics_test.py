@@ -0,0 +1,115 @@
+#! /usr/bin/env python3
+
+# Copyright 2007 Google Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+#
+
+"""Tests for the telemetry of statistics.py."""
+
+import json
+import os
+import unittest
+
+import basics
+import include_analyzer_memoizing_node
+import parse_command
+import statistics
+
+
+class StatisticsTest(unittest.TestCase):
+
+  def setUp(self):
+    basics.opt_debug_pattern = 1
+
+  def test_Telemetry_phases(self):
+    n = statistics.translation_unit_counter
+    statistics.StartTiming()
+    statistics.AddPhaseTime('parse', 0.25)
+    statistics.AddPhaseTime('parse', 0.25)
+    statistics.AddPhaseTime('compress', 0.125)
+    statistics.len_calculated_closure = 7
+    statistics.EndTiming("foo.c")
+    statistics.StartTiming()
+    statistics.EndTiming("bar.c", failed=True)
+
+    telemetry = statistics.Telemetry()
+    # The telemetry must be writable as JSON.
+    self.assertEqual(json.loads(json.dumps(telemetry)), telemetry)
+    self.assertEqual(telemetry['pid'], os.getpid())
+    self.assertEqual(telemetry['requests'], n + 2)
+    self.assertTrue(telemetry['failed_requests'] >= 1)
+    self.assertTrue(telemetry['phases_ms']['parse']['total'] >= 500.0)
+    self.assertTrue(telemetry['phases_ms']['parse']['max'] >= 500.0)
+    self.assertTrue(telemetry['closure']['max'] >= 7)
+    self.assertEqual(telemetry['closure']['last'], 0)
+
+    foo, bar = telemetry['recent_requests'][-2:]
+    self.assertEqual(foo['translation_unit'], "foo.c")
+    self.assertEqual(foo['failed'], False)
+    self.assertEqual(foo['phases_ms']['parse'], 500.0)
+    self.assertEqual(foo['phases_ms']['compress'], 125.0)
+    self.assertEqual(foo['phases_ms']['resolve'], 0.0)
+    self.assertEqual(foo['closure'], 7)
+    self.assertEqual(bar['translation_unit'], "bar.c")
+    self.assertEqual(bar['failed'], True)
+    self.assertEqual(bar['phases_ms']['parse'], 0.0)
+
+  def test_Telemetry_recent_requests_bounded(self):
+    for i in range(statistics.RECENT_REQUESTS + 5):
+      statistics.StartTiming()
+      statistics.EndTiming("tu%d.c" % i)
+    recent = statistics.Telemetry()['recent_requests']
+    self.assertEqual(len(recent), statistics.RECENT_REQUESTS)
+    self.assertEqual(recent[-1]['translation_unit'],
+                     "tu%d.c" % (statistics.RECENT_REQUESTS + 4))
+
+  def test_HitRate(self):
+    self.assertEqual(statistics._HitRate(0, 0), None)
+    self.assertEqual(statistics._HitRate(3, 1), 0.75)
+
+  def test_Telemetry_caches(self):
+    include_analyzer = (
+        include_analyzer_memoizing_node.IncludeAnalyzerMemoizingNode(
+            basics.ClientRootKeeper()))
+    try:
+      for unused_i in range(2):
+        statistics.StartTiming()
+        include_analyzer.ProcessCompilationCommand(
+          os.getcwd(),
+          parse_command.ParseCommandArgs(
+            parse_command.ParseCommandLine(
+              "gcc test_data/test_computed_includes/src.c"),
+            os.getcwd(),
+            include_analyzer.includepath_map,
+            include_analyzer.directory_map,
+            include_analyzer.compiler_defaults))
+        statistics.EndTiming("src.c")
+      telemetry = statistics.Telemetry(include_analyzer)
+      caches = telemetry['caches']
+      for cache in ('dirname', 'build_stat', 'parse', 'node'):
+        self.assertTrue(caches[cache]['misses'] > 0, cache)
+      # The second request was answered from the memoized nodes.
+      self.assertTrue(caches['node']['hits'] > 0)
+      self.assertTrue(caches['parse']['size'] > 0)
+      self.assertTrue(caches['node']['size'] > 0)
+      last = telemetry['recent_requests'][-1]
+      self.assertTrue(last['closure'] > 0)
+      self.assertEqual(last['closure'], telemetry['closure']['last'])
+    finally:
+      include_analyzer.client_root_keeper.CleanOutClientRoots()
+
+unittest.main()
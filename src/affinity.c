@@ -0,0 +1,182 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Send the sources of one directory to the same pump server.
+ *
+ * In pump mode each server is sent the headers a translation unit needs,
+ * and files next to each other tend to need the same headers.  With
+ * DISTCC_AFFINITY set, the directory of each source file is hashed onto a
+ * ring of the pump-mode hosts (consistent hashing, so that adding or
+ * removing a host moves only the directories that hashed near it).  The
+ * job goes to the first host at or after that point which has a free slot;
+ * if none has, the host is chosen as usual.
+ *
+ * This only pays once servers keep what they are sent.  distccd does not
+ * do that yet: each job unpacks its headers into a fresh temporary
+ * directory, and the client sends the whole include closure every time.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "md5.h"
+#include "state.h"
+#include "where.h"
+#include "affinity.h"
+
+
+/* Points on the ring for each host, so that the directories are spread
+ * evenly however few hosts there are. */
+#define DCC_AFFINITY_POINTS 32
+
+
+struct dcc_ring_point {
+    unsigned long hash;
+    struct dcc_hostdef *host;
+    int host_index;
+};
+
+
+int dcc_affinity_enabled(void)
+{
+    return dcc_getenv_bool("DISTCC_AFFINITY", 0);
+}
+
+
+static unsigned long dcc_affinity_hash(const char *s, size_t len, int point)
+{
+    unsigned char digest[DCC_MD5_DIGEST_LEN];
+    unsigned char p = (unsigned char) point;
+    struct dcc_md5 md5;
+
+    dcc_md5_init(&md5);
+    dcc_md5_update(&md5, s, len);
+    if (point >= 0)
+        dcc_md5_update(&md5, &p, 1);
+    dcc_md5_final(&md5, digest);
+    return ((unsigned long) digest[0] << 24) | ((unsigned long) digest[1] << 16)
+        | ((unsigned long) digest[2] << 8) | (unsigned long) digest[3];
+}
+
+
+static int dcc_ring_point_cmp(const void *a, const void *b)
+{
+    const struct dcc_ring_point *pa = a, *pb = b;
+
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+    /* Break ties the same way in every client. */
+    return strcmp(pa->host->hostdef_string, pb->host->hostdef_string);
+}
+
+
+/**
+ * Lock a slot on the pump-mode host of @p hostlist that the directory of
+ * @p input_fname hashes to, or failing that on the next one around the
+ * ring that has a free slot.
+ *
+ * @returns EXIT_BUSY if there is no pump-mode host with a free slot, in
+ * which case the caller should choose a host in the usual way.
+ **/
+int dcc_lock_by_affinity(struct dcc_hostdef *hostlist,
+                         const char *input_fname,
+                         struct dcc_hostdef **buildhost,
+                         int *cpu_lock_fd)
+{
+    struct dcc_ring_point *ring;
+    struct dcc_hostdef *h;
+    const char *path, *slash;
+    char *tried;
+    unsigned long key;
+    int n_hosts = 0, n_points, i, j, start, slot, ret = EXIT_BUSY;
+
+    for (h = hostlist; h; h = h->next)
+        if (h->mode != DCC_MODE_LOCAL && h->cpp_where == DCC_CPP_ON_SERVER)
+            n_hosts++;
+    if (n_hosts == 0)
+        return EXIT_BUSY;
+
+    n_points = n_hosts * DCC_AFFINITY_POINTS;
+    ring = malloc(n_points * sizeof *ring);
+    tried = calloc(n_hosts, 1);
+    if (!ring || !tried) {
+        rs_log_error("failed to allocate affinity ring");
+        free(ring);
+        free(tried);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    i = 0;
+    n_hosts = 0;
+    for (h = hostlist; h; h = h->next) {
+        size_t len = strlen(h->hostdef_string);
+
+        if (h->mode == DCC_MODE_LOCAL || h->cpp_where != DCC_CPP_ON_SERVER)
+            continue;
+        for (j = 0; j < DCC_AFFINITY_POINTS; j++, i++) {
+            ring[i].hash = dcc_affinity_hash(h->hostdef_string, len, j);
+            ring[i].host = h;
+            ring[i].host_index = n_hosts;
+        }
+        n_hosts++;
+    }
+    qsort(ring, n_points, sizeof *ring, dcc_ring_point_cmp);
+
+    path = dcc_abspath(input_fname, 0);
+    slash = strrchr(path, '/');
+    key = dcc_affinity_hash(path, slash ? (size_t) (slash - path) : 0, -1);
+    for (start = 0; start < n_points && ring[start].hash < key; start++)
+        ;
+
+    rs_trace("home of %.*s is %s", slash ? (int) (slash - path) : 0, path,
+             ring[start % n_points].host->hostdef_string);
+
+    /* Walk once around the ring, trying each host at its first point and
+     * skipping its later ones. */
+    for (i = 0; i < n_points && ret == EXIT_BUSY; i++) {
+        struct dcc_ring_point *point = &ring[(start + i) % n_points];
+
+        if (tried[point->host_index])
+            continue;
+        tried[point->host_index] = 1;
+        ret = dcc_try_lock_host(point->host, &slot, cpu_lock_fd);
+        if (ret == 0) {
+            dcc_note_state_slot(slot, DCC_REMOTE);
+            *buildhost = point->host;
+        }
+    }
+
+    free(ring);
+    free(tried);
+    return ret;
+}
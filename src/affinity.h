@@ -0,0 +1,32 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef DCC_AFFINITY_H
+#define DCC_AFFINITY_H
+
+/* affinity.c */
+int dcc_affinity_enabled(void);
+
+int dcc_lock_by_affinity(struct dcc_hostdef *hostlist,
+                         const char *input_fname,
+                         struct dcc_hostdef **buildhost,
+                         int *cpu_lock_fd);
+
+#endif /* DCC_AFFINITY_H */
@@ -55,8 +55,8 @@
  * the server.  An even better solution is to have the client tell the server
  * where to put the input and output files.
  *
- * @todo Perhaps make the argument parser driven by a data table.  (Would that
- * actually be clearer?)  Perhaps use regexps to recognize strings.
+ * Most options are classified by the table in argtab.c; only the few that
+ * need more than a table entry are handled here.
  *
  * @todo We could also detect options like "-x cpp-output" or "-x
  * assembler-with-cpp", because they should override language detection based
@@ -156,39 +156,23 @@ int dcc_scan_args(char *argv[], char **input_file, char **output_file,
 
     for (i = 0; (a = argv[i]); i++) {
         if (a[0] == '-') {
+            const struct dcc_arg_rule *rule = dcc_find_arg_rule(a);
+
             if (!strcmp(a, "-E")) {
                 rs_trace("-E call for cpp must be local");
                 return EXIT_LOCAL_CPP;
-            } else if (!strcmp(a, "-MD") || !strcmp(a, "-MMD")) {
-                /* These two generate dependencies as a side effect.  They
-                 * should work with the way we call cpp. */
-            } else if (!strcmp(a, "-MG") || !strcmp(a, "-MP")) {
-                /* These just modify the behaviour of other -M* options and do
-                 * nothing by themselves. */
-            } else if (!strcmp(a, "-MF") || !strcmp(a, "-MT") ||
-                       !strcmp(a, "-MQ")) {
-                /* As above but with extra argument. */
-                i++;
-            } else if (!strncmp(a, "-MF", 3) || !strncmp(a, "-MT", 3) ||
-                       !strncmp(a, "-MQ", 3)) {
-                /* As above, without extra argument. */
-            } else if (a[1] == 'M') {
-                /* -M(anything else) causes the preprocessor to
-                    produce a list of make-style dependencies on
-                    header files, either to stdout or to a local file.
-                    It implies -E, so only the preprocessor is run,
-                    not the compiler.  There would be no point trying
-                    to distribute it even if we could. */
-                rs_trace("%s implies -E (maybe) and must be local", a);
-                return EXIT_DISTCC_FAILED;
-            } else if (!strcmp(a, "-march=native")) {
-                rs_trace("-march=native generates code for local machine; "
-                         "must be local");
-                return EXIT_DISTCC_FAILED;
-            } else if (!strcmp(a, "-mtune=native")) {
-                rs_trace("-mtune=native optimizes for local machine; "
-                         "must be local");
+            } else if (rule && (rule->flags & DCC_ARG_LOCAL)) {
+                rs_log_info("%s %s; must be local", a, rule->reason);
                 return EXIT_DISTCC_FAILED;
+            } else if (rule) {
+                /* Don't take the option's argument for an input or output
+                 * file.  After -Xpreprocessor it is an option itself, and
+                 * one that might need to run locally. */
+                if ((rule->flags & DCC_ARG_SEPARATE)
+                    && !(rule->flags & DCC_ARG_WRAPS)
+                    && !strcmp(a, rule->name)
+                    && argv[i+1])
+                    i++;
             } else if (str_startswith("-Wa,", a)) {
                 /* Look for assembler options that would produce output
                  * files and must be local.
@@ -201,18 +185,6 @@ int dcc_scan_args(char *argv[], char **input_file, char **output_file,
                 }
             } else if (!strcmp(a, "-S")) {
                 seen_opt_s = 1;
-            } else if (!strcmp(a, "-fprofile-arcs")
-                       || !strcmp(a, "-ftest-coverage")
-		       || !strcmp(a, "--coverage")
-		       || !strncmp(a, "-fprofile-generate", 18) /* it also has an -fprofile-generate=<path> form */
-		       || !strncmp(a, "-fprofile-use", 13)
-		       || !strncmp(a, "-fauto-profile", 14)
-		       || !strcmp(a, "-fprofile-correction")) {
-                rs_log_info("compiler will emit/use profile info; must be local");
-                return EXIT_DISTCC_FAILED;
-            } else if (!strcmp(a, "-frepo")) {
-                rs_log_info("compiler will emit .rpo files; must be local");
-                return EXIT_DISTCC_FAILED;
             } else if (str_startswith("-x", a)
                        && argv[i+1]
                        && !str_startswith("c", argv[i+1])
@@ -223,10 +195,6 @@ int dcc_scan_args(char *argv[], char **input_file, char **output_file,
                        ) {
                 rs_log_info("gcc's -x handling is complex; running locally for %s", argv[i+1] ? argv[i+1] : "empty");
                 return EXIT_DISTCC_FAILED;
-            } else if (str_startswith("-dr", a)) {
-                rs_log_info("gcc's debug option %s may write extra files; "
-                            "running locally", a);
-                return EXIT_DISTCC_FAILED;
             } else if (!strcmp(a, "-c")) {
                 seen_opt_c = 1;
             } else if (!strcmp(a, "-o")) {
@@ -390,6 +358,55 @@ int dcc_set_output(char **a, char *ofname)
     return EXIT_DISTCC_FAILED;
 }
 
+
+/**
+ * Work out whether the compiler will write split DWARF debug info beside
+ * @p output_fname, and if so under what name: with -gsplit-dwarf, gcc and
+ * clang replace the last extension of the object with ".dwo", or append
+ * ".dwo" if it has none.  Nothing is split off with -S, since it is the
+ * assembler that writes the .dwo file.
+ *
+ * @p dwo_fname is set to a newly allocated name, or to NULL if no .dwo
+ * file is expected.
+ **/
+int dcc_get_dwo_fname(char **argv, const char *output_fname,
+                      char **dwo_fname)
+{
+    int split = 0, seen_opt_c = 0, seen_opt_s = 0;
+    const char *base, *dot;
+    char *a;
+    int i;
+
+    *dwo_fname = NULL;
+
+    for (i = 0; (a = argv[i]); i++) {
+        if (!strcmp(a, "-gsplit-dwarf") || !strcmp(a, "-gsplit-dwarf=split"))
+            split = 1;
+        else if (!strcmp(a, "-gno-split-dwarf")
+                 || !strcmp(a, "-gsplit-dwarf=single"))
+            split = 0;
+        else if (!strcmp(a, "-c"))
+            seen_opt_c = 1;
+        else if (!strcmp(a, "-S"))
+            seen_opt_s = 1;
+    }
+    if (!split || !seen_opt_c || seen_opt_s)
+        return 0;
+
+    base = dcc_find_basename(output_fname);
+    dot = strrchr(base, '.');
+    if (dot == NULL || dot == base)
+        dot = base + strlen(base);
+    if (asprintf(dwo_fname, "%.*s.dwo",
+                 (int) (dot - output_fname), output_fname) == -1) {
+        rs_log_error("failed to allocate name of .dwo file");
+        *dwo_fname = NULL;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    rs_trace("split DWARF goes to \"%s\"", *dwo_fname);
+    return 0;
+}
+
 /**
  * Change input file to a copy of @p ifname; called on compiler.
  * Frees the old value.
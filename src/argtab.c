@@ -0,0 +1,152 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * The compiler options that distcc needs to know about, and what it needs
+ * to know about each.
+ *
+ * Both dcc_scan_args() and dcc_strip_local_args() classify arguments through
+ * this one table, on the client and on the server, so a new compiler option
+ * only needs teaching here.  Options that neither cares about are left out:
+ * they are passed through to the compiler unchanged.
+ *
+ * The table is searched in order and the first rule that matches wins, so
+ * specific rules have to come before more general ones with the same
+ * prefix, such as "-MF" before "-M".
+ **/
+
+
+#include <config.h>
+
+#include <string.h>
+#include <limits.h>
+
+#include "distcc.h"
+#include "util.h"
+
+
+static const struct dcc_arg_rule dcc_arg_rules[] = {
+    /* Preprocessor options, which the compiler doesn't need once the
+     * source is preprocessed. */
+    { "-D",                 DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-U",                 DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-I",                 DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-include",           DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-imacros",           DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-iprefix",           DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-iwithprefix",       DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-iwithprefixbefore", DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-isystem",           DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-idirafter",         DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-Xpreprocessor",     DCC_ARG_SEPARATE|DCC_ARG_WRAPS|DCC_ARG_STRIP, 0 },
+    { "-Wp,",               DCC_ARG_JOINED|DCC_ARG_STRIP, 0 },
+    { "-undef",             DCC_ARG_STRIP, 0 },
+    { "-nostdinc",          DCC_ARG_STRIP, 0 },
+    { "-nostdinc++",        DCC_ARG_STRIP, 0 },
+
+    /* Dependency generation.  -MD and -MMD work with the way we run cpp,
+     * and the others only modify them, but anything else starting with
+     * -M implies -E. */
+    { "-MD",                DCC_ARG_STRIP, 0 },
+    { "-MMD",               DCC_ARG_STRIP, 0 },
+    { "-MG",                DCC_ARG_STRIP, 0 },
+    { "-MP",                DCC_ARG_STRIP, 0 },
+    { "-MF",                DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-MT",                DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-MQ",                DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-M",                 DCC_ARG_JOINED|DCC_ARG_LOCAL,
+      "implies -E (maybe)" },
+
+    /* Linker options, which don't matter when compiling. */
+    { "-L",                 DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-l",                 DCC_ARG_JOINED|DCC_ARG_SEPARATE|DCC_ARG_STRIP, 0 },
+    { "-Wl,",               DCC_ARG_JOINED|DCC_ARG_STRIP, 0 },
+    { "-stdlib",            DCC_ARG_JOINED|DCC_ARG_STRIP, 0 },
+
+    /* Options whose results depend on, or end up on, the local machine. */
+    { "-march=native",      DCC_ARG_LOCAL,
+      "generates code for the local machine" },
+    { "-mtune=native",      DCC_ARG_LOCAL,
+      "optimizes for the local machine" },
+    { "-fprofile-arcs",     DCC_ARG_LOCAL, "emits profile info" },
+    { "-ftest-coverage",    DCC_ARG_LOCAL, "emits profile info" },
+    { "--coverage",         DCC_ARG_LOCAL, "emits profile info" },
+    { "-fprofile-generate", DCC_ARG_JOINED|DCC_ARG_LOCAL,
+      "emits profile info" },
+    { "-fprofile-use",      DCC_ARG_JOINED|DCC_ARG_LOCAL, "uses profile info" },
+    { "-fauto-profile",     DCC_ARG_JOINED|DCC_ARG_LOCAL, "uses profile info" },
+    { "-fprofile-correction", DCC_ARG_LOCAL, "uses profile info" },
+    { "-frepo",             DCC_ARG_LOCAL, "emits .rpo files" },
+    { "-dr",                DCC_ARG_JOINED|DCC_ARG_LOCAL,
+      "is a debug option that may write extra files" },
+};
+
+#define N_RULES ((int) (sizeof dcc_arg_rules / sizeof dcc_arg_rules[0]))
+
+/* Rules chained by the second character of their names, which is the first
+ * one that tells options apart; so looking up an argument only compares it
+ * against the few rules that could possibly match.  Links are indexes into
+ * dcc_arg_rules plus one, with zero ending the chain. */
+static int first_rule[UCHAR_MAX + 1];
+static int next_rule[N_RULES];
+static int chains_built;
+
+
+static void dcc_build_arg_chains(void)
+{
+    int i;
+
+    /* Backwards, so each chain keeps the order of the table. */
+    for (i = N_RULES - 1; i >= 0; i--) {
+        unsigned char c = (unsigned char) dcc_arg_rules[i].name[1];
+        next_rule[i] = first_rule[c];
+        first_rule[c] = i + 1;
+    }
+    chains_built = 1;
+}
+
+
+/**
+ * Find the rule for the argument @p a, or NULL if distcc has no interest in
+ * it.  A rule without DCC_ARG_JOINED only matches the whole word.
+ **/
+const struct dcc_arg_rule *dcc_find_arg_rule(const char *a)
+{
+    int r;
+
+    if (a[0] != '-' || a[1] == '\0')
+        return NULL;
+
+    if (!chains_built)
+        dcc_build_arg_chains();
+
+    for (r = first_rule[(unsigned char) a[1]]; r; r = next_rule[r - 1]) {
+        const struct dcc_arg_rule *rule = &dcc_arg_rules[r - 1];
+
+        if ((rule->flags & DCC_ARG_JOINED)
+            ? str_startswith(rule->name, a)
+            : str_equal(rule->name, a))
+            return rule;
+    }
+    return NULL;
+}
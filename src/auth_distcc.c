@@ -29,11 +29,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "auth.h"
 #include "distcc.h"
 #include "exitcode.h"
 #include "hosts.h"
 #include "netutil.h"
+#include "resolve.h"
 #include "trace.h"
 
 static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
@@ -43,6 +46,8 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
 					       OM_uint32 *ret_flags);
 static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd);
 static int dcc_gssapi_recv_notification(int sd);
+static int dcc_gssapi_peer_name(const struct sockaddr_in *addr,
+                                char **name);
 
 /**
  * Global security context in case other services are implemented in the
@@ -128,7 +133,6 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
     int ret;
     OM_uint32 major_status, minor_status, return_status;
     socklen_t addr_len;
-    struct hostent *hp;
     struct sockaddr_in addr;
 
     if (!host->auth_name) {
@@ -145,19 +149,9 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
                                                 inet_ntoa(addr.sin_addr),
                                                 to_net_sd);
 
-        if ((hp = gethostbyaddr((char *) &addr.sin_addr,
-                                sizeof(addr.sin_addr),
-                                AF_INET)) == NULL) {
-            rs_log_error("Failed to look up host by address \"%s\": %s.",
-                        inet_ntoa(addr.sin_addr),
-                        hstrerror(h_errno));
-            return EXIT_CONNECT_FAILED;
+        if ((ret = dcc_gssapi_peer_name(&addr, &full_name)) != 0) {
+            return ret;
         }
-
-        rs_log_info("Successfully looked up host %s using IP address %s.",
-                                                hp->h_name,
-                                                inet_ntoa(addr.sin_addr));
-        full_name = hp->h_name;
     } else {
         full_name = host->auth_name;
     }
@@ -260,6 +254,75 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
     return 0;
 }
 
+/*
+ * Find the canonical name of the server at @p addr, which its service
+ * principal is named after.  The reverse lookup is a round trip to the
+ * resolver on every connection, so its answer is remembered in the state
+ * directory for DISTCC_RESOLVE_TTL seconds, like the server addresses.
+ *
+ * @param addr.		Address of the server.
+ *
+ * @param name.		Set to the name, in a static buffer.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_peer_name(const struct sockaddr_in *addr,
+                                char **name) {
+    static char buf[256];
+    char *dir, *fname = NULL, *tmp;
+    long long resolved;
+    struct hostent *hp;
+    FILE *f;
+    int ttl = dcc_resolve_ttl();
+
+    if (ttl > 0 && dcc_get_state_dir(&dir) == 0
+        && asprintf(&fname, "%s/authname_%s", dir,
+                    inet_ntoa(addr->sin_addr)) != -1) {
+        if ((f = fopen(fname, "r")) != NULL) {
+            if (fscanf(f, "resolved %lld %255s", &resolved, buf) == 2
+                && time(NULL) - (time_t) resolved < ttl) {
+                fclose(f);
+                free(fname);
+                rs_trace("using remembered name %s of %s", buf,
+                         inet_ntoa(addr->sin_addr));
+                *name = buf;
+                return 0;
+            }
+            fclose(f);
+        }
+    } else {
+        fname = NULL;
+    }
+
+    if ((hp = gethostbyaddr((const char *) &addr->sin_addr,
+                            sizeof(addr->sin_addr),
+                            AF_INET)) == NULL) {
+        rs_log_error("Failed to look up host by address \"%s\": %s.",
+                    inet_ntoa(addr->sin_addr),
+                    hstrerror(h_errno));
+        free(fname);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    rs_log_info("Successfully looked up host %s using IP address %s.",
+                                            hp->h_name,
+                                            inet_ntoa(addr->sin_addr));
+    strncpy(buf, hp->h_name, sizeof buf - 1);
+    buf[sizeof buf - 1] = '\0';
+    *name = buf;
+
+    if (fname && asprintf(&tmp, "%s.tmp%ld", fname, (long) getpid()) != -1) {
+        if ((f = fopen(tmp, "w")) != NULL) {
+            fprintf(f, "resolved %lld %s\n", (long long) time(NULL), buf);
+            if (fclose(f) != 0 || rename(tmp, fname) == -1)
+                unlink(tmp);
+        }
+        free(tmp);
+    }
+    free(fname);
+    return 0;
+}
+
 /*
  * Attempt handshake exchange with the server to indicate client's
  * desire to authenticate.
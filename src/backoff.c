@@ -21,10 +21,27 @@
  */
 
 
+
 /**
  * @file
  *
  * Keep track of hosts which are, or are not, usable.
+ *
+ * Each host has a circuit breaker.  It is closed while the host works.  A
+ * failure opens it for the backoff period, during which the host is not
+ * used; each further failure doubles the period, up to a limit, and the
+ * period is varied a little so that clients that saw the same failure do
+ * not all come back at once.  When the period is over the breaker is
+ * half-open: the first client to lock a slot of the host for a job claims
+ * the right to send that single probe job, and the others keep away until
+ * it succeeds, closing the breaker, or fails, opening it again for longer.
+ *
+ * The breakers of all hosts are kept in one small table in the lock
+ * directory, mapped into memory and shared by every client of the user, so
+ * that checking the host list costs no system calls once it is mapped.
+ * Changes are made holding a lock on the table.  A breaker that has been
+ * closed for longer than the longest backoff period remembers nothing of
+ * use, so its slot may be given to another host.
  **/
 
 #include <config.h>
@@ -39,6 +56,9 @@
 
 #include <sys/stat.h>
 #include <sys/file.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include "distcc.h"
 #include "trace.h"
@@ -46,13 +66,49 @@
 #include "exitcode.h"
 #include "snprintf.h"
 #include "lock.h"
-#include "timefile.h"
 #include "hosts.h"
 
 
+/* How many hosts the table can track. */
+#define DCC_BACKOFF_SLOTS 256
+
+/* The longest backoff is the backoff period doubled this many times. */
+#define DCC_BACKOFF_MAX_DOUBLINGS 4
+
+static const char dcc_backoff_magic[8] = "DCCBO02";
+
+struct dcc_breaker {
+    /** The host's definition, or empty if the slot was never used. */
+    char key[112];
+
+    /** Failures since the host last worked; 0 if the breaker is closed. */
+    int failures;
+
+    int unused;
+
+    /** The host is not used before this time. */
+    time_t open_until;
+
+    /** While this is in the future, a client is probing the host. */
+    time_t probe_until;
+
+    /** When the breaker last opened or closed. */
+    time_t changed;
+};
+
+struct dcc_breaker_table {
+    char magic[8];
+    int entry_size;
+    int n_slots;
+    struct dcc_breaker slots[DCC_BACKOFF_SLOTS];
+};
+
 static int dcc_backoff_period = 60; /* seconds */
 
-static int dcc_get_backoff_period(void)
+static struct dcc_breaker_table *dcc_breakers;
+static char *dcc_breakers_fname;
+
+int dcc_get_backoff_period(void)
 {
     char *bp;
     bp = getenv("DISTCC_BACKOFF_PERIOD");
@@ -66,49 +122,296 @@ int dcc_backoff_is_enabled(void)
     return dcc_get_backoff_period() != 0;
 }
 
+
+/**
+ * Take the lock on the breaker table.  Release it with dcc_unlock().
+ **/
+static int dcc_lock_breakers(int *lock_fd)
+{
+    int ret;
+
+    if ((ret = dcc_open_lockfile(dcc_breakers_fname, lock_fd)))
+        return ret;
+    if ((ret = dcc_lock_fd(*lock_fd))) {
+        dcc_close(*lock_fd);
+        return ret;
+    }
+    return 0;
+}
+
+
+/**
+ * Map the breaker table, creating or resetting it if it is missing or was
+ * written by an incompatible build.
+ **/
+static int dcc_map_breakers(void)
+{
+    struct dcc_breaker_table *table;
+    struct stat st;
+    char *lockdir;
+    int fd, lock_fd, ret;
+
+    if (dcc_breakers)
+        return 0;
+
+    if ((ret = dcc_get_lock_dir(&lockdir)))
+        return ret;
+    if (!dcc_breakers_fname
+        && asprintf(&dcc_breakers_fname, "%s/backoff", lockdir) == -1) {
+        dcc_breakers_fname = NULL;
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((fd = open(dcc_breakers_fname, O_RDWR|O_CREAT, 0666)) == -1) {
+        rs_log_error("failed to open %s: %s", dcc_breakers_fname,
+                     strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((ret = dcc_lock_breakers(&lock_fd))) {
+        dcc_close(fd);
+        return ret;
+    }
+
+    if (fstat(fd, &st) == -1
+        || (st.st_size != (off_t) sizeof *table
+            && ftruncate(fd, (off_t) sizeof *table) == -1)) {
+        rs_log_error("failed to size %s: %s", dcc_breakers_fname,
+                     strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        table = mmap(NULL, sizeof *table, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+        if (table == MAP_FAILED) {
+            rs_log_error("failed to map %s: %s", dcc_breakers_fname,
+                         strerror(errno));
+            ret = EXIT_IO_ERROR;
+        } else {
+            if (memcmp(table->magic, dcc_backoff_magic,
+                       sizeof dcc_backoff_magic)
+                || table->entry_size != (int) sizeof table->slots[0]
+                || table->n_slots != DCC_BACKOFF_SLOTS) {
+                rs_trace("initializing %s", dcc_breakers_fname);
+                memset(table, 0, sizeof *table);
+                memcpy(table->magic, dcc_backoff_magic,
+                       sizeof dcc_backoff_magic);
+                table->entry_size = (int) sizeof table->slots[0];
+                table->n_slots = DCC_BACKOFF_SLOTS;
+            }
+            dcc_breakers = table;
+        }
+    }
+
+    dcc_unlock(lock_fd);
+    dcc_close(fd);
+    return ret;
+}
+
+
+/**
+ * Can the slot of @p b be given to another host?
+ **/
+static int dcc_breaker_is_stale(const struct dcc_breaker *b, time_t now)
+{
+    long longest;
+
+    longest = (long) dcc_backoff_period << DCC_BACKOFF_MAX_DOUBLINGS;
+    return b->failures == 0 && now - b->changed > longest * 5 / 4;
+}
+
+
 /**
- * Remember that this host is working OK.
+ * Find the breaker of @p host, or if @p create, a slot for it: a free one,
+ * or one whose breaker is stale.  Creating a breaker needs the lock.
  *
- * For the moment this just means removing any backoff timer scored against
- * it.
+ * @returns NULL if the host has none, or the table is full.
+ **/
+static struct dcc_breaker *dcc_find_breaker(const struct dcc_hostdef *host,
+                                            int create)
+{
+    struct dcc_breaker *b, *reuse = NULL;
+    const char *key = host->hostdef_string;
+    unsigned long hash = 5381;
+    const char *p;
+    time_t now = 0;
+    int i;
+
+    if (dcc_map_breakers())
+        return NULL;
+    if (strlen(key) >= sizeof b->key) {
+        rs_trace("no backoff for %s: name too long", key);
+        return NULL;
+    }
+    if (create)
+        now = time(NULL);
+
+    /* Slots are never emptied once used, so that a search can stop at the
+     * first empty one; a stale breaker's slot is taken over in place. */
+    for (p = key; *p; p++)
+        hash = hash * 33 + (unsigned char) *p;
+    for (i = 0; i < DCC_BACKOFF_SLOTS; i++) {
+        b = &dcc_breakers->slots[(hash + i) % DCC_BACKOFF_SLOTS];
+        if (!strcmp(b->key, key))
+            return b;
+        if (!b->key[0])
+            break;
+        if (create && !reuse && dcc_breaker_is_stale(b, now))
+            reuse = b;
+    }
+    if (!create)
+        return NULL;
+    if (!reuse && i < DCC_BACKOFF_SLOTS)
+        reuse = b;
+    if (!reuse) {
+        rs_log_warning("no backoff for %s: all %d slots of %s are in use",
+                       key, DCC_BACKOFF_SLOTS, dcc_breakers_fname);
+        return NULL;
+    }
+    memset(reuse, 0, sizeof *reuse);
+    strcpy(reuse->key, key);
+    return reuse;
+}
+
+
+/**
+ * Remember that this host is working OK, closing its breaker.
  **/
 int dcc_enjoyed_host(const struct dcc_hostdef *host)
 {
-    /* special-case: if DISTCC_BACKOFF_PERIOD==0, don't manage backoff files */
+    struct dcc_breaker *b;
+    int lock_fd, ret;
+
+    /* special-case: if DISTCC_BACKOFF_PERIOD==0, don't manage backoff */
     if (!dcc_backoff_is_enabled())
         return 0;
 
-    return dcc_remove_timefile("backoff", host);
+    /* The usual case, checked without the lock: nothing to forget. */
+    if (!(b = dcc_find_breaker(host, 0)) || b->failures == 0)
+        return 0;
+
+    if ((ret = dcc_lock_breakers(&lock_fd)))
+        return ret;
+    /* The slot may have been given to another host meanwhile. */
+    if (!strcmp(b->key, host->hostdef_string) && b->failures) {
+        rs_trace("%s is working again", host->hostdef_string);
+        b->failures = 0;
+        b->open_until = b->probe_until = 0;
+        b->changed = time(NULL);
+    }
+    return dcc_unlock(lock_fd);
 }
 
+
+/**
+ * Remember that this host failed, opening its breaker for longer each
+ * time.
+ **/
 int dcc_disliked_host(const struct dcc_hostdef *host)
 {
-    /* special-case: if DISTCC_BACKOFF_PERIOD==0, don't manage backoff files */
+    struct dcc_breaker *b;
+    time_t now;
+    long period;
+    int lock_fd, ret, doublings;
+
+    /* special-case: if DISTCC_BACKOFF_PERIOD==0, don't manage backoff */
     if (!dcc_backoff_is_enabled())
 	return 0;
 
-    /* i hate you (but only for dcc_backoff_period seconds) */
-    return dcc_mark_timefile("backoff", host);
+    if ((ret = dcc_map_breakers()))
+        return ret;
+    if ((ret = dcc_lock_breakers(&lock_fd)))
+        return ret;
+    if ((b = dcc_find_breaker(host, 1)) != NULL) {
+        now = time(NULL);
+        /* Several jobs may fail on a host at about the same time; count
+         * only the first of them. */
+        if (b->open_until <= now)
+            b->failures++;
+        doublings = b->failures - 1;
+        if (doublings > DCC_BACKOFF_MAX_DOUBLINGS)
+            doublings = DCC_BACKOFF_MAX_DOUBLINGS;
+        period = (long) dcc_backoff_period << doublings;
+        /* Somewhere between three quarters and five quarters of it. */
+        period = period * 3 / 4
+            + (long) (((unsigned long) getpid() * 2654435761UL + now)
+                      % (unsigned long) (period / 2 + 1));
+        if (period < 1)
+            period = 1;
+        b->open_until = now + period;
+        b->probe_until = 0;
+        b->changed = now;
+        rs_trace("backing off from %s for %lds (failure %d)",
+                 host->hostdef_string, period, b->failures);
+    }
+    return dcc_unlock(lock_fd);
 }
 
 
+/**
+ * Can @p host be used?  A host whose breaker is half-open can, but it is
+ * only used once a job claims the probe with dcc_claim_probe(), which may
+ * find that another client got there first.
+ **/
 static int dcc_check_backoff(struct dcc_hostdef *host)
 {
-    int ret;
-    time_t mtime;
+    struct dcc_breaker *b;
+    time_t now;
 
-    if ((ret = dcc_check_timefile("backoff", host, &mtime)))
-        return ret;
+    if (!(b = dcc_find_breaker(host, 0)) || b->failures == 0)
+        return 0;
 
-    if (difftime(time(NULL), mtime) < (double) dcc_backoff_period) {
+    now = time(NULL);
+    if (b->open_until > now || b->probe_until > now) {
         rs_trace("still in backoff period for %s", host->hostdef_string);
         return EXIT_BUSY;
     }
-
     return 0;
 }
 
 
+/**
+ * A slot of @p host has been locked for a job.  If the host's breaker is
+ * half-open, claim the probe for this job.
+ *
+ * This is done only for the host that is actually used, and not while the
+ * host list is checked, so that a probe is never claimed for a job that then
+ * goes elsewhere, keeping the host away from every client for another
+ * backoff period.
+ *
+ * @returns EXIT_BUSY if the host must not be used after all, because another
+ * client claimed the probe, or the host failed again, since it was checked.
+ **/
+int dcc_claim_probe(const struct dcc_hostdef *host)
+{
+    struct dcc_breaker *b;
+    time_t now;
+    int lock_fd, ret;
+
+    if (!dcc_backoff_is_enabled())
+        return 0;
+
+    if (!(b = dcc_find_breaker(host, 0)) || b->failures == 0)
+        return 0;
+
+    if ((ret = dcc_lock_breakers(&lock_fd)))
+        return ret;
+    now = time(NULL);
+    if (strcmp(b->key, host->hostdef_string) || b->failures == 0) {
+        ret = 0;
+    } else if (b->open_until > now || b->probe_until > now) {
+        rs_trace("still in backoff period for %s", host->hostdef_string);
+        ret = EXIT_BUSY;
+    } else {
+        /* Give the probe as long as a backoff period to finish. */
+        b->probe_until = now + dcc_backoff_period;
+        rs_trace("letting one probe through to %s", host->hostdef_string);
+        ret = 0;
+    }
+    dcc_unlock(lock_fd);
+    return ret;
+}
+
+
 /**
  * Walk through @p hostlist and remove any hosts that are marked unavailable.
  **/
@@ -0,0 +1,735 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Compile everything in a compilation database.
+ *
+ * "distcc --batch compile_commands.json" runs every command in a JSON
+ * compilation database, as written by CMake, Meson or Bear, from a single
+ * client process.  It forks one worker per job, up to the number of slots in
+ * the host list (as "distcc -j" shows), so that distcc is not exec'd again
+ * for each translation unit, and while some workers preprocess or scan
+ * includes the others are compiling remotely.  Each worker still reads the
+ * host list, takes its locks and connects as a separate distcc would.
+ *
+ * Each worker's output is captured, and shown once all the jobs before it
+ * have finished, so that it comes out in the order of the database however
+ * the jobs overlap.  The output of a job that finishes before those ahead of
+ * it is moved into one spill file, so that however long the head job takes,
+ * only the running jobs hold files open.
+ *
+ * As with make, no more jobs are started after one fails.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "compile.h"
+#include "implicit.h"
+#include "emaillog.h"
+#include "batch.h"
+
+
+enum dcc_batch_state {
+    DCC_BATCH_WAITING,
+    DCC_BATCH_RUNNING,
+    DCC_BATCH_DONE
+};
+
+struct dcc_batch_job {
+    char *directory;
+    char *file;
+    char **argv;
+    enum dcc_batch_state state;
+    pid_t pid;
+    FILE *out, *err;            /* what the worker wrote */
+    long spill_at;              /* or where it was moved to in the spill */
+    long out_len, err_len;      /* file, and how long each part is */
+    int ret;
+};
+
+/* A position in the compilation database being read. */
+struct dcc_json {
+    const char *fname;
+    const char *start, *p, *end;
+};
+
+
+static int dcc_json_error(struct dcc_json *j, const char *what)
+{
+    rs_log_error("%s: %s at offset %ld", j->fname, what,
+                 (long) (j->p - j->start));
+    return EXIT_BAD_ARGUMENTS;
+}
+
+
+static void dcc_json_skip_space(struct dcc_json *j)
+{
+    while (j->p < j->end
+           && (*j->p == ' ' || *j->p == '\t' || *j->p == '\n'
+               || *j->p == '\r'))
+        j->p++;
+}
+
+
+/**
+ * Consume @p c, after any white space.
+ **/
+static int dcc_json_expect(struct dcc_json *j, char c)
+{
+    dcc_json_skip_space(j);
+    if (j->p >= j->end || *j->p != c) {
+        char what[32];
+        snprintf(what, sizeof what, "expected '%c'", c);
+        return dcc_json_error(j, what);
+    }
+    j->p++;
+    return 0;
+}
+
+
+/**
+ * Return 1 and consume @p c if it comes next, after any white space.
+ **/
+static int dcc_json_accept(struct dcc_json *j, char c)
+{
+    dcc_json_skip_space(j);
+    if (j->p < j->end && *j->p == c) {
+        j->p++;
+        return 1;
+    }
+    return 0;
+}
+
+
+static int dcc_json_hex4(struct dcc_json *j, unsigned *u)
+{
+    int i;
+
+    *u = 0;
+    for (i = 0; i < 4; i++, j->p++) {
+        char c = j->p < j->end ? *j->p : '\0';
+
+        *u <<= 4;
+        if (c >= '0' && c <= '9')
+            *u |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *u |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *u |= c - 'A' + 10;
+        else
+            return dcc_json_error(j, "bad \\u escape");
+    }
+    return 0;
+}
+
+
+/**
+ * Read a string.  If @p s is not NULL, it is set to a newly allocated copy
+ * with the escapes undone.
+ **/
+static int dcc_json_string(struct dcc_json *j, char **s)
+{
+    const char *begin;
+    char *out;
+    int ret;
+
+    if ((ret = dcc_json_expect(j, '"')))
+        return ret;
+
+    /* The unescaped string is never longer than the escaped one. */
+    for (begin = j->p; j->p < j->end && *j->p != '"'; j->p++)
+        if (*j->p == '\\')
+            j->p++;
+    if (j->p >= j->end)
+        return dcc_json_error(j, "unterminated string");
+    if (s == NULL) {
+        j->p++;
+        return 0;
+    }
+    if (!(*s = out = malloc(j->p - begin + 1))) {
+        rs_log_error("failed to allocate string");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (j->p = begin; *j->p != '"'; j->p++) {
+        unsigned u, lo;
+
+        if (*j->p != '\\') {
+            *out++ = *j->p;
+            continue;
+        }
+        switch (*++j->p) {
+        case 'b': *out++ = '\b'; break;
+        case 'f': *out++ = '\f'; break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        case 't': *out++ = '\t'; break;
+        case 'u':
+            j->p++;
+            if ((ret = dcc_json_hex4(j, &u)))
+                goto fail;
+            if (u >= 0xd800 && u < 0xdc00 && j->end - j->p >= 6
+                && j->p[0] == '\\' && j->p[1] == 'u') {
+                j->p += 2;
+                if ((ret = dcc_json_hex4(j, &lo)))
+                    goto fail;
+                u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            j->p--;
+            /* Encode as UTF-8; escapes are never shorter than this. */
+            if (u < 0x80) {
+                *out++ = (char) u;
+            } else if (u < 0x800) {
+                *out++ = (char) (0xc0 | (u >> 6));
+                *out++ = (char) (0x80 | (u & 0x3f));
+            } else if (u < 0x10000) {
+                *out++ = (char) (0xe0 | (u >> 12));
+                *out++ = (char) (0x80 | ((u >> 6) & 0x3f));
+                *out++ = (char) (0x80 | (u & 0x3f));
+            } else {
+                *out++ = (char) (0xf0 | (u >> 18));
+                *out++ = (char) (0x80 | ((u >> 12) & 0x3f));
+                *out++ = (char) (0x80 | ((u >> 6) & 0x3f));
+                *out++ = (char) (0x80 | (u & 0x3f));
+            }
+            break;
+        default:
+            /* '"', '\\' and '/' stand for themselves. */
+            *out++ = *j->p;
+            break;
+        }
+    }
+    *out = '\0';
+    j->p++;
+    return 0;
+
+  fail:
+    free(*s);
+    *s = NULL;
+    return ret;
+}
+
+
+/**
+ * Skip a value of any type.
+ **/
+static int dcc_json_skip_value(struct dcc_json *j)
+{
+    int ret;
+
+    dcc_json_skip_space(j);
+    if (j->p >= j->end)
+        return dcc_json_error(j, "unexpected end");
+
+    if (*j->p == '"')
+        return dcc_json_string(j, NULL);
+    if (dcc_json_accept(j, '[')) {
+        if (dcc_json_accept(j, ']'))
+            return 0;
+        do {
+            if ((ret = dcc_json_skip_value(j)))
+                return ret;
+        } while (dcc_json_accept(j, ','));
+        return dcc_json_expect(j, ']');
+    }
+    if (dcc_json_accept(j, '{')) {
+        if (dcc_json_accept(j, '}'))
+            return 0;
+        do {
+            if ((ret = dcc_json_string(j, NULL))
+                || (ret = dcc_json_expect(j, ':'))
+                || (ret = dcc_json_skip_value(j)))
+                return ret;
+        } while (dcc_json_accept(j, ','));
+        return dcc_json_expect(j, '}');
+    }
+    /* A number, true, false or null. */
+    if (!strchr("-0123456789tfn", *j->p))
+        return dcc_json_error(j, "unexpected character");
+    while (j->p < j->end && strchr("+-.0123456789eEtruefalsn", *j->p))
+        j->p++;
+    return 0;
+}
+
+
+/**
+ * Read an array of strings into a NULL-terminated argv.
+ **/
+static int dcc_json_string_array(struct dcc_json *j, char ***argv)
+{
+    int n = 0, size = 16, ret;
+
+    if ((ret = dcc_json_expect(j, '[')))
+        return ret;
+    if (!(*argv = malloc(size * sizeof **argv))) {
+        rs_log_error("failed to allocate argv");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    (*argv)[0] = NULL;
+    if (dcc_json_accept(j, ']'))
+        return 0;
+    do {
+        if (n + 1 >= size) {
+            char **bigger = realloc(*argv, (size *= 2) * sizeof **argv);
+            if (!bigger) {
+                rs_log_error("failed to allocate argv");
+                return EXIT_OUT_OF_MEMORY;
+            }
+            *argv = bigger;
+        }
+        if ((ret = dcc_json_string(j, &(*argv)[n])))
+            return ret;
+        (*argv)[++n] = NULL;
+    } while (dcc_json_accept(j, ','));
+    return dcc_json_expect(j, ']');
+}
+
+
+/**
+ * Split a "command" entry into words, the way the shell would if it did
+ * nothing but quoting.
+ **/
+static int dcc_batch_split_command(const char *cmd, char ***argv)
+{
+    size_t len = strlen(cmd);
+    char *word;
+    int n = 0;
+
+    /* Neither the number of words nor any one word can be longer than the
+     * command. */
+    if (!(*argv = calloc(len / 2 + 2, sizeof **argv))) {
+        rs_log_error("failed to allocate argv");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (;;) {
+        char *out;
+        char quote = 0;
+
+        while (*cmd == ' ' || *cmd == '\t' || *cmd == '\n')
+            cmd++;
+        if (!*cmd)
+            break;
+        if (!(word = out = malloc(len + 1))) {
+            rs_log_error("failed to allocate argument");
+            return EXIT_OUT_OF_MEMORY;
+        }
+        for (; *cmd; cmd++) {
+            if (quote == '\'') {
+                if (*cmd == '\'')
+                    quote = 0;
+                else
+                    *out++ = *cmd;
+            } else if (quote == '"') {
+                if (*cmd == '"')
+                    quote = 0;
+                else if (*cmd == '\\' && cmd[1] && strchr("\"\\$`", cmd[1]))
+                    *out++ = *++cmd;
+                else
+                    *out++ = *cmd;
+            } else if (*cmd == ' ' || *cmd == '\t' || *cmd == '\n') {
+                break;
+            } else if (*cmd == '\'' || *cmd == '"') {
+                quote = *cmd;
+            } else if (*cmd == '\\' && cmd[1]) {
+                *out++ = *++cmd;
+            } else {
+                *out++ = *cmd;
+            }
+        }
+        *out = '\0';
+        (*argv)[n++] = word;
+    }
+    (*argv)[n] = NULL;
+    return 0;
+}
+
+
+/**
+ * Read one entry of the database.  Entries with no "directory" run in the
+ * current directory.
+ **/
+static int dcc_json_entry(struct dcc_json *j, struct dcc_batch_job *job)
+{
+    char *key, *command = NULL;
+    int ret;
+
+    memset(job, 0, sizeof *job);
+    if ((ret = dcc_json_expect(j, '{')))
+        return ret;
+    if (!dcc_json_accept(j, '}')) {
+        do {
+            if ((ret = dcc_json_string(j, &key))
+                || (ret = dcc_json_expect(j, ':')))
+                return ret;
+            if (!strcmp(key, "directory") && !job->directory)
+                ret = dcc_json_string(j, &job->directory);
+            else if (!strcmp(key, "file") && !job->file)
+                ret = dcc_json_string(j, &job->file);
+            else if (!strcmp(key, "arguments") && !job->argv)
+                ret = dcc_json_string_array(j, &job->argv);
+            else if (!strcmp(key, "command") && !command)
+                ret = dcc_json_string(j, &command);
+            else
+                ret = dcc_json_skip_value(j);
+            free(key);
+            if (ret)
+                return ret;
+        } while (dcc_json_accept(j, ','));
+        if ((ret = dcc_json_expect(j, '}')))
+            return ret;
+    }
+
+    /* "arguments" is preferred when both are given. */
+    if (!job->argv && command)
+        ret = dcc_batch_split_command(command, &job->argv);
+    free(command);
+    if (ret)
+        return ret;
+    if (!job->argv || !job->argv[0])
+        return dcc_json_error(j, "entry has no command");
+    return 0;
+}
+
+
+static int dcc_batch_read_file(const char *fname, char **buf, size_t *len)
+{
+    struct stat st;
+    ssize_t r;
+    size_t got = 0;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if (!(*buf = malloc(st.st_size + 1))) {
+        rs_log_error("failed to allocate %ld bytes for %s",
+                     (long) st.st_size, fname);
+        close(fd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    while (got < (size_t) st.st_size
+           && (r = read(fd, *buf + got, st.st_size - got)) > 0)
+        got += r;
+    close(fd);
+    if (got != (size_t) st.st_size) {
+        rs_log_error("failed to read %s", fname);
+        free(*buf);
+        return EXIT_IO_ERROR;
+    }
+    *len = got;
+    return 0;
+}
+
+
+/**
+ * Read the compilation database @p fname into an array of jobs.
+ **/
+static int dcc_batch_parse(const char *fname,
+                           struct dcc_batch_job **jobs, int *n_jobs)
+{
+    struct dcc_json j;
+    char *buf;
+    size_t len;
+    int size = 64, ret;
+
+    *jobs = NULL;
+    *n_jobs = 0;
+    if ((ret = dcc_batch_read_file(fname, &buf, &len)))
+        return ret;
+    j.fname = fname;
+    j.start = j.p = buf;
+    j.end = buf + len;
+
+    if (!(*jobs = malloc(size * sizeof **jobs))) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if ((ret = dcc_json_expect(&j, '[')))
+        goto out;
+    if (!dcc_json_accept(&j, ']')) {
+        do {
+            if (*n_jobs == size) {
+                struct dcc_batch_job *bigger =
+                    realloc(*jobs, (size *= 2) * sizeof **jobs);
+                if (!bigger) {
+                    ret = EXIT_OUT_OF_MEMORY;
+                    goto out;
+                }
+                *jobs = bigger;
+            }
+            if ((ret = dcc_json_entry(&j, &(*jobs)[*n_jobs])))
+                goto out;
+            ++*n_jobs;
+        } while (dcc_json_accept(&j, ','));
+        ret = dcc_json_expect(&j, ']');
+    }
+
+  out:
+    if (ret == EXIT_OUT_OF_MEMORY)
+        rs_log_error("failed to allocate jobs for %s", fname);
+    free(buf);
+    return ret;
+}
+
+
+/**
+ * Start @p job in a child whose output goes to temporary files.
+ **/
+static int dcc_batch_start(struct dcc_batch_job *job, int sg_level)
+{
+    int status, ret;
+
+    if (!(job->out = tmpfile()) || !(job->err = tmpfile())) {
+        rs_log_error("failed to create file for output: %s",
+                     strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((job->pid = fork()) == -1) {
+        rs_log_error("failed to fork: %s", strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    }
+    if (job->pid != 0) {
+        job->state = DCC_BATCH_RUNNING;
+        rs_trace("started job %d for %s", (int) job->pid,
+                 job->file ? job->file : job->argv[0]);
+        return 0;
+    }
+
+    /* In the child. */
+    dup2(fileno(job->out), STDOUT_FILENO);
+    dup2(fileno(job->err), STDERR_FILENO);
+    if (job->directory && chdir(job->directory) == -1) {
+        rs_log_error("failed to chdir to %s: %s", job->directory,
+                     strerror(errno));
+        dcc_exit(EXIT_BAD_ARGUMENTS);
+    }
+    if (strstr(dcc_find_basename(job->argv[0]), "distcc")) {
+        /* The database was written for "distcc gcc ..." or "distcc ...". */
+        char **compiler_args;
+
+        if ((ret = dcc_find_compiler(job->argv, &compiler_args)))
+            dcc_exit(ret);
+        dcc_free_argv(job->argv);
+        job->argv = compiler_args;
+    }
+    ret = dcc_build_somewhere_timed(job->argv, sg_level, &status);
+    dcc_maybe_send_email();
+    dcc_exit(ret);
+    return 0;                   /* not reached */
+}
+
+
+/**
+ * Copy all of @p from to the end of @p to, and close @p from.
+ *
+ * @returns the number of bytes copied.
+ **/
+static long dcc_batch_copy_output(FILE *from, FILE *to)
+{
+    char buf[8192];
+    size_t n;
+    long len = 0;
+
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof buf, from)) > 0) {
+        fwrite(buf, 1, n, to);
+        len += (long) n;
+    }
+    fflush(to);
+    fclose(from);
+    return len;
+}
+
+
+/**
+ * Copy @p len bytes at @p at in @p spill to @p to.
+ **/
+static void dcc_batch_copy_spilled(FILE *spill, long at, long len, FILE *to)
+{
+    char buf[8192];
+    size_t n;
+
+    if (fseek(spill, at, SEEK_SET) == -1)
+        return;
+    while (len > 0
+           && (n = fread(buf, 1, len < (long) sizeof buf
+                         ? (size_t) len : sizeof buf, spill)) > 0) {
+        fwrite(buf, 1, n, to);
+        len -= (long) n;
+    }
+    fflush(to);
+}
+
+
+/**
+ * Move the output of @p job, which finished before a job ahead of it, to
+ * the end of @p *spill, creating it if need be, and close the job's own
+ * files.
+ **/
+static int dcc_batch_spill(struct dcc_batch_job *job, FILE **spill)
+{
+    if ((!*spill && !(*spill = tmpfile()))
+        || fseek(*spill, 0, SEEK_END) == -1
+        || (job->spill_at = ftell(*spill)) == -1) {
+        rs_log_error("failed to spill output: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    job->out_len = dcc_batch_copy_output(job->out, *spill);
+    job->err_len = dcc_batch_copy_output(job->err, *spill);
+    job->out = job->err = NULL;
+    if (ferror(*spill)) {
+        rs_log_error("failed to spill output: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * Run every command in the compilation database @p fname, @p max_running
+ * at a time.
+ *
+ * @returns 0 if they all succeeded, or else the exit code of the failed job
+ * that comes first in the database, which is not necessarily the first to
+ * finish.
+ **/
+int dcc_batch_compile(const char *fname, int max_running, int sg_level)
+{
+    struct dcc_batch_job *jobs;
+    FILE *spill = NULL;
+    int n_jobs, n_running = 0, next_start = 0, next_shown = 0;
+    int i, ret, failed = 0, first_ret = 0;
+
+    if ((ret = dcc_batch_parse(fname, &jobs, &n_jobs)))
+        goto out;
+
+    if (max_running < 1)
+        max_running = 1;
+    rs_trace("%d jobs in %s, running %d at once", n_jobs, fname,
+             max_running);
+
+    for (;;) {
+        int status;
+        pid_t pid;
+
+        while (!failed && n_running < max_running && next_start < n_jobs) {
+            if ((ret = dcc_batch_start(&jobs[next_start], sg_level))) {
+                failed = ret;
+                break;
+            }
+            next_start++;
+            n_running++;
+        }
+        if (n_running == 0)
+            break;
+
+        if ((pid = wait(&status)) == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("wait failed: %s", strerror(errno));
+            failed = ret = EXIT_DISTCC_FAILED;
+            break;
+        }
+        for (i = next_shown; i < next_start; i++)
+            if (jobs[i].state == DCC_BATCH_RUNNING && jobs[i].pid == pid)
+                break;
+        if (i == next_start)
+            continue;           /* not one of ours */
+        n_running--;
+        jobs[i].state = DCC_BATCH_DONE;
+        if (WIFSIGNALED(status))
+            jobs[i].ret = 128 + WTERMSIG(status);
+        else
+            jobs[i].ret = WEXITSTATUS(status);
+        if (jobs[i].ret && !failed)
+            failed = jobs[i].ret;
+
+        /* Show whatever is now complete, in order. */
+        for (; next_shown < next_start
+                 && jobs[next_shown].state == DCC_BATCH_DONE; next_shown++) {
+            struct dcc_batch_job *job = &jobs[next_shown];
+
+            if (job->out) {
+                dcc_batch_copy_output(job->out, stdout);
+                dcc_batch_copy_output(job->err, stderr);
+                job->out = job->err = NULL;
+            } else {
+                dcc_batch_copy_spilled(spill, job->spill_at, job->out_len,
+                                       stdout);
+                dcc_batch_copy_spilled(spill, job->spill_at + job->out_len,
+                                       job->err_len, stderr);
+            }
+            if (job->ret && !first_ret)
+                first_ret = job->ret;
+            if (job->ret)
+                rs_log_error("compile %s failed with exit code %d",
+                             job->file ? job->file : job->argv[0], job->ret);
+        }
+        /* Not shown yet: keep the output, but not the files. */
+        if (i >= next_shown && (ret = dcc_batch_spill(&jobs[i], &spill))
+            && !failed)
+            failed = ret;
+    }
+    ret = first_ret ? first_ret : failed;
+    if (next_start < n_jobs)
+        rs_log_warning("%d jobs in %s not started",
+                       n_jobs - next_start, fname);
+
+  out:
+    if (spill)
+        fclose(spill);
+    for (i = 0; i < n_jobs; i++) {
+        if (jobs[i].out)
+            fclose(jobs[i].out);
+        if (jobs[i].err)
+            fclose(jobs[i].err);
+        free(jobs[i].directory);
+        free(jobs[i].file);
+        if (jobs[i].argv)
+            dcc_free_argv(jobs[i].argv);
+    }
+    free(jobs);
+    return ret;
+}
@@ -0,0 +1,416 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Microbenchmarks for the layers under every compile: the protocol tokens,
+ * file transfer with and without compression, temporary files, host locks
+ * and argument scanning.  Everything runs on this machine, over
+ * socketpairs and in a private DISTCC_DIR, so results are comparable
+ * between runs.  Run it with "make bench-micro"; results are written to
+ * stdout as JSON.
+ *
+ * An optional argument scales the number of iterations of every benchmark.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "rpc.h"
+#include "bulk.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "lock.h"
+#include "timeval.h"
+
+const char *rs_program_name = "benchmicro";
+
+/* Size of the synthetic source file used for transfer and compression. */
+#define CORPUS_SIZE (4 << 20)
+
+static int scale = 1;
+static int n_results;
+
+
+static double dcc_bench_elapsed(struct timeval *start)
+{
+    struct timeval end, delta;
+
+    gettimeofday(&end, NULL);
+    timeval_subtract(&delta, &end, start);
+    return (double) delta.tv_sec + (double) delta.tv_usec / 1e6;
+}
+
+
+/**
+ * Print one result.  @p bytes is the amount of data handled by each
+ * iteration, or 0 if throughput means nothing for this benchmark.
+ **/
+static void dcc_bench_report(const char *name, long iterations,
+                             double secs, size_t bytes)
+{
+    printf("%s    { \"name\": \"%s\", \"iterations\": %ld, "
+           "\"seconds\": %.6f, \"ns_per_op\": %.1f",
+           n_results++ ? ",\n" : "",
+           name, iterations, secs, secs * 1e9 / iterations);
+    if (bytes)
+        printf(", \"bytes_per_op\": %lu, \"mb_per_sec\": %.1f",
+               (unsigned long) bytes,
+               secs > 0 ? (double) bytes * iterations / secs / 1e6 : 0.0);
+    printf(" }");
+    fflush(stdout);
+}
+
+
+/**
+ * Fill @p buf with something that compresses like preprocessed C: runs of
+ * declarations, with identifiers and numbers that don't repeat too often.
+ **/
+static void dcc_bench_make_corpus(char *buf, size_t len)
+{
+    static const char *const types[] = {
+        "int", "unsigned long", "const char *", "struct dcc_hostdef *",
+        "static inline void", "extern double"
+    };
+    unsigned long seed = 42;
+    size_t used = 0;
+
+    while (used < len) {
+        char line[200];
+        int n;
+
+        seed = seed * 1103515245 + 12345;
+        n = snprintf(line, sizeof line,
+                     "%s func_%lu(int arg_%lu, char *name) "
+                     "{ return arg_%lu * %lu + name[%lu]; }\n",
+                     types[(seed >> 16) % 6], (seed >> 8) % 5000,
+                     (seed >> 4) % 50, (seed >> 4) % 50,
+                     (seed >> 12) % 1000, (seed >> 20) % 16);
+        if (n > (int) (len - used))
+            n = (int) (len - used);
+        memcpy(buf + used, line, n);
+        used += n;
+    }
+}
+
+
+static int dcc_bench_write_file(const char *fname, const char *buf,
+                                size_t len)
+{
+    int fd;
+    int ret;
+
+    if ((fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0600)) == -1) {
+        rs_log_error("failed to create %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_writex(fd, buf, len);
+    dcc_close(fd);
+    return ret;
+}
+
+
+static int dcc_bench_tokens(void)
+{
+    int sv[2];
+    long i, n = 200000L * scale;
+    unsigned val;
+    struct timeval start;
+    int ret = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        rs_log_error("socketpair failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_x_token_int(sv[0], "ARGC", (unsigned) i))
+            || (ret = dcc_r_token_int(sv[1], "ARGC", &val)))
+            break;
+    }
+    if (ret == 0)
+        dcc_bench_report("token_round_trip", n, dcc_bench_elapsed(&start), 0);
+    dcc_close(sv[0]);
+    dcc_close(sv[1]);
+    return ret;
+}
+
+
+/**
+ * Send @p fname to ourselves @p n times through a socketpair, with a child
+ * process on the sending side, as a client and server would.
+ **/
+static int dcc_bench_transfer(const char *name, const char *fname,
+                              size_t len, enum dcc_compress compr)
+{
+    int sv[2];
+    long i, n = 50L * scale;
+    unsigned val;
+    char *out_fname;
+    struct timeval start;
+    pid_t pid;
+    int ret = 0, status;
+
+    if ((ret = dcc_make_tmpnam("benchmicro", ".out", &out_fname)))
+        return ret;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        rs_log_error("socketpair failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    gettimeofday(&start, NULL);
+    if ((pid = fork()) == -1) {
+        rs_log_error("fork failed: %s", strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    } else if (pid == 0) {
+        dcc_close(sv[1]);
+        for (i = 0; i < n; i++)
+            if (dcc_x_file(sv[0], fname, "DOTI", compr, NULL))
+                _exit(1);
+        _exit(0);
+    }
+    dcc_close(sv[0]);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_r_token_int(sv[1], "DOTI", &val))
+            || (ret = dcc_r_file(sv[1], out_fname, val, compr)))
+            break;
+    }
+    dcc_close(sv[1]);
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)
+        || WEXITSTATUS(status) != 0)
+        ret = ret ? ret : EXIT_IO_ERROR;
+    if (ret == 0)
+        dcc_bench_report(name, n, dcc_bench_elapsed(&start), len);
+    free(out_fname);
+    return ret;
+}
+
+
+static int dcc_bench_lzo(const char *corpus, size_t len)
+{
+    long i, n = 50L * scale;
+    char *out_buf, *fname;
+    size_t out_len;
+    struct timeval start;
+    int fd, null_fd, ret;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_compress_lzo1x_alloc(corpus, len, &out_buf, &out_len)))
+            return ret;
+        if (i < n - 1)
+            free(out_buf);
+    }
+    dcc_bench_report("lzo_compress", n, dcc_bench_elapsed(&start), len);
+
+    /* Decompress what we compressed last, from a file as if from the
+     * network. */
+    if ((ret = dcc_make_tmpnam("benchmicro", ".lzo", &fname))
+        || (ret = dcc_bench_write_file(fname, out_buf, out_len))) {
+        free(out_buf);
+        return ret;
+    }
+    free(out_buf);
+    if ((fd = open(fname, O_RDONLY)) == -1
+        || (null_fd = open("/dev/null", O_WRONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        free(fname);
+        return EXIT_IO_ERROR;
+    }
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if (lseek(fd, 0, SEEK_SET) == -1
+            || (ret = dcc_r_bulk_lzo1x(null_fd, fd, (unsigned) out_len)))
+            break;
+    }
+    if (ret == 0)
+        dcc_bench_report("lzo_decompress", n, dcc_bench_elapsed(&start),
+                         len);
+    dcc_close(fd);
+    dcc_close(null_fd);
+    free(fname);
+    return ret;
+}
+
+
+static int dcc_bench_tmpnam(void)
+{
+    long i, n = 2000L * scale;
+    char *fname;
+    struct timeval start;
+    int ret;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_make_tmpnam("benchmicro", ".o", &fname)))
+            return ret;
+        free(fname);
+    }
+    dcc_bench_report("make_tmpnam", n, dcc_bench_elapsed(&start), 0);
+    return 0;
+}
+
+
+static int dcc_bench_lock(void)
+{
+    long i, n = 20000L * scale;
+    char *lock_dir, *fname;
+    struct timeval start;
+    int lock_fd, ret;
+
+    /* Make sure the lock file and directory are cleaned up at the end. */
+    if ((ret = dcc_get_lock_dir(&lock_dir))
+        || (ret = dcc_add_cleanup(lock_dir))
+        || (ret = dcc_make_lock_filename("cpu", dcc_hostdef_local, 0,
+                                         &fname)))
+        return ret;
+    if ((ret = dcc_lock_host("cpu", dcc_hostdef_local, 0, 1, &lock_fd))
+        || (ret = dcc_unlock(lock_fd))
+        || (ret = dcc_add_cleanup(fname))) {
+        free(fname);
+        return ret;
+    }
+    free(fname);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_lock_host("cpu", dcc_hostdef_local, 0, 1, &lock_fd))
+            || (ret = dcc_unlock(lock_fd)))
+            return ret;
+    }
+    dcc_bench_report("lock_host", n, dcc_bench_elapsed(&start), 0);
+    return 0;
+}
+
+
+/**
+ * Scan the kind of 300-word command line that big builds produce.
+ **/
+static int dcc_bench_scan_args(void)
+{
+    static const char *const fixed[] = { "gcc", "-c", "-o", "foo.o" };
+    char *argv[301];
+    char bufs[300][40];
+    char *input_file, *output_file, **new_argv;
+    long i, n = 20000L * scale;
+    struct timeval start;
+    int argc, ret;
+
+    for (argc = 0; argc < 299; argc++) {
+        if (argc < 4)
+            snprintf(bufs[argc], sizeof bufs[0], "%s", fixed[argc]);
+        else if (argc % 5 == 0)
+            snprintf(bufs[argc], sizeof bufs[0], "-Isrc/module%d/include",
+                     argc);
+        else if (argc % 5 == 1)
+            snprintf(bufs[argc], sizeof bufs[0], "-DCONFIG_FEATURE_%d=1",
+                     argc);
+        else if (argc % 5 == 2)
+            snprintf(bufs[argc], sizeof bufs[0], "-isystem");
+        else if (argc % 5 == 3)
+            snprintf(bufs[argc], sizeof bufs[0], "/opt/sdk/include/%d",
+                     argc);
+        else
+            snprintf(bufs[argc], sizeof bufs[0], "-Wno-warning-%d", argc);
+        argv[argc] = bufs[argc];
+    }
+    snprintf(bufs[argc], sizeof bufs[0], "foo.c");
+    argv[argc] = bufs[argc];
+    argv[++argc] = NULL;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        if ((ret = dcc_scan_args(argv, &input_file, &output_file,
+                                 &new_argv)))
+            return ret;
+        dcc_free_argv(new_argv);
+    }
+    dcc_bench_report("scan_args_300", n, dcc_bench_elapsed(&start), 0);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *corpus, *corpus_fname, *top_dir;
+    int ret;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_WARNING, NULL, STDERR_FILENO);
+
+    if (argc > 2 || (argc == 2 && (scale = atoi(argv[1])) < 1)) {
+        rs_log_error("usage: %s [SCALE]", argv[0]);
+        return EXIT_BAD_ARGUMENTS;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    atexit(dcc_cleanup_tempfiles);
+
+    /* Keep our locks away from those of any real builds. */
+    if ((ret = dcc_get_new_tmpdir(&top_dir)))
+        return ret;
+    if (setenv("DISTCC_DIR", top_dir, 1) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    if ((corpus = malloc(CORPUS_SIZE)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    dcc_bench_make_corpus(corpus, CORPUS_SIZE);
+    if ((ret = dcc_make_tmpnam("benchmicro", ".i", &corpus_fname))
+        || (ret = dcc_bench_write_file(corpus_fname, corpus, CORPUS_SIZE)))
+        return ret;
+
+    printf("{\n  \"scale\": %d,\n  \"results\": [\n", scale);
+    if ((ret = dcc_bench_tokens())
+        || (ret = dcc_bench_transfer("file_transfer", corpus_fname,
+                                     CORPUS_SIZE, DCC_COMPRESS_NONE))
+        || (ret = dcc_bench_transfer("file_transfer_lzo", corpus_fname,
+                                     CORPUS_SIZE, DCC_COMPRESS_LZO1X))
+        || (ret = dcc_bench_lzo(corpus, CORPUS_SIZE))
+        || (ret = dcc_bench_lock())
+        || (ret = dcc_bench_scan_args())
+        || (ret = dcc_bench_tmpnam())) {
+        rs_log_error("benchmark failed: %d", ret);
+        return ret;
+    }
+    printf("\n  ]\n}\n");
+
+    free(corpus);
+    free(corpus_fname);
+    return 0;
+}
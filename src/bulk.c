@@ -161,6 +161,42 @@ static int dcc_x_file_lzo1x(int out_fd,
 }
 
 
+/**
+ * Transmit @p len bytes from memory at @p buf to the network, in the same
+ * form as dcc_x_file() sends a file.
+ **/
+int dcc_x_buf(int ofd,
+              const char *buf,
+              size_t len,
+              const char *token,
+              enum dcc_compress compression)
+{
+    int ret;
+    char *out_buf = NULL;
+    size_t out_len;
+
+    rs_trace("send %lu byte buffer with token %s and compression %d",
+             (unsigned long) len, token, compression);
+
+    if (compression == DCC_COMPRESS_NONE || len == 0) {
+        /* As in dcc_x_file_lzo1x(), send 0 as 0 */
+        if ((ret = dcc_x_token_int(ofd, token, len)))
+            return ret;
+        return len ? dcc_writex(ofd, buf, len) : 0;
+    } else if (compression == DCC_COMPRESS_LZO1X) {
+        if ((ret = dcc_compress_lzo1x_alloc(buf, len, &out_buf, &out_len)))
+            return ret;
+        if ((ret = dcc_x_token_int(ofd, token, out_len)) == 0)
+            ret = dcc_writex(ofd, out_buf, out_len);
+        free(out_buf);
+        return ret;
+    } else {
+        rs_log_error("invalid compression");
+        return EXIT_PROTOCOL_ERROR;
+    }
+}
+
+
 /**
  * Transmit from a local file to the network.  Sends TOKEN, LENGTH, BODY,
  * where the length is the appropriate compressed length.
@@ -360,9 +396,7 @@ int dcc_copy_file_to_fd(const char *in_fname, int out_fd)
     ret = dcc_pump_readwrite(out_fd, ifd, (size_t) len);
 #endif
 
-    if (ret) {
+    if (ifd != -1)
         close(ifd);
-        return ret;
-    }
-    return 0;
+    return ret;
 }
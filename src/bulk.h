@@ -28,6 +28,8 @@ int dcc_r_fifo(int ifd, const char *fifo_name, size_t len);
 int dcc_x_file(int ofd, const char *fname, const char *token,
                enum dcc_compress compression,
                off_t *);
+int dcc_x_buf(int ofd, const char *buf, size_t len, const char *token,
+              enum dcc_compress compression);
 
 int dcc_r_file_timed(int ifd, const char *fname, unsigned size,
                      enum dcc_compress);
@@ -41,11 +43,16 @@ int dcc_open_read(const char *fname, int *ifd, off_t *fsize);
 int dcc_copy_file_to_fd(const char *in_fname, int out_fd);
 
 /* clirpc.c */
+struct dcc_hostdef;
 int dcc_x_many_files(int ofd,
                      unsigned int n_files,
-                     char **fnames);
+                     char **fnames,
+                     const struct dcc_hostdef *host,
+                     const char *compiler);
 
 /* srvrpc.c */
+struct dcc_pch_file;
 int dcc_r_many_files(int in_fd,
                      const char *dirname,
-                     enum dcc_compress compr);
+                     enum dcc_compress compr,
+                     struct dcc_pch_file **pch_files);
@@ -0,0 +1,805 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Local cache of compilation results.
+ *
+ * Builds compile the same translation units over and over again: after
+ * "make clean", after switching branches, or in several checkouts of one
+ * tree.  When DISTCC_CACHE_SIZE is set, distcc keeps the results it gets back
+ * from servers in $DISTCC_DIR/cache, under a key computed from everything
+ * that determines them: the preprocessed source (or, in pump mode, the files
+ * chosen by the include server), the arguments sent to the server, and the
+ * identity of the compiler.  A later compilation with the same key is
+ * satisfied from the cache without choosing a host at all.
+ *
+ * An entry consists of files named after the key, in a subdirectory named
+ * after its first two digits: KEY.stderr holds the compiler's messages,
+ * KEY.d the dependency file if the server produced one, and KEY.o the object.
+ * KEY.o is written last, so its presence marks a complete entry.  Hits touch
+ * it, and when the cache grows beyond its limit the entries that were used
+ * least recently are removed first.
+ *
+ * The cache is split into 16 shards by the first digit of the key, so that
+ * concurrent compilations seldom wait for each other.  Shard X owns the
+ * subdirectories X0 to Xf, its counters are kept in the text file "stats.X",
+ * which is only rewritten while it is locked, and it gets a sixteenth of the
+ * size limit.  A shard that has outgrown its share is trimmed by whichever
+ * client gets the lock on "trim.X" first; the others carry on.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "bulk.h"
+#include "lock.h"
+#include "md5.h"
+#include "pch.h"
+#include "include_server_if.h"
+#include "cache.h"
+
+
+/* Bump this whenever the meaning of a key changes. */
+static const char *const dcc_cache_version = "distcc-cache-1";
+
+/* Temporary files left behind by interrupted stores are removed once they
+ * are this old. */
+static const time_t dcc_cache_tmp_max_age = 3600;
+
+enum dcc_cache_counter {
+    DCC_CACHE_HITS,
+    DCC_CACHE_MISSES,
+    DCC_CACHE_STORES,
+    DCC_CACHE_EVICTIONS,
+    DCC_CACHE_BYTES,
+    DCC_CACHE_N_COUNTERS
+};
+
+static const char *const dcc_cache_counter_names[DCC_CACHE_N_COUNTERS] = {
+    "hits", "misses", "stores", "evictions", "bytes"
+};
+
+#define DCC_CACHE_SHARDS 16
+
+
+/**
+ * Return the size limit from DISTCC_CACHE_SIZE, in bytes, or 0 if the cache
+ * is disabled.
+ **/
+static long long dcc_cache_max_size(void)
+{
+    const char *size = getenv("DISTCC_CACHE_SIZE");
+    long long megabytes;
+
+    if (!size)
+        return 0;
+    megabytes = atoll(size);
+    if (megabytes <= 0)
+        return 0;
+    return megabytes * 1024 * 1024;
+}
+
+
+int dcc_cache_enabled(void)
+{
+    return dcc_cache_max_size() > 0;
+}
+
+
+static int dcc_get_cache_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = dcc_get_subdir("cache", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+/**
+ * Return the name of the file of entry @p key with @p suffix, making sure
+ * that its directory exists.
+ **/
+static int dcc_cache_entry_name(const char *key, const char *suffix,
+                                char **name_ret)
+{
+    char *dir, *subdir;
+    int ret;
+
+    if ((ret = dcc_get_cache_dir(&dir)))
+        return ret;
+    if (asprintf(&subdir, "%s/%.2s", dir, key) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = dcc_mkdir(subdir);
+    if (ret == 0 && asprintf(name_ret, "%s/%s%s", subdir, key, suffix) == -1) {
+        rs_log_error("asprintf failed");
+        ret = EXIT_OUT_OF_MEMORY;
+    }
+    free(subdir);
+    return ret;
+}
+
+
+/* Strings are hashed with their terminating NUL, so that consecutive strings
+ * cannot run into each other. */
+static void dcc_hash_string(struct dcc_md5 *md5, const char *s)
+{
+    dcc_md5_update(md5, s, strlen(s) + 1);
+}
+
+
+static int dcc_hash_file(struct dcc_md5 *md5, const char *fname)
+{
+    char buf[65536];
+    char size[32];
+    struct stat st;
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY|O_BINARY)) == -1
+        || fstat(fd, &st) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return EXIT_IO_ERROR;
+    }
+    snprintf(size, sizeof size, "%lld", (long long) st.st_size);
+    dcc_hash_string(md5, size);
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+        dcc_md5_update(md5, buf, n);
+    if (n == -1) {
+        rs_log_error("failed to read %s: %s", fname, strerror(errno));
+        close(fd);
+        return EXIT_IO_ERROR;
+    }
+    close(fd);
+    return 0;
+}
+
+
+/**
+ * Hash the identity of @p compiler: where it is, how big it is and when it
+ * was last changed.  Upgrading the compiler thus invalidates the cache.
+ **/
+static void dcc_hash_compiler(struct dcc_md5 *md5, const char *compiler)
+{
+    char *path = NULL;
+    char buf[64];
+    struct stat st;
+
+    if (strchr(compiler, '/') == NULL && dcc_which(compiler, &path) == 0)
+        compiler = path;
+    dcc_hash_string(md5, compiler);
+    if (stat(compiler, &st) == 0) {
+        snprintf(buf, sizeof buf, "%lld %lld",
+                 (long long) st.st_size, (long long) st.st_mtime);
+        dcc_hash_string(md5, buf);
+    }
+    free(path);
+}
+
+
+/**
+ * Hash the files that the include server chose to send, the way
+ * dcc_x_many_files() sends them.
+ **/
+static int dcc_hash_manifest(struct dcc_md5 *md5, char **files)
+{
+    char link_points_to[MAXPATHLEN + 1];
+    char digest[DCC_PCH_DIGEST_LEN + 1];
+    char *original_fname;
+    int is_link;
+    int ret;
+
+    for (; *files != NULL; ++files) {
+        if ((ret = dcc_get_original_fname(*files, &original_fname)))
+            return ret;
+        dcc_hash_string(md5, original_fname);
+        free(original_fname);
+
+        if (str_endswith("/forcing_technique_271828", *files))
+            continue;
+        /* Precompiled headers are big, and known by their digest. */
+        if (dcc_pch_read_digest(*files, digest) == 0) {
+            dcc_hash_string(md5, "PCH");
+            dcc_hash_string(md5, digest);
+            continue;
+        }
+        if ((ret = dcc_is_link(*files, &is_link)))
+            return ret;
+        if (is_link) {
+            if ((ret = dcc_read_link(*files, link_points_to)))
+                return ret;
+            dcc_hash_string(md5, "LINK");
+            dcc_hash_string(md5, link_points_to);
+        } else if ((ret = dcc_hash_file(md5, *files))) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Compute the cache key of a compilation.
+ *
+ * @param server_argv The arguments that would be sent to the server.  The
+ * name of the output file is left out, so that results can be shared between
+ * trees.
+ *
+ * @param cpp_fname The preprocessed source, or NULL in pump mode.
+ *
+ * @param files In pump mode, the files chosen by the include server.
+ *
+ * @param key_ret On return, a newly allocated string of hexadecimal digits.
+ **/
+int dcc_cache_key(char **server_argv,
+                  const char *cpp_fname,
+                  char **files,
+                  char **key_ret)
+{
+    struct dcc_md5 md5;
+    unsigned char digest[DCC_MD5_DIGEST_LEN];
+    char cwd[MAXPATHLEN];
+    int needs_cwd = (cpp_fname == NULL);
+    int ret;
+    int i;
+
+    dcc_md5_init(&md5);
+    dcc_hash_string(&md5, dcc_cache_version);
+    dcc_hash_compiler(&md5, server_argv[0]);
+
+    for (i = 0; server_argv[i]; i++) {
+        if (!strcmp(server_argv[i], "-o")) {
+            if (server_argv[i+1])
+                i++;
+            continue;
+        }
+        if (str_startswith("-o", server_argv[i]))
+            continue;
+        /* Debug information records the compilation directory. */
+        if (str_startswith("-g", server_argv[i]))
+            needs_cwd = 1;
+        dcc_hash_string(&md5, server_argv[i]);
+    }
+
+    if (needs_cwd) {
+        if (!getcwd(cwd, sizeof cwd)) {
+            rs_log_error("getcwd failed: %s", strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        dcc_hash_string(&md5, "CWD");
+        dcc_hash_string(&md5, cwd);
+    }
+
+    if (cpp_fname)
+        ret = dcc_hash_file(&md5, cpp_fname);
+    else
+        ret = dcc_hash_manifest(&md5, files);
+    if (ret)
+        return ret;
+
+    dcc_md5_final(&md5, digest);
+
+    if ((*key_ret = malloc(2 * DCC_MD5_DIGEST_LEN + 1)) == NULL) {
+        rs_log_error("malloc failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < DCC_MD5_DIGEST_LEN; i++)
+        sprintf(*key_ret + 2 * i, "%02x", digest[i]);
+    rs_trace("cache key %s", *key_ret);
+    return 0;
+}
+
+
+/**
+ * Find out when the entry that the part @p fname belongs to was last used.
+ *
+ * @retval 0 if the entry is complete
+ * @retval -1 if @p fname is an orphan: left over from an interrupted store,
+ * or from an entry that has been removed.
+ **/
+static int dcc_cache_entry_mtime(const char *fname, time_t *mtime)
+{
+    const char *dot = strrchr(fname, '/');
+    char *object;
+    struct stat st;
+    int ret = -1;
+
+    if (dot)
+        dot = strchr(dot, '.');
+    if (!dot || strstr(dot, ".tmp"))
+        return -1;
+    if (asprintf(&object, "%.*s.o", (int) (dot - fname), fname) == -1)
+        return -1;
+    if (stat(object, &st) == 0) {
+        *mtime = st.st_mtime;
+        ret = 0;
+    }
+    free(object);
+    return ret;
+}
+
+
+struct dcc_cache_file {
+    char *fname;
+    time_t atime;               /* when the entry was last used */
+    off_t size;
+};
+
+
+static int dcc_cache_file_cmp(const void *a, const void *b)
+{
+    const struct dcc_cache_file *fa = a, *fb = b;
+
+    if (fa->atime != fb->atime)
+        return fa->atime < fb->atime ? -1 : 1;
+    /* Remove the object, which marks the entry complete, first. */
+    return str_endswith(".o", fb->fname) - str_endswith(".o", fa->fname);
+}
+
+
+/**
+ * Which shard does entry @p key belong to?
+ **/
+static int dcc_cache_shard(const char *key)
+{
+    int c = key[0];
+
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return (c - '0') & (DCC_CACHE_SHARDS - 1);
+}
+
+
+/**
+ * Remove the least recently used entries of @p shard until they take up no
+ * more than @p target bytes.  Called with the shard's trim lock held.
+ *
+ * @param keep The key of an entry that must stay, because it was just
+ * stored; with timestamps only accurate to the second it might otherwise
+ * look as old as any other.
+ *
+ * @param total On return, the bytes that the shard takes up.
+ *
+ * @param evictions On return, how many entries were removed.
+ **/
+static int dcc_cache_trim(const char *dir, int shard, long long target,
+                          const char *keep, long long *total,
+                          long long *evictions)
+{
+    struct dcc_cache_file *files = NULL;
+    size_t n_files = 0, max_files = 0, i;
+    time_t now = time(NULL);
+    int sub;
+
+    *total = *evictions = 0;
+    for (sub = shard * 16; sub < shard * 16 + 16; sub++) {
+        char *subdir;
+        DIR *d;
+        struct dirent *de;
+
+        if (asprintf(&subdir, "%s/%02x", dir, sub) == -1)
+            break;
+        if ((d = opendir(subdir)) == NULL) {
+            free(subdir);
+            continue;
+        }
+        while ((de = readdir(d)) != NULL) {
+            struct dcc_cache_file f;
+            struct stat st;
+
+            if (de->d_name[0] == '.')
+                continue;
+            if (asprintf(&f.fname, "%s/%s", subdir, de->d_name) == -1)
+                continue;
+            if (lstat(f.fname, &st) == -1) {
+                free(f.fname);
+                continue;
+            }
+            f.size = st.st_size;
+            f.atime = st.st_mtime;
+            *total += f.size;
+            if (keep && str_startswith(keep, de->d_name)) {
+                free(f.fname);
+                continue;
+            }
+            if (strstr(de->d_name, ".tmp")
+                && now - st.st_mtime < dcc_cache_tmp_max_age) {
+                /* Probably still being written. */
+                free(f.fname);
+                continue;
+            }
+            /* The other parts of an entry go along with its object;
+             * orphans go first. */
+            if (dcc_cache_entry_mtime(f.fname, &f.atime))
+                f.atime = 0;
+            if (n_files == max_files) {
+                struct dcc_cache_file *more;
+                max_files = max_files ? 2 * max_files : 256;
+                more = realloc(files, max_files * sizeof *files);
+                if (!more) {
+                    free(f.fname);
+                    break;
+                }
+                files = more;
+            }
+            files[n_files++] = f;
+        }
+        closedir(d);
+        free(subdir);
+    }
+
+    qsort(files, n_files, sizeof *files, dcc_cache_file_cmp);
+
+    for (i = 0; i < n_files; i++) {
+        time_t unused;
+
+        /* Objects sort before the other parts of their entries, so those
+         * are orphaned by now if their object was removed. */
+        if (*total > target
+            || dcc_cache_entry_mtime(files[i].fname, &unused)) {
+            if (unlink(files[i].fname) == 0 || errno == ENOENT) {
+                *total -= files[i].size;
+                if (str_endswith(".o", files[i].fname))
+                    (*evictions)++;
+            } else {
+                rs_log_warning("failed to remove %s: %s", files[i].fname,
+                               strerror(errno));
+            }
+        }
+        free(files[i].fname);
+    }
+    free(files);
+
+    rs_trace("cache shard %x trimmed to %lld bytes", shard, *total);
+    return 0;
+}
+
+
+static void dcc_cache_parse_stats(const char *buf,
+                                  long long counters[DCC_CACHE_N_COUNTERS])
+{
+    char name[32];
+    long long value;
+    int i, len;
+
+    while (sscanf(buf, "%31s %lld\n%n", name, &value, &len) == 2) {
+        for (i = 0; i < DCC_CACHE_N_COUNTERS; i++)
+            if (!strcmp(name, dcc_cache_counter_names[i]))
+                counters[i] = value;
+        buf += len;
+    }
+}
+
+
+/**
+ * Open the file @p name of @p shard, such as its stats file.
+ **/
+static int dcc_cache_open_shard_file(const char *dir, const char *name,
+                                     int shard, int *fd)
+{
+    char *fname;
+
+    if (asprintf(&fname, "%s/%s.%x", dir, name, shard) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((*fd = open(fname, O_RDWR|O_CREAT|O_BINARY, 0666)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        free(fname);
+        return EXIT_IO_ERROR;
+    }
+    free(fname);
+    return 0;
+}
+
+
+/**
+ * Add @p delta to the counters of @p shard.
+ *
+ * @param counters If not NULL, receives the updated counters.
+ **/
+static int dcc_cache_update_shard(const char *dir, int shard,
+                                  const long long delta[DCC_CACHE_N_COUNTERS],
+                                  long long counters[DCC_CACHE_N_COUNTERS])
+{
+    long long values[DCC_CACHE_N_COUNTERS] = { 0 };
+    char buf[1024];
+    ssize_t n;
+    int fd, i, len;
+    int ret;
+
+    if ((ret = dcc_cache_open_shard_file(dir, "stats", shard, &fd)))
+        return ret;
+    if ((ret = dcc_lock_fd(fd))) {
+        close(fd);
+        return ret;
+    }
+
+    if ((n = read(fd, buf, sizeof buf - 1)) > 0) {
+        buf[n] = '\0';
+        dcc_cache_parse_stats(buf, values);
+    }
+    if (delta) {
+        for (i = 0; i < DCC_CACHE_N_COUNTERS; i++)
+            values[i] += delta[i];
+        for (i = 0, len = 0; i < DCC_CACHE_N_COUNTERS; i++)
+            len += snprintf(buf + len, sizeof buf - len, "%s %lld\n",
+                            dcc_cache_counter_names[i], values[i]);
+        if (lseek(fd, 0, SEEK_SET) == -1
+            || ftruncate(fd, 0) == -1
+            || (ret = dcc_writex(fd, buf, len))) {
+            rs_log_error("failed to update cache stats: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+        }
+    }
+
+    if (counters)
+        memcpy(counters, values, sizeof values);
+    dcc_unlock(fd);
+    return ret;
+}
+
+
+/**
+ * Count an event for entry @p key, which grew by @p bytes, and trim its
+ * shard if it has outgrown its share of the cache.
+ **/
+static int dcc_cache_count(enum dcc_cache_counter counter, const char *key,
+                           long long bytes)
+{
+    long long delta[DCC_CACHE_N_COUNTERS] = { 0 };
+    long long values[DCC_CACHE_N_COUNTERS];
+    long long share = dcc_cache_max_size() / DCC_CACHE_SHARDS;
+    long long total;
+    int shard = dcc_cache_shard(key);
+    char *dir;
+    int fd, ret;
+
+    delta[counter] = 1;
+    delta[DCC_CACHE_BYTES] = bytes;
+    if ((ret = dcc_get_cache_dir(&dir))
+        || (ret = dcc_cache_update_shard(dir, shard, delta, values)))
+        return ret;
+    if (values[DCC_CACHE_BYTES] <= share || share <= 0)
+        return 0;
+
+    /* Trim without holding the stats lock, and leave it to another client
+     * that is trimming already. */
+    if ((ret = dcc_cache_open_shard_file(dir, "trim", shard, &fd)))
+        return ret;
+    if ((ret = dcc_trylock_fd(fd))) {
+        close(fd);
+        return ret == EXIT_BUSY ? 0 : ret;
+    }
+    /* Leave some room, so that we do not trim after every store. */
+    dcc_cache_trim(dir, shard, share / 10 * 9, key, &total,
+                   &delta[DCC_CACHE_EVICTIONS]);
+    /* Correct the size by what the walk found, keeping what was counted
+     * since it started. */
+    delta[counter] = 0;
+    delta[DCC_CACHE_BYTES] = total - values[DCC_CACHE_BYTES];
+    ret = dcc_cache_update_shard(dir, shard, delta, NULL);
+    dcc_unlock(fd);
+    return ret;
+}
+
+
+/**
+ * Copy @p from to @p to, replacing @p to.  If @p atomic is set, the copy is
+ * made under a temporary name first and then renamed into place, so that
+ * readers never see a partial file.
+ **/
+static int dcc_cache_copy(const char *from, const char *to, int atomic,
+                          off_t *size)
+{
+    char *tmp = NULL;
+    struct stat st;
+    int fd;
+    int ret;
+
+    if (atomic && asprintf(&tmp, "%s.tmp%ld", to, (long) getpid()) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((fd = open(tmp ? tmp : to, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY,
+                   0666)) == -1) {
+        rs_log_error("failed to create %s: %s", tmp ? tmp : to,
+                     strerror(errno));
+        free(tmp);
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_copy_file_to_fd(from, fd);
+    if (ret == 0 && size)
+        *size = fstat(fd, &st) == 0 ? st.st_size : 0;
+    if (dcc_close(fd) && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (tmp) {
+        if (ret == 0 && rename(tmp, to) == -1) {
+            rs_log_error("failed to rename %s to %s: %s", tmp, to,
+                         strerror(errno));
+            ret = EXIT_IO_ERROR;
+        }
+        if (ret)
+            unlink(tmp);
+        free(tmp);
+    }
+    return ret;
+}
+
+
+/**
+ * Look for the result of a compilation in the cache, and if it is there,
+ * produce it just as the server would have: write the object file and the
+ * dependency file, and show the compiler's messages.
+ *
+ * @param deps_fname The dependency file, or NULL if the server would not
+ * have produced one.
+ *
+ * @param hit On return, true if the result was found.
+ **/
+int dcc_cache_lookup(const char *key,
+                     const char *output_fname,
+                     const char *deps_fname,
+                     int *hit)
+{
+    char *object = NULL, *deps = NULL, *messages = NULL;
+    int ret;
+
+    *hit = 0;
+
+    if ((ret = dcc_cache_entry_name(key, ".o", &object))
+        || (ret = dcc_cache_entry_name(key, ".d", &deps))
+        || (ret = dcc_cache_entry_name(key, ".stderr", &messages)))
+        goto out;
+
+    if (access(object, R_OK) == -1
+        || (deps_fname && access(deps, R_OK) == -1)) {
+        rs_trace("cache miss for %s", key);
+        ret = dcc_cache_count(DCC_CACHE_MISSES, key, 0);
+        goto out;
+    }
+
+    if ((ret = dcc_cache_copy(object, output_fname, 0, NULL))
+        || (deps_fname && (ret = dcc_cache_copy(deps, deps_fname, 0, NULL)))
+        || (ret = dcc_copy_file_to_fd(messages, STDERR_FILENO)))
+        goto out;
+
+    /* Mark the entry as recently used. */
+    if (utime(object, NULL) == -1)
+        rs_log_warning("failed to touch %s: %s", object, strerror(errno));
+
+    rs_log_info("found %s in cache as %s", output_fname, key);
+    *hit = 1;
+    ret = dcc_cache_count(DCC_CACHE_HITS, key, 0);
+
+  out:
+    free(object);
+    free(deps);
+    free(messages);
+    return ret;
+}
+
+
+/**
+ * Store the result of a successful compilation in the cache.
+ *
+ * @param deps_fname The dependency file written by the server, or NULL.
+ *
+ * @param stderr_fname The messages written by the compiler.
+ **/
+int dcc_cache_store(const char *key,
+                    const char *output_fname,
+                    const char *deps_fname,
+                    const char *stderr_fname)
+{
+    char *object = NULL, *deps = NULL, *messages = NULL;
+    off_t size, total = 0;
+    int ret;
+
+    if ((ret = dcc_cache_entry_name(key, ".o", &object))
+        || (ret = dcc_cache_entry_name(key, ".d", &deps))
+        || (ret = dcc_cache_entry_name(key, ".stderr", &messages)))
+        goto out;
+
+    if ((ret = dcc_cache_copy(stderr_fname, messages, 1, &size)))
+        goto out;
+    total += size;
+    if (deps_fname) {
+        if ((ret = dcc_cache_copy(deps_fname, deps, 1, &size)))
+            goto out;
+        total += size;
+    }
+    if ((ret = dcc_cache_copy(output_fname, object, 1, &size)))
+        goto out;
+    total += size;
+
+    rs_trace("stored %s in cache as %s", output_fname, key);
+    ret = dcc_cache_count(DCC_CACHE_STORES, key, total);
+
+  out:
+    free(object);
+    free(deps);
+    free(messages);
+    return ret;
+}
+
+
+/**
+ * Print the cache counters, for "distcc --show-cache-stats".
+ **/
+int dcc_cache_show_stats(void)
+{
+    long long counters[DCC_CACHE_N_COUNTERS] = { 0 };
+    long long values[DCC_CACHE_N_COUNTERS];
+    char *dir;
+    int shard, i;
+    int ret;
+
+    if ((ret = dcc_get_cache_dir(&dir)))
+        return ret;
+    for (shard = 0; shard < DCC_CACHE_SHARDS; shard++) {
+        if ((ret = dcc_cache_update_shard(dir, shard, NULL, values)))
+            return ret;
+        for (i = 0; i < DCC_CACHE_N_COUNTERS; i++)
+            counters[i] += values[i];
+    }
+
+    printf("cache directory       %s\n", dir);
+    printf("cache hits            %lld\n", counters[DCC_CACHE_HITS]);
+    printf("cache misses          %lld\n", counters[DCC_CACHE_MISSES]);
+    printf("results stored        %lld\n", counters[DCC_CACHE_STORES]);
+    printf("results evicted       %lld\n", counters[DCC_CACHE_EVICTIONS]);
+    printf("cache size            %.1f MB\n",
+           counters[DCC_CACHE_BYTES] / (1024.0 * 1024.0));
+    printf("max cache size        %.1f MB\n",
+           dcc_cache_max_size() / (1024.0 * 1024.0));
+    return 0;
+}
@@ -0,0 +1,44 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef DCC_CACHE_H
+#define DCC_CACHE_H
+
+/* cache.c */
+int dcc_cache_enabled(void);
+
+int dcc_cache_key(char **server_argv,
+                  const char *cpp_fname,
+                  char **files,
+                  char **key_ret);
+
+int dcc_cache_lookup(const char *key,
+                     const char *output_fname,
+                     const char *deps_fname,
+                     int *hit);
+
+int dcc_cache_store(const char *key,
+                    const char *output_fname,
+                    const char *deps_fname,
+                    const char *stderr_fname);
+
+int dcc_cache_show_stats(void);
+
+#endif /* DCC_CACHE_H */
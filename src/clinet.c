@@ -39,11 +39,13 @@
 #include <signal.h>
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include <netdb.h>
 
@@ -62,6 +64,11 @@ extern int h_errno;
 
 const int dcc_connect_timeout = 4; /* seconds */
 
+/* When a server has several addresses, we start connecting to the next one
+ * if the previous attempt has not succeeded within this time, as recommended
+ * by RFC 8305 ("Happy Eyeballs"). */
+static const int dcc_connect_attempt_delay = 250; /* milliseconds */
+
 /*
  * Client-side networking.
  *
@@ -156,20 +163,310 @@ out_failed:
 }
 
 
+/**
+ * Put @p addrs in the order in which dcc_connect_by_addrs() should try them:
+ * alternating between address families, otherwise in the resolver's order
+ * of preference, except that addresses which failed less than @p backoff
+ * seconds ago go last.
+ **/
+void dcc_order_addrs(struct dcc_addr *addrs, int n_addrs, int backoff)
+{
+    struct dcc_addr *ordered;
+    char *used;
+    time_t now = time(NULL);
+    int pass, i, n = 0;
+
+    ordered = malloc(n_addrs * sizeof *ordered);
+    used = calloc(n_addrs, 1);
+    if (!ordered || !used) {
+        free(ordered);
+        free(used);
+        return;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        int family = AF_UNSPEC;
+        for (;;) {
+            int pick = -1;
+            /* The first remaining address of another family than the one
+             * we took last, or failing that, the first remaining one. */
+            for (i = 0; i < n_addrs; i++) {
+                int recently_failed = (addrs[i].failed != 0 &&
+                                       now - addrs[i].failed < backoff);
+                if (used[i] || recently_failed != pass)
+                    continue;
+                if (pick == -1)
+                    pick = i;
+                if (addrs[i].sa.ss_family != family) {
+                    pick = i;
+                    break;
+                }
+            }
+            if (pick == -1)
+                break;
+            used[pick] = 1;
+            ordered[n++] = addrs[pick];
+            family = addrs[pick].sa.ss_family;
+        }
+    }
+
+    memcpy(addrs, ordered, n_addrs * sizeof *addrs);
+    free(ordered);
+    free(used);
+}
+
+
+static long dcc_ms_since(const struct timeval *then)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - then->tv_sec) * 1000L
+        + (now.tv_usec - then->tv_usec) / 1000L;
+}
+
+
+/*
+ * Start a nonblocking connection to @p addr.
+ *
+ * @returns 0 if it connected at once, EINPROGRESS if it is under way, and
+ * otherwise the errno value of the failure; only in the first two cases is
+ * @p p_fd set to the socket.
+ */
+static int dcc_start_connect(const struct dcc_addr *addr, int *p_fd)
+{
+    const struct sockaddr *sa = (const struct sockaddr *) &addr->sa;
+    int fd, err;
+
+    if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) == -1)
+        return errno;
+    dcc_set_nonblocking(fd);
+    if (connect(fd, sa, addr->salen) == 0) {
+        *p_fd = fd;
+        return 0;
+    }
+    err = errno;
+    /* An interrupted connect goes on in the background. */
+    if (err == EINPROGRESS || err == EINTR) {
+        *p_fd = fd;
+        return EINPROGRESS;
+    }
+    close(fd);
+    return err;
+}
+
+
+/*
+ * Connect to whichever of @p addrs accepts first.
+ *
+ * Attempts start dcc_connect_attempt_delay apart, or as soon as the previous
+ * one fails, so that a dead address delays us by a fraction of a second
+ * rather than by dcc_connect_timeout.  Each attempt is given
+ * dcc_connect_timeout seconds; once one succeeds, the others are abandoned.
+ * An attempt that fails with a transient EAGAIN is made again half a second
+ * later, up to three times as in dcc_connect_by_addr(), while the others go
+ * on.
+ *
+ * The failed member of each address that refused or did not answer is set
+ * to the current time, and that of the address we connected to is cleared.
+ */
+int dcc_connect_by_addrs(struct dcc_addr *addrs, int n_addrs, int *p_fd)
+{
+    struct pollfd *pfds;
+    struct timeval *started;
+    long *retry_ms;
+    int *tries;
+    int next = 0, pending = 0, retrying = 0, winner = -1;
+    int i;
+
+    if (n_addrs == 0)
+        return EXIT_CONNECT_FAILED;
+
+    if (n_addrs == 1) {
+        /* Nothing to race against. */
+        if (dcc_connect_by_addr((struct sockaddr *) &addrs[0].sa,
+                                addrs[0].salen, p_fd)) {
+            addrs[0].failed = time(NULL);
+            return EXIT_CONNECT_FAILED;
+        }
+        addrs[0].failed = 0;
+        return 0;
+    }
+
+    pfds = calloc(n_addrs, sizeof *pfds);
+    started = calloc(n_addrs, sizeof *started);
+    /* When to make the next try at each address, in milliseconds after its
+     * attempt started, or -1 if none is due. */
+    retry_ms = calloc(n_addrs, sizeof *retry_ms);
+    tries = calloc(n_addrs, sizeof *tries);
+    if (!pfds || !started || !retry_ms || !tries) {
+        free(pfds);
+        free(started);
+        free(retry_ms);
+        free(tries);
+        rs_log_error("calloc failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < n_addrs; i++) {
+        pfds[i].fd = -1;
+        retry_ms[i] = -1;
+    }
+
+    while (winner == -1 && (next < n_addrs || pending > 0 || retrying > 0)) {
+        long wait = -1;
+        char *s;
+
+        if (next < n_addrs
+            && (pending + retrying == 0
+                || dcc_ms_since(&started[next-1]) >= dcc_connect_attempt_delay)) {
+            i = next++;
+            gettimeofday(&started[i], NULL);
+            dcc_sockaddr_to_string((struct sockaddr *) &addrs[i].sa,
+                                   addrs[i].salen, &s);
+            rs_trace("started connecting to %s", s ? s : "?");
+            free(s);
+            retry_ms[i] = 0;
+            tries[i] = 4;
+            retrying++;
+        }
+
+        /* Make the tries that are due. */
+        for (i = 0; i < next && winner == -1; i++) {
+            int err, fd = -1;
+
+            if (retry_ms[i] == -1 || dcc_ms_since(&started[i]) < retry_ms[i])
+                continue;
+            retry_ms[i] = -1;
+            retrying--;
+            tries[i]--;
+            err = dcc_start_connect(&addrs[i], &fd);
+            if (err == 0) {
+                pfds[i].fd = fd;
+                winner = i;
+            } else if (err == EINPROGRESS) {
+                pfds[i].fd = fd;
+                pfds[i].events = POLLOUT;
+                pending++;
+            } else if (err == EAGAIN && tries[i] > 0) {
+                retry_ms[i] = dcc_ms_since(&started[i]) + 500;
+                retrying++;
+            } else {
+                dcc_sockaddr_to_string((struct sockaddr *) &addrs[i].sa,
+                                       addrs[i].salen, &s);
+                rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                       "failed to connect to %s: %s", s ? s : "?",
+                       strerror(err));
+                free(s);
+                addrs[i].failed = time(NULL);
+            }
+        }
+        if (winner != -1)
+            break;
+        if (next < n_addrs && pending + retrying == 0)
+            continue;           /* all failed at once: start the next */
+
+        /* Sleep until an attempt completes, one times out, a try is due, or
+         * it is time to start the next. */
+        if (next < n_addrs)
+            wait = dcc_connect_attempt_delay - dcc_ms_since(&started[next-1]);
+        for (i = 0; i < next; i++) {
+            long left;
+            if (pfds[i].fd != -1)
+                left = dcc_connect_timeout * 1000L - dcc_ms_since(&started[i]);
+            else if (retry_ms[i] != -1)
+                left = retry_ms[i] - dcc_ms_since(&started[i]);
+            else
+                continue;
+            if (wait == -1 || left < wait)
+                wait = left;
+        }
+        if (wait < 0)
+            wait = 0;
+
+        if (poll(pfds, next, (int) wait) == -1) {
+            if (errno == EINTR)
+                continue;       /* revents are not valid */
+            rs_log_error("poll failed: %s", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < next && winner == -1; i++) {
+            int connecterr = -1;
+            socklen_t len = sizeof connecterr;
+
+            if (pfds[i].fd == -1)
+                continue;
+            if (pfds[i].revents == 0) {
+                if (dcc_ms_since(&started[i]) < dcc_connect_timeout * 1000L)
+                    continue;
+                connecterr = ETIMEDOUT;
+            } else if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR,
+                                  (char *) &connecterr, &len) < 0) {
+                connecterr = errno;
+            }
+            if (connecterr == 0) {
+                winner = i;
+                break;
+            }
+            if (connecterr == EINPROGRESS)
+                continue;
+            dcc_sockaddr_to_string((struct sockaddr *) &addrs[i].sa,
+                                   addrs[i].salen, &s);
+            if (connecterr == ETIMEDOUT)
+                rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                       "timeout while connecting to %s", s ? s : "?");
+            else
+                rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                       "nonblocking connect to %s failed: %s", s ? s : "?",
+                       strerror(connecterr));
+            free(s);
+            addrs[i].failed = time(NULL);
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            pending--;
+        }
+    }
+
+    for (i = 0; i < next; i++) {
+        if (i == winner)
+            *p_fd = pfds[i].fd;
+        else if (pfds[i].fd != -1)
+            close(pfds[i].fd);
+    }
+    free(pfds);
+    free(started);
+    free(retry_ms);
+    free(tries);
+
+    if (winner == -1)
+        return EXIT_CONNECT_FAILED;
+
+    rs_trace("connected to address %d of %d", winner + 1, n_addrs);
+    addrs[winner].failed = 0;
+    return 0;
+}
+
+
 #if defined(ENABLE_RFC2553)
 
 /**
- * Open a socket to a tcp remote host with the specified port.
+ * Look up the addresses of a tcp remote host.
+ *
+ * @param flags With DCC_LOOKUP_NUMERIC, only numeric addresses are accepted,
+ * and failure is not an error and is not logged.
+ *
+ * @param addrs_ret On return, a newly allocated array of @p n_addrs
+ * addresses.
  **/
-int dcc_connect_by_name(const char *host, int port, int *p_fd)
+int dcc_lookup_addrs(const char *host, int port, int flags,
+                     struct dcc_addr **addrs_ret, int *n_addrs)
 {
     struct addrinfo hints;
-    struct addrinfo *res;
-    int error;
-    int ret;
+    struct addrinfo *res, *ai;
+    struct dcc_addr *addrs;
     char portname[20];
-
-    rs_trace("connecting to %s port %d", host, port);
+    int error;
+    int n = 0;
 
     /* Unfortunately for us, getaddrinfo wants the port (service) as a string */
     snprintf(portname, sizeof portname, "%d", port);
@@ -178,33 +475,65 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
     /* set-up hints structure */
     hints.ai_family = PF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = (flags & DCC_LOOKUP_NUMERIC) ? AI_NUMERICHOST : 0;
     error = getaddrinfo(host, portname, &hints, &res);
     if (error) {
-        rs_log_error("failed to resolve host %s port %d: %s", host, port,
-                     gai_strerror(error));
+        if (!(flags & DCC_LOOKUP_NUMERIC))
+            rs_log_error("failed to resolve host %s port %d: %s", host, port,
+                         gai_strerror(error));
         return EXIT_CONNECT_FAILED;
     }
 
-    /* Try each of the hosts possible addresses. */
-    do {
-        ret = dcc_connect_by_addr(res->ai_addr, res->ai_addrlen, p_fd);
-    } while (ret != 0 && (res = res->ai_next));
+    for (ai = res; ai; ai = ai->ai_next)
+        n++;
+    if ((addrs = calloc(n, sizeof *addrs)) == NULL) {
+        rs_log_error("calloc failed");
+        freeaddrinfo(res);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (ai = res, n = 0; ai; ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof addrs[0].sa)
+            continue;
+        memcpy(&addrs[n].sa, ai->ai_addr, ai->ai_addrlen);
+        addrs[n].salen = ai->ai_addrlen;
+        n++;
+    }
+    freeaddrinfo(res);
 
-    return ret;
+    *addrs_ret = addrs;
+    *n_addrs = n;
+    return 0;
 }
 
 
 #else /* not ENABLE_RFC2553 */
 
-/**
- * Open a socket to a tcp remote host with the specified port.
- *
- * @todo Don't try for too long to connect.
- **/
-int dcc_connect_by_name(const char *host, int port, int *p_fd)
+/* See above. */
+int dcc_lookup_addrs(const char *host, int port, int flags,
+                     struct dcc_addr **addrs_ret, int *n_addrs)
 {
     struct sockaddr_in sock_out;
+    struct dcc_addr *addrs;
     struct hostent *hp;
+    int n;
+
+    memset(&sock_out, 0, sizeof sock_out);
+    sock_out.sin_port = htons((in_port_t) port);
+    sock_out.sin_family = PF_INET;
+
+    if (flags & DCC_LOOKUP_NUMERIC) {
+        if (!inet_aton(host, &sock_out.sin_addr))
+            return EXIT_CONNECT_FAILED;
+        if ((addrs = calloc(1, sizeof *addrs)) == NULL) {
+            rs_log_error("calloc failed");
+            return EXIT_OUT_OF_MEMORY;
+        }
+        memcpy(&addrs[0].sa, &sock_out, sizeof sock_out);
+        addrs[0].salen = sizeof sock_out;
+        *addrs_ret = addrs;
+        *n_addrs = 1;
+        return 0;
+    }
 
     /* FIXME: "warning: gethostbyname() leaks memory.  Use gethostbyname_r
      * instead!" (or indeed perhaps use getaddrinfo?) */
@@ -215,12 +544,44 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
         return EXIT_CONNECT_FAILED;
     }
 
-    memcpy(&sock_out.sin_addr, hp->h_addr, (size_t) hp->h_length);
-    sock_out.sin_port = htons((in_port_t) port);
-    sock_out.sin_family = PF_INET;
+    for (n = 0; hp->h_addr_list[n]; n++)
+        ;
+    if ((addrs = calloc(n, sizeof *addrs)) == NULL) {
+        rs_log_error("calloc failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (n = 0; hp->h_addr_list[n]; n++) {
+        memcpy(&sock_out.sin_addr, hp->h_addr_list[n],
+               (size_t) hp->h_length);
+        memcpy(&addrs[n].sa, &sock_out, sizeof sock_out);
+        addrs[n].salen = sizeof sock_out;
+    }
 
-    return dcc_connect_by_addr((struct sockaddr *) &sock_out,
-                               sizeof sock_out, p_fd);
+    *addrs_ret = addrs;
+    *n_addrs = n;
+    return 0;
 }
 
 #endif /* not ENABLE_RFC2553 */
+
+
+/**
+ * Open a socket to a tcp remote host with the specified port.
+ **/
+int dcc_connect_by_name(const char *host, int port, int *p_fd)
+{
+    struct dcc_addr *addrs;
+    int n_addrs;
+    int ret;
+
+    rs_trace("connecting to %s port %d", host, port);
+
+    if ((ret = dcc_lookup_addrs(host, port, 0, &addrs, &n_addrs)))
+        return ret;
+
+    /* Try all of the host's addresses. */
+    dcc_order_addrs(addrs, n_addrs, 0);
+    ret = dcc_connect_by_addrs(addrs, n_addrs, p_fd);
+    free(addrs);
+    return ret;
+}
@@ -21,7 +21,16 @@
  * USA.
  */
 
-struct sockaddr;
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* One of the addresses of a server. */
+struct dcc_addr {
+    struct sockaddr_storage sa;
+    socklen_t salen;
+    time_t failed;              /* when connecting to it last failed, or 0 */
+};
 
 int dcc_connect_by_name(const char *host,
                         int port,
@@ -30,3 +39,13 @@ int dcc_connect_by_name(const char *host,
 int dcc_connect_by_addr(struct sockaddr *sa,
                         size_t salen,
                         int *p_fd);
+
+/* Flags for dcc_lookup_addrs(). */
+#define DCC_LOOKUP_NUMERIC 1
+
+int dcc_lookup_addrs(const char *host, int port, int flags,
+                     struct dcc_addr **addrs_ret, int *n_addrs);
+
+void dcc_order_addrs(struct dcc_addr *addrs, int n_addrs, int backoff);
+
+int dcc_connect_by_addrs(struct dcc_addr *addrs, int n_addrs, int *p_fd);
@@ -46,6 +46,7 @@
 #include "state.h"
 #include "include_server_if.h"
 #include "emaillog.h"
+#include "pch.h"
 
 /**
  * @file
@@ -147,6 +148,49 @@ int dcc_r_cc_status(int ifd, int *status)
 }
 
 
+static int dcc_r_discard(int net_fd, unsigned len, enum dcc_compress compr)
+{
+    int null_fd, ret;
+
+    if ((null_fd = open("/dev/null", O_WRONLY)) == -1) {
+        rs_log_error("failed to open /dev/null: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_r_bulk(null_fd, net_fd, len, compr);
+    dcc_close(null_fd);
+    return ret;
+}
+
+
+/**
+ * Receive the split DWARF file that the server sends after the object when
+ * the command line asks for one.  An empty file means that the compiler
+ * did not write one, for example because there was no -g.  A server that
+ * knows nothing of split DWARF sends nothing at all, which is why only
+ * hosts given the ",dwo" option are sent these jobs.
+ **/
+static int dcc_r_dwo(int net_fd, const char *dwo_fname,
+                     struct dcc_hostdef *host)
+{
+    unsigned len;
+    int ret;
+
+    if ((ret = dcc_r_token_int(net_fd, "DOTW", &len))) {
+        rs_log_warning("%s did not return split DWARF for %s; "
+                       "is distccd too old for the ,dwo option?",
+                       host->hostdef_string, dwo_fname);
+        return ret;
+    }
+    if (len == 0) {
+        if (unlink(dwo_fname) == -1 && errno != ENOENT)
+            rs_log_warning("failed to remove stale %s: %s",
+                           dwo_fname, strerror(errno));
+        return 0;
+    }
+    return dcc_r_file_timed(net_fd, dwo_fname, len, host->compr);
+}
+
+
 /**
  * The second half of the client protocol: retrieve all results from the server.
  **/
@@ -154,6 +198,7 @@ int dcc_retrieve_results(int net_fd,
                          int *status,
                          const char *output_fname,
                          const char *deps_fname,
+                         const char *dwo_fname,
                          const char *server_stderr_fname,
                          struct dcc_hostdef *host)
 {
@@ -201,12 +246,18 @@ int dcc_retrieve_results(int net_fd,
         if ((ret = dcc_r_file_timed(net_fd, output_fname, o_len, host->compr)))
             return ret;
         if (host->cpp_where == DCC_CPP_ON_SERVER) {
-            if ((ret = dcc_r_token_int(net_fd, "DOTD", &len) == 0)
-                && deps_fname != NULL) {
+            if ((ret = dcc_r_token_int(net_fd, "DOTD", &len)))
+                return ret;
+            if (deps_fname != NULL)
                 ret = dcc_r_file_timed(net_fd, deps_fname, len, host->compr);
+            else if (dwo_fname != NULL)
+                /* Nobody wants it, but the .dwo file follows. */
+                ret = dcc_r_discard(net_fd, len, host->compr);
+            if (ret)
                 return ret;
-            }
         }
+        if (dwo_fname != NULL)
+            return dcc_r_dwo(net_fd, dwo_fname, host);
     } else if (o_len != 0) {
         rs_log_error("remote compiler failed but also returned output: "
                      "I don't know what to do");
@@ -245,24 +296,59 @@ int dcc_is_link(const char *fname, int *is_link)
  * The names can be coming from the include server, so
  * we consult dcc_get_original_fname to get the real names.
  * Always uses lzo compression.
+ *
+ * Precompiled headers are only sent to @p host if it keeps them, and then
+ * only by their digest once it has them for @p compiler; see pch.c.
  */
 /* TODO: This code is highly specific to DCC_VER_3; it assumes
    lzo compression is on, and that the include server has
    actually compressed the files. */
 int dcc_x_many_files(int ofd,
                      unsigned int n_files,
-                     char **fnames)
+                     char **fnames,
+                     const struct dcc_hostdef *host,
+                     const char *compiler)
 {
     int ret;
     char link_points_to[MAXPATHLEN + 1];
+    char digest[DCC_PCH_DIGEST_LEN + 1];
     int is_link;
     const char *fname;
     char *original_fname;
+    char **f;
+
+    if (!host->pch) {
+        for (f = fnames; *f != NULL; ++f)
+            if (dcc_pch_read_digest(*f, digest) == 0)
+                n_files--;
+    }
 
     dcc_x_token_int(ofd, "NFIL", n_files);
 
     for (; *fnames != NULL; ++fnames) {
         fname = *fnames;
+
+        if (dcc_pch_read_digest(fname, digest) == 0) {
+            if (!host->pch)
+                continue;
+            if ((ret = dcc_get_original_fname(fname, &original_fname))
+                || (ret = dcc_x_token_string(ofd, "NAME", original_fname)))
+                return ret;
+            if (dcc_pch_is_cached(host, compiler, digest)) {
+                rs_trace("precompiled header %s is cached on %s",
+                         original_fname, host->hostdef_string);
+                if ((ret = dcc_x_token_string(ofd, "PCHR", digest)))
+                    return ret;
+            } else {
+                if ((ret = dcc_x_token_string(ofd, "PCHS", digest))
+                    || (ret = dcc_x_file(ofd, fname, "FILE",
+                                         DCC_COMPRESS_NONE, NULL)))
+                    return ret;
+                dcc_pch_note_cached(host, compiler, digest);
+            }
+            continue;
+        }
+
         ret = dcc_get_original_fname(fname, &original_fname);
         if (ret) return ret;
 
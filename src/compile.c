@@ -60,6 +60,8 @@
 #include "include_server_if.h"
 #include "emaillog.h"
 #include "dotd.h"
+#include "cache.h"
+#include "cost.h"
 
 /**
  * This boolean is true iff --scan-includes option is enabled.
@@ -76,6 +78,8 @@ static void bad_host(struct dcc_hostdef *host, int *cpu_lock_fd , int *local_cpu
 {
    if (host)
        dcc_disliked_host(host);
+   if (host && host->mode == DCC_MODE_SSH)
+       dcc_ssh_drop_master(host->user, host->hostname);
 
    if (*cpu_lock_fd != -1) {
        dcc_unlock(*cpu_lock_fd);
@@ -632,6 +636,41 @@ static int dcc_gcc_rewrite_fqn(char **argv)
     return -ENOENT;
 }
 
+/**
+ * Run the preprocessor to completion, so that its output can be looked up in
+ * the result cache before a host is chosen.
+ *
+ * @param status On return, the status of the preprocessor.
+ **/
+static int dcc_preprocess_for_cache(char **argv,
+                                    char *input_fname,
+                                    char **cpp_fname,
+                                    int *status)
+{
+    int local_cpu_lock_fd = -1;
+    pid_t cpp_pid;
+    int ret;
+
+    *status = 0;
+
+    if (!dcc_is_preprocessed(input_fname)
+        && (ret = dcc_lock_local_cpp(&local_cpu_lock_fd)) != 0)
+        return ret;
+
+    if ((ret = dcc_cpp_maybe(argv, input_fname, cpp_fname, &cpp_pid)) == 0
+        && cpp_pid != 0) {
+        dcc_note_state(DCC_PHASE_CPP, input_fname, NULL, DCC_LOCAL);
+        if ((ret = dcc_collect_child("cpp", cpp_pid, status,
+                                     timeout_null_fd)) == 0)
+            dcc_critique_status(*status, "cpp", input_fname,
+                                dcc_hostdef_local, 0);
+    }
+
+    if (local_cpu_lock_fd != -1)
+        dcc_unlock(local_cpu_lock_fd);
+    return ret;
+}
+
 static int dcc_get_max_retries(void)
 {
     if (dcc_backoff_is_enabled()) {
@@ -695,6 +734,7 @@ dcc_build_somewhere(char *argv[],
     char **localcpp_server_argv = NULL;
     char **remotecpp_server_argv = NULL;
     char *server_stderr_fname = NULL;
+    char *dwo_fname = NULL;
     int needs_dotd = 0;
     int sets_dotd_target = 0;
     pid_t cpp_pid = 0;
@@ -705,6 +745,10 @@ dcc_build_somewhere(char *argv[],
     struct dcc_hostdef *host = NULL;
     char *discrepancy_filename = NULL;
     char **new_argv;
+    char *cache_key = NULL;
+    int cache_hit = 0;
+    int cpp_done = 0;
+    struct timeval local_start;
 
     max_retries = dcc_get_max_retries();
 
@@ -754,13 +798,52 @@ dcc_build_somewhere(char *argv[],
         goto fallback;
     }
 
+    if ((ret = dcc_get_dwo_fname(argv, output_fname, &dwo_fname)))
+        goto fallback;
+
+    /* The cache keeps only the object, not the split DWARF beside it. */
+    if (dcc_cache_enabled() && !dwo_fname && !dcc_scan_includes
+        && !getenv("INCLUDE_SERVER_PORT")) {
+        /* Without an include server, the source is preprocessed here
+         * whichever host is chosen.  Do that first, so that a cached result
+         * spares us choosing one at all. */
+        if ((ret = dcc_preprocess_for_cache(argv, input_fname, &cpp_fname,
+                                            status)))
+            goto fallback;
+        if (*status != 0) {
+            /* Let the compiler report the problem. */
+            goto lock_local;
+        }
+        cpp_done = 1;
+        if ((ret = dcc_strip_local_args(argv, &localcpp_server_argv)))
+            goto fallback;
+        if (dcc_cache_key(localcpp_server_argv, cpp_fname, NULL, &cache_key)
+            || dcc_cache_lookup(cache_key, output_fname, NULL, &cache_hit)) {
+            rs_log_warning("result cache unavailable");
+            free(cache_key);
+            cache_key = NULL;
+        } else if (cache_hit) {
+            goto clean_up;
+        }
+    }
+
     /* Lock ordering invariant: always acquire the lock for the
      * remote host (if any) first. */
 
     /* Choose the distcc server host (which could be either a remote
      * host or localhost) and acquire the lock for it.  */
   choose_host:
-    if ((ret = dcc_pick_host_from_list_and_lock_it(&host, &cpu_lock_fd)) != 0) {
+    /* A distccd that knows nothing of split DWARF would leave the .dwo file
+     * behind and fail the job; only ",dwo" hosts get these. */
+    if ((ret = dcc_pick_host_from_list_and_lock_it(input_fname,
+                                                   cpp_done ? cpp_fname : NULL,
+                                                   dwo_fname != NULL,
+                                                   &host, &cpu_lock_fd)) != 0) {
+        if (dwo_fname && ret == EXIT_NO_HOSTS) {
+            rs_log_info("no usable host is marked as returning split DWARF; "
+                        "compiling %s locally", input_fname);
+            goto lock_local;
+        }
         /* Doesn't happen at the moment: all failures are masked by
            returning localhost. */
         goto fallback;
@@ -771,7 +854,23 @@ dcc_build_somewhere(char *argv[],
         goto run_local;
     }
 
-    if (!dcc_is_preprocessed(input_fname)) {
+    if (dcc_cost_model_enabled()
+        && dcc_cost_prefer_local(host, input_fname)) {
+        int local_lock_fd;
+
+        /* Not worth the trip: compile here, if that won't mean waiting. */
+        dcc_read_localslots_configuration();
+        if (dcc_try_lock_local(&local_lock_fd) == 0) {
+            rs_log_info("%s is quicker to compile than to send to %s; "
+                        "compiling locally", input_fname,
+                        host->hostdef_string);
+            dcc_unlock(cpu_lock_fd);
+            cpu_lock_fd = local_lock_fd;
+            goto run_local;
+        }
+    }
+
+    if (!cpp_done && !dcc_is_preprocessed(input_fname)) {
         /* Lock the local CPU, since we're going to be doing preprocessing
          * or include scanning. */
         if ((ret = dcc_lock_local_cpp(&local_cpu_lock_fd)) != 0) {
@@ -820,7 +919,8 @@ dcc_build_somewhere(char *argv[],
     if (host->cpp_where == DCC_CPP_ON_CLIENT) {
         files = NULL;
 
-        if ((ret = dcc_cpp_maybe(argv, input_fname, &cpp_fname, &cpp_pid) != 0))
+        if (!cpp_done
+            && (ret = dcc_cpp_maybe(argv, input_fname, &cpp_fname, &cpp_pid) != 0))
             goto fallback;
 
         /* localcpp_server_argv may already be processed from a previous bad host */
@@ -848,6 +948,23 @@ dcc_build_somewhere(char *argv[],
             }
         }
         server_side_argv = remotecpp_server_argv;
+
+        if (dcc_cache_enabled() && !dwo_fname && cache_key == NULL) {
+            /* The include server's answer identifies the source as well as
+             * preprocessed output would. */
+            if (dcc_cache_key(server_side_argv, NULL, files, &cache_key)
+                || dcc_cache_lookup(cache_key, output_fname,
+                                    needs_dotd ? deps_fname : NULL,
+                                    &cache_hit)) {
+                rs_log_warning("result cache unavailable");
+                free(cache_key);
+                cache_key = NULL;
+            } else if (cache_hit) {
+                *status = 0;
+                ret = 0;
+                goto unlock_and_clean_up;
+            }
+        }
     }
     if ((ret = dcc_compile_remote(server_side_argv,
                                   input_fname,
@@ -855,6 +972,7 @@ dcc_build_somewhere(char *argv[],
                                   files,
                                   output_fname,
                                   needs_dotd ? deps_fname : NULL,
+                                  dwo_fname,
                                   server_stderr_fname,
                                   cpp_pid, local_cpu_lock_fd,
                   host, status, &remote_unsupported)) != 0) {
@@ -902,6 +1020,10 @@ dcc_build_somewhere(char *argv[],
             rs_log_warning("Could not show server-side errors");
             goto fallback;
         }
+        if (cache_key)
+            (void) dcc_cache_store(cache_key, output_fname,
+                                   needs_dotd ? deps_fname : NULL,
+                                   server_stderr_fname);
         /* SUCCESS! */
         goto clean_up;
     }
@@ -985,7 +1107,21 @@ dcc_build_somewhere(char *argv[],
   run_local:
     /* Either compile locally, after remote failure, or simply do other cc tasks
        as assembling, linking, etc. */
+    if (gettimeofday(&local_start, NULL))
+        rs_log_warning("gettimeofday failed");
     ret = dcc_compile_local(argv, input_fname);
+    if (ret == 0 && input_fname && !sg_level && dcc_cost_model_enabled()) {
+        struct dcc_cost_history history;
+        struct timeval local_end, delta;
+
+        gettimeofday(&local_end, NULL);
+        timeval_subtract(&delta, &local_end, &local_start);
+        memset(&history, 0, sizeof history);
+        history.compile_ms = delta.tv_sec * 1000L + delta.tv_usec / 1000;
+        if (history.compile_ms <= 0)
+            history.compile_ms = 1;
+        dcc_cost_note_history(input_fname, &history);
+    }
     if (remote_ret != 0) {
         if (remote_ret != ret) {
             /* Oops! it seems what we did remotely is not the same as what we did
@@ -1025,6 +1161,8 @@ dcc_build_somewhere(char *argv[],
         free(localcpp_server_argv);
     }
     free(discrepancy_filename);
+    free(cache_key);
+    free(dwo_fname);
     return ret;
 }
 
@@ -29,6 +29,7 @@ int dcc_compile_remote(char **argv,
                        char **file_names,
                        char *output_fname,
                        char *deps_fname,
+                       char *dwo_fname,
                        char *server_stderr_fname,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
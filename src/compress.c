@@ -122,10 +122,11 @@ int dcc_compress_file_lzo1x(int in_fd,
  * one big chunk.  So we just read the whole input into a buffer, build the
  * output in a buffer, and send it once its complete.
  **/
-int dcc_compress_lzo1x_alloc(const char *in_buf,
-                             size_t in_len,
-                             char **out_buf_ret,
-                             size_t *out_len_ret)
+static int dcc_compress_lzo1x_work(const char *in_buf,
+                                   size_t in_len,
+                                   char **out_buf_ret,
+                                   size_t *out_len_ret,
+                                   void *wrkmem)
 {
     int ret = 0, lzo_ret;
     char *out_buf = NULL;
@@ -145,7 +146,7 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
     out_len = out_size;
     lzo_ret = lzo1x_1_compress((lzo_byte*)in_buf, in_len,
                                (lzo_byte*)out_buf, &out_len,
-                               work_mem);
+                               wrkmem);
     if (lzo_ret != LZO_E_OK) {
         rs_log_error("LZO1X1 compression failed: %d", lzo_ret);
         free(out_buf);
@@ -163,6 +164,40 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
 }
 
 
+int dcc_compress_lzo1x_alloc(const char *in_buf,
+                             size_t in_len,
+                             char **out_buf_ret,
+                             size_t *out_len_ret)
+{
+    return dcc_compress_lzo1x_work(in_buf, in_len, out_buf_ret, out_len_ret,
+                                   work_mem);
+}
+
+
+/**
+ * Like dcc_compress_lzo1x_alloc(), but with work memory of its own rather
+ * than the shared static buffer, so that several threads may compress at
+ * once.
+ **/
+int dcc_compress_lzo1x_alloc_r(const char *in_buf,
+                               size_t in_len,
+                               char **out_buf_ret,
+                               size_t *out_len_ret)
+{
+    int ret;
+    void *wrkmem;
+
+    if ((wrkmem = malloc(LZO1X_1_MEM_COMPRESS)) == NULL) {
+        rs_log_error("failed to allocate compression work memory");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = dcc_compress_lzo1x_work(in_buf, in_len, out_buf_ret, out_len_ret,
+                                  wrkmem);
+    free(wrkmem);
+    return ret;
+}
+
+
 
 /**
  * Receive @p in_len compressed bytes from @p in_fd, and write the
@@ -0,0 +1,530 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Decide whether a compilation is worth sending over the network.
+ *
+ * Distributing a tiny translation unit can take longer than compiling it.
+ * With DISTCC_COST_MODEL set, the client remembers for each source file how
+ * much it sent and received last time, and how long the compiler itself
+ * took; and for each server, how long connecting takes.  A file whose
+ * compilation is expected to take less time than connecting is compiled
+ * locally, if a local slot is free.
+ *
+ * The same measurements tell heavy jobs from light ones, and fast servers
+ * from slow ones, so that the heaviest jobs can be offered to the fastest
+ * servers first.  A server's speed is only learned by comparing its time
+ * for a source file with the time another server took for the same file,
+ * so that a server that happens to get the heavy files does not look slow.
+ *
+ * The history of source files is kept in $DISTCC_DIR/cost, one small file
+ * per source file, named after a hash of its absolute path, together with
+ * running averages over all of them.  The link measurements of each server
+ * are kept in the lock directory, next to its slot locks.  Each file is
+ * locked while it is updated, since many clients update them at once.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "lock.h"
+#include "md5.h"
+#include "cost.h"
+
+
+int dcc_cost_model_enabled(void)
+{
+    return dcc_getenv_bool("DISTCC_COST_MODEL", 0);
+}
+
+
+/**
+ * Return the name of the history file of source file @p input_fname, making
+ * sure that its directory exists.
+ **/
+static int dcc_cost_history_name(const char *input_fname, char **fname)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[DCC_MD5_DIGEST_LEN];
+    char key[2 * DCC_MD5_DIGEST_LEN + 1];
+    struct dcc_md5 md5;
+    const char *path;
+    char *dir, *subdir;
+    int i, ret;
+
+    path = dcc_abspath(input_fname, 0);
+    dcc_md5_init(&md5);
+    dcc_md5_update(&md5, path, strlen(path));
+    dcc_md5_final(&md5, digest);
+    for (i = 0; i < DCC_MD5_DIGEST_LEN; i++) {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 15];
+    }
+    key[2 * DCC_MD5_DIGEST_LEN] = '\0';
+
+    if ((ret = dcc_get_subdir("cost", &dir)))
+        return ret;
+    if (asprintf(&subdir, "%s/%.2s", dir, key) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = dcc_mkdir(subdir);
+    if (ret == 0 && asprintf(fname, "%s/%s", subdir, key + 2) == -1) {
+        rs_log_error("asprintf failed");
+        ret = EXIT_OUT_OF_MEMORY;
+    }
+    free(subdir);
+    return ret;
+}
+
+
+/**
+ * Read the first line or so of @p fname into @p buf.  A missing file reads
+ * as empty.
+ **/
+static void dcc_cost_read_file(const char *fname, char *buf, size_t size)
+{
+    ssize_t n = -1;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY|O_BINARY)) != -1) {
+        n = read(fd, buf, size - 1);
+        close(fd);
+    }
+    buf[n > 0 ? n : 0] = '\0';
+}
+
+
+/**
+ * Open @p fname, creating it if need be, lock it and read it into @p buf,
+ * as the first half of updating it.  Several clients may be updating the
+ * same file at once; holding the lock from the read to the write keeps
+ * them from losing each other's measurements.  The caller finishes with
+ * dcc_cost_rewrite() and releases @p fd with dcc_unlock().
+ **/
+static int dcc_cost_open_locked(const char *fname, int *fd,
+                                char *buf, size_t size)
+{
+    ssize_t n;
+    int ret;
+
+    if ((*fd = open(fname, O_RDWR|O_CREAT|O_BINARY, 0666)) == -1) {
+        rs_log_warning("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((ret = dcc_lock_fd(*fd))) {
+        close(*fd);
+        *fd = -1;
+        return ret;
+    }
+    n = read(*fd, buf, size - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    return 0;
+}
+
+
+/**
+ * Replace the contents of @p fd, opened by dcc_cost_open_locked(), with
+ * @p line.
+ **/
+static int dcc_cost_rewrite(int fd, const char *fname, const char *line)
+{
+    if (lseek(fd, 0, SEEK_SET) == -1 || ftruncate(fd, 0) == -1) {
+        rs_log_warning("failed to rewrite %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return dcc_writex(fd, line, strlen(line));
+}
+
+
+static int dcc_cost_average_name(char **fname)
+{
+    char *dir;
+    int ret;
+
+    if ((ret = dcc_get_subdir("cost", &dir)))
+        return ret;
+    if (asprintf(fname, "%s/average", dir) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+static void dcc_cost_parse_average(const char *buf,
+                                   long *avg_ms, long *avg_bytes)
+{
+    if (sscanf(buf, "%ld %ld", avg_ms, avg_bytes) != 2)
+        *avg_ms = *avg_bytes = 0;
+}
+
+
+/**
+ * Read the average compile time and size sent over all source files.  Both
+ * are zero if unknown.
+ **/
+static int dcc_cost_read_average(long *avg_ms, long *avg_bytes)
+{
+    char *fname, buf[64];
+    int ret;
+
+    if ((ret = dcc_cost_average_name(&fname)))
+        return ret;
+    dcc_cost_read_file(fname, buf, sizeof buf);
+    dcc_cost_parse_average(buf, avg_ms, avg_bytes);
+    free(fname);
+    return 0;
+}
+
+
+/**
+ * Fold one source file's measurements into the averages.  Each file counts
+ * a sixteenth, so the averages follow what is being built now.
+ **/
+static int dcc_cost_note_average(const struct dcc_cost_history *history)
+{
+    long avg_ms, avg_bytes;
+    char *fname, line[64];
+    int fd, ret;
+
+    if ((ret = dcc_cost_average_name(&fname)))
+        return ret;
+    if ((ret = dcc_cost_open_locked(fname, &fd, line, sizeof line))) {
+        free(fname);
+        return ret;
+    }
+    dcc_cost_parse_average(line, &avg_ms, &avg_bytes);
+    if (history->compile_ms)
+        avg_ms = avg_ms ? (15 * avg_ms + history->compile_ms) / 16
+            : history->compile_ms;
+    if (history->sent)
+        avg_bytes = avg_bytes ? (15 * avg_bytes + history->sent) / 16
+            : history->sent;
+
+    snprintf(line, sizeof line, "%ld %ld\n", avg_ms, avg_bytes);
+    ret = dcc_cost_rewrite(fd, fname, line);
+    dcc_unlock(fd);
+    free(fname);
+    return ret;
+}
+
+
+static void dcc_cost_parse_history(const char *buf,
+                                   struct dcc_cost_history *history)
+{
+    /* Older files do not say where the file was compiled. */
+    switch (sscanf(buf, "%ld %ld %ld %lu", &history->sent, &history->received,
+                   &history->compile_ms, &history->host)) {
+    case 3:
+        history->host = 0;
+        break;
+    case 4:
+        break;
+    default:
+        memset(history, 0, sizeof *history);
+    }
+}
+
+
+/**
+ * Read what is known about compiling @p input_fname.  Unknown quantities are
+ * zero.
+ **/
+int dcc_cost_read_history(const char *input_fname,
+                          struct dcc_cost_history *history)
+{
+    char *fname, buf[96];
+    int ret;
+
+    memset(history, 0, sizeof *history);
+    if ((ret = dcc_cost_history_name(input_fname, &fname)))
+        return ret;
+    dcc_cost_read_file(fname, buf, sizeof buf);
+    dcc_cost_parse_history(buf, history);
+    free(fname);
+    return 0;
+}
+
+
+/**
+ * Remember what was learned about compiling @p input_fname.  Quantities
+ * that were not measured this time, being zero, keep their old values.
+ **/
+int dcc_cost_note_history(const char *input_fname,
+                          const struct dcc_cost_history *history)
+{
+    struct dcc_cost_history old;
+    char *fname, line[96];
+    int fd, ret;
+
+    dcc_cost_note_average(history);
+    if ((ret = dcc_cost_history_name(input_fname, &fname)))
+        return ret;
+    if ((ret = dcc_cost_open_locked(fname, &fd, line, sizeof line))) {
+        free(fname);
+        return ret;
+    }
+    dcc_cost_parse_history(line, &old);
+    if (history->sent)
+        old.sent = history->sent;
+    if (history->received)
+        old.received = history->received;
+    if (history->compile_ms) {
+        old.compile_ms = history->compile_ms;
+        old.host = history->host;
+    }
+
+    snprintf(line, sizeof line, "%ld %ld %ld %lu\n",
+             old.sent, old.received, old.compile_ms, old.host);
+    ret = dcc_cost_rewrite(fd, fname, line);
+    dcc_unlock(fd);
+    free(fname);
+    return ret;
+}
+
+
+static void dcc_cost_parse_link(const char *buf,
+                                long *connect_ms, long *slowness)
+{
+    if (sscanf(buf, "%ld %ld", connect_ms, slowness) != 2)
+        *connect_ms = *slowness = 0;
+}
+
+
+/**
+ * Read the measurements of @p host: the time to connect, and how long it
+ * takes to compile compared to other servers, in thousandths.  Both are zero
+ * if unknown.
+ **/
+static int dcc_cost_read_link(const struct dcc_hostdef *host,
+                              long *connect_ms, long *slowness)
+{
+    char *fname, buf[96];
+    int ret;
+
+    if ((ret = dcc_make_lock_filename("link", host, 0, &fname)))
+        return ret;
+    dcc_cost_read_file(fname, buf, sizeof buf);
+    dcc_cost_parse_link(buf, connect_ms, slowness);
+    free(fname);
+    return 0;
+}
+
+
+/**
+ * Return a number that identifies @p host in the history of source files;
+ * never 0.
+ **/
+unsigned long dcc_cost_host_id(const struct dcc_hostdef *host)
+{
+    unsigned long id = 5381;
+    const char *p;
+
+    for (p = host->hostdef_string; *p; p++)
+        id = (id * 33 + (unsigned char) *p) & 0xffffffffUL;
+    return id ? id : 1;
+}
+
+
+/**
+ * Fold one job's measurements for @p host into the running averages.
+ *
+ * There is no measure of how fast data moves: the client only sees its
+ * request go into the socket buffers, not reach the server, and the
+ * server does not say when it started compiling.
+ *
+ * @param connect_ms Time taken to connect (including any SSH startup and
+ * authentication).
+ * @param compile_ms Time from sending the request to the answer.
+ * @param previous What was known about the source file before this job.
+ * Only if another server compiled it last does this job tell anything
+ * about the speed of @p host.
+ **/
+int dcc_cost_note_link(const struct dcc_hostdef *host,
+                       long connect_ms, long compile_ms,
+                       const struct dcc_cost_history *previous)
+{
+    long old_connect, old_slowness, slowness = 0;
+    char *fname, line[96];
+    int fd, ret;
+
+    if (previous->host && previous->host != dcc_cost_host_id(host)
+        && previous->compile_ms > 0) {
+        slowness = compile_ms * 1000 / previous->compile_ms;
+        if (slowness < 1)
+            slowness = 1;
+    }
+
+    if ((ret = dcc_make_lock_filename("link", host, 0, &fname)))
+        return ret;
+    if ((ret = dcc_cost_open_locked(fname, &fd, line, sizeof line))) {
+        free(fname);
+        return ret;
+    }
+    dcc_cost_parse_link(line, &old_connect, &old_slowness);
+
+    /* Weigh the new measurement a quarter, so that one odd job does not
+     * change the decisions much. */
+    if (old_connect)
+        connect_ms = (3 * old_connect + connect_ms) / 4;
+    if (!slowness)
+        slowness = old_slowness;
+    else if (old_slowness)
+        slowness = (3 * old_slowness + slowness) / 4;
+
+    snprintf(line, sizeof line, "%ld %ld\n", connect_ms, slowness);
+    ret = dcc_cost_rewrite(fd, fname, line);
+    dcc_unlock(fd);
+    free(fname);
+    return ret;
+}
+
+
+/**
+ * Return the total size of @p files, the closure sent in pump mode.
+ **/
+long dcc_cost_files_size(char **files)
+{
+    struct stat st;
+    long size = 0;
+
+    for (; files && *files; files++)
+        if (stat(*files, &st) == 0 && S_ISREG(st.st_mode))
+            size += (long) st.st_size;
+    return size;
+}
+
+
+/**
+ * Would compiling @p input_fname here take less time than connecting to
+ * @p host?
+ *
+ * Only the compiler's own time is compared with the cost of the network,
+ * since the server's compiler is assumed to be no faster than the local
+ * one.  The compile time learned from a remote job includes whatever of
+ * the request was still on its way, which errs on the side of
+ * distributing.  If anything needed is unknown, the answer is no, so that
+ * the compilation is distributed as it would be without the model.
+ **/
+int dcc_cost_prefer_local(const struct dcc_hostdef *host,
+                          const char *input_fname)
+{
+    struct dcc_cost_history history;
+    long connect_ms, slowness;
+
+    if (dcc_cost_read_history(input_fname, &history)
+        || dcc_cost_read_link(host, &connect_ms, &slowness))
+        return 0;
+    if (history.compile_ms <= 0 || connect_ms <= 0)
+        return 0;
+
+    rs_trace("%s: compiling takes %ldms, connecting to %s %ldms",
+             input_fname, history.compile_ms, host->hostdef_string,
+             connect_ms);
+    return history.compile_ms < connect_ms;
+}
+
+
+/**
+ * Give each remote host in @p hostlist that has no declared speed one
+ * learned from how quickly it has compiled compared to the others: a host
+ * that takes half the average time for the same source files gets speed 2.
+ * Hosts that have not been compared yet are left alone.
+ **/
+void dcc_cost_learn_speeds(struct dcc_hostdef *hostlist)
+{
+    struct dcc_hostdef *h;
+    long connect_ms, slowness;
+    double total = 0;
+    int n = 0;
+
+    for (h = hostlist; h; h = h->next) {
+        if (h->mode == DCC_MODE_LOCAL || h->speed > 0)
+            continue;
+        if (dcc_cost_read_link(h, &connect_ms, &slowness) == 0
+            && slowness > 0) {
+            total += slowness;
+            n++;
+        }
+    }
+    if (n < 2)
+        return;
+
+    for (h = hostlist; h; h = h->next) {
+        if (h->mode == DCC_MODE_LOCAL || h->speed > 0)
+            continue;
+        if (dcc_cost_read_link(h, &connect_ms, &slowness) == 0
+            && slowness > 0) {
+            h->speed = total / n / slowness;
+            rs_trace("%s compiles at speed %g", h->hostdef_string, h->speed);
+        }
+    }
+}
+
+
+/**
+ * Is compiling @p input_fname heavier than the average job?
+ *
+ * The time the compiler took last time decides, if it is known; otherwise
+ * the size of the preprocessed source @p cpp_fname (which may be NULL) or,
+ * failing that, the size sent last time.
+ *
+ * @returns 1 for a heavy job, -1 for a light one, and 0 if there is no way
+ * to tell.
+ **/
+int dcc_cost_job_weight(const char *input_fname, const char *cpp_fname)
+{
+    struct dcc_cost_history history;
+    struct stat st;
+    long avg_ms, avg_bytes, size;
+
+    if (dcc_cost_read_average(&avg_ms, &avg_bytes)
+        || dcc_cost_read_history(input_fname, &history))
+        return 0;
+
+    if (history.compile_ms > 0 && avg_ms > 0)
+        return history.compile_ms >= avg_ms ? 1 : -1;
+
+    size = history.sent;
+    if (cpp_fname && stat(cpp_fname, &st) == 0)
+        size = (long) st.st_size;
+    if (size > 0 && avg_bytes > 0)
+        return size >= avg_bytes ? 1 : -1;
+    return 0;
+}
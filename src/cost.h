@@ -0,0 +1,65 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef DCC_COST_H
+#define DCC_COST_H
+
+/** What is known about compiling one source file. */
+struct dcc_cost_history {
+    /** Bytes sent to the server: preprocessed source, or the closure of
+     * files in pump mode. */
+    long sent;
+
+    /** Bytes of results received. */
+    long received;
+
+    /** Milliseconds the compiler took, locally or on the server. */
+    long compile_ms;
+
+    /** Which server took them, as given by dcc_cost_host_id(); 0 if the
+     * compilation was local, or it is not known. */
+    unsigned long host;
+};
+
+/* cost.c */
+int dcc_cost_model_enabled(void);
+
+int dcc_cost_read_history(const char *input_fname,
+                          struct dcc_cost_history *history);
+
+int dcc_cost_note_history(const char *input_fname,
+                          const struct dcc_cost_history *history);
+
+unsigned long dcc_cost_host_id(const struct dcc_hostdef *host);
+
+int dcc_cost_note_link(const struct dcc_hostdef *host,
+                       long connect_ms, long compile_ms,
+                       const struct dcc_cost_history *previous);
+
+long dcc_cost_files_size(char **files);
+
+int dcc_cost_prefer_local(const struct dcc_hostdef *host,
+                          const char *input_fname);
+
+void dcc_cost_learn_speeds(struct dcc_hostdef *hostlist);
+
+int dcc_cost_job_weight(const char *input_fname, const char *cpp_fname);
+
+#endif /* DCC_COST_H */
@@ -50,6 +50,8 @@
 #include "implicit.h"
 #include "compile.h"
 #include "emaillog.h"
+#include "cache.h"
+#include "batch.h"
 
 
 /* Name of this program, for trace.c */
@@ -78,17 +80,21 @@ static void dcc_show_usage(void)
     printf(
 "Usage:\n"
 "   distcc [--scan-includes] [COMPILER] [compile options] -o OBJECT -c SOURCE\n"
-"   distcc [--help|--version|--show-hosts|-j]\n"
+"   distcc [--help|--version|--show-hosts|--show-cache-stats|-j]\n"
+"   distcc --batch COMPILE_COMMANDS_JSON\n"
 "\n"
 "Options:\n"
 "   COMPILER                   Defaults to \"cc\".\n"
 "   --help                     Explain usage, and exit.\n"
 "   --version                  Show version, and exit.\n"
 "   --show-hosts               Show host list, and exit.\n"
+"   --show-cache-stats         Show result cache statistics, and exit.\n"
 "   -j                         Show the concurrency level, as calculated from\n"
 "                              the host list, and exit.\n"
 "   --scan-includes            Show the files that distcc would send to the\n"
 "                              remote machine, and exit.  (Pump mode only.)\n"
+"   --batch FILE               Run every compile command in a compilation\n"
+"                              database, as many at once as -j shows.\n"
 #ifdef HAVE_GSSAPI
 "   --show-principal           Show current distccd GSS-API principal and exit.\n"
 #endif
@@ -99,6 +105,7 @@ static void dcc_show_usage(void)
 "   DISTCC_LOG                 Send messages to file, not stderr.\n"
 "   DISTCC_SSH                 Command to run to open SSH connections.\n"
 "   DISTCC_DIR                 Directory for host list and locks.\n"
+"   DISTCC_CACHE_SIZE          Cache results locally, using up to this many MB.\n"
 #ifdef HAVE_GSSAPI
 "   DISTCC_PRINCIPAL	      The name of the server principal to connect to.\n"
 #endif
@@ -170,14 +177,14 @@ static void dcc_show_hosts(void) {
     dcc_free_hostlist(list);
 }
 
-static void dcc_concurrency_level(void) {
+static int dcc_count_slots(void) {
     struct dcc_hostdef *list, *l;
     int nhosts;
     int nslots = 0;
 
     if (dcc_get_hostlist(&list, &nhosts) != 0) {
         rs_log_crit("Failed to get host list");
-        return;
+        return -1;
     }
 
     for (l = list; l; l = l->next)
@@ -185,7 +192,14 @@ static void dcc_concurrency_level(void) {
 
     dcc_free_hostlist(list);
 
-    printf("%i\n", nslots);
+    return nslots;
+}
+
+static void dcc_concurrency_level(void) {
+    int nslots = dcc_count_slots();
+
+    if (nslots >= 0)
+        printf("%i\n", nslots);
 }
 
 #ifdef HAVE_GSSAPI
@@ -268,12 +282,35 @@ int main(int argc, char **argv)
             goto out;
         }
 
+        if (!strcmp(argv[1], "--show-cache-stats")) {
+            ret = dcc_cache_show_stats();
+            goto out;
+        }
+
         if (!strcmp(argv[1], "-j")) {
             dcc_concurrency_level();
             ret = 0;
             goto out;
         }
 
+        if (!strcmp(argv[1], "--batch")) {
+            if (argc != 3) {
+                fprintf (stderr,
+                         "%s: --batch takes one operand\n"
+                         "Try `%s --help' for more information.\n",
+                         argv[0], argv[0]);
+                ret = EXIT_BAD_ARGUMENTS;
+                goto out;
+            }
+            if (sg_level > 0) {
+                rs_log_crit("distcc seems to have invoked itself recursively!");
+                ret = EXIT_RECURSION;
+                goto out;
+            }
+            ret = dcc_batch_compile(argv[2], dcc_count_slots(), sg_level);
+            goto out;
+        }
+
         if (!strcmp(argv[1], "--scan-includes")) {
             if (argc <= 2) {
                 fprintf (stderr,
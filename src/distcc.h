@@ -147,6 +147,7 @@ int dcc_ssh_connect(char *ssh_cmd, char *user,
                     char *machine, char *path,
                     int *f_in, int *f_out,
                     pid_t *ssh_pid);
+void dcc_ssh_drop_master(char *user, char *machine);
 
 /* safeguard.c */
 int dcc_increment_safeguard(void);
@@ -179,6 +180,7 @@ int dcc_retrieve_results(int net_fd,
                          int *status,
                          const char *output_fname,
                          const char *deps_fname,
+                         const char *dwo_fname,
                          const char *server_stderr_fname,
                          struct dcc_hostdef *);
 
@@ -190,7 +192,9 @@ int dcc_support_masquerade(char *argv[], char *progname, int *);
 int dcc_enjoyed_host(const struct dcc_hostdef *host);
 int dcc_disliked_host(const struct dcc_hostdef *host);
 int dcc_remove_disliked(struct dcc_hostdef **hostlist);
+int dcc_claim_probe(const struct dcc_hostdef *host);
 int dcc_backoff_is_enabled(void);
+int dcc_get_backoff_period(void);
 
 
 
@@ -243,6 +247,11 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
                             char **out_buf_ret,
                             size_t *out_len_ret);
 
+int dcc_compress_lzo1x_alloc_r(const char *in_buf,
+                               size_t in_len,
+                               char **out_buf_ret,
+                               size_t *out_len_ret);
+
 
 
 /* bulk.c */
@@ -256,10 +265,27 @@ void dcc_calc_rate(off_t size_out,
 int dcc_set_action_opt(char **, const char *);
 int dcc_set_output(char **, char *);
 int dcc_set_input(char **, char *);
+int dcc_get_dwo_fname(char **argv, const char *output_fname,
+                      char **dwo_fname);
 int dcc_scan_args(char *argv[], /*@out@*/ /*@relnull@*/ char **orig_o,
                   char **orig_i, char ***ret_newargv);
 int dcc_expand_preprocessor_options(char ***argv_ptr);
 
+/* argtab.c */
+#define DCC_ARG_JOINED   0x01   /* also matches with text appended: "-DFOO" */
+#define DCC_ARG_SEPARATE 0x02   /* alone, takes the next word as argument */
+#define DCC_ARG_WRAPS    0x04   /* ... which is an option for another tool */
+#define DCC_ARG_STRIP    0x08   /* not needed to compile preprocessed source */
+#define DCC_ARG_LOCAL    0x10   /* the compilation must run locally */
+
+struct dcc_arg_rule {
+    const char *name;
+    int flags;
+    const char *reason;         /* for DCC_ARG_LOCAL: why, for the log */
+};
+
+const struct dcc_arg_rule *dcc_find_arg_rule(const char *a);
+
 /* argutil.c */
 unsigned int dcc_argv_len(char **a);
 int dcc_argv_search(char **a, const char *);
@@ -116,8 +116,20 @@ const char *arg_log_file = NULL;
 
 const char *arg_sysroot = NULL;
 
+/**
+ * If true, have the compiler take the temporary directory out of the debug
+ * info of pump mode compiles with -fdebug-prefix-map, instead of rewriting
+ * the object file afterwards.
+ **/
+int opt_debug_prefix_map = 0;
+
 int opt_job_lifetime = 0;
 
+/**
+ * Megabytes of precompiled headers to keep for clients; see pch.c.
+ **/
+int opt_pch_cache_size = 1024;
+
 /* Enumeration values for options that don't have single-letter name.  These
  * must be numerically above all the ascii letters. */
 enum {
@@ -152,6 +164,7 @@ const struct poptOption options[] = {
 #endif
     { "jobs", 'j',       POPT_ARG_INT, &arg_max_jobs, 'j', 0, 0 },
     { "daemon", 0,       POPT_ARG_NONE, &opt_daemon_mode, 0, 0, 0 },
+    { "debug-prefix-map", 0, POPT_ARG_NONE, &opt_debug_prefix_map, 0, 0, 0 },
     { "help", 0,         POPT_ARG_NONE, 0, '?', 0, 0 },
     { "inetd", 0,        POPT_ARG_NONE, &opt_inetd_mode, 0, 0, 0 },
     { "lifetime", 0,     POPT_ARG_INT, &opt_lifetime, 0, 0, 0 },
@@ -167,6 +180,7 @@ const struct poptOption options[] = {
 #ifdef HAVE_LINUX
     { "oom-score-adj",0, POPT_ARG_INT,  &opt_oom_score_adj, 0, 0, 0 },
 #endif
+    { "pch-cache-size", 0, POPT_ARG_INT, &opt_pch_cache_size, 0, 0, 0 },
     { "pid-file", 'P',   POPT_ARG_STRING, &arg_pid_file, 0, 0, 0 },
     { "port", 'p',       POPT_ARG_INT, &arg_port, 0, 0, 0 },
 #ifdef HAVE_GSSAPI
@@ -211,6 +225,8 @@ static void distccd_show_usage(void)
 "    --user USER                if run by root, change to this persona\n"
 "    --jobs, -j LIMIT           maximum tasks at any time\n"
 "    --job-lifetime SECONDS     maximum lifetime of a compile request\n"
+"    --debug-prefix-map         let the compiler fix debug info paths\n"
+"    --pch-cache-size MB        precompiled headers to keep, 0 for none\n"
 "  Networking:\n"
 "    -p, --port PORT            TCP port to listen on\n"
 "    --listen ADDRESS           IP address to listen on\n"
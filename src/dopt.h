@@ -45,6 +45,8 @@ extern int opt_lifetime;
 extern char *opt_listen_addr;
 extern int opt_niceness;
 extern const char *arg_sysroot;
+extern int opt_debug_prefix_map;
+extern int opt_pch_cache_size;
 
 #ifdef HAVE_LINUX
 extern int opt_oom_score_adj;
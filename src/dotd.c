@@ -23,127 +23,142 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include "distcc.h"
+#include "trace.h"
+#include "util.h"
 #include "exitcode.h"
 #include "dotd.h"
 #include "snprintf.h"
 
-/* The dotd file is compiler generated,
- * so it should not have lines with more than
- * twice the length of the maximum path length.
- */
-#define MAX_DOTD_LINE_LEN (MAXPATHLEN * 2)
+/* The rewritten file is collected in a buffer that grows as needed. */
+struct dcc_dotd_buf {
+    char *data;
+    size_t len, size;
+};
 
-/* Replaces the first occurrence of needle in haystack with
-   new_needle. haystack must be of at least hay_size,
-   and hay_size must be large enough to hold the string
-   after the replacement.
-   new_needle should not overlap with the haystack.
-   Returns 0 if all goes well, 1 otherwise.
-*/
-static int dcc_strgraft(char *haystack, size_t hay_size,
-                        const char *needle, const char *new_needle)
+static int dcc_dotd_append(struct dcc_dotd_buf *out,
+                           const char *p, size_t len)
 {
-    char *found;
-    size_t needle_len = 0;
-    size_t new_needle_len = 0;
-
-    found = strstr(haystack, needle);
-    if (found == NULL)
-        return 0;
+    if (out->len + len > out->size) {
+        size_t new_size = out->size ? out->size : 4096;
+        char *new_data;
 
-    needle_len = strlen(needle);
-    new_needle_len = strlen(new_needle);
-
-    if (strlen(haystack) - needle_len + new_needle_len + 1 > hay_size)
-        return 1;
+        while (new_size < out->len + len)
+            new_size *= 2;
+        if ((new_data = realloc(out->data, new_size)) == NULL) {
+            rs_log_error("failed to allocate %lu bytes for .d file",
+                         (unsigned long) new_size);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        out->data = new_data;
+        out->size = new_size;
+    }
+    memcpy(out->data + out->len, p, len);
+    out->len += len;
+    return 0;
+}
 
-    /* make some room in the haystack for the new needle */
-    memmove(found + new_needle_len,
-            found + needle_len,
-            strlen(found + needle_len) + 1);
-    memcpy(found, new_needle, new_needle_len);
+/* Append the @p len bytes at @p p to @p out, leaving out every occurrence
+ * of @p root_dir. */
+static int dcc_dotd_append_unrooted(struct dcc_dotd_buf *out,
+                                    const char *p, size_t len,
+                                    const char *root_dir,
+                                    size_t root_len)
+{
+    const char *end = p + len;
+    const char *found;
+    int ret;
 
-    return 0;
+    while ((found = dcc_memmem(p, end - p, root_dir, root_len)) != NULL) {
+        if ((ret = dcc_dotd_append(out, p, found - p)))
+            return ret;
+        p = found + root_len;
+    }
+    return dcc_dotd_append(out, p, end - p);
 }
 
 /* Given the name of a dotd file, and the name of the directory
- * masquerading as root, write a @p new_dotd file that
- * contains everything in dotd, but with the "root" directory removed.
- * It will also substitute client_out_name for server_out_name,
- * rewriting the dependency target.
+ * masquerading as root, return in @p new_dotd (of length @p new_dotd_len)
+ * everything in dotd, but with the "root" directory removed.
+ * It will also substitute client_out_name for the first server_out_name
+ * on each line, rewriting the dependency target.
+ *
+ * This is done in a single pass over the mapped file, so lines may be of
+ * any length; generated sources can give very long ones.  The caller
+ * sends the result and frees it.
  */
 int dcc_cleanup_dotd(const char *dotd_fname,
-                     char **new_dotd_fname,
+                     char **new_dotd,
+                     size_t *new_dotd_len,
                      const char *root_dir,
                      const char *client_out_name,
                      const char *server_out_name)
 {
-    /* When we do the substitution of server-side output name to
-     * client-side output name, we may end up with a line that
-     * longer than the longest line we expect from the compiler.
-     */
-    char buf[2 * MAX_DOTD_LINE_LEN];
+    struct dcc_dotd_buf out = { NULL, 0, 0 };
+    size_t root_len = strlen(root_dir);
+    size_t server_len = strlen(server_out_name);
+    size_t client_len = strlen(client_out_name);
+    const char *base = NULL, *p, *end;
+    struct stat st;
+    int fd, ret = 0;
 
-    FILE *dotd, *tmp_dotd;
-    char *found;
-    int ret;
-
-    dotd = fopen(dotd_fname, "r");
-    if (dotd == NULL) {
-        return 1;
+    if ((fd = open(dotd_fname, O_RDONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", dotd_fname, strerror(errno));
+        return EXIT_IO_ERROR;
     }
-    ret = dcc_make_tmpnam(dcc_find_basename(dotd_fname),
-                          ".d", new_dotd_fname);
-
-    if (ret) {
-        fclose(dotd);
-        return ret;
+    if (fstat(fd, &st) == -1) {
+        rs_log_error("failed to stat %s: %s", dotd_fname, strerror(errno));
+        dcc_close(fd);
+        return EXIT_IO_ERROR;
     }
-
-    tmp_dotd = fopen(*new_dotd_fname, "w");
-    if (tmp_dotd == NULL) {
-        fclose(dotd);
-        return 1;
+    if (st.st_size > 0) {
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            rs_log_error("failed to map %s: %s", dotd_fname,
+                         strerror(errno));
+            dcc_close(fd);
+            return EXIT_IO_ERROR;
+        }
     }
+    dcc_close(fd);
 
-    while (fgets(buf, MAX_DOTD_LINE_LEN, dotd)) {
-        if ((strchr(buf, '\n') == NULL) && !feof(dotd)) {
-            /* Line length must have exceeded MAX_DOTD_LINE_LEN: bail out. */
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
-        }
+    for (p = base, end = base + st.st_size; p < end && ret == 0; ) {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *line_end = eol ? eol + 1 : end;
+        const char *target = dcc_memmem(p, line_end - p,
+                                        server_out_name, server_len);
 
         /* First, the dependency target substitution */
-        if (dcc_strgraft(buf, sizeof(buf),
-                         server_out_name, client_out_name)) {
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
+        if (target) {
+            if ((ret = dcc_dotd_append_unrooted(&out, p, target - p,
+                                                root_dir, root_len))
+                || (ret = dcc_dotd_append(&out, client_out_name,
+                                          client_len)))
+                break;
+            p = target + server_len;
         }
-
-        /* Second, the trimming of the "root" directory" */
-        found = strstr(buf, root_dir);
-        while (found) {
-            char *rest_of_buf = found + strlen(root_dir);
-            memmove(found, rest_of_buf, strlen(rest_of_buf) + 1);
-            found = strstr(found, root_dir);
-        }
-        if (fprintf(tmp_dotd, "%s", buf) < 0) {
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
-        }
-    }
-    if (ferror(dotd) || ferror(tmp_dotd)) {
-       return 1;
+        /* Second, the trimming of the "root" directory */
+        ret = dcc_dotd_append_unrooted(&out, p, line_end - p,
+                                       root_dir, root_len);
+        p = line_end;
     }
-    fclose(dotd);
-    if (fclose(tmp_dotd) < 0) {
-        return 1;
+
+    if (base)
+        munmap((void *) base, st.st_size);
+    if (ret) {
+        free(out.data);
+        return ret;
     }
+    *new_dotd = out.data;
+    *new_dotd_len = out.len;
     return 0;
 }
 
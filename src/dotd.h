@@ -19,7 +19,8 @@
  */
 
 int dcc_cleanup_dotd(const char *dotd_fname,
-                     char **new_dotd_fname,
+                     char **new_dotd,
+                     size_t *new_dotd_len,
                      const char *root_dir,
                      const char *client_out_name,
                      const char *server_out_name);
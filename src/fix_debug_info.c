@@ -42,7 +42,9 @@
   #include <sys/mman.h>
 #endif
 
+#include "distcc.h"
 #include "trace.h"
+#include "util.h"
 #include "fix_debug_info.h"
 
 /* XINDEX isn't defined everywhere, but where it is, it's always the
@@ -235,22 +237,24 @@ static int FindElfSection(const void *elf_mapped_base, off_t elf_size,
  */
 static int replace_string(void *base, size_t size,
                            const char *search, const char *replace) {
-  char *start = (char *) base;
-  char *end = (char *) base + size;
+  char *p = (char *) base;
+  char *limit;
   int count = 0;
-  char *p;
   size_t search_len = strlen(search);
   size_t replace_len = strlen(replace);
 
   assert(replace_len == search_len);
 
-  if (size < search_len + 1)
+  if (size < search_len + 2)
     return 0;
-  for (p = start; p < end - search_len - 1; p++) {
-    if (memcmp(p, search, search_len) == 0) {
-      memcpy(p, replace, replace_len);
-      count++;
-    }
+  /* A match has to leave room for at least the terminating null. */
+  limit = (char *) base + size - 2;
+  /* Sections of big objects run to many megabytes, so this had better
+   * not look at every byte. */
+  while ((p = dcc_memmem(p, limit - p, search, search_len)) != NULL) {
+    memcpy(p, replace, replace_len);
+    count++;
+    p += search_len;
   }
   return count;
 }
@@ -402,6 +406,9 @@ static int update_debug_info(const char *path, const char *search,
   update_section(path, base, st.st_size, ".debug_str", search, replace);
   /* DWARF 5+ puts the DW_AT_comp_dir string in .debug_line_str */
   update_section(path, base, st.st_size, ".debug_line_str", search, replace);
+  /* The same, in the .dwo file written with -gsplit-dwarf. */
+  update_section(path, base, st.st_size, ".debug_info.dwo", search, replace);
+  update_section(path, base, st.st_size, ".debug_str.dwo", search, replace);
 
   return munmap_file(base, path, fd, &st);
 }
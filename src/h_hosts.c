@@ -36,6 +36,9 @@
  *
  * "ssh" USER HOST COMMAND
  * "tcp" HOST PORT
+ *
+ * followed by " speed=FACTOR" if a speed was declared, " pch" if the
+ * host keeps precompiled headers, and " dwo" if it returns split DWARF.
  **/
 
 
@@ -88,19 +91,27 @@ int main(int UNUSED(argc), char **argv)
         printf("%4d ", e->n_slots);
 
         if (e->mode == DCC_MODE_LOCAL) {
-            printf("LOCAL\n");
+            printf("LOCAL");
         } else if (e->mode == DCC_MODE_SSH) {
-            printf("SSH %s %s %s\n",
+            printf("SSH %s %s %s",
                    e->user        ? e->user        : "(no-user)",
                    e->hostname    ? e->hostname    : "(no-hostname)",
                    e->ssh_command ? e->ssh_command : "(no-command)");
         } else if (e->mode == DCC_MODE_TCP) {
-            printf("TCP %s %d\n",
+            printf("TCP %s %d",
                    e->hostname    ? e->hostname    : "(no-hostname)",
                    e->port);
         } else {
             printf("BOGUS %d\n", e->mode);
+            continue;
         }
+        if (e->speed > 0)
+            printf(" speed=%g", e->speed);
+        if (e->pch)
+            printf(" pch");
+        if (e->dwo)
+            printf(" dwo");
+        printf("\n");
     }
     if (e) {
         rs_log_error("extra entries in list!");
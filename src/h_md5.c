@@ -0,0 +1,68 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/*
+ * h_md5.c:
+ * Helper for tests of the MD5 implementation.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "md5.h"
+
+const char *rs_program_name = "h_md5";
+
+
+/**
+ * Test harness: print the MD5 digest of standard input in hex, feeding it to
+ * dcc_md5_update() in pieces of the size given as the argument, if any.
+ **/
+int main(int argc, char *argv[])
+{
+    unsigned char digest[DCC_MD5_DIGEST_LEN];
+    unsigned char buf[4096];
+    struct dcc_md5 md5;
+    size_t piece = sizeof buf, n;
+    int i;
+
+    if (argc > 1) {
+        piece = atoi(argv[1]);
+        if (piece < 1 || piece > sizeof buf) {
+            rs_log_error("usage: %s [PIECE_SIZE]", argv[0]);
+            return 1;
+        }
+    }
+
+    dcc_md5_init(&md5);
+    while ((n = fread(buf, 1, piece, stdin)) > 0)
+        dcc_md5_update(&md5, buf, n);
+    dcc_md5_final(&md5, digest);
+
+    for (i = 0; i < DCC_MD5_DIGEST_LEN; i++)
+        printf("%02x", digest[i]);
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Decide when a remote compilation is late enough to hedge.
+ *
+ * With DISTCC_HEDGE set, a job that has taken longer than 95% of the recent
+ * jobs on its server is sent to a second server as well, and the first
+ * answer is used.  The recent latencies of each server, in milliseconds, are
+ * kept in a small text file in the lock directory, shared by all clients of
+ * the user.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "lock.h"
+#include "hedge.h"
+
+
+/* How many latencies to remember for each server. */
+#define DCC_HEDGE_SAMPLES 32
+
+/* Don't hedge on a server until this many of its jobs have been seen. */
+#define DCC_HEDGE_MIN_SAMPLES 8
+
+
+int dcc_hedge_enabled(void)
+{
+    return dcc_getenv_bool("DISTCC_HEDGE", 0);
+}
+
+
+/**
+ * Read up to DCC_HEDGE_SAMPLES latencies, oldest first, from @p fd.
+ **/
+static int dcc_hedge_read(int fd, long *samples)
+{
+    char buf[DCC_HEDGE_SAMPLES * 12 + 1];
+    char *p, *end;
+    ssize_t len;
+    int n = 0;
+
+    if ((len = read(fd, buf, sizeof buf - 1)) <= 0)
+        return 0;
+    buf[len] = '\0';
+
+    for (p = buf; n < DCC_HEDGE_SAMPLES; p = end) {
+        long ms = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (ms >= 0)
+            samples[n++] = ms;
+    }
+    return n;
+}
+
+
+static int dcc_hedge_open(const struct dcc_hostdef *host, int *fd)
+{
+    char *fname;
+    int ret;
+
+    if ((ret = dcc_make_lock_filename("hedge", host, 0, &fname)))
+        return ret;
+    if ((*fd = open(fname, O_RDWR|O_CREAT, 0666)) == -1) {
+        rs_log_warning("failed to open %s: %s", fname, strerror(errno));
+        free(fname);
+        return EXIT_IO_ERROR;
+    }
+    free(fname);
+    return 0;
+}
+
+
+/**
+ * Remember that a job on @p host took @p ms milliseconds from connecting to
+ * receiving its results.
+ **/
+int dcc_hedge_note_latency(const struct dcc_hostdef *host, long ms)
+{
+    long samples[DCC_HEDGE_SAMPLES];
+    FILE *f;
+    int fd, n, i, ret;
+
+    if ((ret = dcc_hedge_open(host, &fd)))
+        return ret;
+    if ((ret = dcc_lock_fd(fd))) {
+        close(fd);
+        return ret;
+    }
+
+    n = dcc_hedge_read(fd, samples);
+    if (n == DCC_HEDGE_SAMPLES) {
+        memmove(samples, samples + 1, (n - 1) * sizeof *samples);
+        n--;
+    }
+    samples[n++] = ms;
+
+    if (lseek(fd, 0, SEEK_SET) == -1 || ftruncate(fd, 0) == -1
+        || (f = fdopen(dup(fd), "w")) == NULL) {
+        rs_log_warning("failed to rewrite latencies: %s", strerror(errno));
+        dcc_unlock(fd);
+        return EXIT_IO_ERROR;
+    }
+    for (i = 0; i < n; i++)
+        fprintf(f, "%ld\n", samples[i]);
+    if (fclose(f) != 0) {
+        rs_log_warning("failed to write latencies: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+
+    dcc_unlock(fd);
+    return ret;
+}
+
+
+static int dcc_hedge_compare(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Work out how long to wait for @p host before hedging: the 95th percentile
+ * of its recent latencies.
+ *
+ * @param ms On return, the delay in milliseconds, or -1 if too little is
+ * known about the host to hedge at all.
+ **/
+int dcc_hedge_delay(const struct dcc_hostdef *host, long *ms)
+{
+    long samples[DCC_HEDGE_SAMPLES];
+    int fd, n, ret;
+
+    *ms = -1;
+    if ((ret = dcc_hedge_open(host, &fd)))
+        return ret;
+    n = dcc_hedge_read(fd, samples);
+    close(fd);
+
+    if (n < DCC_HEDGE_MIN_SAMPLES) {
+        rs_trace("only %d latencies known for %s; not hedging",
+                 n, host->hostdef_string);
+        return 0;
+    }
+
+    qsort(samples, n, sizeof *samples, dcc_hedge_compare);
+    *ms = samples[(95 * n + 99) / 100 - 1];
+    rs_trace("p95 latency of %s is %ldms", host->hostdef_string, *ms);
+    return 0;
+}
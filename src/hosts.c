@@ -48,7 +48,7 @@
   OLDSTYLE_TCP_HOST = HOSTID[/LIMIT][:PORT][OPTIONS]
   HOSTID = HOSTNAME | IPV4
   OPTIONS = ,OPTION[OPTIONS]
-  OPTION = lzo | cpp
+  OPTION = lzo | cpp | pch | dwo | speed=FACTOR
   GLOBAL_OPTION = --randomize
  *
  * Any amount of whitespace may be present between hosts.
@@ -233,8 +233,9 @@ static int dcc_parse_multiplier(const char **psrc, struct dcc_hostdef *hostdef)
 /**
  * Parse an optionally present option string.
  *
- * At the moment the only two options we have is "lzo" for compression,
- * and "cpp" if the server supports doing the preprocessing there, also.
+ * The options are "lzo" for compression, "cpp" if the server supports
+ * doing the preprocessing there, also, and "speed=FACTOR" for how fast
+ * the machine compiles compared to the others.
  **/
 static int dcc_parse_options(const char **psrc,
                              struct dcc_hostdef *host)
@@ -243,6 +244,9 @@ static int dcc_parse_options(const char **psrc,
 
     host->compr = DCC_COMPRESS_NONE;
     host->cpp_where = DCC_CPP_ON_CLIENT;
+    host->speed = 0;
+    host->pch = 0;
+    host->dwo = 0;
 #ifdef HAVE_GSSAPI
     host->authenticate = 0;
     host->auth_name = NULL;
@@ -262,6 +266,24 @@ static int dcc_parse_options(const char **psrc,
             rs_trace("got CPP option");
             host->cpp_where = DCC_CPP_ON_SERVER;
             p += 3;
+        } else if (str_startswith("pch", p)) {
+            rs_trace("got PCH option");
+            host->pch = 1;
+            p += 3;
+        } else if (str_startswith("dwo", p)) {
+            rs_trace("got DWO option");
+            host->dwo = 1;
+            p += 3;
+        } else if (str_startswith("speed=", p)) {
+            char *end;
+            p += 6;
+            host->speed = strtod(p, &end);
+            if (end == p || host->speed <= 0) {
+                rs_log_error("bad speed in host specification: %s", started);
+                return EXIT_BAD_HOSTSPEC;
+            }
+            rs_trace("got speed %g", host->speed);
+            p = end;
 #ifdef HAVE_GSSAPI
         } else if (str_startswith("auth", p)) {
             rs_trace("got GSSAPI option");
@@ -59,6 +59,18 @@ struct dcc_hostdef {
     /** Where are we doing preprocessing? */
     enum dcc_cpp_where cpp_where;
 
+    /** How fast this machine compiles, relative to the others; 0 if not
+     * declared. */
+    double speed;
+
+    /** Does the server keep the precompiled headers sent to it?  See
+     * pch.c. */
+    int pch;
+
+    /** Does the server send back the .dwo file written with
+     * -gsplit-dwarf? */
+    int dwo;
+
 #ifdef HAVE_GSSAPI
     /* Are we authenticating with this host? */
     int authenticate;
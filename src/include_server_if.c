@@ -26,6 +26,7 @@
 #include <stdio.h>
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -41,10 +42,12 @@
 #include "util.h"
 #include "hosts.h"
 #include "include_server_if.h"
+#include "timeval.h"
 
 static int dcc_count_slashes(const char *path);
 static int dcc_count_leading_dotdots(const char *path);
 static int dcc_categorize_file(const char *include_server_filename);
+static long dcc_ms_since(const struct timeval *from);
 
 /* The include server puts all files in its own special directory,
  * which is n path components long, where n = INCLUDE_SERVER_DIR_DEPTH
@@ -55,6 +58,10 @@ static int dcc_categorize_file(const char *include_server_filename);
  * in env variable INCLUDE_SERVER_PORT. If all goes well,
  * it returns the array of files in @p files and returns 0;
  * if anything goes wrong, it returns a non-zero value.
+ *
+ * How long the include server took is logged, so that slow pump builds can
+ * be told apart from slow compilations; 'pump --stats' tells where the
+ * include server spends its time.
  */
 
 int dcc_talk_to_include_server(char **argv, char ***files)
@@ -62,6 +69,8 @@ int dcc_talk_to_include_server(char **argv, char ***files)
     char *include_server_port;
     int fd;
     struct sockaddr_un sa;
+    struct timeval before;
+    long send_ms;
 
     int ret;
     char *stub;
@@ -93,32 +102,58 @@ int dcc_talk_to_include_server(char **argv, char ***files)
     strcpy(sa.sun_path, include_server_port);
     sa.sun_family = AF_UNIX;
 
+    gettimeofday(&before, NULL);
+
     if (dcc_connect_by_addr((struct sockaddr *) &sa, sizeof(sa), &fd))
         return 1;
 
     /* TODO? switch include_server to use more appropriate token names */
     if (dcc_x_cwd(fd) ||
-        dcc_x_argv(fd, "ARGC", "ARGV", argv) ||
-        dcc_r_argv(fd, "ARGC", "ARGV", files)) {
-        rs_log_warning("failed to talk to include server '%s'",
-                       include_server_port);
+        dcc_x_argv(fd, "ARGC", "ARGV", argv)) {
+        rs_log_warning("failed to send request to include server '%s' "
+                       "after %ldms", include_server_port,
+                       dcc_ms_since(&before));
         dcc_close(fd);
         /* We are failing anyway, so we can ignore
            the return value of dcc_close() */
         return 1;
     }
+    send_ms = dcc_ms_since(&before);
+
+    if (dcc_r_argv(fd, "ARGC", "ARGV", files)) {
+        rs_log_warning("failed to get answer from include server '%s' "
+                       "after %ldms", include_server_port,
+                       dcc_ms_since(&before));
+        dcc_close(fd);
+        return 1;
+    }
 
     if (dcc_close(fd)) {
         return 1;
     }
 
     if (dcc_argv_len(*files) == 0) {
-        rs_log_warning("include server gave up analyzing");
+        rs_log_warning("include server gave up analyzing after %ldms",
+                       dcc_ms_since(&before));
         return 1;
     }
+    rs_log_info("include server answered with %u files in %ldms "
+                "(%ldms to connect and send)",
+                dcc_argv_len(*files), dcc_ms_since(&before), send_ms);
     return 0;
 }
 
+/* The milliseconds elapsed since @p from. */
+static long dcc_ms_since(const struct timeval *from)
+{
+    struct timeval now, then, delta;
+
+    gettimeofday(&now, NULL);
+    then = *from;  /* timeval_subtract normalizes its last argument */
+    timeval_subtract(&delta, &now, &then);
+    return delta.tv_sec * 1000L + delta.tv_usec / 1000;
+}
+
 /* The include server puts all files in its own special directory,
  * which is n path components long, where n = INCLUDE_SERVER_DIR_DEPTH
  * The original file should drop those components.
@@ -0,0 +1,668 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Load generator for distccd.
+ *
+ * Runs a number of concurrent clients that each send a series of compile
+ * requests to a distccd on this machine, through the same functions as
+ * distcc itself uses to send them and read the results, and then
+ * reports the throughput and the distribution of latency in each phase of
+ * a request.  Together with the stub compiler below this measures what the
+ * daemon itself costs: accepting, forking, reading and writing the
+ * protocol, temporary files and cleaning up.
+ *
+ * The compiler that the clients ask for is this same program, which when
+ * called with --stub-compiler just copies its input to its output after a
+ * configurable delay.  The daemon must therefore be started with
+ * --enable-tcp-insecure, or with DISTCC_CMDLIST allowing it.
+ *
+ * Protocol 3 sends the source and a set of headers as pump mode does, with
+ * the files compressed once up front into a client root, as the include
+ * server would have done; protocol 2 compresses the preprocessed source for
+ * each request, as distcc does.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <popt.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "rpc.h"
+#include "bulk.h"
+#include "clinet.h"
+#include "hosts.h"
+#include "emaillog.h"
+#include "state.h"
+#include "exitcode.h"
+#include "timeval.h"
+
+const char *rs_program_name = "distcc-loadgen";
+
+enum dcc_loadgen_phase {
+    DCC_LOADGEN_CONNECT,
+    DCC_LOADGEN_SEND,
+    DCC_LOADGEN_SERVER,
+    DCC_LOADGEN_RECEIVE,
+    DCC_LOADGEN_TOTAL,
+    DCC_LOADGEN_PHASES
+};
+
+static const char *const dcc_loadgen_phase_names[DCC_LOADGEN_PHASES] = {
+    "connect", "send", "server", "receive", "total"
+};
+
+/**
+ * What each client tells the parent about one request.  These are written
+ * whole to a pipe shared by all clients, so they must stay smaller than
+ * PIPE_BUF.
+ **/
+struct dcc_loadgen_sample {
+    int failed;
+    double secs[DCC_LOADGEN_PHASES];
+};
+
+static const char *opt_host = "127.0.0.1";
+static int opt_port = DISTCC_DEFAULT_PORT;
+static int opt_clients = 4;
+static int opt_requests = 100;
+static int opt_protocol = DCC_VER_1;
+static int opt_size = 32 * 1024;
+static int opt_headers = 16;
+static int opt_header_size = 4 * 1024;
+static int opt_delay_ms = 0;
+
+static const struct poptOption dcc_loadgen_options[] = {
+    { "clients", 'c',     POPT_ARG_INT, &opt_clients, 0, 0, 0 },
+    { "delay-ms", 'd',    POPT_ARG_INT, &opt_delay_ms, 0, 0, 0 },
+    { "header-size", 0,   POPT_ARG_INT, &opt_header_size, 0, 0, 0 },
+    { "headers", 0,       POPT_ARG_INT, &opt_headers, 0, 0, 0 },
+    { "help", 0,          POPT_ARG_NONE, 0, '?', 0, 0 },
+    { "host", 'H',        POPT_ARG_STRING, &opt_host, 0, 0, 0 },
+    { "port", 'p',        POPT_ARG_INT, &opt_port, 0, 0, 0 },
+    { "protocol", 'P',    POPT_ARG_INT, &opt_protocol, 0, 0, 0 },
+    { "requests", 'n',    POPT_ARG_INT, &opt_requests, 0, 0, 0 },
+    { "size", 's',        POPT_ARG_INT, &opt_size, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0 }
+};
+
+
+static void dcc_loadgen_show_usage(void)
+{
+    dcc_show_version("distcc-loadgen");
+    printf(
+"Usage:\n"
+"   distcc-loadgen [OPTIONS]\n"
+"\n"
+"Options:\n"
+"    --help                     explain usage and exit\n"
+"    -H, --host HOST            distccd to load [127.0.0.1]\n"
+"    -p, --port PORT            its TCP port [3632]\n"
+"    -c, --clients N            concurrent clients [4]\n"
+"    -n, --requests N           requests sent by each client [100]\n"
+"    -P, --protocol VERSION     1 plain, 2 LZO, 3 pump mode [1]\n"
+"    -s, --size BYTES           size of the source file [32768]\n"
+"    --headers N                headers sent with protocol 3 [16]\n"
+"    --header-size BYTES        size of each header [4096]\n"
+"    -d, --delay-ms MS          time the stub compiler takes [0]\n"
+"\n"
+"The daemon runs this program as its compiler, so it must be started\n"
+"with --enable-tcp-insecure.\n"
+);
+}
+
+
+/**
+ * Fill @p buf with @p len bytes that look roughly like C source.
+ **/
+static void dcc_loadgen_fill(char *buf, size_t len, unsigned seed)
+{
+    size_t used = 0;
+
+    while (used < len) {
+        char line[100];
+        int n;
+
+        seed = seed * 1103515245 + 12345;
+        n = snprintf(line, sizeof line,
+                     "static int func_%u(int x) { return x * %u; }\n",
+                     (seed >> 8) % 10000, (seed >> 16) % 1000);
+        if (n > (int) (len - used))
+            n = (int) (len - used);
+        memcpy(buf + used, line, n);
+        used += n;
+    }
+}
+
+
+/**
+ * Write @p len bytes of made-up source to @p fname, creating its directory,
+ * and compressed if @p compr says so.  Both are removed on exit.
+ **/
+static int dcc_loadgen_make_file(const char *fname, size_t len,
+                                 unsigned seed, enum dcc_compress compr)
+{
+    char *buf, *out;
+    size_t out_len;
+    int fd, ret;
+
+    if ((buf = malloc(len ? len : 1)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    dcc_loadgen_fill(buf, len, seed);
+    out = buf;
+    out_len = len;
+    if (compr == DCC_COMPRESS_LZO1X && len
+        && (ret = dcc_compress_lzo1x_alloc(buf, len, &out, &out_len))) {
+        free(buf);
+        return ret;
+    }
+
+    if ((ret = dcc_mk_tmp_ancestor_dirs(fname)))
+        goto out;
+    if ((fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        rs_log_error("failed to create %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if ((ret = dcc_add_cleanup(fname)) == 0)
+        ret = dcc_writex(fd, out, out_len);
+    if (dcc_close(fd) && ret == 0)
+        ret = EXIT_IO_ERROR;
+
+  out:
+    if (out != buf)
+        free(out);
+    free(buf);
+    return ret;
+}
+
+
+/**
+ * dcc_retrieve_results() puts the messages of the server in the log email
+ * of the client; the load generator sends none.
+ **/
+int dcc_add_file_to_log_email(const char *description, const char *fname)
+{
+    (void) description;
+    (void) fname;
+    return 0;
+}
+
+
+static double dcc_loadgen_secs(const struct timeval *from,
+                               const struct timeval *to)
+{
+    struct timeval delta, x = *to, y = *from;
+
+    timeval_subtract(&delta, &x, &y);
+    return (double) delta.tv_sec + (double) delta.tv_usec / 1e6;
+}
+
+
+/**
+ * Send one request and read back the results, timing each phase.
+ **/
+static int dcc_loadgen_request(char **argv, char **files,
+                               struct dcc_hostdef *host,
+                               struct dcc_loadgen_sample *sample)
+{
+    struct timeval t[DCC_LOADGEN_PHASES + 1];
+    int fd, i, status, ret;
+
+    gettimeofday(&t[0], NULL);
+    if ((ret = dcc_connect_by_name(host->hostname, host->port, &fd)))
+        return ret;
+    gettimeofday(&t[1], NULL);
+
+    /* As dcc_send_header() in remote.c does. */
+    tcp_cork_sock(fd, 1);
+    if ((ret = dcc_x_req_header(fd, host->protover))
+        || (host->cpp_where == DCC_CPP_ON_SERVER
+            && (ret = dcc_x_cwd(fd)))
+        || (ret = dcc_x_argv(fd, "ARGC", "ARGV", argv)))
+        goto out;
+    if (host->cpp_where == DCC_CPP_ON_SERVER)
+        ret = dcc_x_many_files(fd, (unsigned) dcc_argv_len(files), files,
+                               host, argv[0]);
+    else
+        ret = dcc_x_file(fd, files[0], "DOTI", host->compr, NULL);
+    if (ret)
+        goto out;
+    tcp_cork_sock(fd, 0);
+    gettimeofday(&t[2], NULL);
+
+    if ((ret = dcc_select_for_read(fd, dcc_get_io_timeout())))
+        goto out;
+    gettimeofday(&t[3], NULL);
+
+    if ((ret = dcc_retrieve_results(fd, &status, "/dev/null",
+                                    host->cpp_where == DCC_CPP_ON_SERVER
+                                    ? "/dev/null" : NULL,
+                                    NULL, "/dev/null", host)))
+        goto out;
+    gettimeofday(&t[4], NULL);
+
+    for (i = 0; i < DCC_LOADGEN_TOTAL; i++)
+        sample->secs[i] = dcc_loadgen_secs(&t[i], &t[i + 1]);
+    sample->secs[DCC_LOADGEN_TOTAL] = dcc_loadgen_secs(&t[0], &t[4]);
+    if (status != 0) {
+        rs_log_error("stub compiler failed with status %d", status);
+        ret = EXIT_COMPILER_CRASHED;
+    }
+
+  out:
+    dcc_close(fd);
+    return ret;
+}
+
+
+/**
+ * Body of one client process: send the requests and report each of them
+ * to @p report_fd.
+ **/
+static int dcc_loadgen_client(char **argv, char **files,
+                              struct dcc_hostdef *host, int report_fd)
+{
+    struct dcc_loadgen_sample sample;
+    int i, ret, failed = 0;
+
+    for (i = 0; i < opt_requests; i++) {
+        memset(&sample, 0, sizeof sample);
+        if (dcc_loadgen_request(argv, files, host, &sample))
+            sample.failed = failed = 1;
+        if ((ret = dcc_writex(report_fd, &sample, sizeof sample)))
+            break;
+    }
+    dcc_remove_state_file();
+    if (i < opt_requests)
+        return ret;
+    return failed ? EXIT_DISTCC_FAILED : 0;
+}
+
+
+static int dcc_loadgen_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Nearest-rank percentile of the sorted array @p v of @p n values.
+ **/
+static double dcc_loadgen_percentile(const double *v, int n, int pct)
+{
+    int rank = (n * pct + 99) / 100;
+
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+
+static void dcc_loadgen_report(const struct dcc_loadgen_sample *samples,
+                               int n_samples, double wall_secs)
+{
+    double *v;
+    int phase, i, n, n_failed = 0;
+
+    for (i = 0; i < n_samples; i++)
+        n_failed += samples[i].failed;
+    n = n_samples - n_failed;
+
+    printf("%d clients, protocol %d, %d byte source, %d ms compile\n",
+           opt_clients, opt_protocol, opt_size, opt_delay_ms);
+    printf("%d requests, %d failed, in %.3fs: %.1f requests/s\n",
+           n_samples, n_failed, wall_secs,
+           wall_secs > 0 ? n / wall_secs : 0.0);
+    if (n == 0 || (v = malloc(n * sizeof *v)) == NULL)
+        return;
+
+    printf("%-10s %10s %10s %10s %10s %10s   (ms)\n",
+           "phase", "mean", "p50", "p95", "p99", "max");
+    for (phase = 0; phase < DCC_LOADGEN_PHASES; phase++) {
+        double sum = 0;
+        int j = 0;
+
+        for (i = 0; i < n_samples; i++)
+            if (!samples[i].failed)
+                sum += (v[j++] = samples[i].secs[phase]);
+        qsort(v, n, sizeof *v, dcc_loadgen_cmp_double);
+        printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+               dcc_loadgen_phase_names[phase], sum * 1e3 / n,
+               dcc_loadgen_percentile(v, n, 50) * 1e3,
+               dcc_loadgen_percentile(v, n, 95) * 1e3,
+               dcc_loadgen_percentile(v, n, 99) * 1e3,
+               v[n - 1] * 1e3);
+    }
+    free(v);
+}
+
+
+/**
+ * Act as the compiler: copy the input to the output given by -o, after
+ * sleeping for the time given by --stub-delay-ms.  If there's -MF, write a
+ * dependency file too, as the server asks for one in pump mode.
+ **/
+static int dcc_loadgen_stub(int argc, char *argv[])
+{
+    const char *input = NULL, *output = NULL, *deps = NULL;
+    struct timespec delay;
+    long delay_ms = 0;
+    FILE *f;
+    int i, fd, ret;
+
+    for (i = 2; i < argc; i++) {
+        if (str_startswith("--stub-delay-ms=", argv[i]))
+            delay_ms = atol(argv[i] + strlen("--stub-delay-ms="));
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "-MF") && i + 1 < argc)
+            deps = argv[++i];
+        else if ((!strcmp(argv[i], "-MT") || !strcmp(argv[i], "-MQ"))
+                 && i + 1 < argc)
+            i++;
+        else if (argv[i][0] != '-')
+            input = argv[i];
+    }
+    if (input == NULL || output == NULL) {
+        rs_log_error("stub compiler needs an input and -o");
+        return EXIT_BAD_ARGUMENTS;
+    }
+
+    if (delay_ms > 0) {
+        delay.tv_sec = delay_ms / 1000;
+        delay.tv_nsec = (delay_ms % 1000) * 1000000L;
+        while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+            ;
+    }
+
+    if ((fd = open(output, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        rs_log_error("failed to create %s: %s", output, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_copy_file_to_fd(input, fd);
+    dcc_close(fd);
+    if (ret)
+        return ret;
+
+    if (deps) {
+        if ((f = fopen(deps, "w")) == NULL) {
+            rs_log_error("failed to create %s: %s", deps, strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        fprintf(f, "%s: %s\n", output, input);
+        if (fclose(f) == EOF)
+            return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * Find the absolute name of this program, for the daemon to run as the
+ * compiler.
+ **/
+static int dcc_loadgen_self(const char *argv0, char **self)
+{
+    char buf[MAXPATHLEN + 1];
+    ssize_t len;
+
+    if ((len = readlink("/proc/self/exe", buf, sizeof buf - 1)) > 0) {
+        buf[len] = '\0';
+        *self = strdup(buf);
+    } else {
+        *self = realpath(argv0, NULL);
+    }
+    if (*self == NULL) {
+        rs_log_error("can't find the absolute name of %s", argv0);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    return 0;
+}
+
+
+static int dcc_loadgen_parse_options(int argc, const char **argv)
+{
+    poptContext po;
+    int po_err, ret = 0;
+
+    po = poptGetContext("distcc-loadgen", argc, argv, dcc_loadgen_options, 0);
+    while ((po_err = poptGetNextOpt(po)) != -1) {
+        if (po_err == '?') {
+            dcc_loadgen_show_usage();
+            ret = EXIT_BAD_ARGUMENTS;
+            goto out;
+        }
+        rs_log_error("%s: %s", poptBadOption(po, POPT_BADOPTION_NOALIAS),
+                     poptStrerror(po_err));
+        ret = EXIT_BAD_ARGUMENTS;
+        goto out;
+    }
+    if (poptGetArg(po) != NULL) {
+        rs_log_error("unexpected argument; try --help");
+        ret = EXIT_BAD_ARGUMENTS;
+    } else if (opt_clients < 1 || opt_requests < 1 || opt_size < 0
+               || opt_headers < 0 || opt_header_size < 0 || opt_delay_ms < 0
+               || opt_protocol < DCC_VER_1 || opt_protocol > DCC_VER_3) {
+        rs_log_error("bad option value; try --help");
+        ret = EXIT_BAD_ARGUMENTS;
+    }
+
+  out:
+    poptFreeContext(po);
+    return ret;
+}
+
+
+/**
+ * Make the files that the clients send, and the list of their names.  In
+ * pump mode they go into a client root, made where and as deep as the
+ * include server makes its own, and under it into the current directory,
+ * as distccd will look for them there.
+ **/
+static int dcc_loadgen_make_files(struct dcc_hostdef *host, char ***files)
+{
+    enum dcc_compress compr = host->compr;
+    const char *client_tmp;
+    char *root, *cwd, *fname;
+    int n_files, depth, i, ret;
+    const char *p;
+
+    n_files = host->cpp_where == DCC_CPP_ON_SERVER ? 1 + opt_headers : 1;
+    if ((*files = calloc(n_files + 1, sizeof **files)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    if (host->cpp_where != DCC_CPP_ON_SERVER) {
+        /* Compressed as it is sent, if at all. */
+        if ((ret = dcc_get_new_tmpdir(&root)))
+            return ret;
+        if (asprintf(&fname, "%s/main.i", root) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        (*files)[0] = fname;
+        return dcc_loadgen_make_file(fname, opt_size, 1, DCC_COMPRESS_NONE);
+    }
+
+    if (!(client_tmp = getenv("DISTCC_CLIENT_TMP")))
+        client_tmp = access("/dev/shm", R_OK|W_OK|X_OK) == 0
+            ? "/dev/shm" : "/tmp";
+    if (asprintf(&root, "%s/distcc-loadgen_XXXXXX", client_tmp) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (mkdtemp(root) == NULL) {
+        rs_log_error("failed to create %s: %s", root, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((ret = dcc_add_cleanup(root)))
+        return ret;
+    for (depth = 0, p = root; *p; p++)
+        depth += *p == '/';
+    if (depth > 3) {
+        rs_log_error("%s is too deep to be a client root", root);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    for (; depth < 3; depth++) {
+        if (asprintf(&fname, "%s/padding", root) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        root = fname;
+    }
+    if ((cwd = getcwd(NULL, 0)) == NULL) {
+        rs_log_error("getcwd failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    for (i = 0; i < n_files; i++) {
+        if ((i == 0
+             ? asprintf(&fname, "%s%s/src/main.c.lzo", root, cwd)
+             : asprintf(&fname, "%s%s/include/h%d.h.lzo", root, cwd, i)) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        (*files)[i] = fname;
+        if ((ret = dcc_loadgen_make_file(fname,
+                                         i ? opt_header_size : opt_size,
+                                         i + 1, compr)))
+            return ret;
+    }
+    free(cwd);
+    return 0;
+}
+
+
+/**
+ * The host to load, written as in DISTCC_HOSTS, so that it is set up for
+ * the protocol as distcc would set it up.
+ **/
+static int dcc_loadgen_host(struct dcc_hostdef **host)
+{
+    static const char *const options[] = { "", "", ",lzo", ",lzo,cpp" };
+    char *spec;
+    int n_hosts, ret;
+
+    if (asprintf(&spec, strchr(opt_host, ':') ? "[%s]:%d%s" : "%s:%d%s",
+                 opt_host, opt_port, options[opt_protocol]) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = dcc_parse_hosts(spec, "--host", host, &n_hosts, NULL);
+    free(spec);
+    if (ret == 0 && n_hosts != 1) {
+        rs_log_error("bad host %s", opt_host);
+        ret = EXIT_BAD_HOSTSPEC;
+    }
+    return ret;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct dcc_hostdef *host;
+    struct dcc_loadgen_sample *samples;
+    struct timeval start, end;
+    char **cc_argv, **files, *self, delay_arg[40];
+    int n_samples = 0, i, pipe_fd[2], status, ret = 0;
+    ssize_t r;
+    pid_t pid;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_WARNING, NULL, STDERR_FILENO);
+
+    if (argc > 1 && !strcmp(argv[1], "--stub-compiler"))
+        return dcc_loadgen_stub(argc, argv);
+
+    if ((ret = dcc_loadgen_parse_options(argc, (const char **) argv))
+        || (ret = dcc_loadgen_self(argv[0], &self))
+        || (ret = dcc_loadgen_host(&host)))
+        return ret;
+    atexit(dcc_cleanup_tempfiles);
+    if ((ret = dcc_loadgen_make_files(host, &files)))
+        return ret;
+
+    snprintf(delay_arg, sizeof delay_arg, "--stub-delay-ms=%d", opt_delay_ms);
+    cc_argv = calloc(10, sizeof *cc_argv);
+    if (cc_argv == NULL
+        || (ret = dcc_argv_append(cc_argv, self))
+        || (ret = dcc_argv_append(cc_argv, strdup("--stub-compiler")))
+        || (ret = dcc_argv_append(cc_argv, strdup(delay_arg)))
+        || (ret = dcc_argv_append(cc_argv, strdup("-Iinclude")))
+        || (ret = dcc_argv_append(cc_argv, strdup("-c")))
+        || (ret = dcc_argv_append(cc_argv,
+                                  strdup(opt_protocol == DCC_VER_3
+                                         ? "src/main.c" : "main.i")))
+        || (ret = dcc_argv_append(cc_argv, strdup("-o")))
+        || (ret = dcc_argv_append(cc_argv, strdup("main.o"))))
+        return ret ? ret : EXIT_OUT_OF_MEMORY;
+
+    if ((samples = calloc((size_t) opt_clients * opt_requests,
+                          sizeof *samples)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (pipe(pipe_fd) == -1) {
+        rs_log_error("pipe failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < opt_clients; i++) {
+        if ((pid = fork()) == -1) {
+            rs_log_error("fork failed: %s", strerror(errno));
+            return EXIT_DISTCC_FAILED;
+        } else if (pid == 0) {
+            dcc_close(pipe_fd[0]);
+            _exit(dcc_loadgen_client(cc_argv, files, host, pipe_fd[1]));
+        }
+    }
+    dcc_close(pipe_fd[1]);
+
+    /* Every sample is written in one piece, so reads return whole ones. */
+    while (n_samples < opt_clients * opt_requests) {
+        r = read(pipe_fd[0], &samples[n_samples], sizeof *samples);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r != (ssize_t) sizeof *samples)
+            break;
+        n_samples++;
+    }
+    gettimeofday(&end, NULL);
+    dcc_close(pipe_fd[0]);
+
+    while (wait(&status) != -1)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ret = EXIT_DISTCC_FAILED;
+    if (n_samples < opt_clients * opt_requests)
+        ret = EXIT_DISTCC_FAILED;
+
+    dcc_loadgen_report(samples, n_samples, dcc_loadgen_secs(&start, &end));
+    return ret;
+}
@@ -101,6 +101,9 @@ struct dcc_hostdef _dcc_local = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0.0,                        /* speed (ignored) */
+    0,                          /* keeps precompiled headers (ignored) */
+    0,                          /* returns split DWARF (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
     NULL,                       /* Authentication name */
@@ -122,6 +125,9 @@ struct dcc_hostdef _dcc_local_cpp = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0.0,                        /* speed (ignored) */
+    0,                          /* keeps precompiled headers (ignored) */
+    0,                          /* returns split DWARF (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
     NULL,                       /* Authentication name */
@@ -236,6 +242,42 @@ int dcc_unlock(int lock_fd)
 }
 
 
+/**
+ * Block until we hold an exclusive lock on the open file @p fd.  Release it
+ * with dcc_unlock().
+ **/
+int dcc_lock_fd(int fd)
+{
+    if (sys_lock(fd, 1) == -1) {
+        rs_log_error("failed to lock fd%d: %s", fd, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * Like dcc_lock_fd(), but return EXIT_BUSY at once if another process holds
+ * the lock.
+ **/
+int dcc_trylock_fd(int fd)
+{
+    if (sys_lock(fd, 0) == 0)
+        return 0;
+    switch (errno) {
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+    case EAGAIN:
+    case EACCES: /* HP-UX and Cygwin give this for exclusion */
+        return EXIT_BUSY;
+    default:
+        rs_log_error("failed to lock fd%d: %s", fd, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+}
+
+
 /**
  * Open a lockfile, creating if it does not exist.
  **/
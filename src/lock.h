@@ -24,6 +24,10 @@ int dcc_lock_host(const char *lockname,
                   const struct dcc_hostdef *host, int slot, int block,
                   int *lock_fd);
 
+int dcc_lock_fd(int fd);
+
+int dcc_trylock_fd(int fd);
+
 int dcc_unlock(int lock_fd);
 
 int dcc_make_lock_filename(const char *lockname,
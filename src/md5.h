@@ -0,0 +1,40 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef DCC_MD5_H
+#define DCC_MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DCC_MD5_DIGEST_LEN 16
+
+struct dcc_md5 {
+    uint32_t state[4];
+    uint64_t length;            /* bytes hashed so far */
+    unsigned char block[64];
+};
+
+void dcc_md5_init(struct dcc_md5 *ctx);
+void dcc_md5_update(struct dcc_md5 *ctx, const void *buf, size_t len);
+void dcc_md5_final(struct dcc_md5 *ctx,
+                   unsigned char digest[DCC_MD5_DIGEST_LEN]);
+
+#endif /* DCC_MD5_H */
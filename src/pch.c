@@ -0,0 +1,553 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Send GCC precompiled headers to each server once.
+ *
+ * In pump mode, when a header given with -include has a GCC precompiled
+ * header next to it, the include server adds the precompiled header to the
+ * files to send, with its MD5 digest in a file beside the compressed image.
+ * A precompiled header is typically tens of megabytes, so it is only sent to
+ * hosts marked with the "pch" option, and then only once: the server keeps
+ * it in a cache of its own, and later compilations send just the digest.
+ *
+ * The server keys its cache by the name of the compiler as well, since a
+ * precompiled header is only of use to the compiler that made it.  The
+ * client remembers what it sent to each server in the lock directory, for
+ * DCC_PCH_CACHED_SECONDS.  If the server no longer has the precompiled header
+ * by then, the compilation goes ahead without it: GCC falls back on the
+ * header itself, which is always sent.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "lock.h"
+#include "md5.h"
+#include "pch.h"
+
+
+/** How long a client assumes that a server still has a precompiled header
+ * that was sent to it. */
+#define DCC_PCH_CACHED_SECONDS 3600
+
+/** The suffix of the compressed images of precompiled headers that the
+ * include server makes, and of the file holding the digest next to them. */
+static const char pch_image_suffix[] = ".gch.lzo";
+static const char pch_digest_suffix[] = ".md5";
+
+
+/**
+ * Is @p digest made of DCC_PCH_DIGEST_LEN lowercase hex digits?  Digests
+ * come from the network and end up in file names.
+ **/
+int dcc_pch_valid_digest(const char *digest)
+{
+    int i;
+
+    for (i = 0; i < DCC_PCH_DIGEST_LEN; i++)
+        if (!((digest[i] >= '0' && digest[i] <= '9')
+              || (digest[i] >= 'a' && digest[i] <= 'f')))
+            return 0;
+    return digest[DCC_PCH_DIGEST_LEN] == '\0';
+}
+
+
+/**
+ * If @p fname is the image of a precompiled header made by the include
+ * server, read its digest into @p digest, which must have room for
+ * DCC_PCH_DIGEST_LEN + 1 characters.
+ *
+ * @return 0 if it is; nonzero otherwise.
+ **/
+int dcc_pch_read_digest(const char *fname, char *digest)
+{
+    char *digest_fname;
+    ssize_t n;
+    int fd;
+
+    if (!str_endswith(pch_image_suffix, fname))
+        return EXIT_DISTCC_FAILED;
+    if (asprintf(&digest_fname, "%s%s", fname, pch_digest_suffix) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    fd = open(digest_fname, O_RDONLY);
+    free(digest_fname);
+    if (fd == -1)
+        return EXIT_DISTCC_FAILED;
+    n = read(fd, digest, DCC_PCH_DIGEST_LEN);
+    close(fd);
+    if (n != DCC_PCH_DIGEST_LEN)
+        return EXIT_DISTCC_FAILED;
+    digest[DCC_PCH_DIGEST_LEN] = '\0';
+    return dcc_pch_valid_digest(digest) ? 0 : EXIT_DISTCC_FAILED;
+}
+
+
+/**
+ * Copy @p compiler into @p key, a newly allocated string usable as the name
+ * of a file or directory of its own.
+ *
+ * A name such as "." or ".." would take the precompiled headers out of the
+ * per-compiler directories that dcc_pch_trim() looks in, so names that are
+ * empty or start with a dot are refused.
+ **/
+static int dcc_pch_compiler_key(const char *compiler, char **key)
+{
+    char *p;
+
+    if (compiler[0] == '\0' || compiler[0] == '.') {
+        rs_log_info("not caching precompiled headers for compiler \"%s\"",
+                    compiler);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if ((*key = strdup(compiler)) == NULL) {
+        rs_log_error("strdup failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (p = *key; *p; p++)
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')
+              || (*p >= '0' && *p <= '9')
+              || *p == '.' || *p == '+' || *p == '-'))
+            *p = '_';
+    return 0;
+}
+
+
+/**
+ * Return the name of the file marking that the precompiled header
+ * @p digest was sent to @p host for @p compiler, making sure that its
+ * directory exists.
+ **/
+static int dcc_pch_marker_name(const struct dcc_hostdef *host,
+                               const char *compiler, const char *digest,
+                               char **fname)
+{
+    char *dir, *key;
+    int ret;
+
+    if ((ret = dcc_make_lock_filename("pch", host, 0, &dir)))
+        return ret;
+    if ((ret = dcc_mkdir(dir))) {
+        free(dir);
+        return ret;
+    }
+    if ((ret = dcc_pch_compiler_key(compiler, &key))) {
+        free(dir);
+        return ret;
+    }
+    if (asprintf(fname, "%s/%s-%s", dir, digest, key) == -1) {
+        rs_log_error("asprintf failed");
+        ret = EXIT_OUT_OF_MEMORY;
+    }
+    free(key);
+    free(dir);
+    return ret;
+}
+
+
+/**
+ * Was the precompiled header @p digest sent to @p host for @p compiler
+ * recently enough that the server can be expected to still have it?
+ **/
+int dcc_pch_is_cached(const struct dcc_hostdef *host, const char *compiler,
+                      const char *digest)
+{
+    struct stat st;
+    char *fname;
+    int cached;
+
+    if (dcc_pch_marker_name(host, compiler, digest, &fname))
+        return 0;
+    cached = stat(fname, &st) == 0
+        && st.st_mtime + DCC_PCH_CACHED_SECONDS > time(NULL);
+    free(fname);
+    return cached;
+}
+
+
+/**
+ * Remember that the precompiled header @p digest was sent to @p host for
+ * @p compiler.
+ **/
+int dcc_pch_note_cached(const struct dcc_hostdef *host, const char *compiler,
+                        const char *digest)
+{
+    char *fname;
+    int fd, ret;
+
+    if ((ret = dcc_pch_marker_name(host, compiler, digest, &fname)))
+        return ret;
+    if ((fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        rs_log_warning("failed to create %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        close(fd);
+    }
+    free(fname);
+    return ret;
+}
+
+
+/**
+ * Return the server's cache directory for the precompiled headers of
+ * @p compiler, creating it if need be.  If @p compiler is NULL, return the
+ * top of the cache.
+ *
+ * The cache lives under the temporary directory, which other users can
+ * write to as well, so it is only used if it belongs to us and nobody else
+ * can write into it: otherwise anybody could plant a precompiled header.
+ **/
+static int dcc_pch_cache_dir(const char *compiler, char **dir_ret)
+{
+    const char *tmp_top;
+    char *top, *key;
+    struct stat st;
+    int ret;
+
+    if ((ret = dcc_get_tmp_top(&tmp_top)))
+        return ret;
+    if (asprintf(&top, "%s/distccd-pch", tmp_top) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (mkdir(top, 0700) == -1 && errno != EEXIST) {
+        rs_log_warning("failed to create %s: %s", top, strerror(errno));
+        free(top);
+        return EXIT_IO_ERROR;
+    }
+    if (lstat(top, &st) == -1 || !S_ISDIR(st.st_mode)
+        || st.st_uid != geteuid() || (st.st_mode & 022)) {
+        rs_log_warning("not using %s for precompiled headers: "
+                       "it is not a private directory of ours", top);
+        free(top);
+        return EXIT_IO_ERROR;
+    }
+    if (compiler == NULL) {
+        *dir_ret = top;
+        return 0;
+    }
+
+    if ((ret = dcc_pch_compiler_key(compiler, &key))) {
+        free(top);
+        return ret;
+    }
+    ret = asprintf(dir_ret, "%s/%s", top, key);
+    free(key);
+    free(top);
+    if (ret == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (mkdir(*dir_ret, 0700) == -1 && errno != EEXIST) {
+        rs_log_warning("failed to create %s: %s", *dir_ret, strerror(errno));
+        free(*dir_ret);
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * Does the MD5 digest of the contents of @p fname match @p digest?
+ **/
+static int dcc_pch_check_digest(const char *fname, const char *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char md5_digest[DCC_MD5_DIGEST_LEN];
+    char buf[65536];
+    struct dcc_md5 md5;
+    ssize_t n;
+    int fd, i;
+
+    if ((fd = open(fname, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return 0;
+    }
+    dcc_md5_init(&md5);
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+        dcc_md5_update(&md5, buf, n);
+    close(fd);
+    if (n == -1) {
+        rs_log_error("failed to read %s: %s", fname, strerror(errno));
+        return 0;
+    }
+    dcc_md5_final(&md5, md5_digest);
+    for (i = 0; i < DCC_MD5_DIGEST_LEN; i++)
+        if (digest[2 * i] != hex[md5_digest[i] >> 4]
+            || digest[2 * i + 1] != hex[md5_digest[i] & 15])
+            return 0;
+    return 1;
+}
+
+
+struct dcc_pch_entry {
+    char *fname;
+    off_t size;
+    time_t mtime;
+};
+
+static int dcc_pch_entry_cmp(const void *a, const void *b)
+{
+    const struct dcc_pch_entry *x = a, *y = b;
+
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+
+/**
+ * Remove the least recently used precompiled headers until those left take
+ * no more than @p cache_mb megabytes.
+ **/
+static void dcc_pch_trim(const char *top, int cache_mb)
+{
+    struct dcc_pch_entry *entries = NULL;
+    size_t n_entries = 0, max_entries = 0, i;
+    long long total = 0, limit = (long long) cache_mb << 20;
+    DIR *top_dir, *dir;
+    struct dirent *top_de, *de;
+    struct stat st;
+    char *subdir, *fname;
+
+    if ((top_dir = opendir(top)) == NULL)
+        return;
+    while ((top_de = readdir(top_dir)) != NULL) {
+        if (top_de->d_name[0] == '.')
+            continue;
+        if (asprintf(&subdir, "%s/%s", top, top_de->d_name) == -1)
+            break;
+        if ((dir = opendir(subdir)) != NULL) {
+            while ((de = readdir(dir)) != NULL) {
+                if (!str_endswith(".gch", de->d_name))
+                    continue;
+                if (asprintf(&fname, "%s/%s", subdir, de->d_name) == -1)
+                    break;
+                if (stat(fname, &st) == -1 || !S_ISREG(st.st_mode)) {
+                    free(fname);
+                    continue;
+                }
+                if (n_entries == max_entries) {
+                    struct dcc_pch_entry *more;
+                    max_entries = max_entries ? 2 * max_entries : 16;
+                    more = realloc(entries, max_entries * sizeof *entries);
+                    if (more == NULL) {
+                        free(fname);
+                        break;
+                    }
+                    entries = more;
+                }
+                entries[n_entries].fname = fname;
+                entries[n_entries].size = st.st_size;
+                entries[n_entries].mtime = st.st_mtime;
+                n_entries++;
+                total += st.st_size;
+            }
+            closedir(dir);
+        }
+        free(subdir);
+    }
+    closedir(top_dir);
+
+    qsort(entries, n_entries, sizeof *entries, dcc_pch_entry_cmp);
+    for (i = 0; i < n_entries; i++) {
+        if (total > limit) {
+            rs_trace("removing precompiled header %s", entries[i].fname);
+            if (unlink(entries[i].fname) == 0)
+                total -= entries[i].size;
+        }
+        free(entries[i].fname);
+    }
+    free(entries);
+}
+
+
+/**
+ * Keep @p fname, the precompiled header @p digest just received for
+ * @p compiler, in the cache, provided that it matches its digest.
+ *
+ * Failing to do so does not fail the compilation, which has the file
+ * anyway.
+ **/
+static int dcc_pch_store(const char *fname, const char *compiler,
+                         const char *digest, int cache_mb)
+{
+    char *dir, *cached = NULL, *tmp = NULL;
+    int ret;
+
+    if (cache_mb <= 0)
+        return 0;
+    if (!dcc_pch_check_digest(fname, digest)) {
+        rs_log_warning("precompiled header %s does not match its digest %s; "
+                       "not caching it", fname, digest);
+        return 0;
+    }
+    if ((ret = dcc_pch_cache_dir(compiler, &dir)))
+        return 0;
+    if (asprintf(&cached, "%s/%s.gch", dir, digest) == -1
+        || asprintf(&tmp, "%s.tmp%ld", cached, (long) getpid()) == -1) {
+        rs_log_error("asprintf failed");
+        ret = EXIT_OUT_OF_MEMORY;
+    } else if (link(fname, tmp) == -1 || rename(tmp, cached) == -1) {
+        rs_log_warning("failed to cache precompiled header %s as %s: %s",
+                       fname, cached, strerror(errno));
+        unlink(tmp);
+    } else {
+        rs_log_info("cached precompiled header %s for %s", digest, compiler);
+    }
+    free(tmp);
+    free(cached);
+    free(dir);
+
+    if (ret == 0 && dcc_pch_cache_dir(NULL, &dir) == 0) {
+        dcc_pch_trim(dir, cache_mb);
+        free(dir);
+    }
+    return ret;
+}
+
+
+/**
+ * Put the cached precompiled header @p digest for @p compiler in place as
+ * @p fname, if the cache has it.
+ *
+ * If it does not, nothing is put in place, and the compiler uses the header
+ * instead; this is only worth a message.
+ **/
+static int dcc_pch_fetch(const char *fname, const char *compiler,
+                         const char *digest)
+{
+    char *dir, *cached;
+    int ret;
+
+    if (dcc_pch_cache_dir(compiler, &dir)) {
+        rs_log_info("no cached precompiled header %s; compiling without it",
+                    digest);
+        return 0;
+    }
+    ret = asprintf(&cached, "%s/%s.gch", dir, digest);
+    free(dir);
+    if (ret == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((ret = dcc_mk_tmp_ancestor_dirs(fname))) {
+        free(cached);
+        return ret;
+    }
+    if (link(cached, fname) == -1) {
+        rs_log_info("no cached precompiled header %s for %s (%s); "
+                    "compiling without it", digest, compiler, strerror(errno));
+        free(cached);
+        return 0;
+    }
+    /* Its modification time tells when it was last used. */
+    utime(cached, NULL);
+    free(cached);
+
+    if ((ret = dcc_add_cleanup(fname))) {
+        unlink(fname);
+        return ret;
+    }
+    return 0;
+}
+
+
+/**
+ * Remember that the precompiled header @p digest came with the job as
+ * @p fname if @p received, or is wanted there from the cache otherwise.
+ **/
+int dcc_pch_add_file(struct dcc_pch_file **files, const char *fname,
+                     const char *digest, int received)
+{
+    struct dcc_pch_file *file;
+
+    if ((file = calloc(1, sizeof *file)) == NULL
+        || (file->fname = strdup(fname)) == NULL) {
+        rs_log_error("failed to allocate precompiled header entry");
+        free(file);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    strcpy(file->digest, digest);
+    file->received = received;
+    file->next = *files;
+    *files = file;
+    return 0;
+}
+
+
+/**
+ * Keep the precompiled headers in @p files that were received in the cache
+ * of @p cache_mb megabytes, and put the others in place from it, for
+ * @p compiler.
+ *
+ * This is only called once the job has been accepted, with the compiler
+ * that is going to run, so that rejected jobs leave the cache alone.
+ **/
+int dcc_pch_use_files(const struct dcc_pch_file *files, const char *compiler,
+                      int cache_mb)
+{
+    int ret;
+
+    for (; files; files = files->next) {
+        if (files->received)
+            ret = dcc_pch_store(files->fname, compiler, files->digest,
+                                cache_mb);
+        else
+            ret = dcc_pch_fetch(files->fname, compiler, files->digest);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+
+void dcc_pch_free_files(struct dcc_pch_file *files)
+{
+    struct dcc_pch_file *next;
+
+    for (; files; files = next) {
+        next = files->next;
+        free(files->fname);
+        free(files);
+    }
+}
@@ -0,0 +1,59 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef DCC_PCH_H
+#define DCC_PCH_H
+
+/** Length of the hexadecimal MD5 digest by which a precompiled header is
+ * known, not counting the terminating nul. */
+#define DCC_PCH_DIGEST_LEN 32
+
+struct dcc_hostdef;
+
+/** A precompiled header that came with a pump mode job, either received
+ * as @p fname or only named by its digest, to be put there from the cache.
+ * The server deals with them once it has accepted the job. */
+struct dcc_pch_file {
+    char *fname;
+    char digest[DCC_PCH_DIGEST_LEN + 1];
+    int received;
+    struct dcc_pch_file *next;
+};
+
+/* pch.c */
+int dcc_pch_valid_digest(const char *digest);
+
+int dcc_pch_read_digest(const char *fname, char *digest);
+
+int dcc_pch_is_cached(const struct dcc_hostdef *host, const char *compiler,
+                      const char *digest);
+
+int dcc_pch_note_cached(const struct dcc_hostdef *host, const char *compiler,
+                        const char *digest);
+
+int dcc_pch_add_file(struct dcc_pch_file **files, const char *fname,
+                     const char *digest, int received);
+
+int dcc_pch_use_files(const struct dcc_pch_file *files, const char *compiler,
+                      int cache_mb);
+
+void dcc_pch_free_files(struct dcc_pch_file *files);
+
+#endif /* DCC_PCH_H */
@@ -34,9 +34,12 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
 
 #include "distcc.h"
 #include "trace.h"
@@ -44,11 +47,16 @@
 #include "exitcode.h"
 #include "util.h"
 #include "clinet.h"
+#include "resolve.h"
 #include "hosts.h"
 #include "exec.h"
 #include "lock.h"
 #include "compile.h"
 #include "bulk.h"
+#include "where.h"
+#include "hedge.h"
+#include "cost.h"
+#include "timeval.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 
@@ -67,8 +75,9 @@ extern gss_ctx_id_t distcc_ctx_handle;
  */
 
 /**
- * Open a connection using either a TCP socket or SSH.  Return input
- * and output file descriptors (which may or may not be different.)
+ * Open a connection using either a TCP socket or SSH, and authenticate if
+ * the host asks for it.  Return input and output file descriptors (which may
+ * or may not be different.)
  **/
 static int dcc_remote_connect(struct dcc_hostdef *host,
                               int *to_net_fd,
@@ -79,22 +88,67 @@ static int dcc_remote_connect(struct dcc_hostdef *host,
 
     if (host->mode == DCC_MODE_TCP) {
         *ssh_pid = 0;
-        if ((ret = dcc_connect_by_name(host->hostname, host->port,
-                                       to_net_fd)) != 0)
+        if ((ret = dcc_connect_by_name_cached(host->hostname, host->port,
+                                              to_net_fd)) != 0)
             return ret;
         *from_net_fd = *to_net_fd;
-        return 0;
     } else if (host->mode == DCC_MODE_SSH) {
         if ((ret = dcc_ssh_connect(NULL, host->user, host->hostname,
                                    host->ssh_command,
                                    from_net_fd, to_net_fd,
                                    ssh_pid)))
             return ret;
-        return 0;
     } else {
         rs_log_crit("impossible host mode");
         return EXIT_DISTCC_FAILED;
     }
+
+#ifdef HAVE_GSSAPI
+    /* Perform requested security. */
+    if(host->authenticate) {
+        rs_log_info("Performing authentication.");
+
+        if ((ret = dcc_gssapi_perform_requested_security(host, *to_net_fd, *from_net_fd)) != 0) {
+            rs_log_crit("Failed to perform authentication.");
+            return ret;
+        }
+
+        /* Context deleted here as we no longer need it.  However, we have it available */
+        /* in case we want to use confidentiality/integrity type services in the future. */
+        dcc_gssapi_delete_ctx(&distcc_ctx_handle);
+    } else {
+        rs_log_info("No authentication requested.");
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * Close a connection opened by dcc_remote_connect(), and collect the SSH
+ * child if any.
+ **/
+static void dcc_remote_disconnect(int to_net_fd, int from_net_fd,
+                                  pid_t ssh_pid)
+{
+    int ssh_status;
+
+    if (to_net_fd != from_net_fd) {
+        if (to_net_fd != -1)
+            dcc_close(to_net_fd);
+    }
+    if (from_net_fd != -1)
+        dcc_close(from_net_fd);
+
+    /* Collect the SSH child.  Strictly this is unnecessary; it might slow the
+     * client down a little when things could otherwise be proceeding in the
+     * background.  But it helps make sure that we don't assume we succeeded
+     * when something possibly went wrong, and it allows us to account for the
+     * cost of the ssh child. */
+    if (ssh_pid) {
+        dcc_collect_child("ssh", ssh_pid, &ssh_status, timeout_null_fd); /* ignore failure */
+    }
 }
 
 
@@ -194,6 +248,215 @@ out:
 }
 
 
+static long dcc_ms_between(struct timeval *from, struct timeval *to)
+{
+    struct timeval delta;
+
+    timeval_subtract(&delta, to, from);
+    return delta.tv_sec * 1000L + delta.tv_usec / 1000;
+}
+
+
+/**
+ * poll() @p pfd until one of them is ready, or until @p limit_ms have passed
+ * since @p start.  When a signal interrupts it, it is restarted with the time
+ * that is left, so that signals cannot stretch the wait.
+ *
+ * @returns as poll(): the number of ready fds, 0 when the time is up, or -1.
+ **/
+static int dcc_poll_since(struct pollfd *pfd, nfds_t nfds,
+                          struct timeval *start, long limit_ms)
+{
+    struct timeval now;
+    long left;
+    int n_ready;
+
+    do {
+        if (gettimeofday(&now, NULL))
+            return -1;
+        left = limit_ms - dcc_ms_between(start, &now);
+        n_ready = poll(pfd, nfds, left > 0 ? (int) left : 0);
+    } while (n_ready == -1 && errno == EINTR);
+    return n_ready;
+}
+
+
+/**
+ * Has the server at the other end of @p fd started to answer?  A connection
+ * that was dropped is readable too, but is not an answer.
+ **/
+static int dcc_remote_answered(const struct pollfd *pfd)
+{
+#ifdef FIONREAD
+    int avail = 0;
+
+    if (pfd->revents & POLLIN)
+        return ioctl(pfd->fd, FIONREAD, &avail) == 0 && avail > 0;
+    return 0;
+#else
+    return (pfd->revents & POLLIN) != 0;
+#endif
+}
+
+
+/**
+ * Wait for the server of a job that has been sent, and if it is late, send
+ * the job to a spare server as well and keep whichever answers first.  The
+ * other connection is dropped, so that its server kills the compiler.
+ *
+ * A job is late when it has taken longer than 95% of the recent jobs on its
+ * server.  It is only hedged if another server, preprocessing in the same
+ * place, has a free slot, so that hedging adds no load when the cluster is
+ * saturated.  Failing to hedge is not an error: the job just stays where it
+ * is.  Hedging is given up once one I/O timeout has passed since the job was
+ * sent, so that the caller's timed wait for the results then times out as
+ * usual.
+ *
+ * @param before When the job was started.
+ *
+ * @param sent When it had been sent.
+ *
+ * @param hedge_host, hedge_lock_fd If the spare server answered first, it
+ * and the lock on its slot, which the caller must release after collecting
+ * the results; the connection fds and @p ssh_pid are then the spare's.
+ * Otherwise NULL and -1.
+ **/
+static void dcc_hedge_remote(char **argv,
+                             char *input_fname,
+                             char *cpp_fname,
+                             char **files,
+                             struct timeval *before,
+                             struct timeval *sent,
+                             struct dcc_hostdef *host,
+                             int *to_net_fd,
+                             int *from_net_fd,
+                             pid_t *ssh_pid,
+                             struct dcc_hostdef **hedge_host,
+                             int *hedge_lock_fd)
+{
+    struct dcc_hostdef *spare = NULL;
+    int lock_fd = -1, to_fd = -1, from_fd = -1;
+    pid_t pid = 0;
+    struct pollfd pfd[2];
+    struct timeval now;
+    long delay, waited, limit, left;
+    int timeout, answered;
+    off_t doti_size;
+
+    *hedge_host = NULL;
+    *hedge_lock_fd = -1;
+
+    if (dcc_hedge_delay(host, &delay) || delay < 0)
+        return;
+
+    if (gettimeofday(&now, NULL))
+        return;
+    waited = dcc_ms_between(before, &now);
+    limit = dcc_get_io_timeout() * 1000L;
+    left = limit - dcc_ms_between(sent, &now);
+    if (delay - waited >= left)
+        return;                 /* it would never be late in time */
+    timeout = waited < delay ? (int) (delay - waited) : 0;
+
+    pfd[0].fd = *from_net_fd;
+    pfd[0].events = POLLIN;
+    while (1) {
+        if (poll(pfd, 1, timeout) != 0)
+            return;             /* answered, or failed: either way, wait */
+        if (dcc_lock_spare_host(host, &spare, &lock_fd) == 0)
+            break;
+        /* Keep waiting, and look for a free slot again later. */
+        if (gettimeofday(&now, NULL))
+            return;
+        left = limit - dcc_ms_between(sent, &now);
+        if (left <= 0) {
+            rs_trace("no spare server for %s within the I/O timeout",
+                     input_fname);
+            return;
+        }
+        timeout = left < 1000 ? (int) left : 1000;
+    }
+
+    rs_log_info("compilation of %s on %s is late; also sending it to %s",
+                input_fname, host->hostdef_string, spare->hostdef_string);
+
+    if (dcc_remote_connect(spare, &to_fd, &from_fd, &pid)
+        || dcc_send_header(to_fd, argv, spare)
+        || (spare->cpp_where == DCC_CPP_ON_SERVER
+            ? dcc_x_many_files(to_fd, dcc_argv_len(files), files,
+                               spare, argv[0])
+            : dcc_x_file(to_fd, cpp_fname, "DOTI", spare->compr, &doti_size))) {
+        rs_log_warning("failed to hedge on %s", spare->hostdef_string);
+        goto drop_spare;
+    }
+    tcp_cork_sock(to_fd, 0);
+
+    pfd[1].fd = from_fd;
+    pfd[1].events = POLLIN;
+    do {
+        if (dcc_poll_since(pfd, 2, sent, limit) <= 0)
+            goto drop_spare;
+        if (dcc_remote_answered(&pfd[0]))
+            goto drop_spare;
+        answered = dcc_remote_answered(&pfd[1]);
+        if (!answered && pfd[1].revents)
+            goto drop_spare;    /* the spare gave up: wait for the first */
+    } while (!answered && !pfd[0].revents);
+
+    rs_log_info("%s answered first for %s", spare->hostdef_string,
+                input_fname);
+    dcc_remote_disconnect(*to_net_fd, *from_net_fd, *ssh_pid);
+    *to_net_fd = to_fd;
+    *from_net_fd = from_fd;
+    *ssh_pid = pid;
+    *hedge_host = spare;
+    *hedge_lock_fd = lock_fd;
+    return;
+
+  drop_spare:
+    dcc_remote_disconnect(to_fd, from_fd, pid);
+    dcc_unlock(lock_fd);
+    dcc_free_hostdef(spare);
+}
+
+
+/**
+ * Tell the cost model what this compilation cost.  @p before, @p connected,
+ * @p sent and @p answered are when the job started, was connected, finished
+ * sending, and when the results started arriving.
+ **/
+static void dcc_note_remote_cost(struct dcc_hostdef *host,
+                                 const char *input_fname,
+                                 long sent_bytes,
+                                 const char *output_fname,
+                                 const char *deps_fname,
+                                 struct timeval *before,
+                                 struct timeval *connected,
+                                 struct timeval *sent,
+                                 struct timeval *answered)
+{
+    struct dcc_cost_history history, previous;
+    struct stat st;
+
+    history.sent = sent_bytes;
+    history.received = 0;
+    if (stat(output_fname, &st) == 0)
+        history.received += (long) st.st_size;
+    if (deps_fname && stat(deps_fname, &st) == 0)
+        history.received += (long) st.st_size;
+    /* This includes any of the request still on its way to the server. */
+    history.compile_ms = dcc_ms_between(sent, answered);
+    if (history.compile_ms <= 0)
+        history.compile_ms = 1;
+    history.host = dcc_cost_host_id(host);
+
+    dcc_cost_read_history(input_fname, &previous);
+    dcc_cost_note_history(input_fname, &history);
+    dcc_cost_note_link(host, dcc_ms_between(before, connected),
+                       history.compile_ms, &previous);
+}
+
+
 /**
  * Pass a compilation across the network.
  *
@@ -216,6 +479,9 @@ out:
  *
  * @param output_fname File that the object code should be delivered to.
  *
+ * @param dwo_fname File that split DWARF debug info should be delivered to,
+ * or NULL if the compiler is not asked to write any.
+ *
  * @param cpp_pid If nonzero, the pid of the preprocessor.  Must be
  * allowed to complete before we send the input file.
  *
@@ -242,6 +508,7 @@ int dcc_compile_remote(char **argv,
                        char **files,
                        char *output_fname,
                        char *deps_fname,
+                       char *dwo_fname,
                        char *server_stderr_fname,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
@@ -252,10 +519,14 @@ int dcc_compile_remote(char **argv,
     int to_net_fd = -1, from_net_fd = -1;
     int ret;
     pid_t ssh_pid = 0;
-    int ssh_status;
-    off_t doti_size;
+    off_t doti_size = 0;
     struct timeval before, after;
+    struct timeval connected, sending, sent, answered;
+    struct pollfd pfd;
+    int n_ready;
     unsigned int n_files;
+    struct dcc_hostdef *hedge_host = NULL;
+    int hedge_lock_fd = -1;
 
     if (gettimeofday(&before, NULL))
         rs_log_warning("gettimeofday failed");
@@ -270,24 +541,8 @@ int dcc_compile_remote(char **argv,
     *status = 0;
     if ((ret = dcc_remote_connect(host, &to_net_fd, &from_net_fd, &ssh_pid)))
         goto out;
-
-#ifdef HAVE_GSSAPI
-    /* Perform requested security. */
-    if(host->authenticate) {
-        rs_log_info("Performing authentication.");
-
-        if ((ret = dcc_gssapi_perform_requested_security(host, to_net_fd, from_net_fd)) != 0) {
-            rs_log_crit("Failed to perform authentication.");
-            goto out;
-        }
-
-        /* Context deleted here as we no longer need it.  However, we have it available */
-        /* in case we want to use confidentiality/integrity type services in the future. */
-        dcc_gssapi_delete_ctx(&distcc_ctx_handle);
-    } else {
-        rs_log_info("No authentication requested.");
-    }
-#endif
+    gettimeofday(&connected, NULL);
+    sending = connected;
 
     dcc_note_state(DCC_PHASE_SEND, NULL, NULL, DCC_REMOTE);
 
@@ -297,7 +552,8 @@ int dcc_compile_remote(char **argv,
         }
 
         n_files = dcc_argv_len(files);
-        if ((ret = dcc_x_many_files(to_net_fd, n_files, files))) {
+        if ((ret = dcc_x_many_files(to_net_fd, n_files, files, host,
+                                    argv[0]))) {
             goto out;
         }
     } else {
@@ -321,6 +577,7 @@ int dcc_compile_remote(char **argv,
         if (*status != 0)
             goto out;
 
+        gettimeofday(&sending, NULL);
         if ((ret = dcc_x_file(to_net_fd, cpp_fname, "DOTI", host->compr,
                               &doti_size)))
             goto out;
@@ -328,6 +585,7 @@ int dcc_compile_remote(char **argv,
 
     rs_trace("client finished sending request to server");
     tcp_cork_sock(to_net_fd, 0);
+    gettimeofday(&sent, NULL);
     /* but it might not have been read in by the server yet; there's
      * 100kB or more of buffers in the two kernels. */
 
@@ -339,20 +597,65 @@ int dcc_compile_remote(char **argv,
     /* If cpp failed, just abandon the connection, without trying to
      * receive results. */
     if (ret == 0 && *status == 0) {
-        ret = dcc_retrieve_results(from_net_fd, status, output_fname,
-                                   deps_fname, server_stderr_fname, host);
+        if (dcc_hedge_enabled())
+            dcc_hedge_remote(argv, input_fname, cpp_fname, files, &before,
+                             &sent, host, &to_net_fd, &from_net_fd, &ssh_pid,
+                             &hedge_host, &hedge_lock_fd);
+        /* Note when the server finished compiling, for the cost model and
+         * the log.  This wait stands in for the first read's, so a server
+         * that never answers is given up on one I/O timeout after the job
+         * was sent. */
+        pfd.fd = from_net_fd;
+        pfd.events = POLLIN;
+        n_ready = dcc_poll_since(&pfd, 1, &sent,
+                                 dcc_get_io_timeout() * 1000L);
+        if (n_ready == -1) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+        } else if (n_ready == 0) {
+            rs_log_error("IO timeout");
+            ret = EXIT_IO_ERROR;
+        } else {
+            gettimeofday(&answered, NULL);
+            ret = dcc_retrieve_results(from_net_fd, status, output_fname,
+                                       deps_fname, dwo_fname,
+                                       server_stderr_fname,
+                                       hedge_host ? hedge_host : host);
+        }
     }
 
     if (gettimeofday(&after, NULL)) {
         rs_log_warning("gettimeofday failed");
-    } else if (host->cpp_where == DCC_CPP_ON_CLIENT) {
+    } else {
         double secs, rate;
 
         dcc_calc_rate(doti_size, &before, &after, &secs, &rate);
-        rs_log(RS_LOG_INFO|RS_LOG_NONAME,
-               "%lu bytes from %s compiled on %s in %.4fs, rate %.0fkB/s",
-               (unsigned long) doti_size, input_fname, host->hostname,
-               secs, rate);
+        if (host->cpp_where == DCC_CPP_ON_CLIENT)
+            rs_log(RS_LOG_INFO|RS_LOG_NONAME,
+                   "%lu bytes from %s compiled on %s in %.4fs, rate %.0fkB/s",
+                   (unsigned long) doti_size, input_fname,
+                   (hedge_host ? hedge_host : host)->hostname, secs, rate);
+        if (ret == 0 && *status == 0)
+            rs_log(RS_LOG_INFO|RS_LOG_NONAME,
+                   "phases of %s on %s: connect %ldms, cpp %ldms, "
+                   "send %ldms, compile %ldms, receive %ldms",
+                   input_fname, (hedge_host ? hedge_host : host)->hostname,
+                   dcc_ms_between(&before, &connected),
+                   dcc_ms_between(&connected, &sending),
+                   dcc_ms_between(&sending, &sent),
+                   dcc_ms_between(&sent, &answered),
+                   dcc_ms_between(&answered, &after));
+        /* Only whole jobs count towards the latency of a host. */
+        if (ret == 0 && *status == 0 && !hedge_host && dcc_hedge_enabled())
+            dcc_hedge_note_latency(host, (long) (secs * 1000));
+        if (ret == 0 && *status == 0 && !hedge_host
+            && dcc_cost_model_enabled())
+            dcc_note_remote_cost(host, input_fname,
+                                 host->cpp_where == DCC_CPP_ON_SERVER
+                                 ? dcc_cost_files_size(files)
+                                 : (long) doti_size,
+                                 output_fname, deps_fname,
+                                 &before, &connected, &sent, &answered);
     }
 
   out:
@@ -363,20 +666,11 @@ int dcc_compile_remote(char **argv,
 
     /* Close socket so that the server can terminate, rather than
      * making it wait until we've finished our work. */
-    if (to_net_fd != from_net_fd) {
-        if (to_net_fd != -1)
-            dcc_close(to_net_fd);
-    }
-    if (from_net_fd != -1)
-        dcc_close(from_net_fd);
+    dcc_remote_disconnect(to_net_fd, from_net_fd, ssh_pid);
 
-    /* Collect the SSH child.  Strictly this is unnecessary; it might slow the
-     * client down a little when things could otherwise be proceeding in the
-     * background.  But it helps make sure that we don't assume we succeeded
-     * when something possibly went wrong, and it allows us to account for the
-     * cost of the ssh child. */
-    if (ssh_pid) {
-        dcc_collect_child("ssh", ssh_pid, &ssh_status, timeout_null_fd); /* ignore failure */
+    if (hedge_host) {
+        dcc_unlock(hedge_lock_fd);
+        dcc_free_hostdef(hedge_host);
     }
 
     /* The compilation failed remotely: let's see if that was due to unsupported 
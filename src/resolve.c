@@ -0,0 +1,274 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * @brief Remember the addresses of servers between invocations.
+ *
+ * Every distcc process used to look up its server afresh, which is slow
+ * where the resolver is slow.  Instead, the addresses are kept for
+ * DISTCC_RESOLVE_TTL seconds in a file in the state directory, shared by
+ * all clients of the user.
+ *
+ * The file also records when connecting to each address last failed, so that
+ * for DISTCC_BACKOFF_PERIOD seconds other addresses of the server are tried
+ * first.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "clinet.h"
+#include "resolve.h"
+
+
+/* Longest numeric address written to the file, including the nul. */
+#define DCC_ADDRSTRLEN 64
+
+
+/**
+ * How long, in seconds, looked-up names and addresses are remembered.
+ **/
+int dcc_resolve_ttl(void)
+{
+    const char *ttl = getenv("DISTCC_RESOLVE_TTL");
+
+    return ttl ? atoi(ttl) : 60;
+}
+
+
+static int dcc_resolve_cache_name(const char *host, int port, char **fname)
+{
+    char *dir;
+    int ret;
+
+    if (strchr(host, '/'))
+        return EXIT_BAD_HOSTSPEC;
+    if ((ret = dcc_get_state_dir(&dir)))
+        return ret;
+    if (asprintf(fname, "%s/resolve_%s_%d", dir, host, port) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Read the addresses remembered in @p fname, regardless of their age.
+ *
+ * The file holds a line "resolved TIME", followed by a line "ADDRESS FAILED"
+ * for each address, where FAILED is when connecting to it last failed.
+ **/
+static int dcc_read_resolve_cache(const char *fname, int port,
+                                  time_t *resolved,
+                                  struct dcc_addr **addrs_ret, int *n_addrs)
+{
+    char address[DCC_ADDRSTRLEN];
+    long long t, failed;
+    struct dcc_addr *addrs = NULL, *more, *parsed;
+    int n = 0, n_parsed;
+    FILE *f;
+
+    if ((f = fopen(fname, "r")) == NULL)
+        return EXIT_IO_ERROR;
+    if (fscanf(f, "resolved %lld\n", &t) != 1) {
+        fclose(f);
+        return EXIT_IO_ERROR;
+    }
+    *resolved = (time_t) t;
+
+    while (fscanf(f, "%63s %lld\n", address, &failed) == 2) {
+        if (dcc_lookup_addrs(address, port, DCC_LOOKUP_NUMERIC,
+                             &parsed, &n_parsed))
+            continue;
+        if (n_parsed == 1
+            && (more = realloc(addrs, (n + 1) * sizeof *addrs)) != NULL) {
+            addrs = more;
+            addrs[n] = parsed[0];
+            addrs[n].failed = (time_t) failed;
+            n++;
+        }
+        free(parsed);
+    }
+    fclose(f);
+
+    if (n == 0) {
+        free(addrs);
+        return EXIT_IO_ERROR;
+    }
+    *addrs_ret = addrs;
+    *n_addrs = n;
+    return 0;
+}
+
+
+/**
+ * Format the address of @p addr numerically into @p buf.
+ **/
+static int dcc_addr_to_string(const struct dcc_addr *addr, char *buf)
+{
+    const void *in;
+
+    if (addr->sa.ss_family == AF_INET)
+        in = &((const struct sockaddr_in *) &addr->sa)->sin_addr;
+#ifdef AF_INET6
+    else if (addr->sa.ss_family == AF_INET6)
+        in = &((const struct sockaddr_in6 *) &addr->sa)->sin6_addr;
+#endif
+    else
+        return -1;
+    return inet_ntop(addr->sa.ss_family, in, buf, DCC_ADDRSTRLEN) ? 0 : -1;
+}
+
+
+static void dcc_write_resolve_cache(const char *fname, time_t resolved,
+                                    const struct dcc_addr *addrs, int n_addrs)
+{
+    char address[DCC_ADDRSTRLEN];
+    char *tmp;
+    FILE *f;
+    int i;
+
+    if (asprintf(&tmp, "%s.tmp%ld", fname, (long) getpid()) == -1)
+        return;
+    if ((f = fopen(tmp, "w")) == NULL) {
+        rs_log_warning("failed to create %s: %s", tmp, strerror(errno));
+        free(tmp);
+        return;
+    }
+    fprintf(f, "resolved %lld\n", (long long) resolved);
+    for (i = 0; i < n_addrs; i++) {
+        if (dcc_addr_to_string(&addrs[i], address) == 0)
+            fprintf(f, "%s %lld\n", address, (long long) addrs[i].failed);
+    }
+    if (fclose(f) != 0 || rename(tmp, fname) == -1) {
+        rs_log_warning("failed to write %s: %s", fname, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+
+/**
+ * Carry the failure times over from @p old to the same addresses in @p addrs.
+ **/
+static void dcc_copy_failures(struct dcc_addr *addrs, int n_addrs,
+                              const struct dcc_addr *old, int n_old)
+{
+    int i, j;
+
+    for (i = 0; i < n_addrs; i++)
+        for (j = 0; j < n_old; j++)
+            if (addrs[i].salen == old[j].salen
+                && !memcmp(&addrs[i].sa, &old[j].sa, addrs[i].salen))
+                addrs[i].failed = old[j].failed;
+}
+
+
+/**
+ * Open a socket to a TCP server, using its remembered addresses if they are
+ * recent enough.
+ **/
+int dcc_connect_by_name_cached(const char *host, int port, int *p_fd)
+{
+    struct dcc_addr *addrs = NULL, *old = NULL;
+    time_t *failed = NULL;
+    time_t resolved = 0;
+    int n_addrs, n_old;
+    int ttl = dcc_resolve_ttl();
+    int from_cache = 0, changed = 0;
+    char *fname = NULL;
+    int ret, i;
+
+    if (ttl <= 0 || dcc_resolve_cache_name(host, port, &fname))
+        return dcc_connect_by_name(host, port, p_fd);
+
+    if (dcc_lookup_addrs(host, port, DCC_LOOKUP_NUMERIC, &addrs, &n_addrs) == 0) {
+        /* Nothing to look up, nor to remember. */
+        free(fname);
+        fname = NULL;
+    } else if (dcc_read_resolve_cache(fname, port, &resolved,
+                                      &old, &n_old) == 0
+               && time(NULL) - resolved < ttl) {
+        rs_trace("using remembered addresses of %s", host);
+        addrs = old;
+        n_addrs = n_old;
+        old = NULL;
+        from_cache = 1;
+    } else {
+        rs_trace("resolving %s", host);
+        if ((ret = dcc_lookup_addrs(host, port, 0, &addrs, &n_addrs)))
+            goto out;
+        resolved = time(NULL);
+        if (old)
+            dcc_copy_failures(addrs, n_addrs, old, n_old);
+        changed = 1;
+    }
+
+    dcc_order_addrs(addrs, n_addrs, dcc_get_backoff_period());
+
+    if ((failed = malloc((n_addrs + 1) * sizeof *failed)) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < n_addrs; i++)
+        failed[i] = addrs[i].failed;
+
+    ret = dcc_connect_by_addrs(addrs, n_addrs, p_fd);
+
+    for (i = 0; i < n_addrs; i++)
+        if (addrs[i].failed != failed[i])
+            changed = 1;
+
+    if (fname == NULL) {
+        /* A numeric address. */
+    } else if (ret != 0 && from_cache) {
+        /* Perhaps the server has moved: look it up again next time. */
+        unlink(fname);
+    } else if (changed) {
+        dcc_write_resolve_cache(fname, resolved, addrs, n_addrs);
+    }
+
+  out:
+    free(failed);
+    free(addrs);
+    free(old);
+    free(fname);
+    return ret;
+}
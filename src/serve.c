@@ -88,6 +88,7 @@
 #include "stringmap.h"
 #include "dotd.h"
 #include "fix_debug_info.h"
+#include "pch.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 
@@ -572,21 +573,86 @@ static int dcc_convert_mt_to_dotd_target(char **argv, char **dotd_target)
 }
 
 
+/**
+ * Whether @p compiler looks like gcc or clang, which both understand
+ * -fdebug-prefix-map.  Cross compilers such as "arm-linux-gnueabi-gcc-12"
+ * count too.
+ **/
+static int dcc_compiler_takes_prefix_map(const char *compiler)
+{
+    const char *base = dcc_find_basename(compiler);
+
+    return strstr(base, "gcc") || strstr(base, "g++")
+        || strstr(base, "clang")
+        || !strcmp(base, "cc") || !strcmp(base, "c++");
+}
+
+
+/**
+ * Have the compiler map @p root_dir out of the paths it writes into the
+ * debug info, so that dcc_fix_debug_info() need not search the object for
+ * it afterwards.  Our map goes first: where several maps match, the last
+ * one wins, so the client's own -fdebug-prefix-map, -ffile-prefix-map
+ * and -fmacro-prefix-map options still apply once their old prefixes have
+ * @p root_dir in front as well.
+ *
+ * @p argv must have room for one more argument.
+ **/
+static int tweak_prefix_map_arguments_for_server(char **argv,
+                                                 const char *root_dir)
+{
+    static const char *const map_opts[] = {
+        "-fdebug-prefix-map=", "-ffile-prefix-map=", "-fmacro-prefix-map=",
+        NULL
+    };
+    char *map;
+    int i, j;
+
+    for (i = 1; argv[i]; i++) {
+        for (j = 0; map_opts[j]; j++) {
+            size_t len = strlen(map_opts[j]);
+            if (str_startswith(map_opts[j], argv[i])
+                && argv[i][len] == '/') {
+                char *buf;
+                if (asprintf(&buf, "%s%s%s", map_opts[j], root_dir,
+                             argv[i] + len) == -1) {
+                    rs_log_error("failed to allocate prefix map");
+                    return EXIT_OUT_OF_MEMORY;
+                }
+                free(argv[i]);
+                argv[i] = buf;
+                break;
+            }
+        }
+    }
+
+    if (asprintf(&map, "-fdebug-prefix-map=%s=", root_dir) == -1) {
+        rs_log_error("failed to allocate prefix map");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    memmove(argv + 2, argv + 1, i * sizeof argv[0]);
+    argv[1] = map;
+    return 0;
+}
+
+
 /**
  * Add -MMD and -MF to get a .d file.
  * Find what the dotd target should be (if any).
  * Prepend @p root_dir to every command
  * line argument that refers to a file/dir by an absolute name.
+ * If @p prefix_map is set, also map @p root_dir out of the debug info.
  **/
 static int tweak_arguments_for_server(char **argv,
                                       const char *root_dir,
                                       const char *deps_fname,
+                                      int prefix_map,
                                       char **dotd_target,
                                       char ***tweaked_argv)
 {
     int ret;
     *dotd_target = 0;
-    if ((ret = dcc_copy_argv(argv, tweaked_argv, 3)))
+    if ((ret = dcc_copy_argv(argv, tweaked_argv, 4)))
       return 1;
 
     if ((ret = dcc_convert_mt_to_dotd_target(*tweaked_argv, dotd_target)))
@@ -600,10 +666,93 @@ static int tweak_arguments_for_server(char **argv,
 
     tweak_include_arguments_for_server(*tweaked_argv, root_dir);
     tweak_input_argument_for_server(*tweaked_argv, root_dir);
+    if (prefix_map
+        && tweak_prefix_map_arguments_for_server(*tweaked_argv, root_dir))
+      return 1;
+    return 0;
+}
+
+
+/**
+ * With split DWARF, the object records the name of its .dwo file, as the
+ * output was named to the compiler.  So put the object where the client
+ * wants it inside @p root_dir, so that the name becomes the client's own
+ * once dcc_fix_debug_info_for_client() has taken @p root_dir out of it.
+ *
+ * In pump mode, @p root_dir stands for the client's root directory, and
+ * relative names are taken from @p client_cwd.  In plain mode the client's
+ * working directory is not known, so @p client_cwd is NULL, and
+ * @p root_dir, made here if need be, stands for it instead.
+ *
+ * Output names that might climb out of @p root_dir are left in the
+ * temporary directory.
+ **/
+static int dcc_mirror_output_for_dwo(char **argv,
+                                     char **root_dir,
+                                     const char *client_cwd,
+                                     const char *orig_output,
+                                     char **temp_o)
+{
+    char *dwo_fname, *mirrored;
+    int ret;
+
+    if ((ret = dcc_get_dwo_fname(argv, orig_output, &dwo_fname)))
+        return ret;
+    if (dwo_fname == NULL)
+        return 0;
+    free(dwo_fname);
+
+    if (strstr(orig_output, "..")) {
+        rs_trace("leaving output %s in the temporary directory", orig_output);
+        return 0;
+    }
+    if (*root_dir == NULL && (ret = dcc_get_new_tmpdir(root_dir)))
+        return ret;
+    if (orig_output[0] == '/')
+        checked_asprintf(&mirrored, "%s%s", *root_dir, orig_output);
+    else
+        checked_asprintf(&mirrored, "%s%s/%s", *root_dir,
+                         client_cwd ? client_cwd : "", orig_output);
+    if (mirrored == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if ((ret = dcc_mk_tmp_ancestor_dirs(mirrored))
+        || (ret = dcc_add_cleanup(mirrored))) {
+        free(mirrored);
+        return ret;
+    }
+    free(*temp_o);
+    *temp_o = mirrored;
     return 0;
 }
 
 
+/**
+ * Turn the server's paths in the debug info of @p fname into the
+ * client's, by replacing @p root_dir, as set up by
+ * dcc_mirror_output_for_dwo().  In plain mode @p root_dir stands for the
+ * client's working directory, so a relative output name is made relative
+ * again.
+ **/
+static int dcc_fix_debug_info_for_client(const char *fname,
+                                         const char *root_dir,
+                                         enum dcc_cpp_where cpp_where,
+                                         const char *orig_output)
+{
+    char *search;
+    int ret;
+
+    if (cpp_where == DCC_CPP_ON_SERVER || orig_output[0] == '/')
+        return dcc_fix_debug_info(fname, "/", root_dir);
+
+    checked_asprintf(&search, "%s/", root_dir);
+    if (search == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    ret = dcc_fix_debug_info(fname, "./", search);
+    free(search);
+    return ret;
+}
+
+
 /**
  * Read the client working directory from in_fd socket,
  * and set up the server side directory corresponding to that.
@@ -650,9 +799,11 @@ static int dcc_run_job(int in_fd,
     char **argv = NULL;
     char **tweaked_argv = NULL;
     int status = 0;
-    char *temp_i = NULL, *temp_o = NULL;
+    char *temp_i = NULL, *temp_o = NULL, *temp_dwo = NULL;
+    int prefix_map = 0;
     char *err_fname = NULL, *out_fname = NULL, *deps_fname = NULL;
-    char *temp_dir = NULL; /* for receiving multiple files */
+    char *temp_dir = NULL; /* for receiving multiple files, or for the
+                            * output with split DWARF */
     int ret = 0, compile_ret = 0;
     char *orig_input = NULL, *orig_output = NULL;
     char *orig_input_tmp, *orig_output_tmp;
@@ -668,6 +819,7 @@ static int dcc_run_job(int in_fd,
     char *server_cwd = NULL;
     char *client_cwd = NULL;
     int changed_directory = 0;
+    struct dcc_pch_file *pch_files = NULL;
 
     gettimeofday(&start, NULL);
 
@@ -737,10 +889,15 @@ static int dcc_run_job(int in_fd,
      * in a loop.
      */
     if (cpp_where == DCC_CPP_ON_SERVER) {
-        if (dcc_r_many_files(in_fd, temp_dir, compr)
+        prefix_map = opt_debug_prefix_map
+            && dcc_compiler_takes_prefix_map(argv[0]);
+        if (dcc_r_many_files(in_fd, temp_dir, compr, &pch_files)
+            || dcc_mirror_output_for_dwo(argv, &temp_dir, client_cwd,
+                                         orig_output, &temp_o)
             || dcc_set_output(argv, temp_o)
             || tweak_arguments_for_server(argv, temp_dir, deps_fname,
-                                          &dotd_target, &tweaked_argv))
+                                          prefix_map, &dotd_target,
+                                          &tweaked_argv))
             goto out_cleanup;
         /* Repeat the switcharoo trick a few lines above. */
         dcc_free_argv(argv);
@@ -751,10 +908,17 @@ static int dcc_run_job(int in_fd,
             goto out_cleanup;
         if ((ret = dcc_r_token_file(in_fd, "DOTI", temp_i, compr))
             || (ret = dcc_set_input(argv, temp_i))
+            || (ret = dcc_mirror_output_for_dwo(argv, &temp_dir, NULL,
+                                                orig_output, &temp_o))
             || (ret = dcc_set_output(argv, temp_o)))
             goto out_cleanup;
     }
 
+    /* The compiler may write split DWARF beside the object. */
+    if ((ret = dcc_get_dwo_fname(argv, temp_o, &temp_dwo))
+        || (temp_dwo && (ret = dcc_add_cleanup(temp_dwo))))
+        goto out_cleanup;
+
     if (!dcc_remap_compiler(&argv[0]))
         goto out_cleanup;
 
@@ -793,6 +957,11 @@ static int dcc_run_job(int in_fd,
        }
     }
 
+    /* Only now that the job is accepted, fill or use the cache of
+     * precompiled headers, keyed by the compiler that is going to run. */
+    if ((ret = dcc_pch_use_files(pch_files, argv[0], opt_pch_cache_size)))
+        goto out_cleanup;
+
     if ((compile_ret = dcc_spawn_child(argv, &cc_pid,
                                        "/dev/null", out_fname, err_fname))
         || (compile_ret = dcc_collect_child("cc", cc_pid, &status, in_fd))) {
@@ -816,7 +985,11 @@ static int dcc_run_job(int in_fd,
         if (job_result == -1)
             job_result = STATS_COMPILE_ERROR;
     } else {
-        if (cpp_where == DCC_CPP_ON_SERVER) {
+        /* The compiler does not map the name of the .dwo file, so with
+         * split DWARF the object needs fixing even with prefix_map, and in
+         * plain mode too. */
+        if (temp_dir && (cpp_where == DCC_CPP_ON_SERVER
+                         ? !prefix_map || temp_dwo : temp_dwo != NULL)) {
           rs_trace("fixing up debug info");
           /*
            * We update the debugging information, replacing all occurrences
@@ -828,7 +1001,8 @@ static int dcc_run_job(int in_fd,
            * unlikely that this pattern could occur in the debug info by
            * chance.
            */
-          if ((ret = dcc_fix_debug_info(temp_o, "/", temp_dir)))
+          if ((ret = dcc_fix_debug_info_for_client(temp_o, temp_dir,
+                                                   cpp_where, orig_output)))
             goto out_cleanup;
         }
         if ((ret = dcc_x_file(out_fd, temp_o, "DOTO", compr, NULL)))
@@ -836,16 +1010,32 @@ static int dcc_run_job(int in_fd,
 
         if (cpp_where == DCC_CPP_ON_SERVER) {
             char *cleaned_dotd;
+            size_t cleaned_dotd_len;
             ret = dcc_cleanup_dotd(deps_fname,
                                    &cleaned_dotd,
+                                   &cleaned_dotd_len,
                                    temp_dir,
                                    dotd_target ? dotd_target : orig_output,
                                    temp_o);
             if (ret) goto out_cleanup;
-            ret = dcc_x_file(out_fd, cleaned_dotd, "DOTD", compr, NULL);
+            ret = dcc_x_buf(out_fd, cleaned_dotd, cleaned_dotd_len, "DOTD",
+                            compr);
             free(cleaned_dotd);
         }
 
+        if (ret == 0 && temp_dwo) {
+            if (access(temp_dwo, F_OK) == -1) {
+                /* For example -gsplit-dwarf without -g. */
+                ret = dcc_x_token_int(out_fd, "DOTW", 0);
+            } else if (cpp_where == DCC_CPP_ON_SERVER && !prefix_map
+                       && (ret = dcc_fix_debug_info_for_client(temp_dwo,
+                                        temp_dir, cpp_where, orig_output))) {
+                goto out_cleanup;
+            } else {
+                ret = dcc_x_file(out_fd, temp_dwo, "DOTW", compr, NULL);
+            }
+        }
+
         job_result = STATS_COMPILE_OK;
     }
 
@@ -921,6 +1111,7 @@ out_cleanup:
 
     free(orig_input);
     free(orig_output);
+    dcc_pch_free_files(pch_files);
 
     if (argv)
         dcc_free_argv(argv);
@@ -930,6 +1121,7 @@ out_cleanup:
     free(temp_dir);
     free(temp_i);
     free(temp_o);
+    free(temp_dwo);
 
     free(deps_fname);
     free(err_fname);
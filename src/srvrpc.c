@@ -48,6 +48,7 @@
 #include "hosts.h"
 #include "bulk.h"
 #include "snprintf.h"
+#include "pch.h"
 
 int dcc_r_request_header(int ifd,
                          enum dcc_protover *ver_ret)
@@ -96,15 +97,25 @@ static int prepend_dir_to_name(const char *dirname, char **path)
         return 0;
 }
 
+/**
+ * Receive the files of a pump mode compilation into @p dirname.
+ *
+ * A precompiled header comes with its digest: either with the file, or
+ * without, if the client expects the server to have it in its cache
+ * already; see pch.c.  Either way it is added to @p pch_files, for the
+ * caller to deal with once the job is accepted.
+ **/
 int dcc_r_many_files(int in_fd,
                      const char *dirname,
-                     enum dcc_compress compr)
+                     enum dcc_compress compr,
+                     struct dcc_pch_file **pch_files)
 {
     int ret = 0;
     unsigned int n_files;
     unsigned int i;
     char *name = 0;
     char *link_target = 0;
+    char *digest = 0;
     char token[5];
 
     if ((ret = dcc_r_token_int(in_fd, "NFIL", &n_files)))
@@ -154,6 +165,27 @@ int dcc_r_many_files(int in_fd,
                 unlink(name);
                 goto out_cleanup;
             }
+        } else if (strncmp(token, "PCHS", 4) == 0
+                   || strncmp(token, "PCHR", 4) == 0) {
+            if ((ret = dcc_r_str_alloc(in_fd, link_or_file_len, &digest)))
+                goto out_cleanup;
+            if (!dcc_pch_valid_digest(digest)) {
+                rs_log_error("bad precompiled header digest for %s", name);
+                ret = EXIT_PROTOCOL_ERROR;
+                goto out_cleanup;
+            }
+            if (token[3] == 'R') {
+                ret = dcc_pch_add_file(pch_files, name, digest, 0);
+                goto out_cleanup;
+            }
+            if ((ret = dcc_r_token_int(in_fd, "FILE", &link_or_file_len))
+                || (ret = dcc_r_file(in_fd, name, link_or_file_len, compr)))
+                goto out_cleanup;
+            if ((ret = dcc_add_cleanup(name))) {
+                unlink(name);
+                goto out_cleanup;
+            }
+            ret = dcc_pch_add_file(pch_files, name, digest, 1);
         } else if (strncmp(token, "FILE", 4) == 0) {
             if ((ret = dcc_r_file(in_fd, name, link_or_file_len, compr))) {
                 goto out_cleanup;
@@ -166,7 +198,8 @@ int dcc_r_many_files(int in_fd,
         } else {
             char buf[4 + sizeof(link_or_file_len)];
             /* unexpected token */
-            rs_log_error("protocol derailment: expected token FILE or LINK");
+            rs_log_error("protocol derailment: expected token FILE, LINK, "
+                         "PCHS or PCHR");
             /* We should explain what happened here, but we have already read
              * a few more bytes.
              */
@@ -183,6 +216,8 @@ out_cleanup:
         name = NULL;
         free(link_target);
         link_target = NULL;
+        free(digest);
+        digest = NULL;
         if (ret)
             break;
     }
@@ -38,6 +38,14 @@
  * rsync has a configuration option for that, but I don't support it here,
  * because there's no point using rsh, you might as well use the native
  * protocol.
+ *
+ * With DISTCC_SSH_MULTIPLEX set, OpenSSH is asked to keep a master
+ * connection to each server open for a while, with its control socket in
+ * $DISTCC_DIR/ssh, and later jobs go through it instead of doing the key
+ * exchange and authentication again.  ssh itself removes sockets whose
+ * master has gone away; if a job through a master fails, distcc tells the
+ * master to stop accepting new sessions ("ssh -O stop"), so that the next job
+ * starts afresh while jobs already going through it finish.
  */
 
 
@@ -62,9 +70,13 @@
 #include "exec.h"
 #include "snprintf.h"
 #include "netutil.h"
+#include "md5.h"
 
 const char *dcc_default_ssh = "ssh";
 
+/* How long an idle master connection stays open, in seconds. */
+static const int dcc_ssh_persist_default = 300;
+
 
 
 
@@ -167,6 +179,101 @@ static int dcc_run_piped_cmd(char **argv,
 
 
 
+/**
+ * Should connections to @p machine through @p ssh_cmd share a master
+ * connection?  Only OpenSSH knows how.
+ **/
+static int dcc_ssh_multiplex_enabled(const char *ssh_cmd)
+{
+    const char *base = strrchr(ssh_cmd, '/');
+
+    base = base ? base + 1 : ssh_cmd;
+    return strcmp(base, "ssh") == 0
+        && dcc_getenv_bool("DISTCC_SSH_MULTIPLEX", 0);
+}
+
+
+/**
+ * Work out the control socket of the master connection to @p machine as
+ * @p user, with @p n_args extra ssh arguments @p args.
+ *
+ * The name is a hash of all of them, since sockets have a short length
+ * limit and different options may reach a different server.
+ **/
+static int dcc_ssh_control_path(const char *ssh_cmd, char **args, int n_args,
+                                const char *user, const char *machine,
+                                char **path)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[DCC_MD5_DIGEST_LEN];
+    char key[17];
+    struct dcc_md5 md5;
+    char *dir;
+    int i, ret;
+
+    dcc_md5_init(&md5);
+    dcc_md5_update(&md5, ssh_cmd, strlen(ssh_cmd) + 1);
+    for (i = 0; i < n_args; i++)
+        dcc_md5_update(&md5, args[i], strlen(args[i]) + 1);
+    if (user)
+        dcc_md5_update(&md5, user, strlen(user));
+    dcc_md5_update(&md5, "@", 1);
+    dcc_md5_update(&md5, machine, strlen(machine));
+    dcc_md5_final(&md5, digest);
+    for (i = 0; i < 8; i++) {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 15];
+    }
+    key[16] = '\0';
+
+    if ((ret = dcc_get_subdir("ssh", &dir)))
+        return ret;
+    if (asprintf(path, "%s/%s", dir, key) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    /* ssh adds a suffix of 17 characters while creating the socket, and
+     * the name of a Unix socket can't be much longer than 100. */
+    if (strlen(*path) + 17 >= 100) {
+        rs_trace("not multiplexing: %s is too long for a socket", *path);
+        free(*path);
+        return EXIT_DISTCC_FAILED;
+    }
+    return 0;
+}
+
+
+/**
+ * Split $DISTCC_SSH, if @p ssh_cmd is not given, into the command and up to
+ * @p max_args arguments.  They point into @p *buf, which the caller frees,
+ * if it is not NULL.
+ **/
+static char *dcc_ssh_command(char *ssh_cmd, char **args, int max_args,
+                             int *n_args, char **buf)
+{
+    char *ssh_cmd_in;
+
+    *n_args = 0;
+    *buf = NULL;
+    /* Tokenize a copy, so that this can be done more than once. */
+    if (!ssh_cmd && (ssh_cmd_in = getenv("DISTCC_SSH"))
+        && (ssh_cmd_in = strdup(ssh_cmd_in))) {
+        *buf = ssh_cmd_in;
+        ssh_cmd = strtok(ssh_cmd_in, " ");
+        char *token = strtok(NULL, " ");
+        while (token != NULL) {
+            args[(*n_args)++] = token;
+            token = strtok(NULL, " ");
+            if (*n_args == max_args)
+                break;
+        }
+    }
+    if (!ssh_cmd)
+        ssh_cmd = (char *) dcc_default_ssh;
+    return ssh_cmd;
+}
+
+
 /**
  * Open a connection to a remote machine over ssh.
  *
@@ -192,34 +299,25 @@ int dcc_ssh_connect(char *ssh_cmd,
                     int *f_in, int *f_out,
                     pid_t *ssh_pid)
 {
-    pid_t ret;
+    int ret;
     const int max_ssh_args = 12;
     char *ssh_args[max_ssh_args];
-    char *child_argv[11+max_ssh_args];
+    char *child_argv[17+max_ssh_args];
     int i,j;
-    int num_ssh_args = 0;
-    char *ssh_cmd_in;
+    int num_ssh_args;
+    char *ssh_buf, *control_path;
+    char *control_opt = NULL, *persist_opt = NULL;
 
     /* We need to cast away constness.  I promise the strings in the argv[]
      * will not be modified. */
 
-    if (!ssh_cmd && (ssh_cmd_in = getenv("DISTCC_SSH"))) {
-        ssh_cmd = strtok(ssh_cmd_in, " ");
-        char *token = strtok(NULL, " ");
-        while (token != NULL) {
-            ssh_args[num_ssh_args++] = token;
-            token = strtok(NULL, " ");
-            if (num_ssh_args == max_ssh_args)
-                break;
-        }
-    }
-    if (!ssh_cmd)
-        ssh_cmd = (char *) dcc_default_ssh;
-
     if (!machine) {
         rs_log_crit("no machine defined!");
         return EXIT_DISTCC_FAILED;
     }
+
+    ssh_cmd = dcc_ssh_command(ssh_cmd, ssh_args, max_ssh_args,
+                              &num_ssh_args, &ssh_buf);
     if (!path)
         path = (char *) "distccd";
 
@@ -229,6 +327,32 @@ int dcc_ssh_connect(char *ssh_cmd,
         child_argv[i++] = ssh_args[j++];
     }
 
+    if (dcc_ssh_multiplex_enabled(ssh_cmd)
+        && dcc_ssh_control_path(ssh_cmd, ssh_args, num_ssh_args,
+                                user, machine, &control_path) == 0) {
+        int persist = dcc_ssh_persist_default;
+        const char *p = getenv("DISTCC_SSH_PERSIST");
+
+        if (p && atoi(p) > 0)
+            persist = atoi(p);
+        ret = asprintf(&control_opt, "ControlPath=%s", control_path);
+        free(control_path);
+        if (ret == -1
+            || asprintf(&persist_opt, "ControlPersist=%d", persist) == -1) {
+            rs_log_error("asprintf failed");
+            if (ret != -1)
+                free(control_opt);
+            free(ssh_buf);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        child_argv[i++] = (char *) "-o";
+        child_argv[i++] = (char *) "ControlMaster=auto";
+        child_argv[i++] = (char *) "-o";
+        child_argv[i++] = control_opt;
+        child_argv[i++] = (char *) "-o";
+        child_argv[i++] = persist_opt;
+    }
+
     if (user) {
         child_argv[i++] = (char *) "-l";
         child_argv[i++] = user;
@@ -247,5 +371,77 @@ int dcc_ssh_connect(char *ssh_cmd,
 
     ret = dcc_run_piped_cmd(child_argv, f_in, f_out, ssh_pid);
 
+    free(control_opt);
+    free(persist_opt);
+    free(ssh_buf);
     return ret;
 }
+
+
+/**
+ * Tell the master connection to @p machine, if there is one, to stop
+ * accepting new sessions, so that the next connection is made afresh.
+ * Called when a job through it failed, in case the master is what is broken.
+ *
+ * The master is not told to exit, since that would also cut the other jobs
+ * going through it, which would then fail and stop the next master too.
+ * It exits by itself once their sessions are over.
+ **/
+void dcc_ssh_drop_master(char *user, char *machine)
+{
+    const int max_ssh_args = 12;
+    char *ssh_args[max_ssh_args];
+    char *child_argv[8+max_ssh_args];
+    char *ssh_cmd, *ssh_buf, *control_path, *control_opt;
+    struct stat st;
+    pid_t pid;
+    int i, j, num_ssh_args, status;
+
+    ssh_cmd = dcc_ssh_command(NULL, ssh_args, max_ssh_args, &num_ssh_args,
+                              &ssh_buf);
+    if (!machine || !dcc_ssh_multiplex_enabled(ssh_cmd)
+        || dcc_ssh_control_path(ssh_cmd, ssh_args, num_ssh_args,
+                                user, machine, &control_path)) {
+        free(ssh_buf);
+        return;
+    }
+    if (stat(control_path, &st) == -1
+        || asprintf(&control_opt, "ControlPath=%s", control_path) == -1) {
+        free(control_path);
+        free(ssh_buf);
+        return;
+    }
+
+    i = 0;
+    child_argv[i++] = ssh_cmd;
+    for (j = 0; j < num_ssh_args; )
+        child_argv[i++] = ssh_args[j++];
+    child_argv[i++] = (char *) "-o";
+    child_argv[i++] = control_opt;
+    child_argv[i++] = (char *) "-O";
+    child_argv[i++] = (char *) "stop";
+    if (user) {
+        child_argv[i++] = (char *) "-l";
+        child_argv[i++] = user;
+    }
+    child_argv[i++] = machine;
+    child_argv[i++] = NULL;
+
+    rs_trace("stopping ssh master connection %s", control_path);
+    if ((pid = fork()) == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execvp(child_argv[0], child_argv);
+        _exit(1);
+    } else if (pid != -1) {
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+            ;
+    }
+    free(control_opt);
+    free(control_path);
+    free(ssh_buf);
+}
@@ -79,52 +79,17 @@ int dcc_strip_local_args(char **from, char ***out_argv)
     /* skip through argv, copying all arguments but skipping ones that
      * ought to be omitted */
     for (from_i = to_i = 0; from[from_i]; from_i++) {
-        if (str_equal("-D", from[from_i])
-            || str_equal("-I", from[from_i])
-            || str_equal("-U", from[from_i])
-            || str_equal("-L", from[from_i])
-            || str_equal("-l", from[from_i])
-            || str_equal("-MF", from[from_i])
-            || str_equal("-MT", from[from_i])
-            || str_equal("-MQ", from[from_i])
-            || str_equal("-include", from[from_i])
-            || str_equal("-imacros", from[from_i])
-            || str_equal("-iprefix", from[from_i])
-            || str_equal("-iwithprefix", from[from_i])
-            || str_equal("-isystem", from[from_i])
-            || str_equal("-iwithprefixbefore", from[from_i])
-            || str_equal("-idirafter", from[from_i])
-            || str_equal("-Xpreprocessor", from[from_i])) {
-            /* skip next word, being option argument */
-            if (from[from_i+1])
+        const struct dcc_arg_rule *rule = dcc_find_arg_rule(from[from_i]);
+
+        if (rule && (rule->flags & DCC_ARG_STRIP)) {
+            /* Something like "-DNDEBUG" or "-Wp,-MD,.deps/nsinstall.pp";
+             * skip this word, and the next if it is the option's
+             * argument. */
+            if ((rule->flags & DCC_ARG_SEPARATE)
+                && str_equal(rule->name, from[from_i])
+                && from[from_i+1])
                 from_i++;
         }
-        else if (str_startswith("-Wp,", from[from_i])
-                 || str_startswith("-Wl,", from[from_i])
-                 || str_startswith("-D", from[from_i])
-                 || str_startswith("-U", from[from_i])
-                 || str_startswith("-I", from[from_i])
-                 || str_startswith("-l", from[from_i])
-                 || str_startswith("-L", from[from_i])
-                 || str_startswith("-MF", from[from_i])
-                 || str_startswith("-MT", from[from_i])
-                 || str_startswith("-MQ", from[from_i])
-                 || str_startswith("-isystem", from[from_i])
-                 || str_startswith("-stdlib", from[from_i])) {
-            /* Something like "-DNDEBUG" or
-             * "-Wp,-MD,.deps/nsinstall.pp".  Just skip this word */
-            ;
-        }
-        else if (str_equal("-undef", from[from_i])
-                 || str_equal("-nostdinc", from[from_i])
-                 || str_equal("-nostdinc++", from[from_i])
-                 || str_equal("-MD", from[from_i])
-                 || str_equal("-MMD", from[from_i])
-                 || str_equal("-MG", from[from_i])
-                 || str_equal("-MP", from[from_i])) {
-            /* Options that only affect cpp; skip */
-            ;
-        }
         else {
             to[to_i++] = from[from_i];
         }
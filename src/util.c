@@ -107,6 +107,40 @@ int str_startswith(const char *head, const char *worm)
 }
 
 
+/**
+ * Return the first occurrence of @p needle (of length @p needle_len) in
+ * the @p hay_len bytes at @p hay, or NULL if there is none.
+ *
+ * Rather than trying memcmp() at every byte, let the C library skip to
+ * candidates; its memmem() and memchr() are vectorized on the platforms
+ * that matter.
+ **/
+char *dcc_memmem(const char *hay, size_t hay_len,
+                 const char *needle, size_t needle_len)
+{
+#ifdef HAVE_MEMMEM
+    return memmem(hay, hay_len, needle, needle_len);
+#else
+    const char *last;
+
+    if (hay_len < needle_len)
+        return NULL;
+    if (needle_len == 0)
+        return (char *) hay;
+    last = hay + hay_len - needle_len;
+    while (hay <= last) {
+        hay = memchr(hay, needle[0], last - hay + 1);
+        if (hay == NULL)
+            return NULL;
+        if (memcmp(hay, needle, needle_len) == 0)
+            return (char *) hay;
+        hay++;
+    }
+    return NULL;
+#endif
+}
+
+
 
 /**
  * Skim through NULL-terminated @p argv, looking for @p s.
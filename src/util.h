@@ -33,6 +33,8 @@ void dcc_getloadavg(double loadavg[3]);
 int argv_contains(char **argv, const char *s);
 int dcc_redirect_fd(int, const char *fname, int);
 int str_startswith(const char *head, const char *worm);
+char *dcc_memmem(const char *hay, size_t hay_len,
+                 const char *needle, size_t needle_len);
 char *dcc_gethostname(void);
 void dcc_exit(int exitcode) NORETURN;
 int dcc_getenv_bool(const char *name, int def_value);
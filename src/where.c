@@ -51,6 +51,14 @@
  * cpp is probably cheap enough that we can allow it to run unlocked.  However
  * that is not true for local compilation or linking.
  *
+ * If the hosts differ in speed, declared with ",speed=" or learned by the
+ * cost model, heavy jobs try the fastest hosts first and light jobs the
+ * slowest, so that the big translation units do not end up holding up the
+ * build on a slow machine.
+ *
+ * With DISTCC_AFFINITY, pump-mode jobs first try the host their directory
+ * hashes to; see affinity.c.
+ *
  * @todo Write a test harness for the host selection algorithm.  Perhaps a
  * really simple simulation of machines taking different amounts of time to
  * build stuff?
@@ -76,6 +84,8 @@
 #include "lock.h"
 #include "where.h"
 #include "exitcode.h"
+#include "cost.h"
+#include "affinity.h"
 
 
 static int dcc_lock_one(struct dcc_hostdef *hostlist,
@@ -99,8 +109,83 @@ void dcc_read_localslots_configuration(void)
 }
 
 
-int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
-                            int *cpu_lock_fd)
+static double dcc_host_speed(const struct dcc_hostdef *h)
+{
+    return h->speed > 0 ? h->speed : 1.0;
+}
+
+
+/**
+ * Sort @p hostlist by speed: slowest first if the job is known to be light,
+ * otherwise fastest first.  Hosts of the same speed keep their order.
+ **/
+static void dcc_order_hosts_by_speed(struct dcc_hostdef **hostlist,
+                                     const char *input_fname,
+                                     const char *cpp_fname)
+{
+    struct dcc_hostdef *sorted = NULL, **pp, *h;
+    int weight = 0;
+
+    for (h = *hostlist; h; h = h->next)
+        if (dcc_host_speed(h) != dcc_host_speed(*hostlist))
+            break;
+    if (!h)
+        return;                 /* all the same */
+
+    if (input_fname && dcc_cost_model_enabled())
+        weight = dcc_cost_job_weight(input_fname, cpp_fname);
+
+    /* Insertion sort; the lists are short. */
+    while ((h = *hostlist) != NULL) {
+        *hostlist = h->next;
+        for (pp = &sorted; *pp; pp = &(*pp)->next) {
+            if (weight >= 0 ? dcc_host_speed(h) > dcc_host_speed(*pp)
+                : dcc_host_speed(h) < dcc_host_speed(*pp))
+                break;
+        }
+        h->next = *pp;
+        *pp = h;
+    }
+    *hostlist = sorted;
+
+    rs_trace("%s job: trying %s first",
+             weight > 0 ? "heavy" : weight < 0 ? "light" : "unknown",
+             sorted->hostdef_string);
+}
+
+
+/**
+ * Walk through @p hostlist and remove the remote hosts that are not marked
+ * as returning split DWARF.
+ **/
+static void dcc_remove_without_dwo(struct dcc_hostdef **hostlist)
+{
+    struct dcc_hostdef *h;
+
+    while ((h = *hostlist) != NULL) {
+        if (h->mode != DCC_MODE_LOCAL && !h->dwo) {
+            rs_trace("%s does not return split DWARF", h->hostdef_string);
+            *hostlist = h->next;
+            dcc_free_hostdef(h);
+        } else {
+            hostlist = &h->next;
+        }
+    }
+}
+
+
+/**
+ * Choose a host for compiling @p input_fname, which has been preprocessed
+ * into @p cpp_fname if that is not NULL, and lock one of its slots.
+ *
+ * @param need_dwo If true, the job writes a .dwo file, and only localhost
+ * and ",dwo" hosts are considered.
+ **/
+int dcc_pick_host_from_list_and_lock_it(const char *input_fname,
+                                        const char *cpp_fname,
+                                        int need_dwo,
+                                        struct dcc_hostdef **buildhost,
+                                        int *cpu_lock_fd)
 {
     struct dcc_hostdef *hostlist;
     int ret;
@@ -112,17 +197,116 @@ int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
 
     if ((ret = dcc_remove_disliked(&hostlist)))
         return ret;
+    if (need_dwo)
+        dcc_remove_without_dwo(&hostlist);
 
     if (!hostlist) {
         return EXIT_NO_HOSTS;
     }
 
+    if (input_fname && dcc_affinity_enabled()) {
+        ret = dcc_lock_by_affinity(hostlist, input_fname, buildhost,
+                                   cpu_lock_fd);
+        if (ret != EXIT_BUSY)
+            return ret;
+    }
+
+    if (dcc_cost_model_enabled())
+        dcc_cost_learn_speeds(hostlist);
+    dcc_order_hosts_by_speed(&hostlist, input_fname, cpp_fname);
+
     return dcc_lock_one(hostlist, buildhost, cpu_lock_fd);
 
     /* FIXME: Host list is leaked? */
 }
 
 
+/**
+ * Lock slot @p i_cpu of @p host for a job, without waiting, and claim the
+ * probe if the host is recovering from a failure.
+ *
+ * @returns EXIT_BUSY if the slot is taken, or if the host may not be used
+ * after all.
+ **/
+static int dcc_lock_host_for_job(const struct dcc_hostdef *host, int i_cpu,
+                                 int *cpu_lock_fd)
+{
+    int ret;
+
+    if ((ret = dcc_lock_host("cpu", host, i_cpu, 0, cpu_lock_fd)))
+        return ret;
+    if ((ret = dcc_claim_probe(host))) {
+        dcc_unlock(*cpu_lock_fd);
+        *cpu_lock_fd = -1;
+    }
+    return ret;
+}
+
+
+/**
+ * Lock a free slot of @p host, without waiting.
+ *
+ * @param slot If not NULL, set to the slot that was locked.
+ *
+ * @returns EXIT_BUSY if all the slots are taken.
+ **/
+int dcc_try_lock_host(const struct dcc_hostdef *host, int *slot,
+                      int *cpu_lock_fd)
+{
+    int i_cpu;
+    int ret = EXIT_BUSY;
+
+    for (i_cpu = 0; i_cpu < host->n_slots; i_cpu++) {
+        ret = dcc_lock_host_for_job(host, i_cpu, cpu_lock_fd);
+        if (ret == 0 && slot)
+            *slot = i_cpu;
+        if (ret != EXIT_BUSY)
+            break;
+    }
+    return ret;
+}
+
+
+/**
+ * Lock a free slot on a remote host other than @p busy that preprocesses in
+ * the same place, without waiting.
+ *
+ * @returns EXIT_BUSY if there is no such slot.  Otherwise the caller must
+ * free @p spare_host with dcc_free_hostdef().
+ **/
+int dcc_lock_spare_host(const struct dcc_hostdef *busy,
+                        struct dcc_hostdef **spare_host,
+                        int *cpu_lock_fd)
+{
+    struct dcc_hostdef *hostlist, *h, *next;
+    int n_hosts;
+    int ret = EXIT_BUSY;
+
+    if (dcc_get_hostlist(&hostlist, &n_hosts) != 0)
+        return EXIT_BUSY;
+    if (dcc_remove_disliked(&hostlist))
+        hostlist = NULL;
+
+    *spare_host = NULL;
+    for (h = hostlist; h && ret == EXIT_BUSY; h = h->next) {
+        if (h->mode == DCC_MODE_LOCAL
+            || h->cpp_where != busy->cpp_where
+            || (busy->dwo && !h->dwo) /* the job may want split DWARF */
+            || !strcmp(h->hostdef_string, busy->hostdef_string))
+            continue;
+        if ((ret = dcc_try_lock_host(h, NULL, cpu_lock_fd)) == 0)
+            *spare_host = h;
+    }
+
+    for (h = hostlist; h; h = next) {
+        next = h->next;
+        if (h != *spare_host)
+            dcc_free_hostdef(h);
+    }
+    return ret;
+}
+
+
 static void dcc_lock_pause(void)
 {
     /* This could do with some tuning.
@@ -182,7 +366,7 @@ static int dcc_lock_one(struct dcc_hostdef *hostlist,
 
                 i_cpu_is_usable = 1;
 
-                ret = dcc_lock_host("cpu", h, i_cpu, 0, cpu_lock_fd);
+                ret = dcc_lock_host_for_job(h, i_cpu, cpu_lock_fd);
 
                 if (ret == 0) {
                     *buildhost = h;
@@ -217,6 +401,21 @@ int dcc_lock_local(int *cpu_lock_fd)
     return dcc_lock_one(dcc_hostdef_local, &chosen, cpu_lock_fd);
 }
 
+/**
+ * Lock localhost if one of its slots is free, without waiting.
+ *
+ * @returns EXIT_BUSY if all the slots are taken.
+ **/
+int dcc_try_lock_local(int *cpu_lock_fd)
+{
+    int slot;
+    int ret;
+
+    if ((ret = dcc_try_lock_host(dcc_hostdef_local, &slot, cpu_lock_fd)) == 0)
+        dcc_note_state_slot(slot, DCC_LOCAL);
+    return ret;
+}
+
 int dcc_lock_local_cpp(int *cpu_lock_fd)
 {
     int ret;
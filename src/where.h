@@ -23,9 +23,21 @@
 
 /* where.c */
 void dcc_read_localslots_configuration(void);
-int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **,
+int dcc_pick_host_from_list_and_lock_it(const char *input_fname,
+                                        const char *cpp_fname,
+                                        int need_dwo,
+                                        struct dcc_hostdef **,
                                         int *cpu_lock_fd);
 
+int dcc_try_lock_host(const struct dcc_hostdef *host, int *slot,
+                      int *cpu_lock_fd);
+
+int dcc_lock_spare_host(const struct dcc_hostdef *busy,
+                        struct dcc_hostdef **spare_host,
+                        int *cpu_lock_fd);
+
 int dcc_lock_local(int *cpu_lock_fd);
 
+int dcc_try_lock_local(int *cpu_lock_fd);
+
 int dcc_lock_local_cpp(int *cpu_lock_fd);
@@ -140,7 +140,6 @@ Example:
 
 # TODO: Test path stripping.
 
-# TODO: Test backoff from downed hosts.
 
 # TODO: Check again in --no-prefork mode.
 
@@ -478,6 +477,10 @@ class StripArgs_Case(SimpleDistCC_Case):
                  # New options stripped in 0.11
                  ("cc -o nsinstall.o -c -DOSTYPE=\"Linux2.4\" -DOSARCH=\"Linux\" -DOJI -D_BSD_SOURCE -I../dist/include -I../dist/include -I/home/mbp/work/mozilla/mozilla-1.1/dist/include/nspr -I/usr/X11R6/include -fPIC -I/usr/X11R6/include -Wall -W -Wno-unused -Wpointer-arith -Wcast-align -pedantic -Wno-long-long -pthread -pipe -DDEBUG -D_DEBUG -DDEBUG_mbp -DTRACING -g -I/usr/X11R6/include -include ../config-defs.h -DMOZILLA_CLIENT -Wp,-MD,.deps/nsinstall.pp nsinstall.c",
                   "cc -o nsinstall.o -c -fPIC -Wall -W -Wno-unused -Wpointer-arith -Wcast-align -pedantic -Wno-long-long -pthread -pipe -g nsinstall.c"),
+                 ("cc -c -Xpreprocessor -C -MMD -MF dep.d -isystem/x -nostdinc hello.c -lm",
+                  "cc -c hello.c"),
+                 # -M implies -E, so it is left for the compiler to reject
+                 ("cc -c -M -MDx hello.c", "cc -c -M -MDx hello.c"),
                  )
         for cmd, expect in cases:
             o, err = self.runcmd("h_strip %s" % cmd)
@@ -566,6 +569,15 @@ class ScanArgs_Case(SimpleDistCC_Case):
 
                  # Fixed in 2.18.4 -- -dr writes rtl to a local file
                  ("gcc -dr -c foo.c", "local"),
+
+                 # Option arguments are not input or output files
+                 ("gcc -include pre.c -c foo.c", "distribute", "foo.c", "foo.o"),
+                 ("gcc -c -I inc.o foo.c", "distribute", "foo.c", "foo.o"),
+                 ("gcc -MF foo.o -MMD -c bar.c", "distribute", "bar.c", "bar.o"),
+                 # ... except that the preprocessor's own options count
+                 ("gcc -Xpreprocessor -M -c foo.c", "local"),
+                 ("gcc -march=native -c foo.c", "local"),
+                 ("gcc -fprofile-generate=dir -c foo.c", "local"),
                  ]
         for tup in cases:
             self.checkScanArgs(*tup)
@@ -862,10 +874,14 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
         @angry,lzo#asdasd
         # oh yeah nothing here
         @angry:/usr/sbin/distccd,lzo
+        angry/44,speed=2.5
+        @angry,lzo,speed=0.5
+        angry,lzo,cpp,pch
+        angry:3000,dwo
         localhostbutnotreally
         """
 
-        expected="""16
+        expected="""20
    2 LOCAL
    4 TCP 127.0.0.1 3632
    4 SSH (no-user) angry (no-command)
@@ -881,6 +897,10 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
   44 TCP angry 3632
    4 SSH (no-user) angry (no-command)
    4 SSH (no-user) angry /usr/sbin/distccd
+  44 TCP angry 3632 speed=2.5
+   4 SSH (no-user) angry (no-command) speed=0.5
+   4 TCP angry 3632 pch
+   4 TCP angry 3000 dwo
    4 TCP localhostbutnotreally 3632
 """
         out, err = self.runcmd(("DISTCC_HOSTS=\"%s\" " % spec) + self.valgrind()
@@ -1437,6 +1457,569 @@ int main(void) {
         os.environ['DISTCC_HOSTS'] = (
             '127.0.0.1:%d,lzo' % self.server_port + _server_options)
 
+class SplitDwarf_Case(CompileHello_Case):
+    """Test that the .dwo file written with -gsplit-dwarf comes back from a
+    ,dwo server, that the object names it as the client would, and that
+    other servers are not sent such jobs."""
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d,dwo' % self.server_port + _server_options)
+
+    def compileOpts(self):
+        return "-g -gsplit-dwarf"
+
+    def runtest(self):
+        rc, _, _ = self.runcmd_unchecked(self._cc +
+            " -g -gsplit-dwarf -c -o probe.o %s && test -f probe.dwo" %
+            self.sourceFilename())
+        if rc != 0:
+            raise comfychair.NotRunError(
+                'compiler does not write .dwo files with -gsplit-dwarf')
+        self.compile()
+        if not os.path.exists('testtmp.dwo'):
+            self.fail("testtmp.dwo was not returned by the server")
+        self.link()
+        self.checkBuiltProgram()
+        if _IsElf('testtmp.o'):
+            obj = open('testtmp.o', 'rb').read()
+            if "cpp" in _server_options:
+                dwo_name = re.escape((os.getcwd() + '/testtmp.dwo').encode())
+            else:
+                # The server does not know our directory: a relative
+                # name stays relative.
+                dwo_name = b'\\./*testtmp\\.dwo'
+            if not re.search(dwo_name + b'\0', obj):
+                self.fail("object does not name %s" % dwo_name)
+
+        # A ,dwo host gets the job even when another host comes first.
+        os.remove('testtmp.dwo')
+        hosts = os.environ['DISTCC_HOSTS'].replace(',dwo', '')
+        self.runcmd("DISTCC_HOSTS='%s localhost:%d,dwo%s' "
+                    % (hosts, self.server_port, _server_options)
+                    + self.compileCmd())
+        self.assert_re_search(r'phases of \S+ on localhost',
+                              open(os.environ['DISTCC_LOG']).read())
+        if not os.path.exists('testtmp.dwo'):
+            self.fail("testtmp.dwo was not returned by the ,dwo server")
+
+        os.remove('testtmp.dwo')
+        self.runcmd("DISTCC_HOSTS='%s' " % hosts + self.compileCmd())
+        self.assert_re_search('no usable host is marked as returning split '
+                              'DWARF', open(os.environ['DISTCC_LOG']).read())
+        if not os.path.exists('testtmp.dwo'):
+            self.fail("testtmp.dwo was not written by the local compile")
+
+class PrecompiledHeader_Case(CompileHello_Case):
+    """Test that in pump mode a precompiled header is sent to a ,pch server
+    once, then only named by its digest and taken from the server's cache,
+    and that one not matching its digest is not cached."""
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d,pch' % self.server_port + _server_options)
+
+    def compileOpts(self):
+        return "-include foo.h"
+
+    def clearLog(self):
+        open(os.environ['DISTCC_LOG'], 'w').close()
+
+    def cached(self, digest):
+        return glob.glob(os.path.join(os.environ['TMPDIR'], 'daemon_tmp',
+                                      'distccd-pch', '*', digest + '.gch'))
+
+    def runtest(self):
+        if "cpp" not in _server_options:
+            raise comfychair.NotRunError('precompiled headers are only sent '
+                                         'in pump mode')
+        open('foo.h', 'w').write('#define FOO_GREETING "hello"\n')
+        self.runcmd(self._cc + " -x c-header foo.h -o foo.h.gch")
+        gch = open('foo.h.gch', 'rb').read()
+        if gch[:4] != b'gpch':
+            raise comfychair.NotRunError(
+                'compiler does not write GCC precompiled headers')
+        import hashlib
+        digest = hashlib.md5(gch).hexdigest()
+
+        # The first time, the precompiled header goes with the job, and the
+        # server keeps it.
+        self.clearLog()
+        self.compile()
+        self.assert_re_search(r'send PCHS', open(os.environ['DISTCC_LOG']).read())
+        cached = self.cached(digest)
+        self.assert_equal(len(cached), 1)
+
+        # The next time, only its digest does, and the cached one is used.
+        os.utime(cached[0], (1, 1))
+        self.clearLog()
+        self.compile()
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r'send PCHR', log)
+        self.assert_(not re.search(r'send PCHS', log))
+        self.assert_(os.stat(cached[0]).st_mtime > 1)
+        self.link()
+        self.checkBuiltProgram()
+
+        # A precompiled header that does not match its digest is refused by
+        # the server, and the compilation goes ahead with it all the same.
+        image = re.search(r"'(/\S*/foo\.h\.gch\.lzo)'", log)
+        if not image:
+            image = re.search(r'"(/\S*/foo\.h\.gch\.lzo)"', log)
+        self.assert_(image)
+        wrong = '0' * 32
+        digest_file = image.group(1) + '.md5'
+        open(digest_file, 'w').write(wrong)
+        try:
+            out, err = self.runcmd(self.compileCmd())
+        finally:
+            open(digest_file, 'w').write(digest)
+        self.assert_re_search(r'does not match its digest', err)
+        self.assert_equal(self.cached(wrong), [])
+        self.link()
+        self.checkBuiltProgram()
+
+
+class DebugPrefixMap_Case(CompileHello_Case):
+    """Test distccd --debug-prefix-map: in pump mode the compiler maps the
+    server's temporary directory out of the debug info, and the client's
+    own -fdebug-prefix-map still applies on top of it."""
+
+    def daemon_command(self):
+        return CompileHello_Case.daemon_command(self) + " --debug-prefix-map"
+
+    def compileOpts(self):
+        return "-g -fdebug-prefix-map=%s=/mapped_by_client" % _ShellSafe(
+            os.getcwd())
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        if "cpp" in _server_options and _IsElf('testtmp.o'):
+            obj = open('testtmp.o', 'rb').read()
+            if obj.find(b'/mapped_by_client') == -1:
+                self.fail("client's -fdebug-prefix-map was not applied")
+            if obj.find(b'distccd_') != -1:
+                self.fail("server's temporary directory left in debug info")
+            if open(self.daemon_logfile).read().find('updated "') != -1:
+                self.fail("distccd rewrote the debug info anyway")
+
+class Batch_Case(WithDaemon_Case):
+    """Test compiling the entries of a compilation database with --batch."""
+
+    def runtest(self):
+        cwd = os.getcwd()
+        os.mkdir('sub')
+        open('sub/a.c', 'w').write('#warning first\nint a(void) { return 1; }\n')
+        open('b.c', 'w').write('int a(void);\n'
+                               'int main(void) { return a() - 1; }\n')
+        open('compile_commands.json', 'w').write("""[
+  { "directory": "%s/sub", "file": "a.c",
+    "arguments": ["%s", "-c", "a.c", "-o", "a.o"] },
+  { "directory": "%s", "file": "b.c",
+    "command": "%s -c -o 'b.o' \\"b.c\\"" }
+]
+""" % (cwd, self._cc, cwd, self._cc))
+        out, err = self.runcmd(self.distcc_without_fallback()
+                               + "--batch compile_commands.json")
+        self.assert_re_search('first', err)
+        self.runcmd(self._cc + " -o testtmp sub/a.o b.o")
+        self.runcmd("./testtmp")
+
+        # A job that fails is reported, and so is its exit code.
+        open('bad.c', 'w').write('this is not C\n')
+        open('bad.json', 'w').write(
+            '[{"directory": "%s", "file": "bad.c",'
+            ' "arguments": ["%s", "-c", "bad.c"]}]' % (cwd, self._cc))
+        rc, out, err = self.runcmd_unchecked(self.distcc()
+                                             + "--batch bad.json")
+        self.assert_equal(rc, 1)
+        self.assert_re_search('compile bad.c failed',
+                              open(os.environ['DISTCC_LOG']).read())
+
+        # The exit code is that of the failed job first in the database,
+        # even when a later one fails sooner.
+        open('order.json', 'w').write(
+            '[{"directory": "%s", "arguments": ["sh", "-c", "sleep 1; exit 3"]},'
+            ' {"directory": "%s", "arguments": ["sh", "-c", "exit 5"]}]'
+            % (cwd, cwd))
+        rc, out, err = self.runcmd_unchecked(self.distcc()
+                                             + "--batch order.json")
+        self.assert_equal(rc, 3)
+
+        # Many jobs finishing behind a slow one need no more open files
+        # than the running ones, and still come out in order.
+        n_quick = 60
+        open('slow.json', 'w').write(
+            '[{"directory": "%s", "arguments": ["sh", "-c",'
+            ' "sleep 1; echo slow"]}' % cwd
+            + ''.join([',{"directory": "%s", "arguments": ["echo", "%d"]}'
+                       % (cwd, i) for i in range(n_quick)])
+            + ']')
+        out, err = self.runcmd("ulimit -n 32 && " + self.distcc()
+                               + "--batch slow.json")
+        self.assert_equal(out.split(),
+                          ['slow'] + [str(i) for i in range(n_quick)])
+
+class ResultCache_Case(CompileHello_Case):
+    """Test that a repeated compilation is served from the result cache,
+    without any help from the server."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        os.environ['DISTCC_CACHE_SIZE'] = '10'
+
+    def runtest(self):
+        self.compile()
+        os.remove('testtmp.o')
+        self.killDaemon()
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        out, err = self.runcmd(self.distcc() + "--show-cache-stats")
+        self.assert_re_search(r'cache hits +1\n', out)
+        self.assert_re_search(r'cache misses +1\n', out)
+        self.assert_re_search(r'results stored +1\n', out)
+
+
+class ResolveCache_Case(CompileHello_Case):
+    """Test that the addresses of a server named in DISTCC_HOSTS are
+    remembered, and used by the next compilation."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = (
+            'localhost:%d' % self.server_port + _server_options)
+
+    def runtest(self):
+        self.compile()
+        cache = os.path.join(os.environ['DISTCC_DIR'], 'state',
+                             'resolve_localhost_%d' % self.server_port)
+        self.assert_re_match(r'resolved \d+\n', open(cache).read())
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'using remembered addresses of localhost',
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class HedgedCompile_Case(CompileHello_Case):
+    """Test that a compilation that is late by the standards of its server is
+    also sent to a spare server, and still produces the right output."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        # Two names for the one server, so that there is a spare.
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d%s localhost:%d%s' % (self.server_port, _server_options,
+                                               self.server_port, _server_options))
+        os.environ['DISTCC_HEDGE'] = '1'
+
+    def runtest(self):
+        # Pretend that the first server usually answers within 1ms.
+        lockdir = os.path.join(os.environ['DISTCC_DIR'], 'lock')
+        if not os.path.isdir(lockdir):
+            os.makedirs(lockdir)
+        open(os.path.join(lockdir, 'hedge_tcp_127.0.0.1_%d_0' % self.server_port),
+             'w').write('1\n' * 10)
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'is late; also sending it to localhost',
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class HedgeTimeout_Case(CompileHello_Case):
+    """Test that a late compilation with no spare server to hedge on gives
+    up after the I/O timeout, and is then compiled locally."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        # A server that takes connections, but never answers.
+        self.silent = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.silent.bind(('127.0.0.1', 0))
+        self.silent.listen(5)
+        self.silent_port = self.silent.getsockname()[1]
+        self.add_cleanup(self.silent.close)
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d%s' % (self.silent_port, _server_options))
+        os.environ['DISTCC_HEDGE'] = '1'
+        os.environ['DISTCC_IO_TIMEOUT'] = '2'
+
+    def compileCmd(self):
+        return (self.distcc() + self._cc + " -o testtmp.o "
+                + self.compileOpts() + " -c %s" % self.sourceFilename())
+
+    def runtest(self):
+        lockdir = os.path.join(os.environ['DISTCC_DIR'], 'lock')
+        if not os.path.isdir(lockdir):
+            os.makedirs(lockdir)
+        open(os.path.join(lockdir, 'hedge_tcp_127.0.0.1_%d_0' % self.silent_port),
+             'w').write('1\n' * 10)
+        started = time.time()
+        self.compile()
+        self.assert_(time.time() - started < 30)
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'IO timeout',
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class CostModel_Case(CompileHello_Case):
+    """Test that the cost model learns from a remote compilation, and then
+    keeps a compilation local when the network is too slow for it."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        os.environ['DISTCC_COST_MODEL'] = '1'
+
+    def runtest(self):
+        self.compile()
+        link = os.path.join(os.environ['DISTCC_DIR'], 'lock',
+                            'link_tcp_127.0.0.1_%d_0' % self.server_port)
+        self.assert_re_match(r'\d+ \d+\n', open(link).read())
+        # Make connecting look very slow.
+        open(link, 'w').write('100000 1\n')
+        self.killDaemon()
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'quicker to compile than to send',
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class HostSpeed_Case(CompileHello_Case):
+    """Test that jobs of unknown weight go to the fastest host first, and
+    light ones to the slowest."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        # Two names for the one server, one declared faster than the other.
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d%s localhost:%d%s,speed=3'
+            % (self.server_port, _server_options,
+               self.server_port, _server_options))
+        os.environ['DISTCC_COST_MODEL'] = '1'
+
+    def runtest(self):
+        self.compile()
+        self.assert_re_search(r'unknown job: trying localhost:%d\S*speed=3 first'
+                              % self.server_port,
+                              open(os.environ['DISTCC_LOG']).read())
+        # Make every other job look much bigger than this one.
+        open(os.path.join(os.environ['DISTCC_DIR'], 'cost', 'average'),
+             'w').write('1000000 100000000\n')
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'light job: trying 127\.0\.0\.1:%d\S* first'
+                              % self.server_port,
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class Affinity_Case(CompileHello_Case):
+    """Test that compilations from one directory keep going to the same
+    pump-mode server."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        # Two names for the one server.  Without an include server the
+        # client falls back to preprocessing locally, which is enough here.
+        options = _server_options
+        if ',cpp' not in options:
+            options += ',lzo,cpp'
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d%s localhost:%d%s' % (self.server_port, options,
+                                               self.server_port, options))
+        os.environ['DISTCC_AFFINITY'] = '1'
+
+    def runtest(self):
+        self.compile()
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        homes = re.findall(r'home of \S+ is (\S+)',
+                           open(os.environ['DISTCC_LOG']).read())
+        self.assert_equal(len(homes), 2)
+        self.assert_equal(homes[0], homes[1])
+
+
+class Breaker_Case(CompileHello_Case):
+    """Test that a server that failed is avoided for the backoff period,
+    and afterwards sent just one probe job."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        # A port that nothing listens on, ahead of the real server.
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.bind(('127.0.0.1', 0))
+        self.dead_port = s.getsockname()[1]
+        s.close()
+        os.environ['DISTCC_HOSTS'] = (
+            '127.0.0.1:%d%s 127.0.0.1:%d%s' % (self.dead_port, _server_options,
+                                               self.server_port, _server_options))
+        os.environ['DISTCC_BACKOFF_PERIOD'] = '4'
+
+    def runtest(self):
+        self.compile()
+        self.assert_re_search(
+            r'backing off from 127\.0\.0\.1:%d\S* for \d+s \(failure 1\)'
+            % self.dead_port, open(os.environ['DISTCC_LOG']).read())
+        self.compile()
+        self.assert_re_search(
+            r'still in backoff period for 127\.0\.0\.1:%d' % self.dead_port,
+            open(os.environ['DISTCC_LOG']).read())
+        time.sleep(6)
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(
+            r'letting one probe through to 127\.0\.0\.1:%d' % self.dead_port, log)
+        self.assert_re_search(
+            r'backing off from 127\.0\.0\.1:%d\S* for \d+s \(failure 2\)'
+            % self.dead_port, log)
+
+
+class BreakerProbe_Case(CompileHello_Case):
+    """Test that a server recovering from a failure, but not first in the
+    host list, is not kept away by jobs that went to another server."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        self.recovering = '127.0.0.1:%d%s' % (self.server_port, _server_options)
+        os.environ['DISTCC_BACKOFF_PERIOD'] = '2'
+
+    def restartDaemon(self):
+        old_tmpdir = os.environ['TMPDIR']
+        os.environ['TMPDIR'] = old_tmpdir + "/daemon_tmp"
+        os.chdir("daemon")
+        try:
+            self.runcmd(self.daemon_command())
+        finally:
+            os.environ['TMPDIR'] = old_tmpdir
+            os.chdir("..")
+
+    def runtest(self):
+        # Let the server fail once.
+        self.killDaemon()
+        os.environ['DISTCC_HOSTS'] = self.recovering
+        self.runcmd(self.distcc() + self._cc + " -o testtmp.o -c testtmp.c")
+        self.assert_re_search(
+            r'backing off from 127\.0\.0\.1:%d\S* for \d+s \(failure 1\)'
+            % self.server_port, open(os.environ['DISTCC_LOG']).read())
+        self.restartDaemon()
+        time.sleep(3)
+
+        # The same server under another name comes first, and takes the job.
+        os.environ['DISTCC_HOSTS'] = ('localhost:%d%s %s'
+                                      % (self.server_port, _server_options,
+                                         self.recovering))
+        self.compile()
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r'phases of \S+ on localhost', log)
+        self.assert_(not re.search(r'letting one probe through', log))
+
+        # So the probe is still there for the next job.
+        os.environ['DISTCC_HOSTS'] = self.recovering
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(
+            r'letting one probe through to 127\.0\.0\.1:%d' % self.server_port,
+            open(os.environ['DISTCC_LOG']).read())
+
+
+class SshMultiplex_Case(CompileHello_Case):
+    """Test that connections to an ssh-mode host ask ssh to share a master
+    connection, using a stand-in for ssh that runs the command locally."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        ssh = os.path.join(os.getcwd(), 'ssh')
+        open(ssh, 'w').write("""#!/bin/sh
+echo "$@" >> %s/ssh-args
+while [ $# -gt 0 ]; do
+  case "$1" in
+    -o|-l) shift 2 ;;
+    -O) exit 0 ;;
+    *) shift; break ;;
+  esac
+done
+exec "$@" 2>> %s/ssh-stderr
+""" % (os.getcwd(), os.getcwd()))
+        os.chmod(ssh, 0o755)
+        os.environ['DISTCC_SSH'] = ssh
+        os.environ['DISTCC_SSH_MULTIPLEX'] = '1'
+        os.environ['DISTCC_HOSTS'] = '@localhost' + _server_options
+
+    def runtest(self):
+        self.compile()
+        self.link()
+        self.checkBuiltProgram()
+        self.assert_re_search(r'-o ControlMaster=auto -o ControlPath=\S+/ssh/'
+                              r'[0-9a-f]{16} -o ControlPersist=\d+ localhost '
+                              r'distccd --inetd', open('ssh-args').read())
+
+
+class SshMultiplexFailure_Case(CompileHello_Case):
+    """Test that a job failing on an ssh-mode host does not take down the
+    other jobs sharing its master connection.
+
+    The stand-in for ssh kills every session it started when asked to make
+    the master exit, as ssh does.  The first session is slow, and the second
+    one fails."""
+
+    def setupEnv(self):
+        Compilation_Case.setupEnv(self)
+        ssh = os.path.join(os.getcwd(), 'ssh')
+        open(ssh, 'w').write("""#!/bin/sh
+dir=%s
+while [ $# -gt 0 ]; do
+  case "$1" in
+    -o) case "$2" in ControlPath=*) touch "${2#ControlPath=}" ;; esac
+        shift 2 ;;
+    -l) shift 2 ;;
+    -O) echo "$2" >> $dir/ssh-control
+        if [ "$2" = exit ]; then kill `cat $dir/ssh-sessions`; fi
+        exit 0 ;;
+    *) shift; break ;;
+  esac
+done
+echo $$ >> $dir/ssh-sessions
+case `wc -l < $dir/ssh-sessions` in
+  *1) sleep 3 ;;
+  *2) exit 1 ;;
+esac
+exec "$@" 2>> $dir/ssh-stderr
+""" % os.getcwd())
+        os.chmod(ssh, 0o755)
+        os.environ['DISTCC_SSH'] = ssh
+        os.environ['DISTCC_SSH_MULTIPLEX'] = '1'
+        os.environ['DISTCC_HOSTS'] = '@localhost' + _server_options
+
+    def runtest(self):
+        slow = self.runcmd_background(
+            self.distcc_without_fallback() + self._cc
+            + " -o slow.o -c %s >slow.log 2>&1" % self.sourceFilename())
+        for i in range(100):
+            if os.path.exists('ssh-sessions'):
+                break
+            time.sleep(0.1)
+        # This one fails on the host, and is compiled locally.
+        self.runcmd(self.distcc() + self._cc + " -o testtmp.o -c %s"
+                    % self.sourceFilename())
+        pid, status = os.waitpid(slow, 0)
+        if status != 0:
+            self.fail("the slow job failed too:\n" + open('slow.log').read())
+        control = open('ssh-control').read()
+        self.assert_('stop' in control.split(), control)
+        self.assert_('exit' not in control.split(), control)
+        self.link()
+        self.checkBuiltProgram()
+
+
 class DashONoSpace_Case(CompileHello_Case):
     def compileCmd(self):
         return self.distcc_without_fallback() + \
@@ -1686,6 +2269,25 @@ class DashMD_DashMF_DashMT_Case(CompileHello_Case):
         self.assert_re_search("target_name_42", dotd_contents)
 
 
+class DashMTLong_Case(CompileHello_Case):
+    """Test a dependency target far longer than any path"""
+
+    def compileOpts(self):
+        return "-MD -MFdotd_filename -MT" + self.target()
+
+    def target(self):
+        return "long_target_" + "x" * 20000
+
+    def runtest(self):
+        self.compile()
+        dotd_contents = open("dotd_filename").read()
+        if not dotd_contents.startswith(self.target() + ":"):
+            self.fail("dependency target was not rewritten")
+        self.assert_re_search(r"testhdr\.h", dotd_contents)
+        if dotd_contents.find("distccd_") != -1:
+            self.fail("server's temporary directory left in .d file")
+
+
 class DashWpMD_Case(CompileHello_Case):
     """Test -Wp,-MD,depfile"""
 
@@ -2270,6 +2872,18 @@ class Lsdistcc_Case(WithDaemon_Case):
           self.assert_re_search("127.0.0.4:%d\n" % self.server_port, out)
           self.assert_re_search("127.0.0.5:%d\n" % self.server_port, out)
 
+class Loadgen_Case(WithDaemon_Case):
+    """Check that distcc-loadgen can drive the daemon in every protocol."""
+
+    def runtest(self):
+        for protocol in (1, 2, 3):
+            out, err = self.runcmd("distcc-loadgen --port %d --protocol %d "
+                                   "--clients 3 --requests 4 --size 5000"
+                                   % (self.server_port, protocol))
+            self.assert_re_search("12 requests, 0 failed", out)
+            self.assert_re_search("\nserver +[0-9.]+ ", out)
+            self.assert_equal(err, "")
+
 class Getline_Case(comfychair.TestCase):
     """Test getline()."""
     values = [
@@ -2306,6 +2920,27 @@ class Getline_Case(comfychair.TestCase):
                 self.assert_equal(msg_parts[3], " line = '%s'" % line);
                 self.assert_equal(msg_parts[4], " rest = '%s'\n" % rest);
 
+class Md5_Case(comfychair.TestCase):
+    """Test the MD5 implementation against the test suite of RFC 1321."""
+    values = [
+        ('', 'd41d8cd98f00b204e9800998ecf8427e'),
+        ('a', '0cc175b9c0f1b6a831c399e269772661'),
+        ('abc', '900150983cd24fb0d6963f7d28e17f72'),
+        ('message digest', 'f96b697d7cb7938d525a2f31aaf161d0'),
+        ('abcdefghijklmnopqrstuvwxyz', 'c3fcd3d76192e4007dfb496cca67e13b'),
+        ('ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789',
+         'd174ab98d277d9f5a5611c2c9f419d9f'),
+        ('1234567890' * 8, '57edf4a22be3c955ac49da2e2107b67a'),
+        ]
+    def runtest(self):
+        for input, digest in Md5_Case.values:
+            # Pieces of 1 and 63 bytes cross the 64-byte blocks unaligned.
+            for piece in ['', '1', '63']:
+                out, err = self.runcmd("printf '%s' | h_md5 %s"
+                                       % (input, piece))
+                self.assert_equal(out, digest + '\n')
+                self.assert_equal(err, '')
+
 # All the tests defined in this suite
 tests = [
          CompileHello_Case,
@@ -2323,16 +2958,33 @@ tests = [
          GdbOpt2_Case,
          GdbOpt3_Case,
          Lsdistcc_Case,
+         Loadgen_Case,
          BadLogFile_Case,
          ScanArgs_Case,
          ParseMask_Case,
          DotD_Case,
          DashMD_DashMF_DashMT_Case,
+         DashMTLong_Case,
          Compile_c_Case,
          ImplicitCompilerScan_Case,
          StripArgs_Case,
          StartStopDaemon_Case,
          CompressedCompile_Case,
+         SplitDwarf_Case,
+    PrecompiledHeader_Case,
+         DebugPrefixMap_Case,
+         Batch_Case,
+         ResultCache_Case,
+         ResolveCache_Case,
+         HedgedCompile_Case,
+    HedgeTimeout_Case,
+         CostModel_Case,
+         HostSpeed_Case,
+         Affinity_Case,
+         Breaker_Case,
+    BreakerProbe_Case,
+         SshMultiplex_Case,
+         SshMultiplexFailure_Case,
          DashONoSpace_Case,
          WriteDevNull_Case,
          CppError_Case,
@@ -2372,6 +3024,7 @@ tests = [
          HostFile_Case,
          AbsSourceFilename_Case,
          Getline_Case,
+         Md5_Case,
          Unicode_Case,
          # slow tests below here
          Concurrent_Case,